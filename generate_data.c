@@ -2,23 +2,31 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <time.h>
 
 #define MAX_PATIENTS 100
 #define MAX_DOCTORS 30
 #define MAX_NAME_LEN 50
 #define MAX_VISIT_HISTORY 20
+#define MAX_DOCTOR_SLOTS 32
 
 struct Doctor {
     int id;
     char name[MAX_NAME_LEN];
     char specialty[MAX_NAME_LEN];
-    int isBusy;
+    int capacity;
     int patientsAttended;
+    unsigned int freeSlots;
+    int shiftStart;
+    int shiftEnd;
+    int slotPatientId[MAX_DOCTOR_SLOTS];
 };
 
 struct VisitRecord {
     char doctorName[MAX_NAME_LEN]; 
     char notes[MAX_NAME_LEN]; 
+    int doctorId;
+    long long visitTime;
 };
 
 struct Patient {
@@ -30,6 +38,7 @@ struct Patient {
     int occupied;
     int isEmergency;
     int assignedDoctorId;
+    char requestedSpecialty[MAX_NAME_LEN];
     struct VisitRecord visitHistory[MAX_VISIT_HISTORY];
 };
 
@@ -68,111 +77,121 @@ int findDoctorInSpecialty(struct Doctor doctors[], int doctorCount, const char*
     return selectedDoctorId;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    // Output file can be given for a multi-site setup, e.g. hospital_data_North.bin
+    const char* dataFile = argc > 1 ? argv[1] : "hospital_data.bin";
+
     struct Patient patients[MAX_PATIENTS] = {0};
     struct Doctor doctors[MAX_DOCTORS] = {0};
     int patientCount = 0;
     int doctorCount = 0;
 
-    // Comprehensive doctor specialties (same as previous version)
+    // Comprehensive doctor specialties, with their consultation slots
     struct Doctor sampleDoctors[] = {
         // General Medicine
-        {1, "Dr. Rajesh Kumar", "General Medicine", 0, 0},
-        {2, "Dr. Sunita Desai", "General Medicine", 0, 0},
-        {3, "Dr. Arvind Shah", "General Medicine", 0, 0},
-        {4, "Dr. Neelam Gupta", "General Medicine", 0, 0},
+        {.id = 1, .name = "Dr. Rajesh Kumar", .specialty = "General Medicine", .capacity = 3},
+        {.id = 2, .name = "Dr. Sunita Desai", .specialty = "General Medicine", .capacity = 3},
+        {.id = 3, .name = "Dr. Arvind Shah", .specialty = "General Medicine", .capacity = 3},
+        {.id = 4, .name = "Dr. Neelam Gupta", .specialty = "General Medicine", .capacity = 3},
 
         // Cardiology
-        {5, "Dr. Suresh Iyer", "Cardiology", 0, 0},
-        {6, "Dr. Rekha Nair", "Cardiology", 0, 0},
+        {.id = 5, .name = "Dr. Suresh Iyer", .specialty = "Cardiology", .capacity = 2},
+        {.id = 6, .name = "Dr. Rekha Nair", .specialty = "Cardiology", .capacity = 2},
 
         // Orthopedics
-        {7, "Dr. Anil Patel", "Orthopedics", 0, 0},
-        {22, "Dr. Meera Deshmukh", "Orthopedics", 0, 0},
+        {.id = 7, .name = "Dr. Anil Patel", .specialty = "Orthopedics", .capacity = 2},
+        {.id = 22, .name = "Dr. Meera Deshmukh", .specialty = "Orthopedics", .capacity = 2},
 
         // Pediatrics
-        {8, "Dr. Priya Sharma", "Pediatrics", 0, 0},
-        {9, "Dr. Ankit Verma", "Pediatrics", 0, 0},
+        {.id = 8, .name = "Dr. Priya Sharma", .specialty = "Pediatrics", .capacity = 2},
+        {.id = 9, .name = "Dr. Ankit Verma", .specialty = "Pediatrics", .capacity = 2},
 
         // Gynecology & Urology
-        {10, "Dr. Vikram Rao", "Gynecology", 0, 0},
-        {11, "Dr. Kavita Nair", "Urology", 0, 0},
+        {.id = 10, .name = "Dr. Vikram Rao", .specialty = "Gynecology", .capacity = 1},
+        {.id = 11, .name = "Dr. Kavita Nair", .specialty = "Urology", .capacity = 1},
 
         // Neurology
-        {12, "Dr. Sushma Joshi", "Neurology", 0, 0},
-        {23, "Dr. Rahul Khanna", "Neurology", 0, 0},
+        {.id = 12, .name = "Dr. Sushma Joshi", .specialty = "Neurology", .capacity = 1},
+        {.id = 23, .name = "Dr. Rahul Khanna", .specialty = "Neurology", .capacity = 1},
 
         // Dermatology
-        {13, "Dr. Neha Desai", "Dermatology", 0, 0},
+        {.id = 13, .name = "Dr. Neha Desai", .specialty = "Dermatology", .capacity = 1},
 
         // Other specialties
-        {14, "Dr. Amit Kapoor", "Pulmonology", 0, 0},
-        {15, "Dr. Manoj Yadav", "Gastroenterology", 0, 0},
-        {16, "Dr. Pooja Rani", "Oncology", 0, 0},
-        {17, "Dr. Raghav Sharma", "Psychiatry", 0, 0},
-        {18, "Dr. Ravi Bhatia", "Urology", 0, 0},
-        {19, "Dr. Simran Mehta", "Endocrinology", 0, 0},
-        {20, "Dr. Rajiv Bhatia", "Nephrology", 0, 0},
-        {21, "Dr. Harshika Patil", "Rheumatology", 0, 0}
+        {.id = 14, .name = "Dr. Amit Kapoor", .specialty = "Pulmonology", .capacity = 1},
+        {.id = 15, .name = "Dr. Manoj Yadav", .specialty = "Gastroenterology", .capacity = 1},
+        {.id = 16, .name = "Dr. Pooja Rani", .specialty = "Oncology", .capacity = 1},
+        {.id = 17, .name = "Dr. Raghav Sharma", .specialty = "Psychiatry", .capacity = 1},
+        {.id = 18, .name = "Dr. Ravi Bhatia", .specialty = "Urology", .capacity = 1},
+        {.id = 19, .name = "Dr. Simran Mehta", .specialty = "Endocrinology", .capacity = 1},
+        {.id = 20, .name = "Dr. Rajiv Bhatia", .specialty = "Nephrology", .capacity = 1},
+        {.id = 21, .name = "Dr. Harshika Patil", .specialty = "Rheumatology", .capacity = 1}
     };
 
     // Comprehensive patient list from first code
     struct Patient samplePatients[] = {
         // General Medicine Patients
-        {101, "Amit Mehta", 52, "Hypertension", 3, 1, 0, 0, {0}},
-        {102, "Sneha Reddy", 34, "Fatigue", 2, 1, 0, 0, {0}},
-        {103, "Rahul Kapoor", 40, "Chronic Fever", 4, 1, 0, 0, {0}},
-        {104, "Sunita Verma", 61, "Diabetes", 5, 1, 0, 0, {0}},
+        {.id = 101, .name = "Amit Mehta", .age = 52, .disease = "Hypertension", .visitCount = 3, .occupied = 1},
+        {.id = 102, .name = "Sneha Reddy", .age = 34, .disease = "Fatigue", .visitCount = 2, .occupied = 1},
+        {.id = 103, .name = "Rahul Kapoor", .age = 40, .disease = "Chronic Fever", .visitCount = 4, .occupied = 1},
+        {.id = 104, .name = "Sunita Verma", .age = 61, .disease = "Diabetes", .visitCount = 5, .occupied = 1},
 
         // Cardiology Patients
-        {109, "Rajiv Bhatia", 72, "Heart Disease", 6, 1, 1, 0, {0}},
-        {110, "Ishaan Gupta", 19, "Chest Pain", 2, 1, 0, 0, {0}},
-        {111, "Nisha Jain", 28, "High Blood Pressure", 4, 1, 0, 0, {0}},
-        {112, "Kabir Das", 65, "Cholesterol Management", 3, 1, 0, 0, {0}},
+        {.id = 109, .name = "Rajiv Bhatia", .age = 72, .disease = "Heart Disease", .visitCount = 6, .occupied = 1, .isEmergency = 1},
+        {.id = 110, .name = "Ishaan Gupta", .age = 19, .disease = "Chest Pain", .visitCount = 2, .occupied = 1},
+        {.id = 111, .name = "Nisha Jain", .age = 28, .disease = "High Blood Pressure", .visitCount = 4, .occupied = 1},
+        {.id = 112, .name = "Kabir Das", .age = 65, .disease = "Cholesterol Management", .visitCount = 3, .occupied = 1},
 
         // Orthopedics Patients
-        {113, "Meena Yadav", 65, "Arthritis", 4, 1, 0, 0, {0}},
-        {114, "Simran Kaur", 25, "Shoulder Pain", 2, 1, 0, 0, {0}},
-        {202, "Vikram Singh", 45, "Back Problems", 3, 1, 0, 0, {0}},
-        {203, "Priya Patel", 55, "Knee Replacement", 2, 1, 0, 0, {0}},
+        {.id = 113, .name = "Meena Yadav", .age = 65, .disease = "Arthritis", .visitCount = 4, .occupied = 1},
+        {.id = 114, .name = "Simran Kaur", .age = 25, .disease = "Shoulder Pain", .visitCount = 2, .occupied = 1},
+        {.id = 202, .name = "Vikram Singh", .age = 45, .disease = "Back Problems", .visitCount = 3, .occupied = 1},
+        {.id = 203, .name = "Priya Patel", .age = 55, .disease = "Knee Replacement", .visitCount = 2, .occupied = 1},
 
         // Pediatrics Patients
-        {115, "Deepa Choudhury", 5, "Chickenpox", 1, 1, 0, 0, {0}},
-        {116, "Kabir Kumar", 7, "Viral Fever", 1, 1, 0, 0, {0}},
-        {117, "Ishaan Gupta", 6, "Growth Checkup", 2, 1, 0, 0, {0}},
-        {118, "Rajiv Bhatia Jr", 8, "Vaccination", 1, 1, 0, 0, {0}},
+        {.id = 115, .name = "Deepa Choudhury", .age = 5, .disease = "Chickenpox", .visitCount = 1, .occupied = 1},
+        {.id = 116, .name = "Kabir Kumar", .age = 7, .disease = "Viral Fever", .visitCount = 1, .occupied = 1},
+        {.id = 117, .name = "Ishaan Gupta", .age = 6, .disease = "Growth Checkup", .visitCount = 2, .occupied = 1},
+        {.id = 118, .name = "Rajiv Bhatia Jr", .age = 8, .disease = "Vaccination", .visitCount = 1, .occupied = 1},
 
         // Neurology Patients
-        {122, "Sunita Verma", 60, "Migraine", 4, 1, 0, 0, {0}},
-        {204, "Arun Malhotra", 55, "Memory Loss", 2, 1, 0, 0, {0}},
-        {205, "Deepika Sharma", 45, "Nerve Pain", 3, 1, 0, 0, {0}},
+        {.id = 122, .name = "Sunita Verma", .age = 60, .disease = "Migraine", .visitCount = 4, .occupied = 1},
+        {.id = 204, .name = "Arun Malhotra", .age = 55, .disease = "Memory Loss", .visitCount = 2, .occupied = 1},
+        {.id = 205, .name = "Deepika Sharma", .age = 45, .disease = "Nerve Pain", .visitCount = 3, .occupied = 1},
 
         // Dermatology Patients
-        {123, "Simran Mehta", 30, "Psoriasis", 2, 1, 0, 0, {0}},
-        {206, "Ravi Kumar", 35, "Skin Allergy", 1, 1, 0, 0, {0}},
+        {.id = 123, .name = "Simran Mehta", .age = 30, .disease = "Psoriasis", .visitCount = 2, .occupied = 1},
+        {.id = 206, .name = "Ravi Kumar", .age = 35, .disease = "Skin Allergy", .visitCount = 1, .occupied = 1},
 
         // Other Specialty Patients
-        {124, "Ravi Bhatia", 45, "Pneumonia", 2, 1, 0, 0, {0}},
-        {125, "Priya Rani", 50, "Stomach Ulcers", 3, 1, 0, 0, {0}},
-        {126, "Amit Kapoor", 55, "Lung Screening", 4, 1, 0, 0, {0}},
-        {127, "Harish Kumar", 36, "Mental Health", 2, 1, 0, 0, {0}},
-        {128, "Kabir Mehta", 60, "Prostate Check", 2, 1, 0, 0, {0}},
-        {129, "Anjali Singh", 40, "Thyroid Issues", 3, 1, 0, 0, {0}},
-        {130, "Neelam Sharma", 50, "Kidney Function", 4, 1, 0, 0, {0}},
-        {131, "Deepika Raj", 45, "Joint Inflammation", 3, 1, 0, 0, {0}}
+        {.id = 124, .name = "Ravi Bhatia", .age = 45, .disease = "Pneumonia", .visitCount = 2, .occupied = 1},
+        {.id = 125, .name = "Priya Rani", .age = 50, .disease = "Stomach Ulcers", .visitCount = 3, .occupied = 1},
+        {.id = 126, .name = "Amit Kapoor", .age = 55, .disease = "Lung Screening", .visitCount = 4, .occupied = 1},
+        {.id = 127, .name = "Harish Kumar", .age = 36, .disease = "Mental Health", .visitCount = 2, .occupied = 1},
+        {.id = 128, .name = "Kabir Mehta", .age = 60, .disease = "Prostate Check", .visitCount = 2, .occupied = 1},
+        {.id = 129, .name = "Anjali Singh", .age = 40, .disease = "Thyroid Issues", .visitCount = 3, .occupied = 1},
+        {.id = 130, .name = "Neelam Sharma", .age = 50, .disease = "Kidney Function", .visitCount = 4, .occupied = 1},
+        {.id = 131, .name = "Deepika Raj", .age = 45, .disease = "Joint Inflammation", .visitCount = 3, .occupied = 1}
     };
 
     doctorCount = sizeof(sampleDoctors) / sizeof(sampleDoctors[0]);
     for (int i = 0; i < doctorCount; i++) {
         doctors[i] = sampleDoctors[i];
+
+        // All consultation slots start free, no shift window (always on)
+        doctors[i].freeSlots = (doctors[i].capacity >= MAX_DOCTOR_SLOTS) ? 0xFFFFFFFFu : (1u << doctors[i].capacity) - 1u;
+        for (int s = 0; s < MAX_DOCTOR_SLOTS; s++) {
+            doctors[i].slotPatientId[s] = -1;
+        }
     }
 
+    time_t now = time(NULL);
     patientCount = sizeof(samplePatients) / sizeof(samplePatients[0]);
     for (int i = 0; i < patientCount; i++) {
         patients[i] = samplePatients[i];
 
         // Intelligent doctor assignment based on specialty
-        int assignedDoctorId = findDoctorInSpecialty(doctors, doctorCount, 
+        const char* specialty =
             (strcmp(patients[i].disease, "Heart Disease") == 0 || 
              strcmp(patients[i].disease, "Chest Pain") == 0 || 
              strcmp(patients[i].disease, "High Blood Pressure") == 0 ||
@@ -194,21 +213,42 @@ int main() {
             (strcmp(patients[i].disease, "Thyroid Issues") == 0) ? "Endocrinology" :
             (strcmp(patients[i].disease, "Stomach Ulcers") == 0) ? "Gastroenterology" :
             (strcmp(patients[i].disease, "Mental Health") == 0) ? "Psychiatry" :
-            "General Medicine");
+            "General Medicine";
+        strcpy(patients[i].requestedSpecialty, specialty);
+        int assignedDoctorId = findDoctorInSpecialty(doctors, doctorCount, specialty);
 
-        patients[i].assignedDoctorId = assignedDoctorId;
+        patients[i].assignedDoctorId = -1;
 
         // Find the doctor and increment their patient count
         for (int j = 0; j < doctorCount; j++) {
             if (doctors[j].id == assignedDoctorId) {
                 doctors[j].patientsAttended++;
+
+                // The patient is with the doctor if a slot is free, otherwise left unassigned
+                for (int slot = 0; slot < doctors[j].capacity && slot < MAX_DOCTOR_SLOTS; slot++) {
+                    if (doctors[j].freeSlots & (1u << slot)) {
+                        doctors[j].freeSlots &= ~(1u << slot);
+                        doctors[j].slotPatientId[slot] = patients[i].id;
+                        patients[i].assignedDoctorId = assignedDoctorId;
+                        break;
+                    }
+                }
+
+                // Past visits with this doctor, one every five weeks going back from today
+                for (int v = 0; v < patients[i].visitCount && v < MAX_VISIT_HISTORY; v++) {
+                    struct VisitRecord* visit = &patients[i].visitHistory[v];
+                    strcpy(visit->doctorName, doctors[j].name);
+                    strcpy(visit->notes, "Routine follow-up");
+                    visit->doctorId = assignedDoctorId;
+                    visit->visitTime = (long long)now - (long long)(patients[i].visitCount - v) * 35 * 24 * 3600;
+                }
                 break;
             }
         }
     }
 
     // Rest of the code remains the same as previous version
-    FILE *fp = fopen("hospital_data.bin", "wb");
+    FILE *fp = fopen(dataFile, "wb");
     if (fp == NULL) {
         printf("Error creating data file!\n");
         return 1;
@@ -227,6 +267,10 @@ int main() {
     // Print out patient-doctor assignments for verification
     printf("\nPatient-Doctor Assignments:\n");
     for (int i = 0; i < patientCount; i++) {
+        if (patients[i].assignedDoctorId == -1) {
+            printf("Patient %d (%s): Unassigned, their doctor has no free slot\n", patients[i].id, patients[i].name);
+            continue;
+        }
         for (int j = 0; j < doctorCount; j++) {
             if (doctors[j].id == patients[i].assignedDoctorId) {
                 printf("Patient %d (%s): Assigned to Dr. %s (Specialty: %s)\n", 
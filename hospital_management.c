@@ -1,8 +1,28 @@
+#define _GNU_SOURCE  // fopencookie, for keyboard input on shared sites
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #ifdef _WIN32
 #define CLEAR "cls"
 #else
@@ -13,20 +33,34 @@
 #define MAX_DOCTORS 30
 #define MAX_NAME_LEN 50 
 #define MAX_VISIT_HISTORY 20
+#define MAX_DOCTOR_SLOTS 32  // One bit per slot in Doctor.freeSlots
+#define MAX_SITES 8
+
+// Result codes from assignPatientToDoctor (a slot index >= 0 means success)
+#define ASSIGN_PATIENT_NOT_FOUND -1
+#define ASSIGN_DOCTOR_NOT_FOUND -2
+#define ASSIGN_DOCTOR_BUSY -3
+#define ASSIGN_PATIENT_BUSY -4  // Already holds a slot; release it first
 
 // Structure for storing doctor info
 struct Doctor {
     int id;
     char name[MAX_NAME_LEN];
     char specialty[MAX_NAME_LEN];
-    int isBusy;
+    int capacity;  // Number of concurrent consultation slots
     int patientsAttended;  
+    unsigned int freeSlots;  // Bitmap of free slots (bit set = slot free)
+    int shiftStart;  // Shift window in minutes after midnight
+    int shiftEnd;  // shiftStart == shiftEnd means always on shift
+    int slotPatientId[MAX_DOCTOR_SLOTS];  // Patient occupying each slot, -1 if free
 };
 
 // Structure for storing visit records
 struct VisitRecord {
     char doctorName[MAX_NAME_LEN]; // Name of the doctor
     char notes[MAX_NAME_LEN]; // Notes from the visit
+    int doctorId; // Doctor seen, 0 if not recorded
+    long long visitTime; // Start of the visit (Unix time), 0 if not recorded
 };
 
 // Structure for storing patient info
@@ -39,17 +73,146 @@ struct Patient {
     int occupied;
     int isEmergency;  // New field for priority
     int assignedDoctorId;  // New field to track assigned doctor
+    char requestedSpecialty[MAX_NAME_LEN];  // Chosen at intake, empty if none
     struct VisitRecord visitHistory[MAX_VISIT_HISTORY]; // Array of visit records
 };
 
 // Priority Queue structure
 struct PriorityQueue {
     int front, rear;
+    int capacity;  // Entries there is room for: MAX_PATIENTS, or more in a queue from newPriorityQueue
     struct {
         int patientId;
         int priority;  // 1 for emergency, 0 for common
-    } items[MAX_PATIENTS];
+    } items[MAX_PATIENTS];  // Kept last, so newPriorityQueue can make room past it
+};
+
+// Available specialties with more comprehensive mapping
+const char* specialties[] = {
+    "General Medicine", 
+    "Orthopedics", 
+    "Cardiology", 
+    "Neurology", 
+    "Pulmonology", 
+    "Gastroenterology", 
+    "Oncology", 
+    "Pediatrics", 
+    "Dermatology",
+    "Gynecology",
+    "Urology", 
+    "Psychiatry",
+    "Endocrinology",
+    "Nephrology",
+    "Rheumatology"
+};
+#define SPECIALTY_COUNT (int)(sizeof(specialties) / sizeof(specialties[0]))
+#define OTHER_SPECIALTY SPECIALTY_COUNT  // Doctors whose specialty is not in the list
+
+// Dashboard figures kept up to date on every change, so reading one is O(1)
+struct DashboardCounters {
+    int queuedByPriority[2];  // Regular, emergency
+    int queuedBySpecialty[SPECIALTY_COUNT + 1];
+    int freeDoctorsBySpecialty[SPECIALTY_COUNT + 1];  // At least one free slot
+    int busyDoctorsBySpecialty[SPECIALTY_COUNT + 1];  // Every slot taken
+    int freeSlotsBySpecialty[SPECIALTY_COUNT + 1];
+    int activeConsultations;  // Occupied slots across all doctors
+    int admissionsByHour[24];  // Ring of hourly buckets
+    long long admissionsHourStamp[24];  // Hour (since the epoch) each bucket holds
+};
+
+// Emergency fast-lane dispatches and their enqueue-to-assignment times
+struct FastLaneStats {
+    long long dispatched;
+    long long preempted;  // Dispatches that suspended a regular case to free a slot
+    long long totalMicros;
+    long long worstMicros;
+    long long lastMicros;
+};
+
+#define INDEX_WORDS ((MAX_PATIENTS + 63) / 64)
+#define COLUMN_ROWS (INDEX_WORDS * 64)  // Padded so the scan kernels work in whole blocks
+#define DISEASE_TOKEN_BUCKETS 64
+#define NAME_SOUND_BUCKETS 128
+
+// Set of patient rows (positions in Hospital.patients), one bit per row
+struct RowBitmap {
+    unsigned long long words[INDEX_WORDS];
+    int count;  // Bits set, read by the query planner to order intersections
+};
+
+// Copy of the patient fields that scans test, one array per field, so a scan
+// reads only the bytes it compares instead of striding over whole records
+struct PatientColumns {
+    int id[COLUMN_ROWS];
+    int occupied[COLUMN_ROWS];
+    int age[COLUMN_ROWS];
+    int isEmergency[COLUMN_ROWS];
+    int assignedDoctorId[COLUMN_ROWS];
+};
+
+// Secondary indexes over the patient table, kept up to date like the dashboard counters
+struct PatientIndex {
+    struct RowBitmap live;
+    struct RowBitmap emergency;
+    struct RowBitmap queued;
+    struct RowBitmap needsSpecialty[SPECIALTY_COUNT + 1];  // By requestedSpecialty
+    struct RowBitmap diseaseToken[DISEASE_TOKEN_BUCKETS];  // By hashed word of the disease text
+    struct RowBitmap nameSound[NAME_SOUND_BUCKETS];  // By hashed Soundex code of each word of the name
+    unsigned char queueEntries[MAX_PATIENTS];  // Per row; the same patient can be queued twice
+    struct PatientColumns columns;  // Age and assigned doctor are answered by scanning these
+};
+
+// One hospital site with its own store, queue and data file
+struct Hospital {
+    char siteName[MAX_NAME_LEN];
+    char dataFile[MAX_NAME_LEN + 32];
+    struct Patient patients[MAX_PATIENTS];
+    struct Doctor doctors[MAX_DOCTORS];
+    int patientCount;
+    int doctorCount;
+    struct PriorityQueue waitingQueue;
+    struct DashboardCounters counters;
+    struct PatientIndex index;
+    struct PatientArchive* archive;  // NULL when the site runs without one
+    struct ReplicationJournal* journal;  // NULL unless changes are shipped to a follower
+    struct ChangeFeed* feed;  // NULL unless change events are published
+    int siteNumber;  // Position in the site list, carried in journal records
+    struct AppointmentBook* calendar;  // NULL on a follower
+    struct FastLaneStats fastLane;
+    struct OperationTrace* trace;  // NULL unless operations are recorded with --record
+    struct SiteViews* views;  // Published for lock-free readers; NULL in shared memory and outside a router
+    struct BillingLedger* ledger;  // NULL in shared memory, on a follower and outside the desk
 };
+
+// Hash function
+int hash(int id) {
+    return id % MAX_PATIENTS;
+}
+
+// Index of an occupied patient record by ID, -1 if not found.
+// Starts at the hashed position, where insertPatient normally put the record.
+int findPatientIndex(struct Patient patients[], int patientId) {
+    int start = hash(patientId);
+    if (start < 0) start += MAX_PATIENTS;
+    int i = start;
+    for (int n = 0; n < MAX_PATIENTS; n++) {
+        if (patients[i].occupied && patients[i].id == patientId) {
+            return i;
+        }
+        if (++i == MAX_PATIENTS) i = 0;
+    }
+    return -1;
+}
+
+// Position of a specialty in the specialties list, -1 if unknown
+int specialtyIndex(const char* specialty) {
+    for (int i = 0; i < SPECIALTY_COUNT; i++) {
+        if (strcmp(specialties[i], specialty) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
 void clearScreen() {
     system(CLEAR);
 }
@@ -63,6 +226,35 @@ void printHeader(const char* title) {
 // Initialize Priority Queue
 void initPriorityQueue(struct PriorityQueue* q) {
     q->front = q->rear = -1;
+    q->capacity = MAX_PATIENTS;
+}
+
+size_t priorityQueueBytes(int capacity) {
+    return sizeof(struct PriorityQueue) + (size_t)(capacity - MAX_PATIENTS) * sizeof(((struct PriorityQueue*)0)->items[0]);
+}
+
+// A queue on the heap with room for `capacity` entries (at least MAX_PATIENTS),
+// for queues that outgrow a site's; NULL if there is no memory for it
+struct PriorityQueue* newPriorityQueue(int capacity) {
+    if (capacity < MAX_PATIENTS) {
+        capacity = MAX_PATIENTS;
+    }
+    struct PriorityQueue* q = malloc(priorityQueueBytes(capacity));
+    if (q != NULL) {
+        initPriorityQueue(q);
+        q->capacity = capacity;
+    }
+    return q;
+}
+
+// Double the room of a queue from newPriorityQueue. Returns the queue, which
+// may have moved, or NULL with the old one left as it was.
+struct PriorityQueue* growPriorityQueue(struct PriorityQueue* q) {
+    struct PriorityQueue* grown = realloc(q, priorityQueueBytes(q->capacity * 2));
+    if (grown != NULL) {
+        grown->capacity *= 2;
+    }
+    return grown;
 }
 
 void printDivider() {
@@ -74,52 +266,196 @@ void pauseExecution() {
     getchar();
 }
 
-void removeDoctor(struct Doctor doctors[], int *doctorCount) {
-    if (*doctorCount <= 0) {
-        printf("No doctors to remove.\n");
-        return;
+// Bitmap with the lowest `capacity` bits set
+unsigned int slotMask(int capacity) {
+    if (capacity >= MAX_DOCTOR_SLOTS) {
+        return 0xFFFFFFFFu;
     }
+    return (1u << capacity) - 1u;
+}
 
-    int id;
-    printf("Enter Doctor ID to remove: ");
-    scanf("%d", &id);
+// Index of the lowest set bit, -1 if none
+int lowestSetBit(unsigned int bits) {
+    if (bits == 0) {
+        return -1;
+    }
+#if defined(__GNUC__)
+    return __builtin_ctz(bits);
+#else
+    int index = 0;
+    while (!(bits & 1u)) {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
 
-    for (int i = 0; i < *doctorCount; i++) {
-        if (doctors[i].id == id) {
-            // Shift remaining doctors to fill the gap
-            for (int j = i; j < *doctorCount - 1; j++) {
-                doctors[j] = doctors[j + 1];
-            }
-            (*doctorCount)--;
-            printf("Doctor removed successfully!\n");
-            return;
-        }
+int countSetBits(unsigned int bits) {
+#if defined(__GNUC__)
+    return __builtin_popcount(bits);
+#else
+    int count = 0;
+    while (bits) {
+        bits &= bits - 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+int lowestSetBit64(unsigned long long bits) {
+    if (bits == 0) {
+        return -1;
+    }
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int index = 0;
+    while (!(bits & 1ull)) {
+        bits >>= 1;
+        index++;
     }
+    return index;
+#endif
+}
 
-    printf("Doctor not found.\n");
+int countSetBits64(unsigned long long bits) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(bits);
+#else
+    int count = 0;
+    while (bits) {
+        bits &= bits - 1;
+        count++;
+    }
+    return count;
+#endif
 }
 
-void addDoctor(struct Doctor doctors[], int *doctorCount) {
-    if (*doctorCount >= MAX_DOCTORS) {
-        printf("Max capacity reached for doctors.\n");
+// Set up a doctor's consultation slots, all of them free
+void initDoctorSlots(struct Doctor* doctor, int capacity) {
+    if (capacity < 1) capacity = 1;
+    if (capacity > MAX_DOCTOR_SLOTS) capacity = MAX_DOCTOR_SLOTS;
+    doctor->capacity = capacity;
+    doctor->freeSlots = slotMask(capacity);
+    for (int i = 0; i < MAX_DOCTOR_SLOTS; i++) {
+        doctor->slotPatientId[i] = -1;
+    }
+}
+
+int freeSlotCount(const struct Doctor* doctor) {
+    return countSetBits(doctor->freeSlots);
+}
+
+int occupiedSlotCount(const struct Doctor* doctor) {
+    return doctor->capacity - freeSlotCount(doctor);
+}
+
+// A doctor is busy once every slot is occupied
+int isDoctorBusy(const struct Doctor* doctor) {
+    return doctor->freeSlots == 0;
+}
+
+int isDoctorOnShift(const struct Doctor* doctor, int minuteOfDay) {
+    if (doctor->shiftStart == doctor->shiftEnd) {
+        return 1;
+    }
+    if (doctor->shiftStart < doctor->shiftEnd) {
+        return minuteOfDay >= doctor->shiftStart && minuteOfDay < doctor->shiftEnd;
+    }
+    // Overnight shift, e.g. 22:00 - 06:00
+    return minuteOfDay >= doctor->shiftStart || minuteOfDay < doctor->shiftEnd;
+}
+
+// On shift with at least one free slot
+int isDoctorAvailable(const struct Doctor* doctor, int minuteOfDay) {
+    return doctor->freeSlots != 0 && isDoctorOnShift(doctor, minuteOfDay);
+}
+
+int currentMinuteOfDay() {
+    time_t now = time(NULL);
+    struct tm* local = localtime(&now);
+    return local->tm_hour * 60 + local->tm_min;
+}
+
+// Take the lowest free slot for a patient, returns the slot or -1 if full
+int occupyDoctorSlot(struct Doctor* doctor, int patientId) {
+    int slot = lowestSetBit(doctor->freeSlots);
+    if (slot == -1) {
+        return -1;
+    }
+    doctor->freeSlots &= ~(1u << slot);
+    doctor->slotPatientId[slot] = patientId;
+    return slot;
+}
+
+// Seat a patient with a doctor and count the consultation, returns the slot or -1 if full
+int startConsultation(struct Doctor* doctor, int patientId) {
+    int slot = occupyDoctorSlot(doctor, patientId);  // O(1) via the free-slot bitmap
+    if (slot != -1) {
+        doctor->patientsAttended++;
+    }
+    return slot;
+}
+
+void releaseDoctorSlot(struct Doctor* doctor, int slot) {
+    if (slot < 0 || slot >= doctor->capacity) {
         return;
     }
+    doctor->freeSlots |= 1u << slot;
+    doctor->slotPatientId[slot] = -1;
+}
+
+// Slot held by a patient, -1 if the patient is not with this doctor
+int findPatientSlot(const struct Doctor* doctor, int patientId) {
+    unsigned int occupied = ~doctor->freeSlots & slotMask(doctor->capacity);
+    while (occupied) {
+        int slot = lowestSetBit(occupied);
+        if (doctor->slotPatientId[slot] == patientId) {
+            return slot;
+        }
+        occupied &= occupied - 1;
+    }
+    return -1;
+}
 
-    struct Doctor newDoctor;
-    printf("Enter Doctor ID: ");
-    scanf("%d", &newDoctor.id);
-    getchar(); // Consume leftover newline
-    printf("Enter Doctor Name: ");
-    fgets(newDoctor.name, MAX_NAME_LEN, stdin);
-    newDoctor.name[strcspn(newDoctor.name, "\n")] = 0; // Remove newline
-    printf("Enter Doctor Specialty: ");
-    fgets(newDoctor.specialty, MAX_NAME_LEN, stdin);
-    newDoctor.specialty[strcspn(newDoctor.specialty, "\n")] = 0; // Remove newline
-    newDoctor.isBusy = 0; // Initialize as not busy
+// Remaining capacity across all available doctors of a specialty
+int countAvailableSlotsInSpecialty(struct Doctor doctors[], int doctorCount, const char* specialty, int minuteOfDay) {
+    int slots = 0;
+    for (int i = 0; i < doctorCount; i++) {
+        if (strcmp(doctors[i].specialty, specialty) == 0 && isDoctorOnShift(&doctors[i], minuteOfDay)) {
+            slots += freeSlotCount(&doctors[i]);
+        }
+    }
+    return slots;
+}
 
-    doctors[*doctorCount] = newDoctor;
-    (*doctorCount)++;
-    printf("Doctor added successfully!\n");
+// Least-loaded available doctor of a specialty, falling back to General Medicine
+// when the hospital has no doctor of that specialty at all. Returns an index or -1.
+int findAvailableDoctor(struct Doctor doctors[], int doctorCount, const char* specialty, int minuteOfDay) {
+    int selected = -1;
+    int specialtyStaffed = 0;
+    for (int i = 0; i < doctorCount; i++) {
+        if (strcmp(doctors[i].specialty, specialty) != 0) {
+            continue;
+        }
+        specialtyStaffed = 1;
+        if (!isDoctorAvailable(&doctors[i], minuteOfDay)) {
+            continue;
+        }
+        if (selected == -1 ||
+            freeSlotCount(&doctors[i]) > freeSlotCount(&doctors[selected]) ||
+            (freeSlotCount(&doctors[i]) == freeSlotCount(&doctors[selected]) &&
+             doctors[i].patientsAttended < doctors[selected].patientsAttended)) {
+            selected = i;
+        }
+    }
+
+    if (!specialtyStaffed && strcmp(specialty, "General Medicine") != 0) {
+        return findAvailableDoctor(doctors, doctorCount, "General Medicine", minuteOfDay);
+    }
+    return selected;
 }
 
 // Check if Priority Queue is empty
@@ -129,7 +465,14 @@ int isPriorityQueueEmpty(struct PriorityQueue* q) {
 
 // Add patient to Priority Queue
 void enqueuePriority(struct PriorityQueue* q, int patientId, int priority) {
-    if (q->rear == MAX_PATIENTS - 1) {
+    if (q->rear == q->capacity - 1 && q->front > 0) {
+        // Reclaim the space freed by earlier dequeues
+        int length = q->rear - q->front + 1;
+        memmove(&q->items[0], &q->items[q->front], length * sizeof(q->items[0]));
+        q->front = 0;
+        q->rear = length - 1;
+    }
+    if (q->rear == q->capacity - 1) {
         printf("Queue is full\n");
         return;
     }
@@ -141,18 +484,57 @@ void enqueuePriority(struct PriorityQueue* q, int patientId, int priority) {
         return;
     }
 
-    // Find position for new patient based on priority
-    int i;
-    for (i = q->rear; i >= q->front; i--) {
-        if (q->items[i].priority >= priority) {
-            break;
+    // The entries are in priority order: the new one goes after the last entry
+    // of its class or a higher one
+    int low = q->front, high = q->rear + 1;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (q->items[middle].priority >= priority) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
-        q->items[i + 1] = q->items[i];
     }
-    
-    q->items[i + 1].patientId = patientId;
-    q->items[i + 1].priority = priority;
-    q->rear++;
+    int at = low;
+    // Open the gap from the side with fewer entries to move, e.g. an emergency
+    // joining a long regular queue moves the emergencies ahead of it
+    if (q->front > 0 && at - q->front < q->rear + 1 - at) {
+        memmove(&q->items[q->front - 1], &q->items[q->front], (at - q->front) * sizeof(q->items[0]));
+        q->front--;
+        at--;
+    } else {
+        memmove(&q->items[at + 1], &q->items[at], (q->rear + 1 - at) * sizeof(q->items[0]));
+        q->rear++;
+    }
+    q->items[at].patientId = patientId;
+    q->items[at].priority = priority;
+}
+
+// Put a patient at the head of their priority class, e.g. a consultation
+// suspended for an emergency goes ahead of the other regular patients
+void enqueueFront(struct PriorityQueue* q, int patientId, int priority) {
+    if (q->front == -1) {
+        enqueuePriority(q, patientId, priority);
+        return;
+    }
+    if (q->front == 0) {
+        if (q->rear == q->capacity - 1) {
+            printf("Queue is full\n");
+            return;
+        }
+        memmove(&q->items[1], &q->items[0], (q->rear + 1) * sizeof(q->items[0]));
+        q->front = 1;
+        q->rear++;
+    }
+    // Slide the higher classes one place forward to open a gap in front of this one
+    int i = q->front;
+    while (i <= q->rear && q->items[i].priority > priority) {
+        i++;
+    }
+    memmove(&q->items[q->front - 1], &q->items[q->front], (i - q->front) * sizeof(q->items[0]));
+    q->front--;
+    q->items[i - 1].patientId = patientId;
+    q->items[i - 1].priority = priority;
 }
 
 // Remove patient from Priority Queue
@@ -170,8 +552,8 @@ int dequeuePriority(struct PriorityQueue* q) {
 }
 
 // Function to save data to file
-void saveData(struct Patient patients[], int patientCount, struct Doctor doctors[], int doctorCount) {
-    FILE *fp = fopen("hospital_data.bin", "wb");
+void saveData(const char* path, struct Patient patients[], int patientCount, struct Doctor doctors[], int doctorCount) {
+    FILE *fp = fopen(path, "wb");
     if (fp == NULL) {
         printf("Error opening file for writing\n");
         return;
@@ -186,9 +568,51 @@ void saveData(struct Patient patients[], int patientCount, struct Doctor doctors
     printf("Data saved successfully!\n");
 }
 
+// Patient record as saved before Patient.requestedSpecialty existed. Until
+// their first visit, addPatient kept the requested specialty in visit slot 0.
+struct PatientWithoutSpecialty {
+    int id;
+    char name[MAX_NAME_LEN];
+    int age;
+    char disease[MAX_NAME_LEN];
+    int visitCount;
+    int occupied;
+    int isEmergency;
+    int assignedDoctorId;
+    struct VisitRecord visitHistory[MAX_VISIT_HISTORY];
+};
+
+// Read the patients of a data file saved in the older layout
+size_t loadPatientsWithoutSpecialty(FILE* fp, struct Patient patients[]) {
+    struct PatientWithoutSpecialty* old = calloc(MAX_PATIENTS, sizeof(struct PatientWithoutSpecialty));
+    if (old == NULL) {
+        return 0;
+    }
+    size_t read = fread(old, sizeof(struct PatientWithoutSpecialty), MAX_PATIENTS, fp);
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        struct Patient* patient = &patients[i];
+        memset(patient, 0, sizeof(*patient));
+        patient->id = old[i].id;
+        memcpy(patient->name, old[i].name, MAX_NAME_LEN);
+        patient->age = old[i].age;
+        memcpy(patient->disease, old[i].disease, MAX_NAME_LEN);
+        patient->visitCount = old[i].visitCount;
+        patient->occupied = old[i].occupied;
+        patient->isEmergency = old[i].isEmergency;
+        patient->assignedDoctorId = old[i].assignedDoctorId;
+        memcpy(patient->visitHistory, old[i].visitHistory, sizeof(patient->visitHistory));
+        if (patient->visitCount == 0 && specialtyIndex(patient->visitHistory[0].doctorName) != -1) {
+            strcpy(patient->requestedSpecialty, patient->visitHistory[0].doctorName);
+            patient->visitHistory[0].doctorName[0] = '\0';
+        }
+    }
+    free(old);
+    return read;
+}
+
 // Function to load data from file
-void loadData(struct Patient patients[], int *patientCount, struct Doctor doctors[], int *doctorCount) {
-    FILE *fp = fopen("hospital_data.bin", "rb");
+void loadData(const char* path, struct Patient patients[], int *patientCount, struct Doctor doctors[], int *doctorCount) {
+    FILE *fp = fopen(path, "rb");
     if (fp == NULL) {
         printf("No previous data found\n");
         return;
@@ -202,8 +626,16 @@ void loadData(struct Patient patients[], int *patientCount, struct Doctor doctor
         return;
     }
 
-    // Then read patients and doctors
-    size_t patientsRead = fread(patients, sizeof(struct Patient), MAX_PATIENTS, fp);
+    // Then read patients and doctors; a file from before requestedSpecialty is converted
+    struct stat info;
+    long olderSize = 2 * (long)sizeof(int) + MAX_PATIENTS * (long)sizeof(struct PatientWithoutSpecialty) +
+                     MAX_DOCTORS * (long)sizeof(struct Doctor);
+    size_t patientsRead;
+    if (fstat(fileno(fp), &info) == 0 && (long)info.st_size == olderSize) {
+        patientsRead = loadPatientsWithoutSpecialty(fp, patients);
+    } else {
+        patientsRead = fread(patients, sizeof(struct Patient), MAX_PATIENTS, fp);
+    }
     size_t doctorsRead = fread(doctors, sizeof(struct Doctor), MAX_DOCTORS, fp);
 
     fclose(fp);
@@ -212,426 +644,10072 @@ void loadData(struct Patient patients[], int *patientCount, struct Doctor doctor
         printf("Warning: Incomplete data read\n");
     }
 
+    // Repair doctors whose slot data is out of range
+    for (int i = 0; i < *doctorCount; i++) {
+        if (doctors[i].capacity < 1 || doctors[i].capacity > MAX_DOCTOR_SLOTS) {
+            initDoctorSlots(&doctors[i], 1);
+        } else {
+            doctors[i].freeSlots &= slotMask(doctors[i].capacity);
+        }
+    }
+
     printf("Data loaded successfully!\n");
 }
 
-// Assign patient to a specific doctor by ID
-void assignToDoctor(struct Patient patients[], struct Doctor doctors[], int patientId, int doctorId, int doctorCount) {
-    // Find the patient
-    int patientIndex = -1;
-    for (int i = 0; i < MAX_PATIENTS; i++) {
-        if (patients[i].occupied && patients[i].id == patientId) {
-            patientIndex = i;
-            break;
+// ---------------------------------------------------------------------------
+// Patient archive
+//
+// Long-term store for every patient and doctor record, so discharged
+// patients keep their history without taking space in the in-memory tables.
+// The archive file is a set of fixed-size pages holding two B+trees (patients
+// by ID, doctors by ID). Pages are read through a small buffer pool with clock
+// eviction, so memory use stays fixed however large the archive grows.
+// ---------------------------------------------------------------------------
+
+#define ARCHIVE_PAGE_SIZE 16384
+#define ARCHIVE_POOL_FRAMES 64  // 1 MB of pages per site
+#define ARCHIVE_MAGIC 0x48415232u  // "HAR2", changed whenever the patient or doctor record layout does
+#define ARCHIVE_PATIENTS 0
+#define ARCHIVE_DOCTORS 1
+#define ARCHIVE_TREES 2
+#define ARCHIVE_MAX_HEIGHT 16
+
+// Page 0 of the archive file
+struct ArchiveHeader {
+    unsigned int magic;
+    int pageSize;
+    int pageCount;
+    int rootPage[ARCHIVE_TREES];
+    int height[ARCHIVE_TREES];  // 1 while the root is a leaf
+    int recordCount[ARCHIVE_TREES];
+};
+
+// Start of every tree page; keys follow, then values (leaves) or child pages
+struct NodeHeader {
+    int isLeaf;
+    int keyCount;
+    int nextLeaf;  // Leaves are chained in key order for range scans, -1 at the end
+    int unused;
+};
+
+struct BufferFrame {
+    int pageNo;  // -1 if the frame is empty
+    int pinCount;
+    int dirty;
+    int referenced;  // Clock bit, set on each use
+    unsigned char* data;
+};
+
+struct BufferPool {
+    FILE* file;
+    struct BufferFrame frames[ARCHIVE_POOL_FRAMES];
+    int clockHand;
+    long long hits, misses, writes;
+};
+
+struct PatientArchive {
+    char path[MAX_NAME_LEN + 32];
+    struct ArchiveHeader header;
+    struct BufferPool pool;
+};
+
+// Position of a range scan; records are copied out, so no page stays pinned
+struct ArchiveCursor {
+    struct PatientArchive* archive;
+    int tree;
+    int page;
+    int slot;
+    int lastKey;
+};
+
+int archiveValueSize(int tree) {
+    return tree == ARCHIVE_PATIENTS ? (int)sizeof(struct Patient) : (int)sizeof(struct Doctor);
+}
+
+int leafCapacity(int tree) {
+    return (ARCHIVE_PAGE_SIZE - (int)sizeof(struct NodeHeader)) / ((int)sizeof(int) + archiveValueSize(tree));
+}
+
+#define ARCHIVE_INTERNAL_CAPACITY ((ARCHIVE_PAGE_SIZE - (int)sizeof(struct NodeHeader) - (int)sizeof(int)) / (2 * (int)sizeof(int)))
+
+int* nodeKeys(unsigned char* page) {
+    return (int*)(page + sizeof(struct NodeHeader));
+}
+
+unsigned char* leafValue(unsigned char* page, int tree, int slot) {
+    return page + sizeof(struct NodeHeader) + sizeof(int) * leafCapacity(tree) + (size_t)slot * archiveValueSize(tree);
+}
+
+int* nodeChildren(unsigned char* page) {
+    return (int*)(page + sizeof(struct NodeHeader) + sizeof(int) * ARCHIVE_INTERNAL_CAPACITY);
+}
+
+int writePage(struct BufferPool* pool, int pageNo, const unsigned char* data) {
+    pool->writes++;
+    return fseek(pool->file, (long)pageNo * ARCHIVE_PAGE_SIZE, SEEK_SET) == 0 &&
+           fwrite(data, ARCHIVE_PAGE_SIZE, 1, pool->file) == 1;
+}
+
+// Pin a page in the pool, reading it from the file on a miss; NULL if every
+// frame is pinned or the page cannot be written back
+unsigned char* fetchPage(struct BufferPool* pool, int pageNo) {
+    for (int f = 0; f < ARCHIVE_POOL_FRAMES; f++) {
+        if (pool->frames[f].pageNo == pageNo) {
+            pool->frames[f].pinCount++;
+            pool->frames[f].referenced = 1;
+            pool->hits++;
+            return pool->frames[f].data;
         }
     }
+    pool->misses++;
 
-    if (patientIndex == -1) {
-        printf("Patient not found\n");
-        return;
+    // Clock sweep: pass over recently used frames once, take the first cold one
+    struct BufferFrame* victim = NULL;
+    for (int step = 0; step < 2 * ARCHIVE_POOL_FRAMES && victim == NULL; step++) {
+        struct BufferFrame* frame = &pool->frames[pool->clockHand];
+        pool->clockHand = (pool->clockHand + 1) % ARCHIVE_POOL_FRAMES;
+        if (frame->pinCount > 0) {
+            continue;
+        }
+        if (frame->referenced) {
+            frame->referenced = 0;
+        } else {
+            victim = frame;
+        }
+    }
+    if (victim == NULL) {
+        printf("Error: archive buffer pool exhausted\n");
+        return NULL;
+    }
+    if (victim->dirty && !writePage(pool, victim->pageNo, victim->data)) {
+        printf("Error writing archive page %d\n", victim->pageNo);
+        return NULL;
     }
 
-    // Find the specified doctor by ID
-    for (int i = 0; i < doctorCount; i++) {
-        if (doctors[i].id == doctorId) {
-            if (!doctors[i].isBusy) {
-                doctors[i].isBusy = 1;
-                doctors[i].patientsAttended++;  // Increment the counter
-                patients[patientIndex].visitCount++;  // Increment patient visit count
-                patients[patientIndex].assignedDoctorId = doctorId;  // Set assigned doctor ID
-                printf("Patient assigned to Doctor %s\n", doctors[i].name);
-                return;
-            } else {
-                printf("Doctor is busy.\n");
-                return;
-            }
+    memset(victim->data, 0, ARCHIVE_PAGE_SIZE);
+    if (fseek(pool->file, (long)pageNo * ARCHIVE_PAGE_SIZE, SEEK_SET) == 0) {
+        if (fread(victim->data, ARCHIVE_PAGE_SIZE, 1, pool->file) != 1) {
+            memset(victim->data, 0, ARCHIVE_PAGE_SIZE);  // New page past the end of the file
         }
     }
-    printf("Doctor not found.\n");
+    victim->pageNo = pageNo;
+    victim->pinCount = 1;
+    victim->dirty = 0;
+    victim->referenced = 1;
+    return victim->data;
 }
 
-// Display doctor performance
-void displayDoctorPerformance(struct Doctor doctors[], int doctorCount) {
-    printf("\nDoctor Performance Tracker\n");
-    printf("%-5s %-20s %-20s %-15s\n", "ID", "Name", "Specialty", "Patients Attended");
-    printf("%-5s %-20s %-20s %-15s\n", "--", "------------------", "------------------", "-----------------");
-    for (int i = 0; i < doctorCount; i++) {
-        if (doctors[i].patientsAttended > 0) {  // Only display doctors who have attended patients
-            printf("%-5d %-20s %-20s %-15d\n", doctors[i].id, doctors[i].name, doctors[i].specialty, doctors[i].patientsAttended);
+void unpinPage(struct BufferPool* pool, int pageNo, int dirty) {
+    for (int f = 0; f < ARCHIVE_POOL_FRAMES; f++) {
+        if (pool->frames[f].pageNo == pageNo) {
+            pool->frames[f].pinCount--;
+            pool->frames[f].dirty |= dirty;
+            return;
         }
     }
 }
 
-// Hash function
-int hash(int id) {
-    return id % MAX_PATIENTS;
+// Append an empty tree page and pin it
+unsigned char* newTreePage(struct PatientArchive* archive, int isLeaf, int* pageNo) {
+    *pageNo = archive->header.pageCount++;
+    unsigned char* page = fetchPage(&archive->pool, *pageNo);
+    if (page != NULL) {
+        memset(page, 0, ARCHIVE_PAGE_SIZE);
+        struct NodeHeader* node = (struct NodeHeader*)page;
+        node->isLeaf = isLeaf;
+        node->nextLeaf = -1;
+    }
+    return page;
 }
 
-void addPatient(struct Patient patients[], int* patientCount) {
-    printHeader("Add New Patient");
-    
-    if (*patientCount >= MAX_PATIENTS) {
-        printf("Error: Maximum capacity reached for patients.\n");
-        pauseExecution();
+// Write back dirty pages and the header, so the file is complete on disk
+int archiveFlush(struct PatientArchive* archive) {
+    struct BufferPool* pool = &archive->pool;
+    int ok = 1;
+    for (int f = 0; f < ARCHIVE_POOL_FRAMES; f++) {
+        struct BufferFrame* frame = &pool->frames[f];
+        if (frame->pageNo != -1 && frame->dirty) {
+            ok &= writePage(pool, frame->pageNo, frame->data);
+            frame->dirty = 0;
+        }
+    }
+    unsigned char headerPage[ARCHIVE_PAGE_SIZE] = {0};
+    memcpy(headerPage, &archive->header, sizeof(archive->header));
+    ok &= writePage(pool, 0, headerPage);
+    fflush(pool->file);
+    return ok;
+}
+
+int archiveOpen(struct PatientArchive* archive, const char* path) {
+    memset(archive, 0, sizeof(*archive));
+    snprintf(archive->path, sizeof(archive->path), "%s", path);
+    struct BufferPool* pool = &archive->pool;
+    pool->file = fopen(path, "r+b");
+    int created = 0;
+    if (pool->file == NULL) {
+        pool->file = fopen(path, "w+b");
+        created = 1;
+    }
+    if (pool->file == NULL) {
+        printf("Error opening archive %s\n", path);
+        return 0;
+    }
+    for (int f = 0; f < ARCHIVE_POOL_FRAMES; f++) {
+        pool->frames[f].pageNo = -1;
+        pool->frames[f].data = malloc(ARCHIVE_PAGE_SIZE);
+        if (pool->frames[f].data == NULL) {
+            printf("Error: Not enough memory for the archive buffer pool\n");
+            return 0;
+        }
+    }
+
+    if (!created && fread(&archive->header, sizeof(archive->header), 1, pool->file) == 1 &&
+        archive->header.magic == ARCHIVE_MAGIC && archive->header.pageSize == ARCHIVE_PAGE_SIZE) {
+        return 1;
+    }
+    if (!created) {
+        printf("Archive %s is not readable, starting a new one\n", path);
+    }
+    // Fresh archive: the header page, then an empty leaf as each tree's root
+    archive->header.magic = ARCHIVE_MAGIC;
+    archive->header.pageSize = ARCHIVE_PAGE_SIZE;
+    archive->header.pageCount = 1;
+    for (int tree = 0; tree < ARCHIVE_TREES; tree++) {
+        int pageNo;
+        if (newTreePage(archive, 1, &pageNo) == NULL) {
+            return 0;
+        }
+        unpinPage(pool, pageNo, 1);
+        archive->header.rootPage[tree] = pageNo;
+        archive->header.height[tree] = 1;
+    }
+    return archiveFlush(archive);
+}
+
+void archiveClose(struct PatientArchive* archive) {
+    if (archive->pool.file == NULL) {
         return;
     }
-    
-    struct Patient newPatient;
-    printf("Enter Patient Details\n");
-    printDivider();
-    printf("ID: ");
-    scanf("%d", &newPatient.id);
-    getchar();
-    
-    printf("Name: ");
-    fgets(newPatient.name, MAX_NAME_LEN, stdin);
-    newPatient.name[strcspn(newPatient.name, "\n")] = 0;
-    
-    printf("Age: ");
-    scanf("%d", &newPatient.age);
-    getchar();
-    
-    printf("Disease: ");
-    fgets(newPatient.disease, MAX_NAME_LEN, stdin);
-    newPatient.disease[strcspn(newPatient.disease, "\n")] = 0;
-    
-    // Available specialties with more comprehensive mapping
-    char *specialties[] = {
-        "General Medicine", 
-        "Orthopedics", 
-        "Cardiology", 
-        "Neurology", 
-        "Pulmonology", 
-        "Gastroenterology", 
-        "Oncology", 
-        "Pediatrics", 
-        "Dermatology",
-        "Gynecology",
-        "Urology", 
-        "Psychiatry",
-        "Endocrinology",
-        "Nephrology",
-        "Rheumatology"
-    };
-    int specialtyCount = sizeof(specialties) / sizeof(specialties[0]);
-    
-    // Improved specialty detection
-    char lowercaseDisease[MAX_NAME_LEN];
-    strcpy(lowercaseDisease, newPatient.disease);
-    for (int i = 0; lowercaseDisease[i]; i++) {
-        lowercaseDisease[i] = tolower(lowercaseDisease[i]);
+    archiveFlush(archive);
+    fclose(archive->pool.file);
+    archive->pool.file = NULL;
+    for (int f = 0; f < ARCHIVE_POOL_FRAMES; f++) {
+        free(archive->pool.frames[f].data);
+    }
+}
+
+// First position in a node whose key is >= key (leaves) or > key (internal
+// nodes, giving the child to descend into)
+int searchNode(unsigned char* page, int key) {
+    struct NodeHeader* node = (struct NodeHeader*)page;
+    int* keys = nodeKeys(page);
+    int low = 0, high = node->keyCount;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (keys[mid] < key || (!node->isLeaf && keys[mid] == key)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Leaf that would hold `key`, pinned; the caller unpins it
+unsigned char* findLeaf(struct PatientArchive* archive, int tree, int key, int* pageNo) {
+    *pageNo = archive->header.rootPage[tree];
+    unsigned char* page = fetchPage(&archive->pool, *pageNo);
+    while (page != NULL && !((struct NodeHeader*)page)->isLeaf) {
+        int child = nodeChildren(page)[searchNode(page, key)];
+        unpinPage(&archive->pool, *pageNo, 0);
+        *pageNo = child;
+        page = fetchPage(&archive->pool, *pageNo);
+    }
+    return page;
+}
+
+int archiveGet(struct PatientArchive* archive, int tree, int key, void* value) {
+    int pageNo;
+    unsigned char* page = findLeaf(archive, tree, key, &pageNo);
+    if (page == NULL) {
+        return 0;
+    }
+    int slot = searchNode(page, key);
+    int found = slot < ((struct NodeHeader*)page)->keyCount && nodeKeys(page)[slot] == key;
+    if (found) {
+        memcpy(value, leafValue(page, tree, slot), archiveValueSize(tree));
+    }
+    unpinPage(&archive->pool, pageNo, 0);
+    return found;
+}
+
+// Insert or replace `key` below `pageNo`. If the node had to split, returns 1
+// with the first key and page of the new right-hand node.
+int insertIntoNode(struct PatientArchive* archive, int tree, int pageNo, int key, const void* value,
+                   int* splitKey, int* splitPage, int* added) {
+    unsigned char* page = fetchPage(&archive->pool, pageNo);
+    if (page == NULL) {
+        return -1;
+    }
+    struct NodeHeader* node = (struct NodeHeader*)page;
+    int* keys = nodeKeys(page);
+    int slot = searchNode(page, key);
+    int valueSize = archiveValueSize(tree);
+
+    if (node->isLeaf) {
+        if (slot < node->keyCount && keys[slot] == key) {
+            memcpy(leafValue(page, tree, slot), value, valueSize);
+            unpinPage(&archive->pool, pageNo, 1);
+            return 0;
+        }
+        *added = 1;
+        int capacity = leafCapacity(tree);
+        if (node->keyCount < capacity) {
+            memmove(&keys[slot + 1], &keys[slot], sizeof(int) * (node->keyCount - slot));
+            memmove(leafValue(page, tree, slot + 1), leafValue(page, tree, slot), (size_t)valueSize * (node->keyCount - slot));
+            keys[slot] = key;
+            memcpy(leafValue(page, tree, slot), value, valueSize);
+            node->keyCount++;
+            unpinPage(&archive->pool, pageNo, 1);
+            return 0;
+        }
+
+        // Full leaf: the upper half moves to a new leaf linked after this one
+        int rightNo;
+        unsigned char* right = newTreePage(archive, 1, &rightNo);
+        if (right == NULL) {
+            unpinPage(&archive->pool, pageNo, 0);
+            return -1;
+        }
+        struct NodeHeader* rightNode = (struct NodeHeader*)right;
+        int keep = (capacity + 1) / 2;
+        int moved = capacity - keep;
+        memcpy(nodeKeys(right), &keys[keep], sizeof(int) * moved);
+        memcpy(leafValue(right, tree, 0), leafValue(page, tree, keep), (size_t)valueSize * moved);
+        node->keyCount = keep;
+        rightNode->keyCount = moved;
+        rightNode->nextLeaf = node->nextLeaf;
+        node->nextLeaf = rightNo;
+
+        unsigned char* target = slot <= keep ? page : right;
+        int targetSlot = slot <= keep ? slot : slot - keep;
+        struct NodeHeader* targetNode = (struct NodeHeader*)target;
+        int* targetKeys = nodeKeys(target);
+        memmove(&targetKeys[targetSlot + 1], &targetKeys[targetSlot], sizeof(int) * (targetNode->keyCount - targetSlot));
+        memmove(leafValue(target, tree, targetSlot + 1), leafValue(target, tree, targetSlot),
+                (size_t)valueSize * (targetNode->keyCount - targetSlot));
+        targetKeys[targetSlot] = key;
+        memcpy(leafValue(target, tree, targetSlot), value, valueSize);
+        targetNode->keyCount++;
+
+        *splitKey = nodeKeys(right)[0];
+        *splitPage = rightNo;
+        unpinPage(&archive->pool, rightNo, 1);
+        unpinPage(&archive->pool, pageNo, 1);
+        return 1;
+    }
+
+    int childKey, childPage;
+    int split = insertIntoNode(archive, tree, nodeChildren(page)[slot], key, value, &childKey, &childPage, added);
+    if (split <= 0) {
+        unpinPage(&archive->pool, pageNo, 0);
+        return split;
+    }
+
+    // The child split: add the new child after it, splitting this node if full
+    int capacity = ARCHIVE_INTERNAL_CAPACITY;
+    int* children = nodeChildren(page);
+    if (node->keyCount < capacity) {
+        memmove(&keys[slot + 1], &keys[slot], sizeof(int) * (node->keyCount - slot));
+        memmove(&children[slot + 2], &children[slot + 1], sizeof(int) * (node->keyCount - slot));
+        keys[slot] = childKey;
+        children[slot + 1] = childPage;
+        node->keyCount++;
+        unpinPage(&archive->pool, pageNo, 1);
+        return 0;
+    }
+
+    int allKeys[ARCHIVE_INTERNAL_CAPACITY + 1];
+    int allChildren[ARCHIVE_INTERNAL_CAPACITY + 2];
+    memcpy(allKeys, keys, sizeof(int) * slot);
+    allKeys[slot] = childKey;
+    memcpy(&allKeys[slot + 1], &keys[slot], sizeof(int) * (capacity - slot));
+    memcpy(allChildren, children, sizeof(int) * (slot + 1));
+    allChildren[slot + 1] = childPage;
+    memcpy(&allChildren[slot + 2], &children[slot + 1], sizeof(int) * (capacity - slot));
+
+    int rightNo;
+    unsigned char* right = newTreePage(archive, 0, &rightNo);
+    if (right == NULL) {
+        unpinPage(&archive->pool, pageNo, 0);
+        return -1;
+    }
+    // The middle key moves up; the keys either side of it stay in the two halves
+    int middle = (capacity + 1) / 2;
+    node->keyCount = middle;
+    memcpy(keys, allKeys, sizeof(int) * middle);
+    memcpy(children, allChildren, sizeof(int) * (middle + 1));
+    struct NodeHeader* rightNode = (struct NodeHeader*)right;
+    rightNode->keyCount = capacity - middle;
+    memcpy(nodeKeys(right), &allKeys[middle + 1], sizeof(int) * rightNode->keyCount);
+    memcpy(nodeChildren(right), &allChildren[middle + 1], sizeof(int) * (rightNode->keyCount + 1));
+
+    *splitKey = allKeys[middle];
+    *splitPage = rightNo;
+    unpinPage(&archive->pool, rightNo, 1);
+    unpinPage(&archive->pool, pageNo, 1);
+    return 1;
+}
+
+// Insert or replace a record, returns 0 on an I/O or pool failure
+int archivePut(struct PatientArchive* archive, int tree, int key, const void* value) {
+    int splitKey, splitPage, added = 0;
+    int split = insertIntoNode(archive, tree, archive->header.rootPage[tree], key, value, &splitKey, &splitPage, &added);
+    if (split < 0) {
+        return 0;
+    }
+    if (split == 1) {
+        if (archive->header.height[tree] >= ARCHIVE_MAX_HEIGHT) {
+            printf("Error: archive tree too deep\n");
+            return 0;
+        }
+        // The root split: a new root above the two halves
+        int rootNo;
+        unsigned char* root = newTreePage(archive, 0, &rootNo);
+        if (root == NULL) {
+            return 0;
+        }
+        ((struct NodeHeader*)root)->keyCount = 1;
+        nodeKeys(root)[0] = splitKey;
+        nodeChildren(root)[0] = archive->header.rootPage[tree];
+        nodeChildren(root)[1] = splitPage;
+        unpinPage(&archive->pool, rootNo, 1);
+        archive->header.rootPage[tree] = rootNo;
+        archive->header.height[tree]++;
+    }
+    archive->header.recordCount[tree] += added;
+    return 1;
+}
+
+// Remove a record. Leaves are not merged when they run low; later inserts in
+// the same key range reuse the space.
+int archiveDelete(struct PatientArchive* archive, int tree, int key) {
+    int pageNo;
+    unsigned char* page = findLeaf(archive, tree, key, &pageNo);
+    if (page == NULL) {
+        return 0;
+    }
+    struct NodeHeader* node = (struct NodeHeader*)page;
+    int* keys = nodeKeys(page);
+    int slot = searchNode(page, key);
+    int found = slot < node->keyCount && keys[slot] == key;
+    if (found) {
+        int valueSize = archiveValueSize(tree);
+        memmove(&keys[slot], &keys[slot + 1], sizeof(int) * (node->keyCount - slot - 1));
+        memmove(leafValue(page, tree, slot), leafValue(page, tree, slot + 1), (size_t)valueSize * (node->keyCount - slot - 1));
+        node->keyCount--;
+        archive->header.recordCount[tree]--;
+    }
+    unpinPage(&archive->pool, pageNo, found);
+    return found;
+}
+
+// Start a scan at the first record with key >= fromKey
+void archiveSeek(struct PatientArchive* archive, int tree, int fromKey, struct ArchiveCursor* cursor) {
+    cursor->archive = archive;
+    cursor->tree = tree;
+    unsigned char* page = findLeaf(archive, tree, fromKey, &cursor->page);
+    if (page == NULL) {
+        cursor->page = -1;
+        return;
+    }
+    cursor->slot = searchNode(page, fromKey);
+    unpinPage(&archive->pool, cursor->page, 0);
+}
+
+// Copy out the next record in key order; returns 0 at the end of the tree
+int archiveNext(struct ArchiveCursor* cursor, void* value) {
+    struct BufferPool* pool = &cursor->archive->pool;
+    while (cursor->page != -1) {
+        unsigned char* page = fetchPage(pool, cursor->page);
+        if (page == NULL) {
+            cursor->page = -1;
+            return 0;
+        }
+        struct NodeHeader* node = (struct NodeHeader*)page;
+        if (cursor->slot < node->keyCount) {
+            cursor->lastKey = nodeKeys(page)[cursor->slot];
+            memcpy(value, leafValue(page, cursor->tree, cursor->slot), archiveValueSize(cursor->tree));
+            cursor->slot++;
+            unpinPage(pool, cursor->page, 0);
+            return 1;
+        }
+        int next = node->nextLeaf;
+        unpinPage(pool, cursor->page, 0);
+        cursor->page = next;
+        cursor->slot = 0;
+    }
+    return 0;
+}
+
+// Assign patient to a specific doctor by ID, returns the slot taken or an ASSIGN_* code
+int assignPatientToDoctor(struct Patient patients[], struct Doctor doctors[], int patientId, int doctorId, int doctorCount) {
+    // Find the patient
+    int patientIndex = findPatientIndex(patients, patientId);
+    if (patientIndex == -1) {
+        return ASSIGN_PATIENT_NOT_FOUND;
+    }
+
+    // A patient is with one doctor at a time
+    for (int i = 0; i < doctorCount; i++) {
+        if (doctors[i].id == patients[patientIndex].assignedDoctorId && findPatientSlot(&doctors[i], patientId) != -1) {
+            return ASSIGN_PATIENT_BUSY;
+        }
+    }
+
+    // Find the specified doctor by ID
+    for (int i = 0; i < doctorCount; i++) {
+        if (doctors[i].id == doctorId) {
+            int slot = startConsultation(&doctors[i], patientId);
+            if (slot == -1) {
+                return ASSIGN_DOCTOR_BUSY;
+            }
+            struct Patient* patient = &patients[patientIndex];
+            if (patient->visitCount < MAX_VISIT_HISTORY) {
+                struct VisitRecord* visit = &patient->visitHistory[patient->visitCount];
+                strcpy(visit->doctorName, doctors[i].name);
+                visit->notes[0] = 0;
+                visit->doctorId = doctorId;
+                visit->visitTime = (long long)time(NULL);
+            }
+            patients[patientIndex].visitCount++;  // Increment patient visit count
+            patients[patientIndex].assignedDoctorId = doctorId;  // Set assigned doctor ID
+            return slot;
+        }
+    }
+    return ASSIGN_DOCTOR_NOT_FOUND;
+}
+
+// Store a patient record at its hashed position, returns the index, or -1 if
+// the table is full or already holds a patient with this ID
+int insertPatient(struct Patient patients[], int* patientCount, const struct Patient* record) {
+    if (*patientCount >= MAX_PATIENTS || findPatientIndex(patients, record->id) != -1) {
+        return -1;
+    }
+    int index = hash(record->id);
+    while (patients[index].occupied) {
+        index = (index + 1) % MAX_PATIENTS;
+    }
+    patients[index] = *record;
+    patients[index].occupied = 1;
+    (*patientCount)++;
+    return index;
+}
+
+// Improved specialty detection from the free-text disease
+const char* suggestSpecialty(const char* disease) {
+    char lowercaseDisease[MAX_NAME_LEN];
+    strncpy(lowercaseDisease, disease, MAX_NAME_LEN - 1);
+    lowercaseDisease[MAX_NAME_LEN - 1] = 0;
+    for (int i = 0; lowercaseDisease[i]; i++) {
+        lowercaseDisease[i] = tolower(lowercaseDisease[i]);
     }
     
-    char suggestedSpecialty[MAX_NAME_LEN];
     if (strstr(lowercaseDisease, "heart") || strstr(lowercaseDisease, "cardiac") || 
         strstr(lowercaseDisease, "chest pain") || strstr(lowercaseDisease, "blood pressure") ||
         strstr(lowercaseDisease, "cholesterol")) {
-        strcpy(suggestedSpecialty, "Cardiology");
+        return "Cardiology";
     } else if (strstr(lowercaseDisease, "bone") || strstr(lowercaseDisease, "fracture") || 
                strstr(lowercaseDisease, "arthritis") || strstr(lowercaseDisease, "shoulder") || 
                strstr(lowercaseDisease, "back") || strstr(lowercaseDisease, "knee")) {
-        strcpy(suggestedSpecialty, "Orthopedics");
+        return "Orthopedics";
     } else if (strstr(lowercaseDisease, "lung") || strstr(lowercaseDisease, "respiratory") || 
                strstr(lowercaseDisease, "breathing") || strstr(lowercaseDisease, "pneumonia") ||
                strstr(lowercaseDisease, "screening")) {
-        strcpy(suggestedSpecialty, "Pulmonology");
+        return "Pulmonology";
     } else if (strstr(lowercaseDisease, "brain") || strstr(lowercaseDisease, "neurological") || 
                strstr(lowercaseDisease, "headache") || strstr(lowercaseDisease, "migraine") ||
                strstr(lowercaseDisease, "memory") || strstr(lowercaseDisease, "nerve")) {
-        strcpy(suggestedSpecialty, "Neurology");
+        return "Neurology";
     } else if (strstr(lowercaseDisease, "cancer") || strstr(lowercaseDisease, "tumor") || 
                strstr(lowercaseDisease, "oncology")) {
-        strcpy(suggestedSpecialty, "Oncology");
+        return "Oncology";
     } else if (strstr(lowercaseDisease, "child") || strstr(lowercaseDisease, "kid") || 
                strstr(lowercaseDisease, "chicken pox") || strstr(lowercaseDisease, "vaccination")) {
-        strcpy(suggestedSpecialty, "Pediatrics");
+        return "Pediatrics";
     } else if (strstr(lowercaseDisease, "skin") || strstr(lowercaseDisease, "psoriasis") || 
                strstr(lowercaseDisease, "allergy")) {
-        strcpy(suggestedSpecialty, "Dermatology");
+        return "Dermatology";
     } else if (strstr(lowercaseDisease, "stomach") || strstr(lowercaseDisease, "ulcer") || 
                strstr(lowercaseDisease, "digestive")) {
-        strcpy(suggestedSpecialty, "Gastroenterology");
+        return "Gastroenterology";
     } else if (strstr(lowercaseDisease, "mental") || strstr(lowercaseDisease, "psychiatric") || 
                strstr(lowercaseDisease, "health")) {
-        strcpy(suggestedSpecialty, "Psychiatry");
+        return "Psychiatry";
     } else if (strstr(lowercaseDisease, "thyroid") || strstr(lowercaseDisease, "diabetes")) {
-        strcpy(suggestedSpecialty, "Endocrinology");
+        return "Endocrinology";
     } else if (strstr(lowercaseDisease, "kidney") || strstr(lowercaseDisease, "renal")) {
-        strcpy(suggestedSpecialty, "Nephrology");
+        return "Nephrology";
     } else if (strstr(lowercaseDisease, "joint") || strstr(lowercaseDisease, "inflammation")) {
-        strcpy(suggestedSpecialty, "Rheumatology");
+        return "Rheumatology";
     } else if (strstr(lowercaseDisease, "female") || strstr(lowercaseDisease, "pregnancy")) {
-        strcpy(suggestedSpecialty, "Gynecology");
+        return "Gynecology";
     } else if (strstr(lowercaseDisease, "prostate") || strstr(lowercaseDisease, "urinary")) {
-        strcpy(suggestedSpecialty, "Urology");
+        return "Urology";
     } else if (strstr(lowercaseDisease, "hypertension") || 
                strstr(lowercaseDisease, "fatigue") || 
                strstr(lowercaseDisease, "fever")) {
-        strcpy(suggestedSpecialty, "General Medicine");
+        return "General Medicine";
     } else {
-        strcpy(suggestedSpecialty, "General Medicine");
+        return "General Medicine";
     }
-    
-    printf("Suggested Specialty: %s\n", suggestedSpecialty);
-    printf("Accept suggested specialty? (0-No, 1-Yes): ");
-    int acceptSpecialty;
-    scanf("%d", &acceptSpecialty);
-    
-    char specialty[MAX_NAME_LEN];
-    if (!acceptSpecialty) {
-        // Display specialty options
-        printf("\nSelect Specialty:\n");
-        for (int i = 0; i < specialtyCount; i++) {
-            printf("%d. %s\n", i + 1, specialties[i]);
+}
+
+// The archive sits next to the site's data file: hospital_data.bin -> hospital_data.db
+void openSiteArchive(struct Hospital* site) {
+    char path[MAX_NAME_LEN + 32];
+    snprintf(path, sizeof(path), "%s", site->dataFile);
+    char* extension = strrchr(path, '.');
+    if (extension != NULL && strcmp(extension, ".bin") == 0) {
+        *extension = '\0';
+    }
+    strncat(path, ".db", sizeof(path) - strlen(path) - 1);
+
+    site->archive = malloc(sizeof(struct PatientArchive));
+    if (site->archive == NULL || !archiveOpen(site->archive, path)) {
+        printf("Continuing without a patient archive for site %s\n", site->siteName);
+        if (site->archive != NULL) {
+            archiveClose(site->archive);
         }
-        
-        int specialtyChoice;
-        printf("Enter specialty number (1-%d): ", specialtyCount);
-        scanf("%d", &specialtyChoice);
-        getchar();
-        
-        // Validate and assign specialty
-        if (specialtyChoice > 0 && specialtyChoice <= specialtyCount) {
-            strcpy(specialty, specialties[specialtyChoice - 1]);
+        free(site->archive);
+        site->archive = NULL;
+    }
+}
+
+// Copy every active patient and every doctor into the archive and write it out
+void syncSiteArchive(struct Hospital* site) {
+    if (site->archive == NULL) {
+        return;
+    }
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        if (site->patients[i].occupied) {
+            archivePut(site->archive, ARCHIVE_PATIENTS, site->patients[i].id, &site->patients[i]);
+        }
+    }
+    for (int i = 0; i < site->doctorCount; i++) {
+        archivePut(site->archive, ARCHIVE_DOCTORS, site->doctors[i].id, &site->doctors[i]);
+    }
+    if (!archiveFlush(site->archive)) {
+        printf("Error writing the patient archive\n");
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Replication journal
+//
+// A primary started with --replicate PATH records every change made through
+// the site operations below and streams the records to a follower process
+// over a Unix socket at PATH. Appending only copies the record into a ring
+// buffer; a shipper thread sends whatever has built up in one write, so the
+// desk never waits on the follower. A follower that falls a whole ring
+// behind is dropped, reconnects and starts again from a fresh snapshot.
+// ---------------------------------------------------------------------------
+
+#define JOURNAL_RING_BYTES (4 * 1024 * 1024)
+#define JOURNAL_HEARTBEAT_MS 100  // Idle interval between heartbeats to the follower
+
+#define JOURNAL_SNAPSHOT 0  // Whole site, sent when a follower connects
+#define JOURNAL_SNAPSHOT_END 1
+#define JOURNAL_HEARTBEAT 2
+#define JOURNAL_ADMIT 3
+#define JOURNAL_ENQUEUE 4
+#define JOURNAL_DEQUEUE 5
+#define JOURNAL_WITHDRAW 6
+#define JOURNAL_ASSIGN 7
+#define JOURNAL_RELEASE_SLOT 8
+#define JOURNAL_DISCHARGE 9
+#define JOURNAL_ADD_DOCTOR 10
+#define JOURNAL_REMOVE_DOCTOR 11
+#define JOURNAL_VISIT_NOTES 12
+#define JOURNAL_REQUEUE 13  // Back into the queue at the head of the patient's class
+#define JOURNAL_SAVE 14  // Trace only: the site was saved to its data file
+#define JOURNAL_TRACE_END 15  // Trace only: checksum of every site when recording stopped
+
+// Fixed header of every record; `length` bytes of payload follow it
+struct JournalRecord {
+    long long sequence;  // Heartbeats and snapshots carry the latest sequence instead of a new one
+    long long appendedAt;  // CLOCK_MONOTONIC microseconds on the primary, for lag
+    long long when;  // Wall-clock time of the change, so replicas store the same timestamps
+    int type;
+    int site;  // Position of the site in the primary's site list
+    int patientId;
+    int doctorId;
+    int slot;
+    int length;
+};
+
+// Sent back by the follower after it has applied everything it has read
+struct JournalAck {
+    long long sequence;
+    long long lagMicros;  // Append-to-apply delay of that record
+};
+
+struct SiteSnapshot {
+    char siteName[MAX_NAME_LEN];
+    char dataFile[MAX_NAME_LEN + 32];
+    int patientCount;
+    int doctorCount;
+    struct Patient patients[MAX_PATIENTS];
+    struct Doctor doctors[MAX_DOCTORS];
+    struct PriorityQueue waitingQueue;
+};
+
+struct ReplicationJournal {
+    pthread_mutex_t lock;
+    pthread_cond_t pending;  // Signalled when there are records to ship
+    unsigned char* ring;
+    long long head;  // Bytes appended since the follower connected; ring offset is head % size
+    long long shipped;  // Bytes already written to the follower
+    long long sequence;  // Last record appended
+    int followerFd;  // -1 while no follower is connected
+    int listenFd;
+    int overflowed;  // Follower fell a ring behind and must re-sync
+    int stopping;
+    // Follower progress, from its acks
+    long long ackedSequence;
+    long long lagMicros;
+    long long maxLagMicros;
+    // Shipping statistics
+    long long recordsQueued;
+    long long batches;  // Writes that carried records, not counting lone heartbeats
+    long long heartbeats;
+    long long bytesShipped;
+    int resyncs;
+    unsigned char ackBuffer[sizeof(struct JournalAck)];
+    int ackBytes;
+    struct Hospital* sites[MAX_SITES];
+    pthread_mutex_t* siteLocks[MAX_SITES];
+    int siteCount;
+    char path[108];
+    pthread_t shipper;
+};
+
+long long monotonicMicros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// Copy bytes in at the ring head, wrapping at the end; the caller checked there is room
+void ringWrite(struct ReplicationJournal* journal, const void* data, int length) {
+    int offset = (int)(journal->head % JOURNAL_RING_BYTES);
+    int first = length < JOURNAL_RING_BYTES - offset ? length : JOURNAL_RING_BYTES - offset;
+    memcpy(journal->ring + offset, data, first);
+    memcpy(journal->ring, (const unsigned char*)data + first, length - first);
+    journal->head += length;
+}
+
+// Record one change to a site; called with the site lock held, through recordChange
+void journalAppend(struct Hospital* site, int type, int patientId, int doctorId, int slot, const void* payload, int length) {
+    struct ReplicationJournal* journal = site->journal;
+    if (journal == NULL) {
+        return;
+    }
+    struct JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.appendedAt = monotonicMicros();
+    record.when = (long long)time(NULL);
+    record.type = type;
+    record.site = site->siteNumber;
+    record.patientId = patientId;
+    record.doctorId = doctorId;
+    record.slot = slot;
+    record.length = length;
+
+    pthread_mutex_lock(&journal->lock);
+    record.sequence = ++journal->sequence;
+    if (journal->followerFd != -1 && !journal->overflowed) {
+        if (journal->head - journal->shipped + (long long)sizeof(record) + length > JOURNAL_RING_BYTES) {
+            journal->overflowed = 1;
         } else {
-            strcpy(specialty, "General Medicine");
+            ringWrite(journal, &record, sizeof(record));
+            if (length > 0) {
+                ringWrite(journal, payload, length);
+            }
+            journal->recordsQueued++;
+        }
+        pthread_cond_signal(&journal->pending);
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+// ---------------------------------------------------------------------------
+// Operation trace
+//
+// With --record PATH every site operation is also written to a binary trace
+// in the journal's record format: a snapshot of each site, then one record
+// per operation with its arguments and timestamps, and a checksum of the
+// final state. `replay PATH` runs the operations against the snapshot, so
+// two builds can be compared on exactly the same workload.
+// ---------------------------------------------------------------------------
+
+#define TRACE_MAGIC "HMTRACE1"
+#define TRACE_BUFFER_BYTES (1 << 20)
+
+// Start of a trace file; the sizes reject traces made by a build with other record layouts
+struct TraceHeader {
+    char magic[8];
+    int siteCount;
+    int recordBytes;
+    int patientBytes;
+    int doctorBytes;
+};
+
+struct OperationTrace {
+    pthread_mutex_t lock;
+    FILE* file;
+    char path[PATH_MAX];
+    long long sequence;
+    long long bytes;
+};
+
+void traceAppend(struct Hospital* site, int type, int patientId, int doctorId, int slot, const void* payload, int length) {
+    struct OperationTrace* trace = site->trace;
+    if (trace == NULL) {
+        return;
+    }
+    struct JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.appendedAt = monotonicMicros();
+    record.when = (long long)time(NULL);
+    record.type = type;
+    record.site = site->siteNumber;
+    record.patientId = patientId;
+    record.doctorId = doctorId;
+    record.slot = slot;
+    record.length = length;
+
+    pthread_mutex_lock(&trace->lock);
+    record.sequence = ++trace->sequence;
+    fwrite(&record, sizeof(record), 1, trace->file);
+    if (length > 0) {
+        fwrite(payload, 1, length, trace->file);
+    }
+    trace->bytes += sizeof(record) + length;
+    pthread_mutex_unlock(&trace->lock);
+}
+
+// ---------------------------------------------------------------------------
+// Change feed
+//
+// Typed, sequence-numbered events for downstream systems (pharmacy, billing,
+// bed management), enabled with --events PATH. Events are appended to
+// rotating log files (hospital_events.<first sequence>.log, one JSON object
+// per line) by a writer thread, and served to subscribers on the Unix socket
+// at PATH from any sequence number, so a consumer that restarts picks up
+// where it left off instead of re-reading hospital_data.bin.
+// ---------------------------------------------------------------------------
+
+#define FEED_RING_EVENTS 8192
+#define FEED_SEGMENT_BYTES (4 * 1024 * 1024)
+#define FEED_SEGMENTS_KEPT 16
+#define FEED_MAX_SEGMENTS 1024
+#define FEED_MAX_SUBSCRIBERS 8
+#define FEED_LINE_BYTES 512
+#define FEED_BATCH_BYTES (64 * 1024)
+#define FEED_LINGER_US 500  // Writer waits this long after waking so a batch can build up
+#define FEED_REQUEST_TIMEOUT_MS 5000  // How long a new subscriber has to send its FROM line
+
+// One change as it waits for the writer; the text fields are copied out of
+// the record so the event does not depend on the table row afterwards
+struct ChangeEvent {
+    long long sequence;
+    long long when;
+    int type;  // JOURNAL_* code of the change
+    int site;
+    int patientId;
+    int doctorId;
+    int slot;
+    int number;  // Age of an admitted patient, capacity of an added doctor
+    int flag;  // Emergency flag of an admitted patient
+    char name[MAX_NAME_LEN];
+    char text[MAX_NAME_LEN];  // Disease, specialty or visit notes
+};
+
+struct FeedSubscriber {
+    int fd;  // -1 when the entry is free
+    long long nextSequence;  // Next event this subscriber will be sent, 0 until its request is read
+    pthread_t thread;
+    int started;  // thread has been created and not yet joined
+    struct ChangeFeed* feed;
+};
+
+struct ChangeFeed {
+    pthread_mutex_t lock;
+    pthread_cond_t pending;  // Events waiting for the writer
+    pthread_cond_t drained;  // Room in the ring again
+    pthread_cond_t logged;  // New events are in the log, for subscribers
+    struct ChangeEvent ring[FEED_RING_EVENTS];
+    long long head;  // Events appended; ring slot is head % FEED_RING_EVENTS
+    long long written;  // Events written to the log
+    long long sequence;  // Last sequence handed out
+    long long loggedSequence;  // Last sequence in the log files
+    int writerIdle;  // Writer is asleep and needs a signal for the next event
+    int stopping;
+    // Statistics
+    long long batches;
+    long long stalls;  // Appends that waited for the writer to make room
+    FILE* log;
+    long long segmentFirst;
+    long long segmentBytes;
+    char siteNames[MAX_SITES][MAX_NAME_LEN];
+    int listenFd;
+    char path[108];
+    struct FeedSubscriber subscribers[FEED_MAX_SUBSCRIBERS];
+    pthread_t writer;
+    pthread_t acceptor;
+};
+
+// Queue an event for the log. If the writer has fallen a whole ring behind
+// the change waits for it, rather than an event being lost.
+void feedAppend(struct ChangeFeed* feed, int site, int type, int patientId, int doctorId, int slot, const void* payload) {
+    struct ChangeEvent event;
+    memset(&event, 0, sizeof(event));
+    event.when = (long long)time(NULL);
+    event.type = type;
+    event.site = site;
+    event.patientId = patientId;
+    event.doctorId = doctorId;
+    event.slot = slot;
+    if (type == JOURNAL_ADMIT) {
+        const struct Patient* patient = payload;
+        snprintf(event.name, sizeof(event.name), "%s", patient->name);
+        snprintf(event.text, sizeof(event.text), "%s", patient->disease);
+        event.number = patient->age;
+        event.flag = patient->isEmergency;
+    } else if (type == JOURNAL_ADD_DOCTOR) {
+        const struct Doctor* doctor = payload;
+        snprintf(event.name, sizeof(event.name), "%s", doctor->name);
+        snprintf(event.text, sizeof(event.text), "%s", doctor->specialty);
+        event.number = doctor->capacity;
+    } else if (type == JOURNAL_VISIT_NOTES) {
+        snprintf(event.text, sizeof(event.text), "%s", (const char*)payload);
+    }
+
+    pthread_mutex_lock(&feed->lock);
+    if (feed->head - feed->written >= FEED_RING_EVENTS && !feed->stopping) {
+        feed->stalls++;
+        while (feed->head - feed->written >= FEED_RING_EVENTS && !feed->stopping) {
+            pthread_cond_wait(&feed->drained, &feed->lock);
+        }
+    }
+    event.sequence = ++feed->sequence;
+    feed->ring[feed->head % FEED_RING_EVENTS] = event;
+    feed->head++;
+    if (feed->writerIdle) {
+        feed->writerIdle = 0;
+        pthread_cond_signal(&feed->pending);
+    }
+    pthread_mutex_unlock(&feed->lock);
+}
+
+// ---------------------------------------------------------------------------
+// Billing ledger
+//
+// Every completed visit (its notes are written as the doctor's slot is
+// released) posts its charges to the site's ledger, an append-only file next
+// to the data file: hospital_data.bin -> hospital_data.ledger. The ledger is
+// double-entry. Each posting debits one account and credits another by the
+// same amount: a charge debits the patient's account and credits revenue for
+// the doctor's specialty, a payment debits cash and credits the patient's
+// account, so the books balance by construction.
+//
+// Patient balances and specialty revenue are running totals, brought up to
+// date as each posting is made; the file is read whole only at startup and by
+// the month-end statements. Postings are written by a writer thread, as many
+// as have built up per write, so a busy desk never waits on the disk.
+// ---------------------------------------------------------------------------
+
+#define LEDGER_MAGIC "HMLEDGR1"
+#define LEDGER_RING_POSTINGS 8192
+#define LEDGER_READ_POSTINGS 4096  // Postings per read when the file is streamed
+#define LEDGER_LINGER_US 500  // Writer waits this long after waking so a batch can build up
+
+#define GENERAL_CONSULTATION_CENTS 4000
+#define SPECIALIST_CONSULTATION_CENTS 7500
+#define EMERGENCY_SURCHARGE_CENTS 12000
+
+// Line items
+#define LEDGER_CONSULTATION 1
+#define LEDGER_EMERGENCY_SURCHARGE 2
+#define LEDGER_PAYMENT 3
+
+// Accounts; the patient's account is the posting's patientId, revenue is split by specialty
+#define ACCOUNT_PATIENT 1
+#define ACCOUNT_REVENUE 2
+#define ACCOUNT_CASH 3
+
+// Start of a ledger file; the size rejects ledgers made by a build with another posting layout
+struct LedgerHeader {
+    char magic[8];
+    int postingBytes;
+    int reserved;
+};
+
+struct LedgerPosting {
+    long long sequence;  // Posting number, from 1
+    long long entry;  // The postings of one visit or payment share an entry
+    long long postedAt;  // Unix time; statements go by this
+    long long visitTime;  // Start of the visit charged for, 0 for a payment
+    long long amountCents;
+    int debitAccount;  // ACCOUNT_*
+    int creditAccount;
+    int patientId;
+    int doctorId;  // 0 for a payment
+    int specialty;  // Revenue bucket (specialtyBucket) of a charge
+    int item;  // LEDGER_*
+};
+
+// One patient's account, in an open-addressing map keyed by patient ID
+struct PatientAccount {
+    int patientId;
+    int used;
+    long long chargedCents;
+    long long paidCents;
+    // Only used by the statement pass
+    long long openingCents;
+    int lineCount;
+    int firstLine;
+};
+
+struct AccountMap {
+    struct PatientAccount* slots;
+    int capacity;  // Power of two, kept at least twice the count
+    int count;
+};
+
+struct BillingLedger {
+    pthread_mutex_t lock;
+    pthread_cond_t pending;  // Postings waiting for the writer
+    pthread_cond_t drained;  // Writer has caught up with more of the ring
+    struct LedgerPosting ring[LEDGER_RING_POSTINGS];
+    long long head;  // Postings appended; ring slot is head % LEDGER_RING_POSTINGS
+    long long written;  // Postings in the file
+    int writerIdle;  // Writer is asleep and needs a signal for the next posting
+    int stopping;
+    long long batches;
+    long long stalls;  // Appends that waited for the writer to make room
+    long long replayed;  // Postings read back at startup
+    FILE* file;
+    char path[MAX_NAME_LEN + 32];
+    pthread_t writer;
+    // Kept by the posting side, with the site held
+    long long sequence;
+    long long entry;
+    struct AccountMap accounts;
+    long long revenueCents[SPECIALTY_COUNT + 1];
+    long long cashCents;
+};
+
+unsigned int accountHash(int patientId, int capacity) {
+    return ((unsigned int)patientId * 2654435761u) & (unsigned int)(capacity - 1);
+}
+
+// A patient's account, added first if `create` is set; NULL if there is none
+// (or no memory to add it)
+struct PatientAccount* findAccount(struct AccountMap* map, int patientId, int create) {
+    if (create && (map->count + 1) * 2 > map->capacity) {
+        int capacity = map->capacity > 0 ? map->capacity * 2 : 1024;
+        struct PatientAccount* slots = calloc(capacity, sizeof(struct PatientAccount));
+        if (slots == NULL) {
+            return NULL;
+        }
+        for (int i = 0; i < map->capacity; i++) {
+            if (map->slots[i].used) {
+                unsigned int j = accountHash(map->slots[i].patientId, capacity);
+                while (slots[j].used) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = map->slots[i];
+            }
+        }
+        free(map->slots);
+        map->slots = slots;
+        map->capacity = capacity;
+    }
+    if (map->capacity == 0) {
+        return NULL;
+    }
+    unsigned int i = accountHash(patientId, map->capacity);
+    while (map->slots[i].used) {
+        if (map->slots[i].patientId == patientId) {
+            return &map->slots[i];
+        }
+        i = (i + 1) & (map->capacity - 1);
+    }
+    if (!create) {
+        return NULL;
+    }
+    memset(&map->slots[i], 0, sizeof(struct PatientAccount));
+    map->slots[i].used = 1;
+    map->slots[i].patientId = patientId;
+    map->count++;
+    return &map->slots[i];
+}
+
+// Bring the running totals up to date with one posting
+void applyPosting(struct BillingLedger* ledger, const struct LedgerPosting* posting) {
+    struct PatientAccount* account = findAccount(&ledger->accounts, posting->patientId, 1);
+    if (account != NULL && posting->debitAccount == ACCOUNT_PATIENT) {
+        account->chargedCents += posting->amountCents;
+    } else if (account != NULL && posting->creditAccount == ACCOUNT_PATIENT) {
+        account->paidCents += posting->amountCents;
+    }
+    if (posting->creditAccount == ACCOUNT_REVENUE && posting->specialty >= 0 && posting->specialty <= SPECIALTY_COUNT) {
+        ledger->revenueCents[posting->specialty] += posting->amountCents;
+    }
+    if (posting->debitAccount == ACCOUNT_CASH) {
+        ledger->cashCents += posting->amountCents;
+    }
+    ledger->sequence = posting->sequence;
+    if (posting->entry > ledger->entry) {
+        ledger->entry = posting->entry;
+    }
+}
+
+// Queue the postings of one entry for the writer. If the writer has fallen a
+// whole ring behind the entry waits for it, rather than a posting being lost.
+void ledgerAppend(struct BillingLedger* ledger, const struct LedgerPosting* postings, int count) {
+    pthread_mutex_lock(&ledger->lock);
+    for (int n = 0; n < count; n++) {
+        if (ledger->head - ledger->written >= LEDGER_RING_POSTINGS && !ledger->stopping) {
+            ledger->stalls++;
+            while (ledger->head - ledger->written >= LEDGER_RING_POSTINGS && !ledger->stopping) {
+                pthread_cond_wait(&ledger->drained, &ledger->lock);
+            }
+        }
+        ledger->ring[ledger->head % LEDGER_RING_POSTINGS] = postings[n];
+        ledger->head++;
+    }
+    if (ledger->writerIdle) {
+        ledger->writerIdle = 0;
+        pthread_cond_signal(&ledger->pending);
+    }
+    pthread_mutex_unlock(&ledger->lock);
+}
+
+// Post one entry: number its postings, add them to the running totals and
+// queue them for the file. Called with the site held.
+void postLedgerEntry(struct BillingLedger* ledger, struct LedgerPosting* postings, int count) {
+    long long entry = ++ledger->entry;
+    for (int n = 0; n < count; n++) {
+        postings[n].sequence = ++ledger->sequence;
+        postings[n].entry = entry;
+        applyPosting(ledger, &postings[n]);
+    }
+    ledgerAppend(ledger, postings, count);
+}
+
+// Charge one visit: the consultation, at the specialist rate unless the
+// doctor is in General Medicine, and a surcharge for an emergency. Returns
+// the amount charged.
+long long postVisitCharges(struct BillingLedger* ledger, long long postedAt, int patientId, int doctorId,
+                           int specialty, int isEmergency, long long visitTime) {
+    struct LedgerPosting postings[2];
+    memset(postings, 0, sizeof(postings));
+    int count = isEmergency ? 2 : 1;
+    for (int n = 0; n < count; n++) {
+        postings[n].postedAt = postedAt;
+        postings[n].visitTime = visitTime;
+        postings[n].debitAccount = ACCOUNT_PATIENT;
+        postings[n].creditAccount = ACCOUNT_REVENUE;
+        postings[n].patientId = patientId;
+        postings[n].doctorId = doctorId;
+        postings[n].specialty = specialty;
+    }
+    postings[0].item = LEDGER_CONSULTATION;
+    postings[0].amountCents = specialty == 0 ? GENERAL_CONSULTATION_CENTS : SPECIALIST_CONSULTATION_CENTS;  // specialties[0] is General Medicine
+    postings[1].item = LEDGER_EMERGENCY_SURCHARGE;
+    postings[1].amountCents = EMERGENCY_SURCHARGE_CENTS;
+    postLedgerEntry(ledger, postings, count);
+    return postings[0].amountCents + (isEmergency ? postings[1].amountCents : 0);
+}
+
+void postPayment(struct BillingLedger* ledger, long long postedAt, int patientId, long long amountCents) {
+    struct LedgerPosting payment;
+    memset(&payment, 0, sizeof(payment));
+    payment.postedAt = postedAt;
+    payment.amountCents = amountCents;
+    payment.debitAccount = ACCOUNT_CASH;
+    payment.creditAccount = ACCOUNT_PATIENT;
+    payment.patientId = patientId;
+    payment.specialty = -1;
+    payment.item = LEDGER_PAYMENT;
+    postLedgerEntry(ledger, &payment, 1);
+}
+
+// Writes queued postings to the file, as many as have built up per write
+void* ledgerWriterMain(void* arg) {
+    struct BillingLedger* ledger = arg;
+    while (1) {
+        pthread_mutex_lock(&ledger->lock);
+        if (ledger->head == ledger->written && !ledger->stopping) {
+            while (ledger->head == ledger->written && !ledger->stopping) {
+                ledger->writerIdle = 1;
+                pthread_cond_wait(&ledger->pending, &ledger->lock);
+            }
+            // Let the rest of a burst arrive, rather than waking for every visit
+            pthread_mutex_unlock(&ledger->lock);
+            usleep(LEDGER_LINGER_US);
+            pthread_mutex_lock(&ledger->lock);
+        }
+        if (ledger->head == ledger->written) {
+            pthread_mutex_unlock(&ledger->lock);
+            break;
+        }
+        long long from = ledger->written;
+        long long to = ledger->head;
+        pthread_mutex_unlock(&ledger->lock);
+
+        // At most two runs, where the batch wraps round the end of the ring
+        for (long long i = from; i < to;) {
+            int offset = (int)(i % LEDGER_RING_POSTINGS);
+            long long run = to - i < LEDGER_RING_POSTINGS - offset ? to - i : LEDGER_RING_POSTINGS - offset;
+            if (fwrite(&ledger->ring[offset], sizeof(struct LedgerPosting), run, ledger->file) != (size_t)run) {
+                printf("Error writing billing ledger %s\n", ledger->path);
+            }
+            i += run;
+        }
+        fflush(ledger->file);
+
+        pthread_mutex_lock(&ledger->lock);
+        ledger->written = to;
+        ledger->batches++;
+        pthread_cond_broadcast(&ledger->drained);
+        pthread_mutex_unlock(&ledger->lock);
+    }
+    return NULL;
+}
+
+// Wait until everything posted so far is in the file
+void drainLedger(struct BillingLedger* ledger) {
+    pthread_mutex_lock(&ledger->lock);
+    while (ledger->written < ledger->head) {
+        pthread_cond_wait(&ledger->drained, &ledger->lock);
+    }
+    pthread_mutex_unlock(&ledger->lock);
+}
+
+// Open the ledger at `path`, creating it if needed, read it back into the
+// running totals and start its writer. NULL if the file cannot be used.
+struct BillingLedger* openLedger(const char* path) {
+    struct BillingLedger* ledger = calloc(1, sizeof(struct BillingLedger));
+    if (ledger == NULL) {
+        return NULL;
+    }
+    snprintf(ledger->path, sizeof(ledger->path), "%s", path);
+    FILE* file = fopen(path, "r+b");
+    if (file == NULL) {
+        file = fopen(path, "w+b");
+    }
+    if (file == NULL) {
+        printf("Error opening billing ledger %s\n", path);
+        free(ledger);
+        return NULL;
+    }
+    struct LedgerHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LEDGER_MAGIC, sizeof(header.magic));
+        header.postingBytes = sizeof(struct LedgerPosting);
+        rewind(file);
+        fwrite(&header, sizeof(header), 1, file);
+        fflush(file);
+    } else if (memcmp(header.magic, LEDGER_MAGIC, sizeof(header.magic)) != 0 ||
+               header.postingBytes != (int)sizeof(struct LedgerPosting)) {
+        printf("Error: %s is not a billing ledger written by this build\n", path);
+        fclose(file);
+        free(ledger);
+        return NULL;
+    } else {
+        struct LedgerPosting* batch = malloc(LEDGER_READ_POSTINGS * sizeof(struct LedgerPosting));
+        size_t got;
+        while (batch != NULL && (got = fread(batch, sizeof(struct LedgerPosting), LEDGER_READ_POSTINGS, file)) > 0) {
+            for (size_t i = 0; i < got; i++) {
+                applyPosting(ledger, &batch[i]);
+            }
+            ledger->replayed += got;
+        }
+        free(batch);
+    }
+    // A crash during a write can leave part of a posting at the end; cut it off so appends line up
+    off_t whole = (off_t)sizeof(header) + (off_t)ledger->replayed * (off_t)sizeof(struct LedgerPosting);
+    if (ftruncate(fileno(file), whole) != 0 || fseeko(file, whole, SEEK_SET) != 0) {
+        printf("Error preparing billing ledger %s for appends\n", path);
+    }
+    ledger->file = file;
+    ledger->head = ledger->written = ledger->replayed;
+    pthread_mutex_init(&ledger->lock, NULL);
+    pthread_cond_init(&ledger->pending, NULL);
+    pthread_cond_init(&ledger->drained, NULL);
+    pthread_create(&ledger->writer, NULL, ledgerWriterMain, ledger);
+    return ledger;
+}
+
+// Write out what is still queued, stop the writer and free the ledger
+void closeLedger(struct BillingLedger* ledger) {
+    pthread_mutex_lock(&ledger->lock);
+    ledger->stopping = 1;
+    pthread_cond_signal(&ledger->pending);
+    pthread_mutex_unlock(&ledger->lock);
+    pthread_join(ledger->writer, NULL);
+    fclose(ledger->file);
+    free(ledger->accounts.slots);
+    pthread_mutex_destroy(&ledger->lock);
+    pthread_cond_destroy(&ledger->pending);
+    pthread_cond_destroy(&ledger->drained);
+    free(ledger);
+}
+
+// The ledger sits next to the site's data file: hospital_data.bin -> hospital_data.ledger
+void openSiteLedger(struct Hospital* site) {
+    char path[MAX_NAME_LEN + 32];
+    snprintf(path, sizeof(path), "%s", site->dataFile);
+    char* extension = strrchr(path, '.');
+    if (extension != NULL && strcmp(extension, ".bin") == 0) {
+        *extension = '\0';
+    }
+    strncat(path, ".ledger", sizeof(path) - strlen(path) - 1);
+    site->ledger = openLedger(path);
+    if (site->ledger == NULL) {
+        printf("Continuing without billing for site %s\n", site->siteName);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Billing statements
+//
+// Month-end statements are one streaming pass over a ledger file, so they
+// never need the whole ledger in memory. Postings before the month only move
+// the opening balances; the month's postings are kept as compact lines, then
+// grouped by patient with a counting sort and written out in patient ID
+// order. A patient with nothing posted in the month and nothing owing gets no
+// statement.
+// ---------------------------------------------------------------------------
+
+#define STATEMENT_BUFFER_BYTES (1 << 20)
+
+// One posting of the month, as it appears on a statement
+struct StatementLine {
+    long long postedAt;
+    long long amountCents;  // Positive for a charge, negative for a payment
+    int patientId;
+    int doctorId;
+    int specialty;
+    int item;
+};
+
+struct StatementRun {
+    long long postings;  // Read from the ledger
+    long long lines;
+    long long statements;
+    long long closingCents;  // Sum of the closing balances
+    long long micros;
+};
+
+// First and last second of a month given as YYYY-MM, in local time; 0 if it is not a month
+int parseMonth(const char* text, long long* start, long long* end) {
+    int year, month;
+    if (sscanf(text, "%d-%d", &year, &month) != 2 || month < 1 || month > 12) {
+        return 0;
+    }
+    struct tm local;
+    memset(&local, 0, sizeof(local));
+    local.tm_year = year - 1900;
+    local.tm_mon = month - 1;
+    local.tm_mday = 1;
+    local.tm_isdst = -1;
+    *start = (long long)mktime(&local);
+    local.tm_mon++;  // mktime carries December into January
+    local.tm_isdst = -1;
+    *end = (long long)mktime(&local);
+    return *start != -1 && *end != -1;
+}
+
+// Amount in cents as currency units, e.g. -1234 -> "-12.34"
+void formatCents(long long cents, char out[32]) {
+    snprintf(out, 32, "%s%lld.%02lld", cents < 0 ? "-" : "", llabs(cents) / 100, llabs(cents) % 100);
+}
+
+const char* ledgerItemName(int item) {
+    switch (item) {
+        case LEDGER_CONSULTATION: return "Consultation";
+        case LEDGER_EMERGENCY_SURCHARGE: return "Emergency surcharge";
+        case LEDGER_PAYMENT: return "Payment";
+    }
+    return "Unknown";
+}
+
+int compareAccountIds(const void* a, const void* b) {
+    int left = ((const struct PatientAccount*)a)->patientId;
+    int right = ((const struct PatientAccount*)b)->patientId;
+    return (left > right) - (left < right);
+}
+
+void writeStatement(FILE* out, const char* month, const struct PatientAccount* account, const struct StatementLine* lines) {
+    char amount[32];
+    long long closing = account->openingCents;
+    fprintf(out, "Statement %s for patient %d\n", month, account->patientId);
+    formatCents(account->openingCents, amount);
+    fprintf(out, "  %-61s %12s\n", "Opening balance", amount);
+    for (int i = 0; i < account->lineCount; i++) {
+        const struct StatementLine* line = &lines[i];
+        char day[11];
+        char description[64];
+        time_t when = (time_t)line->postedAt;
+        struct tm local;
+        localtime_r(&when, &local);
+        strftime(day, sizeof(day), "%Y-%m-%d", &local);
+        if (line->item == LEDGER_PAYMENT) {
+            snprintf(description, sizeof(description), "%s", ledgerItemName(line->item));
+        } else {
+            snprintf(description, sizeof(description), "%s, %s, doctor %d", ledgerItemName(line->item),
+                     line->specialty >= 0 && line->specialty < SPECIALTY_COUNT ? specialties[line->specialty] : "Other",
+                     line->doctorId);
+        }
+        formatCents(line->amountCents, amount);
+        fprintf(out, "  %s %-50.50s %12s\n", day, description, amount);
+        closing += line->amountCents;
+    }
+    formatCents(closing, amount);
+    fprintf(out, "  %-61s %12s\n\n", "Closing balance", amount);
+}
+
+// Write the statements for [monthStart, monthEnd) from the ledger file at
+// `ledgerPath` to `outPath`. Returns 0 if either file cannot be used.
+int writeStatements(const char* ledgerPath, const char* month, long long monthStart, long long monthEnd,
+                    const char* outPath, struct StatementRun* run) {
+    memset(run, 0, sizeof(*run));
+    long long started = monotonicMicros();
+    FILE* in = fopen(ledgerPath, "rb");
+    struct LedgerHeader header;
+    if (in == NULL || fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, LEDGER_MAGIC, sizeof(header.magic)) != 0 || header.postingBytes != (int)sizeof(struct LedgerPosting)) {
+        printf("Error: cannot read billing ledger %s\n", ledgerPath);
+        if (in != NULL) {
+            fclose(in);
+        }
+        return 0;
+    }
+
+    struct AccountMap accounts;
+    memset(&accounts, 0, sizeof(accounts));
+    struct StatementLine* lines = NULL;
+    long long lineCapacity = 0;
+    struct LedgerPosting* batch = malloc(LEDGER_READ_POSTINGS * sizeof(struct LedgerPosting));
+    size_t got;
+    int ok = batch != NULL;
+    while (ok && (got = fread(batch, sizeof(struct LedgerPosting), LEDGER_READ_POSTINGS, in)) > 0) {
+        run->postings += got;
+        for (size_t i = 0; i < got && ok; i++) {
+            const struct LedgerPosting* posting = &batch[i];
+            long long change = posting->debitAccount == ACCOUNT_PATIENT ? posting->amountCents
+                             : posting->creditAccount == ACCOUNT_PATIENT ? -posting->amountCents : 0;
+            if (change == 0 || posting->postedAt >= monthEnd) {
+                continue;
+            }
+            struct PatientAccount* account = findAccount(&accounts, posting->patientId, 1);
+            if (account == NULL) {
+                ok = 0;
+                break;
+            }
+            if (posting->postedAt < monthStart) {
+                account->openingCents += change;
+                continue;
+            }
+            if (run->lines == lineCapacity) {
+                lineCapacity = lineCapacity > 0 ? lineCapacity * 2 : 65536;
+                struct StatementLine* grown = realloc(lines, lineCapacity * sizeof(struct StatementLine));
+                if (grown == NULL) {
+                    ok = 0;
+                    break;
+                }
+                lines = grown;
+            }
+            struct StatementLine* line = &lines[run->lines++];
+            line->postedAt = posting->postedAt;
+            line->amountCents = change;
+            line->patientId = posting->patientId;
+            line->doctorId = posting->doctorId;
+            line->specialty = posting->specialty;
+            line->item = posting->item;
+            account->lineCount++;
+        }
+    }
+    free(batch);
+    fclose(in);
+
+    // Group the month's lines by patient, keeping ledger order within each
+    struct StatementLine* grouped = ok && run->lines > 0 ? malloc(run->lines * sizeof(struct StatementLine)) : NULL;
+    if (ok && run->lines > 0 && grouped == NULL) {
+        ok = 0;
+    }
+    if (ok) {
+        int next = 0;
+        for (int i = 0; i < accounts.capacity; i++) {
+            accounts.slots[i].firstLine = next;
+            next += accounts.slots[i].lineCount;
+        }
+        for (long long i = 0; i < run->lines; i++) {
+            struct PatientAccount* account = findAccount(&accounts, lines[i].patientId, 0);
+            grouped[account->firstLine++] = lines[i];
+        }
+        // Order the accounts by patient ID; firstLine was moved past each group, so step it back
+        int count = 0;
+        for (int i = 0; i < accounts.capacity; i++) {
+            if (accounts.slots[i].used) {
+                accounts.slots[count] = accounts.slots[i];
+                accounts.slots[count++].firstLine -= accounts.slots[i].lineCount;
+            }
+        }
+        qsort(accounts.slots, count, sizeof(struct PatientAccount), compareAccountIds);
+
+        FILE* out = fopen(outPath, "w");
+        char* buffer = malloc(STATEMENT_BUFFER_BYTES);
+        if (out == NULL) {
+            printf("Error opening %s for writing\n", outPath);
+            ok = 0;
+        } else {
+            if (buffer != NULL) {
+                setvbuf(out, buffer, _IOFBF, STATEMENT_BUFFER_BYTES);
+            }
+            for (int i = 0; i < count; i++) {
+                const struct PatientAccount* account = &accounts.slots[i];
+                long long closing = account->openingCents;
+                for (int n = 0; n < account->lineCount; n++) {
+                    closing += grouped[account->firstLine + n].amountCents;
+                }
+                run->closingCents += closing;
+                if (account->lineCount > 0 || closing != 0) {
+                    writeStatement(out, month, account, grouped + account->firstLine);
+                    run->statements++;
+                }
+            }
+            if (fclose(out) != 0) {
+                printf("Error writing %s\n", outPath);
+                ok = 0;
+            }
+        }
+        free(buffer);
+    } else {
+        printf("Error: Not enough memory for the statements\n");
+    }
+    free(grouped);
+    free(lines);
+    free(accounts.slots);
+    run->micros = monotonicMicros() - started;
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// Read views
+//
+// Screens that list a whole table read a published view of the site rather
+// than the live tables, so they run with the site let go and never hold up
+// intake. A view never changes once published: it points at copies of the
+// patient and doctor rows and holds a copy of the queue. Every change
+// publishes a new view that shares the rows that did not change and retires
+// the ones it replaced. Changes are noted as the site operations make them and
+// published together when the site is let go (unlockSite), so a reader sees
+// whole commands and a command that runs several operations publishes once.
+//
+// Retired memory is freed once no reader can still be looking at it. A
+// reader announces the epoch it started in; each publication moves the epoch
+// on and tags what it retired with the epoch it ended. A block is freed once
+// every announced epoch is later than its tag. Writers never wait for readers.
+//
+// Sites in shared memory have no views, because other processes cannot follow
+// this process's pointers; their screens read the live tables with the site held.
+// ---------------------------------------------------------------------------
+
+#define MAX_VIEW_READERS 64  // Reads in progress at once, across all sites
+#define VIEW_RECLAIM_BATCH 64  // Retired blocks to collect before trying to free them
+#define VIEW_PENDING_IDS 8  // Changed rows noted before the next publication compares them all
+
+struct SiteView {
+    const struct Patient* patients[MAX_PATIENTS];  // Same positions as site->patients, NULL where empty
+    int patientIds[MAX_PATIENTS];  // Id of each row, so lookups need not follow the pointers
+    const struct Doctor* doctors[MAX_DOCTORS];
+    int patientCount;
+    int doctorCount;
+    struct PriorityQueue waitingQueue;
+};
+
+struct RetiredBlock {
+    void* block;
+    long long epoch;
+};
+
+struct SiteViews {
+    struct SiteView* current;  // Replaced with __atomic_store_n; readers load it once they have announced
+    struct RetiredBlock* retired;
+    int retiredCount;
+    int retiredCapacity;
+    int reclaimAt;  // Retired count that triggers the next attempt to free
+    // Changes since the last publication
+    int changed;
+    int allRows;  // Too many rows to list, or the tables were reloaded
+    int patientIds[VIEW_PENDING_IDS];
+    int patientIdCount;
+    int doctorIds[VIEW_PENDING_IDS];
+    int doctorIdCount;
+};
+
+// One announcement per cache line, so readers on different cores do not contend
+struct ViewReaderSlot {
+    long long epoch;  // 0 while the slot is free
+    char padding[56];
+};
+
+long long viewEpoch = 1;
+struct ViewReaderSlot viewReaders[MAX_VIEW_READERS];
+
+// Position of a patient in a view, -1 if not there; probes as findPatientIndex does
+int findViewPatient(const struct SiteView* view, int patientId) {
+    int start = hash(patientId);
+    if (start < 0) start += MAX_PATIENTS;
+    int i = start;
+    for (int n = 0; n < MAX_PATIENTS; n++) {
+        if (view->patients[i] != NULL && view->patientIds[i] == patientId) {
+            return i;
+        }
+        if (++i == MAX_PATIENTS) i = 0;
+    }
+    return -1;
+}
+
+// Announce a read and take the site's current view; returns the slot to give endSiteRead
+int beginSiteRead(struct Hospital* site, const struct SiteView** view) {
+    while (1) {
+        for (int slot = 0; slot < MAX_VIEW_READERS; slot++) {
+            long long expected = 0;
+            long long epoch = __atomic_load_n(&viewEpoch, __ATOMIC_SEQ_CST);
+            if (__atomic_compare_exchange_n(&viewReaders[slot].epoch, &expected, epoch, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                *view = __atomic_load_n(&site->views->current, __ATOMIC_SEQ_CST);
+                return slot;
+            }
+        }
+        sched_yield();  // Every slot is in use; reads are short, so one frees up soon
+    }
+}
+
+void endSiteRead(int slot) {
+    __atomic_store_n(&viewReaders[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+// Free the retired blocks that no reader can still see
+void reclaimViewBlocks(struct SiteViews* views) {
+    long long oldest = LLONG_MAX;
+    for (int slot = 0; slot < MAX_VIEW_READERS; slot++) {
+        long long epoch = __atomic_load_n(&viewReaders[slot].epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    int kept = 0;
+    for (int i = 0; i < views->retiredCount; i++) {
+        if (views->retired[i].epoch < oldest) {
+            free(views->retired[i].block);
+        } else {
+            views->retired[kept++] = views->retired[i];
+        }
+    }
+    views->retiredCount = kept;
+    // A reader that stays a long time keeps blocks back; don't rescan them on every change
+    views->reclaimAt = kept * 2 > VIEW_RECLAIM_BATCH ? kept * 2 : VIEW_RECLAIM_BATCH;
+}
+
+// Compare the published view with the tables, for DASHBOARD_SELF_CHECK
+int verifySiteView(struct Hospital* site, int report) {
+    if (site->views == NULL) {
+        return 1;
+    }
+    const struct SiteView* view = site->views->current;
+    const char* mismatch = NULL;
+    if (view->patientCount != site->patientCount || view->doctorCount != site->doctorCount) {
+        mismatch = "counts";
+    } else if (memcmp(&view->waitingQueue, &site->waitingQueue, sizeof(struct PriorityQueue)) != 0) {
+        mismatch = "queue";
+    }
+    for (int i = 0; i < MAX_PATIENTS && !mismatch; i++) {
+        if (site->patients[i].occupied ? view->patients[i] == NULL ||
+                                         memcmp(view->patients[i], &site->patients[i], sizeof(struct Patient)) != 0 ||
+                                         view->patientIds[i] != site->patients[i].id
+                                       : view->patients[i] != NULL) {
+            mismatch = "patients";
+        }
+    }
+    for (int i = 0; i < site->doctorCount && !mismatch; i++) {
+        if (view->doctors[i] == NULL || memcmp(view->doctors[i], &site->doctors[i], sizeof(struct Doctor)) != 0) {
+            mismatch = "doctors";
+        }
+    }
+    if (mismatch && report) {
+        printf("Read view %s out of step with the tables at site %s\n", mismatch, site->siteName);
+    }
+    return mismatch == NULL;
+}
+
+// Note a change made by a site operation, for the next publication
+void noteViewChange(struct Hospital* site, int patientId, int doctorId) {
+    struct SiteViews* views = site->views;
+    if (views == NULL) {
+        return;
+    }
+    views->changed = 1;
+    if (views->allRows) {
+        return;
+    }
+    // One command usually touches the same patient several times; list each id once
+    int listed = 0;
+    for (int n = 0; n < views->patientIdCount && !listed; n++) {
+        listed = views->patientIds[n] == patientId;
+    }
+    if (!listed) {
+        if (views->patientIdCount == VIEW_PENDING_IDS) {
+            views->allRows = 1;
+            return;
+        }
+        views->patientIds[views->patientIdCount++] = patientId;
+    }
+    listed = doctorId == 0;
+    for (int n = 0; n < views->doctorIdCount && !listed; n++) {
+        listed = views->doctorIds[n] == doctorId;
+    }
+    if (!listed) {
+        if (views->doctorIdCount == VIEW_PENDING_IDS) {
+            views->allRows = 1;
+            return;
+        }
+        views->doctorIds[views->doctorIdCount++] = doctorId;
+    }
+}
+
+// The tables were replaced wholesale (a snapshot was loaded)
+void noteViewReload(struct Hospital* site) {
+    if (site->views != NULL) {
+        site->views->changed = 1;
+        site->views->allRows = 1;
+    }
+}
+
+// Publish the changes noted since the last view. Only the noted rows are
+// compared with the previous view, unless every row has to be (allRows) or a
+// doctor was added or removed. Called with the site held, as it is let go.
+void publishSiteView(struct Hospital* site) {
+    struct SiteViews* views = site->views;
+    if (views == NULL || !views->changed) {
+        return;
+    }
+    struct SiteView* next = malloc(sizeof(struct SiteView));
+    void* replaced[MAX_PATIENTS + MAX_DOCTORS + 1];
+    int replacedCount = 0;
+    if (views->current != NULL) {
+        memcpy(next, views->current, sizeof(*next));
+        replaced[replacedCount++] = views->current;
+    } else {
+        memset(next, 0, sizeof(*next));
+    }
+
+    char comparePatient[MAX_PATIENTS];
+    memset(comparePatient, views->allRows, sizeof(comparePatient));
+    // The index columns hold the live ids side by side, cheaper to scan than the rows
+    const struct PatientColumns* columns = &site->index.columns;
+    for (int n = 0; n < views->patientIdCount && !views->allRows; n++) {
+        int id = views->patientIds[n];
+        for (int i = 0; i < MAX_PATIENTS; i++) {
+            if ((columns->occupied[i] && columns->id[i] == id) || (next->patients[i] != NULL && next->patientIds[i] == id)) {
+                comparePatient[i] = 1;
+            }
+        }
+    }
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        if (!comparePatient[i]) {
+            continue;
+        }
+        const struct Patient* old = next->patients[i];
+        if (!site->patients[i].occupied) {
+            next->patients[i] = NULL;
+        } else if (old == NULL || memcmp(old, &site->patients[i], sizeof(struct Patient)) != 0) {
+            struct Patient* copy = malloc(sizeof(struct Patient));
+            memcpy(copy, &site->patients[i], sizeof(struct Patient));
+            next->patients[i] = copy;
+        }
+        next->patientIds[i] = next->patients[i] != NULL ? next->patients[i]->id : 0;
+        if (old != NULL && old != next->patients[i]) {
+            replaced[replacedCount++] = (void*)old;
+        }
+    }
+    // Adding or removing a doctor shifts the rows about, so all of them are compared
+    int allDoctors = views->allRows || next->doctorCount != site->doctorCount;
+    for (int i = 0; i < MAX_DOCTORS; i++) {
+        int compare = allDoctors;
+        for (int n = 0; n < views->doctorIdCount && !compare && i < site->doctorCount; n++) {
+            compare = site->doctors[i].id == views->doctorIds[n];
+        }
+        if (!compare) {
+            continue;
+        }
+        const struct Doctor* old = next->doctors[i];
+        if (i >= site->doctorCount) {
+            next->doctors[i] = NULL;
+        } else if (old == NULL || memcmp(old, &site->doctors[i], sizeof(struct Doctor)) != 0) {
+            struct Doctor* copy = malloc(sizeof(struct Doctor));
+            memcpy(copy, &site->doctors[i], sizeof(struct Doctor));
+            next->doctors[i] = copy;
+        }
+        if (old != NULL && old != next->doctors[i]) {
+            replaced[replacedCount++] = (void*)old;
+        }
+    }
+    next->patientCount = site->patientCount;
+    next->doctorCount = site->doctorCount;
+    memcpy(&next->waitingQueue, &site->waitingQueue, sizeof(struct PriorityQueue));
+
+    __atomic_store_n(&views->current, next, __ATOMIC_SEQ_CST);
+    long long epoch = __atomic_fetch_add(&viewEpoch, 1, __ATOMIC_SEQ_CST);  // Readers from here on see `next`
+    if (views->retiredCount + replacedCount > views->retiredCapacity) {
+        views->retiredCapacity = (views->retiredCount + replacedCount) * 2;
+        views->retired = realloc(views->retired, views->retiredCapacity * sizeof(struct RetiredBlock));
+    }
+    for (int i = 0; i < replacedCount; i++) {
+        views->retired[views->retiredCount].block = replaced[i];
+        views->retired[views->retiredCount++].epoch = epoch;
+    }
+    if (views->retiredCount >= views->reclaimAt) {
+        reclaimViewBlocks(views);
+    }
+    views->changed = 0;
+    views->allRows = 0;
+    views->patientIdCount = 0;
+    views->doctorIdCount = 0;
+#ifdef DASHBOARD_SELF_CHECK
+    if (!verifySiteView(site, 1)) abort();
+#endif
+}
+
+void enableSiteViews(struct Hospital* site) {
+    site->views = calloc(1, sizeof(struct SiteViews));
+    site->views->reclaimAt = VIEW_RECLAIM_BATCH;
+    noteViewReload(site);
+    publishSiteView(site);
+}
+
+// Free the views when the site is shut down; nobody may be reading
+void freeSiteViews(struct Hospital* site) {
+    struct SiteViews* views = site->views;
+    if (views == NULL) {
+        return;
+    }
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        free((void*)views->current->patients[i]);
+    }
+    for (int i = 0; i < MAX_DOCTORS; i++) {
+        free((void*)views->current->doctors[i]);
+    }
+    free(views->current);
+    for (int i = 0; i < views->retiredCount; i++) {
+        free(views->retired[i].block);
+    }
+    free(views->retired);
+    free(views);
+    site->views = NULL;
+}
+
+// A view of the live tables for sites without published views; only good while the site is held
+void viewLiveTables(struct Hospital* site, struct SiteView* view) {
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        view->patients[i] = site->patients[i].occupied ? &site->patients[i] : NULL;
+        view->patientIds[i] = site->patients[i].occupied ? site->patients[i].id : 0;
+    }
+    for (int i = 0; i < MAX_DOCTORS; i++) {
+        view->doctors[i] = i < site->doctorCount ? &site->doctors[i] : NULL;
+    }
+    view->patientCount = site->patientCount;
+    view->doctorCount = site->doctorCount;
+    view->waitingQueue = site->waitingQueue;
+}
+
+// Hand a change made by one of the site operations to the replication
+// journal, the change feed and the operation trace, whichever are running,
+// and note it for the read views
+void recordChange(struct Hospital* site, int type, int patientId, int doctorId, int slot, const void* payload, int length) {
+    noteViewChange(site, patientId, doctorId);
+    if (site->feed != NULL) {
+        feedAppend(site->feed, site->siteNumber, type, patientId, doctorId, slot, payload);
+    }
+    journalAppend(site, type, patientId, doctorId, slot, payload, length);
+    traceAppend(site, type, patientId, doctorId, slot, payload, length);
+}
+
+// ---------------------------------------------------------------------------
+// Site operations
+//
+// Every change to a site's tables goes through these functions so that the
+// derived state kept next to the tables (the dashboard counters and the
+// patient indexes) is updated in the same step, and the change is recorded
+// for the replication journal and the change feed.
+// ---------------------------------------------------------------------------
+
+#ifdef DASHBOARD_SELF_CHECK
+#define CHECK_SITE(site) do { if (!verifyDashboardCounters(site, 1) || !verifyPatientIndex(site, 1)) abort(); } while (0)
+#else
+#define CHECK_SITE(site) do { } while (0)
+#endif
+
+int queueLength(struct PriorityQueue* q) {
+    return isPriorityQueueEmpty(q) ? 0 : q->rear - q->front + 1;
+}
+
+// Remove one patient from anywhere in the queue, returns 1 if they were queued.
+// The entries on the shorter side of the gap are moved to close it, so the
+// ones ahead of it move back a place when it is nearer the front.
+int removeFromPriorityQueue(struct PriorityQueue* q, int patientId) {
+    if (isPriorityQueueEmpty(q)) {
+        return 0;
+    }
+    for (int i = q->front; i <= q->rear; i++) {
+        if (q->items[i].patientId == patientId) {
+            if (i - q->front < q->rear - i) {
+                memmove(&q->items[q->front + 1], &q->items[q->front], (i - q->front) * sizeof(q->items[0]));
+                q->front++;
+            } else {
+                memmove(&q->items[i], &q->items[i + 1], (q->rear - i) * sizeof(q->items[0]));
+                q->rear--;
+            }
+            if (q->rear < q->front) {
+                q->front = q->rear = -1;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Specialty a patient asked for at intake, otherwise the one suggested by their disease
+const char* requestedSpecialty(const struct Patient* patient) {
+    if (specialtyIndex(patient->requestedSpecialty) != -1) {
+        return patient->requestedSpecialty;
+    }
+    return suggestSpecialty(patient->disease);
+}
+
+// Counter bucket for a specialty; names outside the list share one bucket
+int specialtyBucket(const char* specialty) {
+    int index = specialtyIndex(specialty);
+    return index == -1 ? OTHER_SPECIALTY : index;
+}
+
+// Add (delta 1) or take out (delta -1) one doctor's contribution to the counters
+void countDoctor(struct DashboardCounters* counters, const struct Doctor* doctor, int delta) {
+    int bucket = specialtyBucket(doctor->specialty);
+    if (isDoctorBusy(doctor)) {
+        counters->busyDoctorsBySpecialty[bucket] += delta;
+    } else {
+        counters->freeDoctorsBySpecialty[bucket] += delta;
+    }
+    counters->freeSlotsBySpecialty[bucket] += delta * freeSlotCount(doctor);
+    counters->activeConsultations += delta * occupiedSlotCount(doctor);
+}
+
+void countQueued(struct DashboardCounters* counters, struct Hospital* site, int patientId, int priority, int delta) {
+    int index = findPatientIndex(site->patients, patientId);
+    int bucket = index == -1 ? OTHER_SPECIALTY : specialtyBucket(requestedSpecialty(&site->patients[index]));
+    counters->queuedByPriority[priority ? 1 : 0] += delta;
+    counters->queuedBySpecialty[bucket] += delta;
+}
+
+void countAdmission(struct DashboardCounters* counters, time_t when) {
+    long long hour = (long long)when / 3600;
+    int bucket = (int)(hour % 24);
+    if (counters->admissionsHourStamp[bucket] != hour) {
+        counters->admissionsHourStamp[bucket] = hour;
+        counters->admissionsByHour[bucket] = 0;
+    }
+    counters->admissionsByHour[bucket]++;
+}
+
+// Admissions during the hour `hoursAgo` hours before now (0-23)
+int admissionsInHour(const struct DashboardCounters* counters, int hoursAgo) {
+    long long hour = (long long)time(NULL) / 3600 - hoursAgo;
+    int bucket = (int)(hour % 24);
+    return counters->admissionsHourStamp[bucket] == hour ? counters->admissionsByHour[bucket] : 0;
+}
+
+// Derive every counter from the tables, except the admission history which only
+// exists as counters
+void computeDashboardCounters(struct Hospital* site, struct DashboardCounters* counters) {
+    struct DashboardCounters fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    memcpy(fresh.admissionsByHour, counters->admissionsByHour, sizeof(fresh.admissionsByHour));
+    memcpy(fresh.admissionsHourStamp, counters->admissionsHourStamp, sizeof(fresh.admissionsHourStamp));
+    for (int i = 0; i < site->doctorCount; i++) {
+        countDoctor(&fresh, &site->doctors[i], 1);
+    }
+    struct PriorityQueue* q = &site->waitingQueue;
+    if (!isPriorityQueueEmpty(q)) {
+        for (int i = q->front; i <= q->rear; i++) {
+            countQueued(&fresh, site, q->items[i].patientId, q->items[i].priority, 1);
+        }
+    }
+    *counters = fresh;
+}
+
+void rebuildDashboardCounters(struct Hospital* site) {
+    computeDashboardCounters(site, &site->counters);
+}
+
+// Compare the maintained counters with a full recompute, returns 1 if they agree
+int verifyDashboardCounters(struct Hospital* site, int report) {
+    struct DashboardCounters expected = site->counters;
+    computeDashboardCounters(site, &expected);
+    if (memcmp(&expected, &site->counters, sizeof(expected)) == 0) {
+        return 1;
+    }
+    if (report) {
+        printf("Dashboard counters out of step with the tables at site %s\n", site->siteName);
+        for (int s = 0; s <= SPECIALTY_COUNT; s++) {
+            if (expected.queuedBySpecialty[s] != site->counters.queuedBySpecialty[s] ||
+                expected.freeDoctorsBySpecialty[s] != site->counters.freeDoctorsBySpecialty[s] ||
+                expected.busyDoctorsBySpecialty[s] != site->counters.busyDoctorsBySpecialty[s] ||
+                expected.freeSlotsBySpecialty[s] != site->counters.freeSlotsBySpecialty[s]) {
+                printf("  %s: queued %d/%d free %d/%d busy %d/%d slots %d/%d (kept/actual)\n",
+                       s == OTHER_SPECIALTY ? "Other" : specialties[s],
+                       site->counters.queuedBySpecialty[s], expected.queuedBySpecialty[s],
+                       site->counters.freeDoctorsBySpecialty[s], expected.freeDoctorsBySpecialty[s],
+                       site->counters.busyDoctorsBySpecialty[s], expected.busyDoctorsBySpecialty[s],
+                       site->counters.freeSlotsBySpecialty[s], expected.freeSlotsBySpecialty[s]);
+            }
+        }
+    }
+    return 0;
+}
+
+int findDoctorIndex(struct Hospital* site, int doctorId) {
+    for (int i = 0; i < site->doctorCount; i++) {
+        if (site->doctors[i].id == doctorId) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Rows a bitmap can hold are 0..MAX_PATIENTS-1, the slots of the patient table
+void addRow(struct RowBitmap* rows, int row) {
+    unsigned long long bit = 1ull << (row & 63);
+    if (!(rows->words[row >> 6] & bit)) {
+        rows->words[row >> 6] |= bit;
+        rows->count++;
+    }
+}
+
+void removeRow(struct RowBitmap* rows, int row) {
+    unsigned long long bit = 1ull << (row & 63);
+    if (rows->words[row >> 6] & bit) {
+        rows->words[row >> 6] &= ~bit;
+        rows->count--;
+    }
+}
+
+int hasRow(const struct RowBitmap* rows, int row) {
+    return (rows->words[row >> 6] >> (row & 63)) & 1;
+}
+
+// Combine two bitmaps in place: op 0 keeps the rows in both, 1 adds the rows of
+// `with`, 2 drops the rows of `with`
+void combineRows(struct RowBitmap* into, const struct RowBitmap* with, int op) {
+    int count = 0;
+    for (int w = 0; w < INDEX_WORDS; w++) {
+        if (op == 0) {
+            into->words[w] &= with->words[w];
+        } else if (op == 1) {
+            into->words[w] |= with->words[w];
+        } else {
+            into->words[w] &= ~with->words[w];
+        }
+        count += countSetBits64(into->words[w]);
+    }
+    into->count = count;
+}
+
+// First row at or after `from`, -1 if there is none
+int nextRow(const struct RowBitmap* rows, int from) {
+    for (int w = from >> 6; w < INDEX_WORDS && from < MAX_PATIENTS; w++) {
+        unsigned long long bits = rows->words[w];
+        if (w == from >> 6) {
+            bits &= ~0ull << (from & 63);
+        }
+        if (bits) {
+            int row = w * 64 + lowestSetBit64(bits);
+            return row < MAX_PATIENTS ? row : -1;
+        }
+    }
+    return -1;
+}
+
+// Rows whose value in `column` lies in [low, high], skipping empty rows.
+// Compares 8 rows per step with AVX2 (4 per instruction with SSE2), so a
+// full-table scan is limited by how fast the column can be read.
+void scanColumnRange(const struct PatientColumns* columns, const int* column, int low, int high, struct RowBitmap* out) {
+    memset(out, 0, sizeof(*out));
+#if defined(__AVX2__)
+    __m256i lowBound = _mm256_set1_epi32(low);
+    __m256i highBound = _mm256_set1_epi32(high);
+    __m256i zero = _mm256_setzero_si256();
+#elif defined(__SSE2__)
+    __m128i lowBound = _mm_set1_epi32(low);
+    __m128i highBound = _mm_set1_epi32(high);
+    __m128i zero = _mm_setzero_si128();
+#endif
+    for (int row = 0; row < COLUMN_ROWS; row += 8) {
+        unsigned int match = 0;
+#if defined(__AVX2__)
+        __m256i values = _mm256_loadu_si256((const __m256i*)(column + row));
+        __m256i empty = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(columns->occupied + row)), zero);
+        __m256i reject = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(lowBound, values),
+                                                         _mm256_cmpgt_epi32(values, highBound)), empty);
+        match = ~(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(reject)) & 0xFFu;
+#elif defined(__SSE2__)
+        for (int half = 0; half < 8; half += 4) {
+            __m128i values = _mm_loadu_si128((const __m128i*)(column + row + half));
+            __m128i empty = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(columns->occupied + row + half)), zero);
+            __m128i reject = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(lowBound, values),
+                                                       _mm_cmpgt_epi32(values, highBound)), empty);
+            match |= (~(unsigned int)_mm_movemask_ps(_mm_castsi128_ps(reject)) & 0xFu) << half;
+        }
+#else
+        for (int lane = 0; lane < 8; lane++) {
+            int value = column[row + lane];
+            if (columns->occupied[row + lane] && value >= low && value <= high) {
+                match |= 1u << lane;
+            }
+        }
+#endif
+        out->words[row >> 6] |= (unsigned long long)match << (row & 63);
+    }
+    for (int w = 0; w < INDEX_WORDS; w++) {
+        out->count += countSetBits64(out->words[w]);
+    }
+}
+
+// All patients assigned to a doctor
+void patientsOfDoctor(const struct PatientIndex* index, int doctorId, struct RowBitmap* out) {
+    scanColumnRange(&index->columns, index->columns.assignedDoctorId, doctorId, doctorId, out);
+}
+
+// Split free text into lower-case words; returns the number of characters
+// consumed, 0 at the end of the text
+int nextWord(const char* text, char word[MAX_NAME_LEN]) {
+    int i = 0;
+    while (text[i] && !isalnum((unsigned char)text[i])) {
+        i++;
+    }
+    int length = 0;
+    while (text[i] && isalnum((unsigned char)text[i])) {
+        if (length < MAX_NAME_LEN - 1) {
+            word[length++] = (char)tolower((unsigned char)text[i]);
+        }
+        i++;
+    }
+    word[length] = '\0';
+    return length > 0 ? i : 0;
+}
+
+int wordBucket(const char* word) {
+    unsigned int h = 5381;
+    while (*word) {
+        h = h * 33 + (unsigned char)*word++;
+    }
+    return (int)(h % DISEASE_TOKEN_BUCKETS);
+}
+
+// Soundex code of a lower-case word, e.g. "gupta" -> "g130", so that names
+// that sound alike ("Ishaan", "Ishan") land in the same block
+void soundexCode(const char* word, char code[5]) {
+    static const char letterCodes[] = "01230120022455012623010202";  // a..z
+    int length = 0;
+    char previous = 0;
+    for (int i = 0; word[i] && length < 4; i++) {
+        char c = word[i];
+        if (c < 'a' || c > 'z') {
+            continue;
+        }
+        char digit = letterCodes[c - 'a'];
+        if (length == 0) {
+            code[length++] = c;
+        } else if (digit != '0' && digit != previous) {
+            code[length++] = digit;
+        }
+        if (c != 'h' && c != 'w') {
+            previous = digit;
+        }
+    }
+    if (length == 0) {
+        code[length++] = word[0] ? word[0] : '0';  // All digits
+    }
+    while (length < 4) {
+        code[length++] = '0';
+    }
+    code[4] = '\0';
+}
+
+int nameSoundBucket(const char* word) {
+    char code[5];
+    soundexCode(word, code);
+    unsigned int h = 5381;
+    for (int i = 0; i < 4; i++) {
+        h = h * 33 + (unsigned char)code[i];
+    }
+    return (int)(h % NAME_SOUND_BUCKETS);
+}
+
+// Whether `word` (lower case) is one of the words of `text`
+int textHasWord(const char* text, const char* word) {
+    char current[MAX_NAME_LEN];
+    int used;
+    while ((used = nextWord(text, current)) > 0) {
+        if (strcmp(current, word) == 0) {
+            return 1;
+        }
+        text += used;
+    }
+    return 0;
+}
+
+// Put a patient row into every index it belongs to
+void indexPatient(struct PatientIndex* index, const struct Patient* patient, int row) {
+    addRow(&index->live, row);
+    if (patient->isEmergency) {
+        addRow(&index->emergency, row);
+    }
+    if (index->queueEntries[row] > 0) {
+        addRow(&index->queued, row);
+    }
+    addRow(&index->needsSpecialty[specialtyBucket(requestedSpecialty(patient))], row);
+
+    char word[MAX_NAME_LEN];
+    const char* text = patient->disease;
+    int used;
+    while ((used = nextWord(text, word)) > 0) {
+        addRow(&index->diseaseToken[wordBucket(word)], row);
+        text += used;
+    }
+    text = patient->name;
+    while ((used = nextWord(text, word)) > 0) {
+        addRow(&index->nameSound[nameSoundBucket(word)], row);
+        text += used;
+    }
+
+    struct PatientColumns* columns = &index->columns;
+    columns->id[row] = patient->id;
+    columns->occupied[row] = 1;
+    columns->age[row] = patient->age;
+    columns->isEmergency[row] = patient->isEmergency;
+    columns->assignedDoctorId[row] = patient->assignedDoctorId;
+}
+
+// Take a patient row out of every index. Clears the row everywhere rather than
+// trusting the record, so it is safe even if the record changed since indexing.
+void unindexPatient(struct PatientIndex* index, int row) {
+    removeRow(&index->live, row);
+    removeRow(&index->emergency, row);
+    removeRow(&index->queued, row);
+    for (int s = 0; s <= SPECIALTY_COUNT; s++) {
+        removeRow(&index->needsSpecialty[s], row);
+    }
+    for (int b = 0; b < DISEASE_TOKEN_BUCKETS; b++) {
+        removeRow(&index->diseaseToken[b], row);
+    }
+    for (int b = 0; b < NAME_SOUND_BUCKETS; b++) {
+        removeRow(&index->nameSound[b], row);
+    }
+    struct PatientColumns* columns = &index->columns;
+    columns->id[row] = 0;
+    columns->occupied[row] = 0;
+    columns->age[row] = 0;
+    columns->isEmergency[row] = 0;
+    columns->assignedDoctorId[row] = 0;
+}
+
+void setQueued(struct PatientIndex* index, int row, int delta) {
+    index->queueEntries[row] += delta;
+    if (index->queueEntries[row] > 0) {
+        addRow(&index->queued, row);
+    } else {
+        removeRow(&index->queued, row);
+    }
+}
+
+void computePatientIndex(struct Hospital* site, struct PatientIndex* index) {
+    memset(index, 0, sizeof(*index));
+    struct PriorityQueue* q = &site->waitingQueue;
+    if (!isPriorityQueueEmpty(q)) {
+        for (int i = q->front; i <= q->rear; i++) {
+            int row = findPatientIndex(site->patients, q->items[i].patientId);
+            if (row != -1) {
+                index->queueEntries[row]++;
+            }
+        }
+    }
+    for (int row = 0; row < MAX_PATIENTS; row++) {
+        if (site->patients[row].occupied) {
+            indexPatient(index, &site->patients[row], row);
+        }
+    }
+}
+
+void rebuildPatientIndex(struct Hospital* site) {
+    computePatientIndex(site, &site->index);
+}
+
+int sameRows(const struct RowBitmap* a, const struct RowBitmap* b) {
+    return a->count == b->count && memcmp(a->words, b->words, sizeof(a->words)) == 0;
+}
+
+// Compare the maintained indexes with a rebuild, returns 1 if they agree
+int verifyPatientIndex(struct Hospital* site, int report) {
+    struct PatientIndex expected;
+    struct PatientIndex* kept = &site->index;
+    computePatientIndex(site, &expected);
+
+    const char* mismatch = NULL;
+    if (!sameRows(&expected.live, &kept->live)) mismatch = "live";
+    else if (!sameRows(&expected.emergency, &kept->emergency)) mismatch = "emergency";
+    else if (!sameRows(&expected.queued, &kept->queued)) mismatch = "queued";
+    else if (memcmp(expected.queueEntries, kept->queueEntries, sizeof(expected.queueEntries)) != 0) mismatch = "queue entries";
+    else if (memcmp(&expected.columns, &kept->columns, sizeof(expected.columns)) != 0) mismatch = "column";
+    for (int s = 0; s <= SPECIALTY_COUNT && !mismatch; s++) {
+        if (!sameRows(&expected.needsSpecialty[s], &kept->needsSpecialty[s])) mismatch = "specialty";
+    }
+    for (int b = 0; b < DISEASE_TOKEN_BUCKETS && !mismatch; b++) {
+        if (!sameRows(&expected.diseaseToken[b], &kept->diseaseToken[b])) mismatch = "disease";
+    }
+    for (int b = 0; b < NAME_SOUND_BUCKETS && !mismatch; b++) {
+        if (!sameRows(&expected.nameSound[b], &kept->nameSound[b])) mismatch = "name";
+    }
+
+    if (mismatch && report) {
+        printf("Patient %s index out of step with the table at site %s\n", mismatch, site->siteName);
+    }
+    return mismatch == NULL;
+}
+
+// Store a new patient record, returns its index or -1 if the site is full
+int hospitalAdmitPatient(struct Hospital* site, const struct Patient* record) {
+    int index = insertPatient(site->patients, &site->patientCount, record);
+    if (index != -1) {
+        countAdmission(&site->counters, time(NULL));
+        indexPatient(&site->index, &site->patients[index], index);
+        recordChange(site, JOURNAL_ADMIT, record->id, 0, 0, &site->patients[index], sizeof(struct Patient));
+    }
+    CHECK_SITE(site);
+    return index;
+}
+
+int hospitalEnqueue(struct Hospital* site, int patientId) {
+    int index = findPatientIndex(site->patients, patientId);
+    if (index == -1 || queueLength(&site->waitingQueue) >= MAX_PATIENTS) {
+        return 0;
+    }
+    int priority = site->patients[index].isEmergency ? 1 : 0;
+    enqueuePriority(&site->waitingQueue, patientId, priority);
+    countQueued(&site->counters, site, patientId, priority, 1);
+    setQueued(&site->index, index, 1);
+    recordChange(site, JOURNAL_ENQUEUE, patientId, 0, 0, NULL, 0);
+    CHECK_SITE(site);
+    return 1;
+}
+
+// Queue a patient ahead of the others of their priority
+int hospitalRequeueFront(struct Hospital* site, int patientId) {
+    int index = findPatientIndex(site->patients, patientId);
+    if (index == -1 || queueLength(&site->waitingQueue) >= MAX_PATIENTS) {
+        return 0;
+    }
+    int priority = site->patients[index].isEmergency ? 1 : 0;
+    enqueueFront(&site->waitingQueue, patientId, priority);
+    countQueued(&site->counters, site, patientId, priority, 1);
+    setQueued(&site->index, index, 1);
+    recordChange(site, JOURNAL_REQUEUE, patientId, 0, 0, NULL, 0);
+    CHECK_SITE(site);
+    return 1;
+}
+
+// Take the highest-priority patient off the queue, -1 if it is empty
+int hospitalDequeue(struct Hospital* site) {
+    if (isPriorityQueueEmpty(&site->waitingQueue)) {
+        return -1;
+    }
+    int priority = site->waitingQueue.items[site->waitingQueue.front].priority;
+    int patientId = dequeuePriority(&site->waitingQueue);
+    countQueued(&site->counters, site, patientId, priority, -1);
+    int row = findPatientIndex(site->patients, patientId);
+    if (row != -1) {
+        setQueued(&site->index, row, -1);
+    }
+    recordChange(site, JOURNAL_DEQUEUE, patientId, 0, 0, NULL, 0);
+    CHECK_SITE(site);
+    return patientId;
+}
+
+int hospitalWithdrawFromQueue(struct Hospital* site, int patientId) {
+    struct PriorityQueue* q = &site->waitingQueue;
+    int priority = 0;
+    if (!isPriorityQueueEmpty(q)) {
+        for (int i = q->front; i <= q->rear; i++) {
+            if (q->items[i].patientId == patientId) {
+                priority = q->items[i].priority;
+                break;
+            }
+        }
+    }
+    if (!removeFromPriorityQueue(q, patientId)) {
+        return 0;
+    }
+    countQueued(&site->counters, site, patientId, priority, -1);
+    int row = findPatientIndex(site->patients, patientId);
+    if (row != -1) {
+        setQueued(&site->index, row, -1);
+    }
+    recordChange(site, JOURNAL_WITHDRAW, patientId, 0, 0, NULL, 0);
+    CHECK_SITE(site);
+    return 1;
+}
+
+// Assign a patient to a doctor, returns the slot taken or an ASSIGN_* code
+int hospitalAssign(struct Hospital* site, int patientId, int doctorId) {
+    int doctorIndex = findDoctorIndex(site, doctorId);
+    if (doctorIndex == -1) {
+        return ASSIGN_DOCTOR_NOT_FOUND;
+    }
+    struct Doctor* doctor = &site->doctors[doctorIndex];
+    int row = findPatientIndex(site->patients, patientId);
+    countDoctor(&site->counters, doctor, -1);
+    if (row != -1) {
+        unindexPatient(&site->index, row);
+    }
+    int result = assignPatientToDoctor(site->patients, site->doctors, patientId, doctorId, site->doctorCount);
+    countDoctor(&site->counters, doctor, 1);
+    if (row != -1) {
+        indexPatient(&site->index, &site->patients[row], row);
+    }
+    if (result >= 0) {
+        recordChange(site, JOURNAL_ASSIGN, patientId, doctorId, result, NULL, 0);
+    }
+    CHECK_SITE(site);
+    return result;
+}
+
+// Free one of a doctor's slots, returns the patient who held it or -1
+int hospitalReleaseSlot(struct Hospital* site, int doctorIndex, int slot) {
+    struct Doctor* doctor = &site->doctors[doctorIndex];
+    if (slot < 0 || slot >= doctor->capacity || (doctor->freeSlots & (1u << slot))) {
+        return -1;
+    }
+    int patientId = doctor->slotPatientId[slot];
+    countDoctor(&site->counters, doctor, -1);
+    releaseDoctorSlot(doctor, slot);
+    countDoctor(&site->counters, doctor, 1);
+    recordChange(site, JOURNAL_RELEASE_SLOT, patientId, doctor->id, slot, NULL, 0);
+    CHECK_SITE(site);
+    return patientId;
+}
+
+// Remove a patient record, along with their queue entry and any slot they hold.
+// The withdrawals and slot release are journaled first, so a replica replaying
+// the discharge finds nothing left to undo.
+int hospitalDischargePatient(struct Hospital* site, int patientId) {
+    int index = findPatientIndex(site->patients, patientId);
+    if (index == -1) {
+        return 0;
+    }
+    while (hospitalWithdrawFromQueue(site, patientId)) {
+        // A patient can have been queued more than once
+    }
+    int doctorIndex = findDoctorIndex(site, site->patients[index].assignedDoctorId);
+    if (doctorIndex != -1) {
+        hospitalReleaseSlot(site, doctorIndex, findPatientSlot(&site->doctors[doctorIndex], patientId));
+    }
+    unindexPatient(&site->index, index);
+    site->patients[index].occupied = 0;
+    site->patientCount--;
+    if (site->archive != NULL) {
+        archivePut(site->archive, ARCHIVE_PATIENTS, patientId, &site->patients[index]);  // Keep their history
+    }
+    recordChange(site, JOURNAL_DISCHARGE, patientId, 0, 0, NULL, 0);
+    CHECK_SITE(site);
+    return 1;
+}
+
+int hospitalAddDoctor(struct Hospital* site, const struct Doctor* doctor) {
+    if (site->doctorCount >= MAX_DOCTORS) {
+        return 0;
+    }
+    site->doctors[site->doctorCount++] = *doctor;
+    countDoctor(&site->counters, doctor, 1);
+    recordChange(site, JOURNAL_ADD_DOCTOR, 0, doctor->id, 0, doctor, sizeof(struct Doctor));
+    CHECK_SITE(site);
+    return 1;
+}
+
+int hospitalRemoveDoctor(struct Hospital* site, int doctorId) {
+    int doctorIndex = findDoctorIndex(site, doctorId);
+    if (doctorIndex == -1) {
+        return 0;
+    }
+    countDoctor(&site->counters, &site->doctors[doctorIndex], -1);
+    // Shift remaining doctors to fill the gap
+    for (int j = doctorIndex; j < site->doctorCount - 1; j++) {
+        site->doctors[j] = site->doctors[j + 1];
+    }
+    site->doctorCount--;
+    recordChange(site, JOURNAL_REMOVE_DOCTOR, 0, doctorId, 0, NULL, 0);
+    CHECK_SITE(site);
+    return 1;
+}
+
+// End a patient's consultation with `doctorId`, whose slot has just been
+// released. The notes go on the patient's latest visit while their history
+// has room for it. A completed visit is billed either way; a visit that stops
+// early (suspended for an emergency) is billed when it completes.
+int hospitalRecordVisitNotes(struct Hospital* site, int patientId, int doctorId, const char* notes, int completed) {
+    int row = findPatientIndex(site->patients, patientId);
+    if (row == -1) {
+        return 0;
+    }
+    struct Patient* patient = &site->patients[row];
+    char kept[MAX_NAME_LEN];
+    memset(kept, 0, sizeof(kept));
+    snprintf(kept, MAX_NAME_LEN, "%s", notes);
+    long long visitTime = (long long)time(NULL);  // When the visit is past the history, it is billed as of now
+    if (patient->visitCount >= 1 && patient->visitCount <= MAX_VISIT_HISTORY) {
+        struct VisitRecord* visit = &patient->visitHistory[patient->visitCount - 1];
+        memcpy(visit->notes, kept, MAX_NAME_LEN);
+        if (visit->doctorId == doctorId) {
+            visitTime = visit->visitTime;
+        }
+    }
+    recordChange(site, JOURNAL_VISIT_NOTES, patientId, doctorId, completed, kept, MAX_NAME_LEN);
+    if (completed && site->ledger != NULL) {
+        int doctorIndex = findDoctorIndex(site, doctorId);
+        int specialty = doctorIndex != -1 ? specialtyBucket(site->doctors[doctorIndex].specialty) : OTHER_SPECIALTY;
+        postVisitCharges(site->ledger, (long long)time(NULL), patientId, doctorId, specialty,
+                         patient->isEmergency, visitTime);
+    }
+    CHECK_SITE(site);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Emergency fast lane
+//
+// An emergency that joins the queue is dispatched straight away. A doctor of
+// the requested specialty with a free slot takes it, then one from the
+// fallback specialty. If every such slot is taken, the regular case that
+// started most recently (the one with the least consultation to lose) is
+// suspended and put back at the head of the regular queue, and the emergency
+// takes its slot in the same operation. Only a site full of emergencies, or a
+// queue with no room for the suspended case, leaves the patient waiting in the
+// queue. A patient who already holds a slot keeps it and is not dispatched.
+// ---------------------------------------------------------------------------
+
+#define FALLBACK_SPECIALTY "General Medicine"  // Can stabilise any emergency
+
+#define DISPATCH_QUEUED 0  // Left in the queue: every matching slot holds an emergency
+#define DISPATCH_FREE_SLOT 1
+#define DISPATCH_PREEMPTED 2
+
+struct EmergencyDispatch {
+    int outcome;
+    int doctorId;
+    int slot;
+    int suspendedPatientId;  // Regular case put back in the queue, -1 if none
+    long long micros;  // From enqueue to assignment
+};
+
+// On-shift doctor of a specialty with a free slot, the one with most free slots; -1 if none
+int findFreeDoctor(struct Hospital* site, const char* specialty, int minuteOfDay) {
+    int best = -1;
+    for (int i = 0; i < site->doctorCount; i++) {
+        struct Doctor* doctor = &site->doctors[i];
+        if (isDoctorAvailable(doctor, minuteOfDay) && strcmp(doctor->specialty, specialty) == 0 &&
+            (best == -1 || freeSlotCount(doctor) > freeSlotCount(&site->doctors[best]))) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Regular case to suspend among the on-shift doctors of a specialty: the one
+// whose visit started last. Returns 0 if every case there is an emergency.
+int findPreemptionTarget(struct Hospital* site, const char* specialty, int minuteOfDay, int* doctorIndex, int* slot) {
+    long long latestStart = -1;
+    for (int i = 0; i < site->doctorCount; i++) {
+        struct Doctor* doctor = &site->doctors[i];
+        if (!isDoctorOnShift(doctor, minuteOfDay) || strcmp(doctor->specialty, specialty) != 0) {
+            continue;
+        }
+        for (unsigned int taken = ~doctor->freeSlots & slotMask(doctor->capacity); taken != 0; taken &= taken - 1) {
+            int s = lowestSetBit(taken);
+            int row = findPatientIndex(site->patients, doctor->slotPatientId[s]);
+            if (row == -1 || site->patients[row].isEmergency) {
+                continue;
+            }
+            struct Patient* patient = &site->patients[row];
+            long long started = 0;
+            if (patient->visitCount >= 1 && patient->visitCount <= MAX_VISIT_HISTORY &&
+                patient->visitHistory[patient->visitCount - 1].doctorId == doctor->id) {
+                started = patient->visitHistory[patient->visitCount - 1].visitTime;
+            }
+            if (started > latestStart) {
+                latestStart = started;
+                *doctorIndex = i;
+                *slot = s;
+            }
+        }
+    }
+    return latestStart != -1;
+}
+
+// Dispatch a queued emergency; `enqueuedAt` is monotonicMicros() when it was queued
+void dispatchEmergency(struct Hospital* site, int patientId, long long enqueuedAt, struct EmergencyDispatch* dispatch) {
+    dispatch->outcome = DISPATCH_QUEUED;
+    dispatch->suspendedPatientId = -1;
+    int row = findPatientIndex(site->patients, patientId);
+    if (row == -1) {
+        return;
+    }
+    // Someone already with a doctor keeps their slot; no one is suspended for them
+    int heldBy = findDoctorIndex(site, site->patients[row].assignedDoctorId);
+    if (heldBy != -1 && findPatientSlot(&site->doctors[heldBy], patientId) != -1) {
+        return;
+    }
+    const char* wanted[2] = {requestedSpecialty(&site->patients[row]), FALLBACK_SPECIALTY};
+    int tries = strcmp(wanted[0], FALLBACK_SPECIALTY) == 0 ? 1 : 2;
+    int minuteOfDay = currentMinuteOfDay();
+
+    int doctorIndex = -1;
+    for (int t = 0; t < tries && doctorIndex == -1; t++) {
+        doctorIndex = findFreeDoctor(site, wanted[t], minuteOfDay);
+    }
+    if (doctorIndex != -1) {
+        dispatch->outcome = DISPATCH_FREE_SLOT;
+    } else {
+        int slot = -1;
+        for (int t = 0; t < tries && doctorIndex == -1; t++) {
+            if (!findPreemptionTarget(site, wanted[t], minuteOfDay, &doctorIndex, &slot)) {
+                doctorIndex = -1;
+            }
+        }
+        // The suspended case needs room in the queue, or the emergency waits
+        if (doctorIndex == -1 || queueLength(&site->waitingQueue) >= MAX_PATIENTS) {
+            return;
+        }
+        int suspended = hospitalReleaseSlot(site, doctorIndex, slot);
+        if (!hospitalRequeueFront(site, suspended)) {
+            // Not requeued after all: give the case its slot back
+            hospitalAssign(site, suspended, site->doctors[doctorIndex].id);
+            return;
+        }
+        hospitalRecordVisitNotes(site, suspended, site->doctors[doctorIndex].id, "Suspended for an emergency", 0);
+        dispatch->outcome = DISPATCH_PREEMPTED;
+        dispatch->suspendedPatientId = suspended;
+    }
+
+    dispatch->doctorId = site->doctors[doctorIndex].id;
+    hospitalWithdrawFromQueue(site, patientId);
+    dispatch->slot = hospitalAssign(site, patientId, dispatch->doctorId);
+    dispatch->micros = monotonicMicros() - enqueuedAt;
+
+    struct FastLaneStats* stats = &site->fastLane;
+    stats->dispatched++;
+    stats->preempted += dispatch->outcome == DISPATCH_PREEMPTED;
+    stats->totalMicros += dispatch->micros;
+    stats->lastMicros = dispatch->micros;
+    if (dispatch->micros > stats->worstMicros) {
+        stats->worstMicros = dispatch->micros;
+    }
+}
+
+// Queue a patient, sending an emergency through the fast lane. Returns 0 if the queue is full.
+int enqueueWithFastLane(struct Hospital* site, int patientId, struct EmergencyDispatch* dispatch) {
+    long long enqueuedAt = monotonicMicros();
+    dispatch->outcome = DISPATCH_QUEUED;
+    dispatch->suspendedPatientId = -1;
+    if (!hospitalEnqueue(site, patientId)) {
+        return 0;
+    }
+    if (site->patients[findPatientIndex(site->patients, patientId)].isEmergency) {
+        dispatchEmergency(site, patientId, enqueuedAt, dispatch);
+    }
+    return 1;
+}
+
+void printDispatch(struct Hospital* site, const struct EmergencyDispatch* dispatch) {
+    if (dispatch->outcome == DISPATCH_QUEUED) {
+        return;
+    }
+    int doctorIndex = findDoctorIndex(site, dispatch->doctorId);
+    printf("Emergency fast lane: assigned to %s (slot %d) in %lld microseconds.\n",
+           doctorIndex != -1 ? site->doctors[doctorIndex].name : "doctor", dispatch->slot + 1, dispatch->micros);
+    if (dispatch->outcome == DISPATCH_PREEMPTED) {
+        printf("Patient ID %d was suspended and is first in line among regular patients.\n",
+               dispatch->suspendedPatientId);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Rebalancing
+//
+// When doctors leave (removed, or off shift with patients still in their
+// slots) all of their patients are moved in one batch. The move is solved as
+// a min-cost flow: every patient is one unit of flow, every doctor who is on
+// shift takes up to their free slots, and a patient nobody can take goes back
+// to the waiting queue at a cost high enough that emergencies are placed first.
+// ---------------------------------------------------------------------------
+
+#define REBALANCE_GENERAL_MEDICINE_COST 50  // General Medicine covering for a missing specialist
+#define REBALANCE_NEW_DOCTOR_COST 20  // Patient has not seen this doctor before
+#define REBALANCE_LOAD_COST 5  // Per slot already in use, so patients spread out
+#define REBALANCE_REQUEUE_COST 500
+#define REBALANCE_EMERGENCY_REQUEUE_COST 1000
+#define REBALANCE_EMERGENCY_WEIGHT 2  // Emergencies count double when missing a specialist
+#define MAX_REBALANCE_PATIENTS (MAX_DOCTORS * MAX_DOCTOR_SLOTS)
+
+struct RebalanceMove {
+    int patientId;
+    int fromDoctorId;
+    int toDoctorId;  // -1 if the patient went back to the waiting queue
+};
+
+struct RebalanceResult {
+    struct RebalanceMove moves[MAX_REBALANCE_PATIENTS];
+    int moveCount;
+    int requeued;
+    int suspended;  // Regular cases suspended for requeued emergencies (dispatchRequeuedEmergencies)
+    long long totalCost;
+    long long micros;
+};
+
+struct FlowEdge {
+    int to;
+    int next;  // Next edge out of the same node, -1 at the end
+    int capacity;
+    long long cost;
+};
+
+struct FlowNetwork {
+    struct FlowEdge* edges;
+    int edgeCount;
+    int* head;  // First edge out of each node
+    int nodeCount;
+};
+
+int initFlowNetwork(struct FlowNetwork* net, int nodeCount, int maxEdges) {
+    net->edges = malloc(sizeof(struct FlowEdge) * maxEdges * 2);
+    net->head = malloc(sizeof(int) * nodeCount);
+    if (net->edges == NULL || net->head == NULL) {
+        free(net->edges);
+        free(net->head);
+        return 0;
+    }
+    net->edgeCount = 0;
+    net->nodeCount = nodeCount;
+    for (int v = 0; v < nodeCount; v++) {
+        net->head[v] = -1;
+    }
+    return 1;
+}
+
+void freeFlowNetwork(struct FlowNetwork* net) {
+    free(net->edges);
+    free(net->head);
+}
+
+// Add an edge and its residual twin, returns the index of the forward edge
+// (the twin is always the index + 1)
+int addFlowEdge(struct FlowNetwork* net, int from, int to, int capacity, long long cost) {
+    struct FlowEdge* forward = &net->edges[net->edgeCount];
+    forward->to = to;
+    forward->capacity = capacity;
+    forward->cost = cost;
+    forward->next = net->head[from];
+    net->head[from] = net->edgeCount++;
+
+    struct FlowEdge* backward = &net->edges[net->edgeCount];
+    backward->to = from;
+    backward->capacity = 0;
+    backward->cost = -cost;
+    backward->next = net->head[to];
+    net->head[to] = net->edgeCount++;
+    return net->edgeCount - 2;
+}
+
+// Push as much flow as possible from source to sink at least cost, along
+// successive shortest paths. Costs start non-negative, so Dijkstra with node
+// potentials finds each path. Returns the total cost.
+long long minCostFlow(struct FlowNetwork* net, int source, int sink) {
+    int n = net->nodeCount;
+    long long* potential = calloc(n, sizeof(long long));
+    long long* distance = malloc(sizeof(long long) * n);
+    int* viaEdge = malloc(sizeof(int) * n);
+    char* done = malloc(n);
+    long long totalCost = 0;
+    if (potential == NULL || distance == NULL || viaEdge == NULL || done == NULL) {
+        free(potential); free(distance); free(viaEdge); free(done);
+        return 0;
+    }
+
+    while (1) {
+        for (int v = 0; v < n; v++) {
+            distance[v] = LLONG_MAX;
+            viaEdge[v] = -1;
+            done[v] = 0;
+        }
+        distance[source] = 0;
+        // Dense Dijkstra: the network has few nodes and many edges
+        for (int round = 0; round < n; round++) {
+            int u = -1;
+            for (int v = 0; v < n; v++) {
+                if (!done[v] && distance[v] != LLONG_MAX && (u == -1 || distance[v] < distance[u])) {
+                    u = v;
+                }
+            }
+            if (u == -1) {
+                break;
+            }
+            done[u] = 1;
+            for (int e = net->head[u]; e != -1; e = net->edges[e].next) {
+                struct FlowEdge* edge = &net->edges[e];
+                long long reduced = edge->cost + potential[u] - potential[edge->to];
+                if (edge->capacity > 0 && distance[u] + reduced < distance[edge->to]) {
+                    distance[edge->to] = distance[u] + reduced;
+                    viaEdge[edge->to] = e;
+                }
+            }
+        }
+        if (distance[sink] == LLONG_MAX) {
+            break;
+        }
+        for (int v = 0; v < n; v++) {
+            if (distance[v] != LLONG_MAX) {
+                potential[v] += distance[v];
+            }
+        }
+
+        int pushed = INT_MAX;
+        for (int v = sink; v != source; v = net->edges[viaEdge[v] ^ 1].to) {
+            if (net->edges[viaEdge[v]].capacity < pushed) {
+                pushed = net->edges[viaEdge[v]].capacity;
+            }
+        }
+        for (int v = sink; v != source; v = net->edges[viaEdge[v] ^ 1].to) {
+            net->edges[viaEdge[v]].capacity -= pushed;
+            net->edges[viaEdge[v] ^ 1].capacity += pushed;
+            totalCost += (long long)pushed * net->edges[viaEdge[v]].cost;
+        }
+    }
+
+    free(potential);
+    free(distance);
+    free(viaEdge);
+    free(done);
+    return totalCost;
+}
+
+int hasSeenDoctor(const struct Patient* patient, int doctorId) {
+    int visits = patient->visitCount < MAX_VISIT_HISTORY ? patient->visitCount : MAX_VISIT_HISTORY;
+    for (int v = 0; v < visits; v++) {
+        if (patient->visitHistory[v].doctorId == doctorId) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Cost of moving a patient who needs `specialty` to `doctor`, -1 if the
+// doctor cannot take them
+long long rebalanceCost(const struct Patient* patient, const char* specialty, const struct Doctor* doctor) {
+    long long cost = 0;
+    if (strcmp(doctor->specialty, specialty) != 0) {
+        if (strcmp(doctor->specialty, "General Medicine") != 0) {
+            return -1;
+        }
+        cost += REBALANCE_GENERAL_MEDICINE_COST * (patient != NULL && patient->isEmergency ? REBALANCE_EMERGENCY_WEIGHT : 1);
+    }
+    if (patient == NULL || !hasSeenDoctor(patient, doctor->id)) {
+        cost += REBALANCE_NEW_DOCTOR_COST;
+    }
+    return cost;
+}
+
+// Move every patient in the slots of the leaving doctors to other doctors
+// (or back to the queue) in one step. The leaving doctors keep their entries
+// in the table; the caller removes them if they are going for good.
+int rebalanceDoctors(struct Hospital* site, const int leavingIds[], int leavingCount, int minuteOfDay,
+                     struct RebalanceResult* result) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    memset(result, 0, sizeof(*result));
+
+    char leaving[MAX_DOCTORS] = {0};
+    for (int i = 0; i < leavingCount; i++) {
+        int doctorIndex = findDoctorIndex(site, leavingIds[i]);
+        if (doctorIndex != -1) {
+            leaving[doctorIndex] = 1;
+        }
+    }
+
+    // The patients to move, and the doctors who could take them
+    int fromDoctor[MAX_REBALANCE_PATIENTS], fromSlot[MAX_REBALANCE_PATIENTS];
+    int patientCount = 0;
+    int targets[MAX_DOCTORS];
+    int targetCount = 0;
+    for (int d = 0; d < site->doctorCount; d++) {
+        struct Doctor* doctor = &site->doctors[d];
+        if (leaving[d]) {
+            for (int slot = 0; slot < doctor->capacity; slot++) {
+                if (doctor->slotPatientId[slot] != -1) {
+                    fromDoctor[patientCount] = d;
+                    fromSlot[patientCount++] = slot;
+                }
+            }
+        } else if (isDoctorOnShift(doctor, minuteOfDay) && freeSlotCount(doctor) > 0) {
+            targets[targetCount++] = d;
+        }
+    }
+    if (patientCount == 0) {
+        return 1;
+    }
+
+    // Nodes: source, patients, target doctors, queue, sink
+    int source = 0, firstPatient = 1, firstTarget = 1 + patientCount;
+    int queueNode = firstTarget + targetCount, sink = queueNode + 1;
+    int maxEdges = patientCount * (targetCount + 2) + targetCount * MAX_DOCTOR_SLOTS + 1;
+    struct FlowNetwork net;
+    if (!initFlowNetwork(&net, sink + 1, maxEdges)) {
+        printf("Not enough memory to rebalance.\n");
+        return 0;
+    }
+    for (int p = 0; p < patientCount; p++) {
+        struct Doctor* from = &site->doctors[fromDoctor[p]];
+        int row = findPatientIndex(site->patients, from->slotPatientId[fromSlot[p]]);
+        const struct Patient* patient = row == -1 ? NULL : &site->patients[row];
+
+        addFlowEdge(&net, source, firstPatient + p, 1, 0);
+        for (int t = 0; t < targetCount; t++) {
+            long long cost = rebalanceCost(patient, from->specialty, &site->doctors[targets[t]]);
+            if (cost >= 0) {
+                addFlowEdge(&net, firstPatient + p, firstTarget + t, 1, cost);
+            }
+        }
+        int emergency = patient != NULL && patient->isEmergency;
+        addFlowEdge(&net, firstPatient + p, queueNode, 1,
+                    emergency ? REBALANCE_EMERGENCY_REQUEUE_COST : REBALANCE_REQUEUE_COST);
+    }
+    // Each further patient on the same doctor costs a little more, which
+    // spreads the moved patients over the doctors with the most room
+    for (int t = 0; t < targetCount; t++) {
+        struct Doctor* doctor = &site->doctors[targets[t]];
+        for (int k = 0; k < freeSlotCount(doctor); k++) {
+            addFlowEdge(&net, firstTarget + t, sink, 1, (long long)REBALANCE_LOAD_COST * (occupiedSlotCount(doctor) + k));
+        }
+    }
+    addFlowEdge(&net, queueNode, sink, patientCount, 0);
+    result->totalCost = minCostFlow(&net, source, sink);
+
+    // Read each patient's choice from the saturated edge, then apply the whole
+    // plan: first free the leaving doctors' slots, then take the new ones
+    for (int p = 0; p < patientCount; p++) {
+        struct RebalanceMove* move = &result->moves[result->moveCount++];
+        struct Doctor* from = &site->doctors[fromDoctor[p]];
+        move->patientId = from->slotPatientId[fromSlot[p]];
+        move->fromDoctorId = from->id;
+        move->toDoctorId = -1;
+        for (int e = net.head[firstPatient + p]; e != -1; e = net.edges[e].next) {
+            int to = net.edges[e].to;
+            if ((e & 1) == 0 && net.edges[e].capacity == 0 && to >= firstTarget && to < queueNode) {
+                move->toDoctorId = site->doctors[targets[to - firstTarget]].id;
+            }
+        }
+    }
+    freeFlowNetwork(&net);
+
+    for (int p = 0; p < patientCount; p++) {
+        hospitalReleaseSlot(site, fromDoctor[p], fromSlot[p]);
+    }
+    for (int m = 0; m < result->moveCount; m++) {
+        struct RebalanceMove* move = &result->moves[m];
+        if (move->toDoctorId != -1 && hospitalAssign(site, move->patientId, move->toDoctorId) < 0) {
+            move->toDoctorId = -1;
+        }
+    }
+    // Anyone left without a doctor was mid-consultation, so they go back to the
+    // head of their class (in plan order) as a suspended case does
+    for (int m = result->moveCount - 1; m >= 0; m--) {
+        if (result->moves[m].toDoctorId == -1) {
+            hospitalRequeueFront(site, result->moves[m].patientId);
+            result->requeued++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    result->micros = (finished.tv_sec - started.tv_sec) * 1000000LL + (finished.tv_nsec - started.tv_nsec) / 1000;
+    return 1;
+}
+
+// Send the emergencies a rebalance put back in the queue through the fast lane,
+// once the doctors who left can no longer take them. Call it after they are
+// removed or off shift.
+void dispatchRequeuedEmergencies(struct Hospital* site, struct RebalanceResult* result) {
+    for (int m = 0; m < result->moveCount; m++) {
+        struct RebalanceMove* move = &result->moves[m];
+        int row = findPatientIndex(site->patients, move->patientId);
+        if (move->toDoctorId != -1 || row == -1 || !site->patients[row].isEmergency) {
+            continue;
+        }
+        struct EmergencyDispatch dispatch;
+        dispatchEmergency(site, move->patientId, monotonicMicros(), &dispatch);
+        if (dispatch.outcome != DISPATCH_QUEUED) {
+            move->toDoctorId = dispatch.doctorId;
+            result->requeued--;
+            result->suspended += dispatch.outcome == DISPATCH_PREEMPTED;
+        }
+    }
+}
+
+void printRebalanceResult(struct Hospital* site, const struct RebalanceResult* result) {
+    if (result->moveCount == 0) {
+        printf("No patients needed moving.\n");
+        return;
+    }
+    printf("%-5s %-20s %-8s %-20s\n", "ID", "Patient", "From", "To");
+    printDivider();
+    for (int m = 0; m < result->moveCount; m++) {
+        const struct RebalanceMove* move = &result->moves[m];
+        int row = findPatientIndex(site->patients, move->patientId);
+        int doctorIndex = findDoctorIndex(site, move->toDoctorId);
+        printf("%-5d %-20s %-8d %-20s\n", move->patientId, row == -1 ? "Unknown" : site->patients[row].name,
+               move->fromDoctorId, doctorIndex == -1 ? "Waiting queue" : site->doctors[doctorIndex].name);
+    }
+    printf("\n%d patient(s) moved, %d back to the queue (plan cost %lld, %lld microseconds).\n",
+           result->moveCount - result->requeued, result->requeued, result->totalCost, result->micros);
+    if (result->suspended > 0) {
+        printf("%d regular case(s) suspended to make room for emergencies.\n", result->suspended);
+    }
+}
+
+// Hand the patients of every doctor now off shift to doctors still on shift
+void rebalanceOffShiftDoctors(struct Hospital* site) {
+    printHeader("Rebalance Off-Shift Doctors");
+    int minuteOfDay = currentMinuteOfDay();
+    int leaving[MAX_DOCTORS];
+    int leavingCount = 0;
+    for (int d = 0; d < site->doctorCount; d++) {
+        if (!isDoctorOnShift(&site->doctors[d], minuteOfDay) && occupiedSlotCount(&site->doctors[d]) > 0) {
+            leaving[leavingCount++] = site->doctors[d].id;
+        }
+    }
+    if (leavingCount == 0) {
+        printf("No off-shift doctor has patients.\n");
+        pauseExecution();
+        return;
+    }
+    struct RebalanceResult result;
+    if (rebalanceDoctors(site, leaving, leavingCount, minuteOfDay, &result)) {
+        dispatchRequeuedEmergencies(site, &result);
+        printRebalanceResult(site, &result);
+    }
+    pauseExecution();
+}
+
+void removeDoctor(struct Hospital* site) {
+    if (site->doctorCount <= 0) {
+        printf("No doctors to remove.\n");
+        return;
+    }
+
+    int id;
+    printf("Enter Doctor ID to remove: ");
+    scanf("%d", &id);
+    getchar();
+
+    // Move their current patients before the doctor's slots disappear
+    struct RebalanceResult result;
+    int doctorIndex = findDoctorIndex(site, id);
+    int hadPatients = doctorIndex != -1 && occupiedSlotCount(&site->doctors[doctorIndex]) > 0;
+    if (hadPatients && !rebalanceDoctors(site, &id, 1, currentMinuteOfDay(), &result)) {
+        return;
+    }
+
+    if (hospitalRemoveDoctor(site, id)) {
+        printf("Doctor removed successfully!\n");
+        if (hadPatients) {
+            dispatchRequeuedEmergencies(site, &result);
+            printRebalanceResult(site, &result);
+            pauseExecution();
+        }
+    } else {
+        printf("Doctor not found.\n");
+    }
+}
+
+// Returns the slot taken or an ASSIGN_* code, after telling the user which
+int assignToDoctor(struct Hospital* site, int patientId, int doctorId) {
+    struct Doctor* doctors = site->doctors;
+    int doctorCount = site->doctorCount;
+    int result = hospitalAssign(site, patientId, doctorId);
+    if (result == ASSIGN_PATIENT_NOT_FOUND) {
+        printf("Patient not found\n");
+    } else if (result == ASSIGN_DOCTOR_NOT_FOUND) {
+        printf("Doctor not found.\n");
+    } else if (result == ASSIGN_DOCTOR_BUSY) {
+        printf("Doctor is busy.\n");
+    } else if (result == ASSIGN_PATIENT_BUSY) {
+        printf("Patient is already with a doctor.\n");
+    } else {
+        for (int i = 0; i < doctorCount; i++) {
+            if (doctors[i].id == doctorId) {
+                printf("Patient assigned to Doctor %s (slot %d of %d)\n", doctors[i].name, result + 1, doctors[i].capacity);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+void addDoctor(struct Hospital* site) {
+    if (site->doctorCount >= MAX_DOCTORS) {
+        printf("Max capacity reached for doctors.\n");
+        return;
+    }
+
+    struct Doctor newDoctor;
+    printf("Enter Doctor ID: ");
+    scanf("%d", &newDoctor.id);
+    getchar(); // Consume leftover newline
+    printf("Enter Doctor Name: ");
+    fgets(newDoctor.name, MAX_NAME_LEN, stdin);
+    newDoctor.name[strcspn(newDoctor.name, "\n")] = 0; // Remove newline
+    printf("Enter Doctor Specialty: ");
+    fgets(newDoctor.specialty, MAX_NAME_LEN, stdin);
+    newDoctor.specialty[strcspn(newDoctor.specialty, "\n")] = 0; // Remove newline
+
+    int capacity;
+    printf("Enter Number of Consultation Slots (1-%d): ", MAX_DOCTOR_SLOTS);
+    scanf("%d", &capacity);
+    initDoctorSlots(&newDoctor, capacity); // All slots start free
+
+    int shiftStartHour, shiftEndHour;
+    printf("Enter Shift Start Hour (0-23, -1 for always on shift): ");
+    scanf("%d", &shiftStartHour);
+    if (shiftStartHour >= 0 && shiftStartHour < 24) {
+        printf("Enter Shift End Hour (0-23): ");
+        scanf("%d", &shiftEndHour);
+        if (shiftEndHour < 0 || shiftEndHour > 23) {
+            shiftEndHour = shiftStartHour;
+        }
+        newDoctor.shiftStart = shiftStartHour * 60;
+        newDoctor.shiftEnd = shiftEndHour * 60;
+    } else {
+        newDoctor.shiftStart = newDoctor.shiftEnd = 0;
+    }
+    getchar();
+    newDoctor.patientsAttended = 0;
+
+    hospitalAddDoctor(site, &newDoctor);
+    printf("Doctor added successfully!\n");
+}
+
+// ---------------------------------------------------------------------------
+// Duplicate patient detection
+//
+// A registration is compared only with the patients in its blocks: those
+// whose name has a word that sounds like one of its own words, within a few
+// years of its age. Names in a block are then compared by edit distance.
+// ---------------------------------------------------------------------------
+
+#define DUPLICATE_AGE_TOLERANCE 2  // Years either way, for ages recorded at different visits
+#define MAX_DUPLICATE_CANDIDATES 10
+
+struct DuplicateCandidate {
+    int row;
+    int nameEdits;
+    int ageGap;
+};
+
+// Lower-case words of a name in sorted order, so "Gupta Ishaan" and
+// "Ishaan Gupta" compare equal
+void normalizeName(const char* name, char out[MAX_NAME_LEN]) {
+    char words[MAX_NAME_LEN / 2][MAX_NAME_LEN];
+    int wordCount = 0;
+    int used;
+    while (wordCount < MAX_NAME_LEN / 2 && (used = nextWord(name, words[wordCount])) > 0) {
+        int at = wordCount++;
+        while (at > 0 && strcmp(words[at - 1], words[at]) > 0) {
+            char swap[MAX_NAME_LEN];
+            strcpy(swap, words[at]);
+            strcpy(words[at], words[at - 1]);
+            strcpy(words[at - 1], swap);
+            at--;
+        }
+        name += used;
+    }
+    int length = 0;
+    out[0] = '\0';
+    for (int w = 0; w < wordCount; w++) {
+        length += snprintf(out + length, MAX_NAME_LEN - length, w ? " %s" : "%s", words[w]);
+        if (length >= MAX_NAME_LEN - 1) {
+            break;
+        }
+    }
+}
+
+// Levenshtein distance with the bit-parallel algorithm of Myers (as given by
+// Hyyrö): one column of the table per machine word, so the cost is one pass
+// over `b`. `a` must be at most 64 characters, which names always are.
+int nameEditDistance(const char* a, const char* b) {
+    int m = (int)strlen(a);
+    int n = (int)strlen(b);
+    if (m == 0) return n;
+    if (m > 64) m = 64;
+
+    unsigned long long peq[256] = {0};  // Positions of each character in `a`
+    for (int i = 0; i < m; i++) {
+        peq[(unsigned char)a[i]] |= 1ull << i;
+    }
+    unsigned long long pv = ~0ull, mv = 0, last = 1ull << (m - 1);
+    int score = m;
+    for (int j = 0; j < n; j++) {
+        unsigned long long eq = peq[(unsigned char)b[j]];
+        unsigned long long xv = eq | mv;
+        unsigned long long xh = (((eq & pv) + pv) ^ pv) | eq;
+        unsigned long long ph = mv | ~(xh | pv);
+        unsigned long long mh = pv & xh;
+        if (ph & last) {
+            score++;
+        } else if (mh & last) {
+            score--;
+        }
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+    return score;
+}
+
+// Edits two normalized names may differ by and still be the same person
+int allowedNameEdits(int length) {
+    return length <= 8 ? 1 : length / 6 + 1;
+}
+
+// Patients who may already be the person registering as `name`, `age`,
+// closest names first. `skipRow` is left out (-1 to compare with everyone).
+int findDuplicateCandidates(struct Hospital* site, const char* name, int age, int skipRow,
+                            struct DuplicateCandidate out[MAX_DUPLICATE_CANDIDATES]) {
+    struct PatientIndex* index = &site->index;
+    struct RowBitmap block;
+    memset(&block, 0, sizeof(block));
+    char word[MAX_NAME_LEN];
+    const char* text = name;
+    int used;
+    while ((used = nextWord(text, word)) > 0) {
+        combineRows(&block, &index->nameSound[nameSoundBucket(word)], 1);
+        text += used;
+    }
+    if (block.count == 0) {
+        return 0;
+    }
+    struct RowBitmap ages;
+    scanColumnRange(&index->columns, index->columns.age, age - DUPLICATE_AGE_TOLERANCE, age + DUPLICATE_AGE_TOLERANCE, &ages);
+    combineRows(&block, &ages, 0);
+    if (skipRow >= 0) {
+        removeRow(&block, skipRow);
+    }
+
+    char wanted[MAX_NAME_LEN], other[MAX_NAME_LEN];
+    normalizeName(name, wanted);
+    int found = 0;
+    for (int row = nextRow(&block, 0); row != -1; row = nextRow(&block, row + 1)) {
+        normalizeName(site->patients[row].name, other);
+        int longer = strlen(wanted) > strlen(other) ? (int)strlen(wanted) : (int)strlen(other);
+        int edits = nameEditDistance(wanted, other);
+        if (edits > allowedNameEdits(longer)) {
+            continue;
+        }
+        // Keep the closest names when there are more than fit
+        int at = found < MAX_DUPLICATE_CANDIDATES ? found++ : MAX_DUPLICATE_CANDIDATES;
+        while (at > 0 && out[at - 1].nameEdits > edits) {
+            if (at < MAX_DUPLICATE_CANDIDATES) {
+                out[at] = out[at - 1];
+            }
+            at--;
+        }
+        if (at < MAX_DUPLICATE_CANDIDATES) {
+            out[at].row = row;
+            out[at].nameEdits = edits;
+            out[at].ageGap = abs(site->patients[row].age - age);
+        }
+    }
+    return found;
+}
+
+void printDuplicateCandidates(struct Hospital* site, struct DuplicateCandidate candidates[], int count) {
+    printf("%-5s %-20s %-5s %-20s %-12s\n", "ID", "Name", "Age", "Disease", "Difference");
+    for (int i = 0; i < count; i++) {
+        const struct Patient* patient = &site->patients[candidates[i].row];
+        char difference[24];
+        if (candidates[i].nameEdits == 0 && candidates[i].ageGap == 0) {
+            snprintf(difference, sizeof(difference), "exact");
+        } else {
+            snprintf(difference, sizeof(difference), "%d edit(s), %dy", candidates[i].nameEdits, candidates[i].ageGap);
+        }
+        printf("%-5d %-20s %-5d %-20s %-12s\n", patient->id, patient->name, patient->age, patient->disease, difference);
+    }
+}
+
+// Every pair of records in the table that may be the same patient
+void findDuplicatePatients(struct Hospital* site) {
+    printHeader("Duplicate Patient Check");
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    int pairs = 0;
+    struct DuplicateCandidate candidates[MAX_DUPLICATE_CANDIDATES];
+    for (int row = nextRow(&site->index.live, 0); row != -1; row = nextRow(&site->index.live, row + 1)) {
+        const struct Patient* patient = &site->patients[row];
+        int count = findDuplicateCandidates(site, patient->name, patient->age, row, candidates);
+        for (int i = 0; i < count; i++) {
+            if (candidates[i].row < row) {
+                continue;  // Listed already from the other record
+            }
+            const struct Patient* other = &site->patients[candidates[i].row];
+            printf("%d %s (%d)  <->  %d %s (%d)  [%d edit(s), %d year(s) apart]\n",
+                   patient->id, patient->name, patient->age, other->id, other->name, other->age,
+                   candidates[i].nameEdits, candidates[i].ageGap);
+            pairs++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    long long micros = (finished.tv_sec - started.tv_sec) * 1000000LL + (finished.tv_nsec - started.tv_nsec) / 1000;
+    printf("\n%d possible duplicate pair(s) among %d patients, checked in %lld microseconds.\n",
+           pairs, site->patientCount, micros);
+    pauseExecution();
+}
+
+void addPatient(struct Hospital* site) {
+    printHeader("Add New Patient");
+    
+    if (site->patientCount >= MAX_PATIENTS) {
+        printf("Error: Maximum capacity reached for patients.\n");
+        pauseExecution();
+        return;
+    }
+    
+    struct Patient newPatient;
+    printf("Enter Patient Details\n");
+    printDivider();
+    printf("ID: ");
+    scanf("%d", &newPatient.id);
+    getchar();
+    if (findPatientIndex(site->patients, newPatient.id) != -1) {
+        printf("A patient with ID %d already exists.\n", newPatient.id);
+        pauseExecution();
+        return;
+    }
+    struct Patient archived;
+    if (site->archive != NULL && archiveGet(site->archive, ARCHIVE_PATIENTS, newPatient.id, &archived)) {
+        printf("ID %d belongs to %s in the patient archive; readmit them from the Patient Archive menu.\n",
+               newPatient.id, archived.name);
+        pauseExecution();
+        return;
+    }
+    
+    printf("Name: ");
+    fgets(newPatient.name, MAX_NAME_LEN, stdin);
+    newPatient.name[strcspn(newPatient.name, "\n")] = 0;
+    
+    printf("Age: ");
+    scanf("%d", &newPatient.age);
+    getchar();
+    
+    // Warn before opening a second chart for someone already registered
+    struct DuplicateCandidate candidates[MAX_DUPLICATE_CANDIDATES];
+    int candidateCount = findDuplicateCandidates(site, newPatient.name, newPatient.age, -1, candidates);
+    if (candidateCount > 0) {
+        printf("\nPossible existing records for this patient:\n");
+        printDuplicateCandidates(site, candidates, candidateCount);
+        printf("Register as a new patient anyway? (1-Yes, 0-No): ");
+        int registerAnyway;
+        scanf("%d", &registerAnyway);
+        getchar();
+        if (!registerAnyway) {
+            printf("Registration cancelled.\n");
+            pauseExecution();
+            return;
+        }
+    }
+    
+    printf("Disease: ");
+    fgets(newPatient.disease, MAX_NAME_LEN, stdin);
+    newPatient.disease[strcspn(newPatient.disease, "\n")] = 0;
+    
+    int specialtyCount = SPECIALTY_COUNT;
+    
+    // Improved specialty detection
+    char suggestedSpecialty[MAX_NAME_LEN];
+    strcpy(suggestedSpecialty, suggestSpecialty(newPatient.disease));
+    
+    printf("Suggested Specialty: %s\n", suggestedSpecialty);
+    printf("Accept suggested specialty? (0-No, 1-Yes): ");
+    int acceptSpecialty;
+    scanf("%d", &acceptSpecialty);
+    
+    char specialty[MAX_NAME_LEN];
+    if (!acceptSpecialty) {
+        // Display specialty options
+        printf("\nSelect Specialty:\n");
+        for (int i = 0; i < specialtyCount; i++) {
+            printf("%d. %s\n", i + 1, specialties[i]);
+        }
+        
+        int specialtyChoice;
+        printf("Enter specialty number (1-%d): ", specialtyCount);
+        scanf("%d", &specialtyChoice);
+        getchar();
+        
+        // Validate and assign specialty
+        if (specialtyChoice > 0 && specialtyChoice <= specialtyCount) {
+            strcpy(specialty, specialties[specialtyChoice - 1]);
+        } else {
+            strcpy(specialty, "General Medicine");
+        }
+    } else {
+        strcpy(specialty, suggestedSpecialty);
+    }
+    
+    printf("Selected Specialty: %s\n", specialty);
+    
+    printf("Emergency case? (1-Yes, 0-No): ");
+    scanf("%d", &newPatient.isEmergency);
+    
+    newPatient.visitCount = 0;
+    newPatient.assignedDoctorId = -1;
+    strcpy(newPatient.requestedSpecialty, specialty);
+
+    // Another terminal on a shared site may have taken the ID while the form was filled in
+    if (findPatientIndex(site->patients, newPatient.id) != -1) {
+        printf("A patient with ID %d was registered meanwhile.\n", newPatient.id);
+        pauseExecution();
+        return;
+    }
+    hospitalAdmitPatient(site, &newPatient);
+    
+    printDivider();
+    printf("Patient added successfully!\n");
+    pauseExecution();
+}
+
+// The listing screens read a view (beginSiteRead) and leave the pause to the caller,
+// so the view is let go before the screen waits for Enter
+void displayPatients(const struct SiteView* view) {
+    printHeader("Patient Records");
+    
+    if (view->patientCount == 0) {
+        printf("No patients in the system.\n");
+        return;
+    }
+    
+    printf("%-5s %-20s %-5s %-20s %-8s %-10s\n", 
+           "ID", "Name", "Age", "Disease", "Visits", "Type");
+    printDivider();
+    
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        const struct Patient* patient = view->patients[i];
+        if (patient != NULL) {
+            printf("%-5d %-20s %-5d %-20s %-8d %-10s\n",
+                   patient->id, 
+                   patient->name, 
+                   patient->age, 
+                   patient->disease, 
+                   patient->visitCount,
+                   patient->isEmergency ? "Emergency" : "Regular");
+        }
+    }
+}
+
+void displayDoctors(const struct SiteView* view) {
+    printHeader("Doctor Status");
+    
+    if (view->doctorCount == 0) {
+        printf("No doctors in the system.\n");
+        return;
+    }
+    
+    printf("%-5s %-20s %-20s %-10s %-10s\n", 
+           "ID", "Name", "Specialty", "Free", "Status");
+    printDivider();
+    
+    int minuteOfDay = currentMinuteOfDay();
+    for (int i = 0; i < view->doctorCount; i++) {
+        const struct Doctor* doctor = view->doctors[i];
+        char slots[24];
+        snprintf(slots, sizeof(slots), "%d/%d", freeSlotCount(doctor), doctor->capacity);
+        printf("%-5d %-20s %-20s %-10s %-10s\n",
+               doctor->id,
+               doctor->name,
+               doctor->specialty,
+               slots,
+               !isDoctorOnShift(doctor, minuteOfDay) ? "Off Shift" :
+               isDoctorBusy(doctor) ? "Busy" : "Available");
+    }
+}
+
+// Display doctor performance
+void displayDoctorPerformance(const struct SiteView* view) {
+    printHeader("Doctor Performance");
+    printf("Doctor Performance Tracker\n");
+    printf("%-5s %-20s %-20s %-15s\n", "ID", "Name", "Specialty", "Patients Attended");
+    printf("%-5s %-20s %-20s %-15s\n", "--", "------------------", "------------------", "-----------------");
+    for (int i = 0; i < view->doctorCount; i++) {
+        const struct Doctor* doctor = view->doctors[i];
+        if (doctor->patientsAttended > 0) {  // Only display doctors who have attended patients
+            printf("%-5d %-20s %-20s %-15d\n", doctor->id, doctor->name, doctor->specialty, doctor->patientsAttended);
+        }
+    }
+}
+
+void displayQueue(const struct SiteView* view) {
+    printHeader("Current Waiting Queue");
+    const struct PriorityQueue* q = &view->waitingQueue;
+    
+    if (q->front == -1) {
+        printf("No patients in the queue.\n");
+        return;
+    }
+    
+    printf("%-5s %-20s %-10s\n", 
+           "ID", "Name", "Priority");
+    printDivider();
+    
+    for (int i = q->front; i <= q->rear; i++) {
+        int j = findViewPatient(view, q->items[i].patientId);
+        if (j != -1) {
+            printf("%-5d %-20s %-10s\n",
+                   view->patients[j]->id,
+                   view->patients[j]->name,
+                   q->items[i].priority ? "Emergency" : "Regular");
+        }
+    }
+}
+
+// Live figures for wall-mounted screens; every number is read from the maintained counters
+void displayDashboard(struct Hospital* site) {
+    printHeader("Live Dashboard");
+    struct DashboardCounters* c = &site->counters;
+
+    printf("Waiting: %d (%d emergency, %d regular)   Active consultations: %d\n",
+           c->queuedByPriority[0] + c->queuedByPriority[1], c->queuedByPriority[1], c->queuedByPriority[0],
+           c->activeConsultations);
+    printDivider();
+
+    printf("%-20s %-8s %-10s %-10s %-10s\n", "Specialty", "Queued", "Free Drs", "Busy Drs", "Free Slots");
+    for (int s = 0; s <= SPECIALTY_COUNT; s++) {
+        if (c->queuedBySpecialty[s] == 0 && c->freeDoctorsBySpecialty[s] == 0 && c->busyDoctorsBySpecialty[s] == 0) {
+            continue;
+        }
+        printf("%-20s %-8d %-10d %-10d %-10d\n", s == OTHER_SPECIALTY ? "Other" : specialties[s],
+               c->queuedBySpecialty[s], c->freeDoctorsBySpecialty[s], c->busyDoctorsBySpecialty[s],
+               c->freeSlotsBySpecialty[s]);
+    }
+
+    printf("\n%-5s %-20s %-10s\n", "ID", "Doctor", "Caseload");
+    for (int i = 0; i < site->doctorCount; i++) {
+        if (occupiedSlotCount(&site->doctors[i]) > 0) {
+            char caseload[24];
+            snprintf(caseload, sizeof(caseload), "%d/%d", occupiedSlotCount(&site->doctors[i]), site->doctors[i].capacity);
+            printf("%-5d %-20s %-10s\n", site->doctors[i].id, site->doctors[i].name, caseload);
+        }
+    }
+
+    printf("\nAdmissions per hour (this hour first): ");
+    int last24 = 0;
+    for (int h = 0; h < 24; h++) {
+        int admissions = admissionsInHour(c, h);
+        last24 += admissions;
+        if (h < 8) {
+            printf("%d ", admissions);
+        }
+    }
+    printf("... (%d in the last 24 hours)\n", last24);
+
+    struct FastLaneStats* fastLane = &site->fastLane;
+    if (fastLane->dispatched > 0) {
+        printf("Emergency fast lane: %lld dispatched (%lld by suspending a regular case), enqueue to assignment "
+               "last %lld, average %lld, worst %lld microseconds\n", fastLane->dispatched, fastLane->preempted,
+               fastLane->lastMicros, fastLane->totalMicros / fastLane->dispatched, fastLane->worstMicros);
+    }
+
+    pauseExecution();
+}
+
+void printPatientDetails(const struct Patient* patient) {
+    printf("Patient ID: %d\n", patient->id);
+    printf("Name: %s\n", patient->name);
+    printf("Age: %d\n", patient->age);
+    printf("Disease: %s\n", patient->disease);
+    printf("Requested Specialty: %s\n", requestedSpecialty(patient));
+    printf("Visits: %d\n", patient->visitCount);
+    printf("Emergency: %s\n", patient->isEmergency ? "Yes" : "No");
+    printf("Assigned Doctor ID: %d\n", patient->assignedDoctorId);
+}
+
+void displayPatientInfo(struct Patient patients[], int patientId) {
+    int index = findPatientIndex(patients, patientId);
+    if (index == -1) {
+        printf("Patient not found.\n");
+        return;
+    }
+    printPatientDetails(&patients[index]);
+}
+
+// New function to add a visit record
+void addVisitRecord(struct Patient *patient, const char *doctorName, const char *notes) {
+    if (patient->visitCount < MAX_VISIT_HISTORY) {
+        strncpy(patient->visitHistory[patient->visitCount].doctorName, doctorName, MAX_NAME_LEN);
+        strncpy(patient->visitHistory[patient->visitCount].notes, notes, MAX_NAME_LEN);
+        patient->visitCount++;
+    } else {
+        printf("Visit history is full for patient ID %d.\n", patient->id);
+    }
+}
+
+void printVisitHistory(const struct Patient* patient, struct Doctor doctors[]) {
+    printf("Visit History for Patient ID: %d, Name: %s\n", 
+           patient->id, patient->name);
+    
+    if (patient->visitCount == 0) {
+        printf("No visit records found.\n");
+        return;
+    }
+    
+    int visits = patient->visitCount < MAX_VISIT_HISTORY ? patient->visitCount : MAX_VISIT_HISTORY;
+    for (int j = 0; j < visits; j++) {
+        // Find the doctor's full name based on the assigned doctor ID
+        char doctorFullName[MAX_NAME_LEN] = "Unknown Doctor";
+        for (int k = 0; k < MAX_DOCTORS; k++) {
+            if (patient->assignedDoctorId == doctors[k].id) {
+                strcpy(doctorFullName, doctors[k].name);
+                break;
+            }
+        }
+        
+        printf("%d. Doctor: %s\n", j + 1, 
+               patient->visitHistory[j].doctorName[0] != '\0' ? 
+               patient->visitHistory[j].doctorName : doctorFullName);
+        printf("   Reason: %s\n", patient->disease);
+        printf("   Notes: %s\n", patient->visitHistory[j].notes);
+        printf("\n");
+    }
+}
+
+// Visit history of an active patient, or of an archived one if they have been discharged
+void displayVisitHistory(struct Hospital* site, int patientId) {
+    int i = findPatientIndex(site->patients, patientId);
+    if (i != -1) {
+        printVisitHistory(&site->patients[i], site->doctors);
+        return;
+    }
+    struct Patient archived;
+    if (site->archive != NULL && archiveGet(site->archive, ARCHIVE_PATIENTS, patientId, &archived)) {
+        printf("(Archived record)\n");
+        printVisitHistory(&archived, site->doctors);
+        return;
+    }
+    printf("Patient not found.\n");
+}
+
+void markDoctorAvailable(struct Hospital* site) {
+    struct Doctor* doctors = site->doctors;
+    struct Patient* patients = site->patients;
+    printf("Doctors With Occupied Slots:\n");
+    printf("%-5s %-20s %-20s %-10s\n", "ID", "Name", "Specialty", "In Use");
+    printf("----------------------------------------\n");
+    for (int i = 0; i < site->doctorCount; i++) {
+        if (occupiedSlotCount(&doctors[i]) > 0) {
+            char inUse[24];
+            snprintf(inUse, sizeof(inUse), "%d/%d", occupiedSlotCount(&doctors[i]), doctors[i].capacity);
+            printf("%-5d %-20s %-20s %-10s\n", doctors[i].id, doctors[i].name, doctors[i].specialty, inUse);
+        }
+    }
+
+    int docId;
+    printf("Enter Doctor ID to release a slot: ");
+    scanf("%d", &docId);
+    getchar();
+
+    for (int i = 0; i < site->doctorCount; i++) {
+        if (doctors[i].id != docId || occupiedSlotCount(&doctors[i]) == 0) {
+            continue;
+        }
+
+        // Pick which consultation to close when several slots are in use
+        int slot = lowestSetBit(~doctors[i].freeSlots & slotMask(doctors[i].capacity));
+        if (occupiedSlotCount(&doctors[i]) > 1) {
+            printf("\nPatients currently with %s:\n", doctors[i].name);
+            for (int s = 0; s < doctors[i].capacity; s++) {
+                if (doctors[i].slotPatientId[s] != -1) {
+                    printf("Slot %d: Patient ID %d\n", s + 1, doctors[i].slotPatientId[s]);
+                }
+            }
+            int patientId;
+            printf("Enter Patient ID whose consultation is finished: ");
+            scanf("%d", &patientId);
+            getchar();
+            i = findDoctorIndex(site, docId);  // The doctor list may have changed on a shared site
+            slot = i != -1 ? findPatientSlot(&doctors[i], patientId) : -1;
+            if (slot == -1) {
+                printf("Patient is not with this doctor.\n");
+                return;
+            }
+        }
+
+        if (slot == -1) {
+            break;
+        }
+        int doctorId = doctors[i].id;
+        int patientId = hospitalReleaseSlot(site, i, slot);
+        printf("Consultation slot released (%d/%d free).\n", freeSlotCount(&doctors[i]), doctors[i].capacity);
+
+        // Show the patient they attended and add notes
+        int j = findPatientIndex(patients, patientId);
+        if (j != -1) {
+            printf("\nAttended Patient: %s (ID: %d)\n", patients[j].name, patients[j].id);
+            printf("Reason for Visit: %s\n", patients[j].disease);
+
+            if (patients[j].visitCount < 1 || patients[j].visitCount > MAX_VISIT_HISTORY) {
+                // The visit is still billed; only its notes have nowhere to go
+                printf("Visit history is full for patient ID %d; the visit is billed without notes.\n", patients[j].id);
+                hospitalRecordVisitNotes(site, patientId, doctorId, "", 1);
+            } else {
+                char notes[MAX_NAME_LEN];
+                printf("Enter Notes for the Visit: ");
+                if (fgets(notes, MAX_NAME_LEN, stdin) == NULL) {
+                    notes[0] = 0;
+                }
+                notes[strcspn(notes, "\n")] = 0;
+                hospitalRecordVisitNotes(site, patientId, doctorId, notes, 1);
+            }
+        }
+        return;
+    }
+
+    printf("Doctor not found or has no patients.\n");
+}
+
+
+// ---------------------------------------------------------------------------
+// Patient queries
+//
+// A query is a list of terms such as "emergency=1 age>=60 specialty=Cardiology
+// queued=0". Each term is answered as a bitmap of rows, from the patient
+// indexes or a column scan; the planner intersects the smallest bitmaps first,
+// and only disease words (indexed by hash) are checked against the records
+// that are left.
+// ---------------------------------------------------------------------------
+
+#define MAX_QUERY_TERMS 16
+#define QUERY_DEFAULT_LIMIT 20
+
+#define QUERY_AGE 0
+#define QUERY_EMERGENCY 1
+#define QUERY_QUEUED 2
+#define QUERY_DISEASE 3
+#define QUERY_NEEDS 4  // Specialty the patient asked for or was suggested
+#define QUERY_SPECIALTY 5  // Specialty of the assigned doctor
+#define QUERY_DOCTOR 6  // assignedDoctorId, -1 for unassigned
+
+struct QueryTerm {
+    int kind;
+    int negate;  // Match the rows the term does not hold
+    int low, high;  // Age range, inclusive
+    int value;  // Specialty bucket or doctor ID
+    char word[MAX_NAME_LEN];  // Disease word, lower case
+    char text[MAX_NAME_LEN];  // The term as typed, for the plan
+    struct RowBitmap rows;  // Rows the index gives for the term
+    int exact;  // 0 if `rows` is a superset that has to be checked row by row
+};
+
+struct PatientQuery {
+    struct QueryTerm terms[MAX_QUERY_TERMS];
+    int termCount;
+    int limit, offset;
+};
+
+struct QueryResult {
+    int rows[MAX_PATIENTS];  // The requested page
+    int rowCount;
+    int total;  // Matches before limit and offset
+    int planOrder[MAX_QUERY_TERMS];  // Terms in the order the planner applied them
+    int planRows[MAX_QUERY_TERMS];  // Candidate rows left after each step
+    int planSteps;
+    long long micros;
+};
+
+// Specialty bucket from a name typed without spaces ("General_Medicine" or
+// "general medicine"), -1 if unknown
+int parseSpecialtyName(const char* name) {
+    if (strcasecmp(name, "Other") == 0) {
+        return OTHER_SPECIALTY;
+    }
+    for (int s = 0; s < SPECIALTY_COUNT; s++) {
+        int i = 0;
+        while (name[i] && specialties[s][i] &&
+               (tolower((unsigned char)name[i]) == tolower((unsigned char)specialties[s][i]) ||
+                (name[i] == '_' && specialties[s][i] == ' '))) {
+            i++;
+        }
+        if (name[i] == '\0' && specialties[s][i] == '\0') {
+            return s;
+        }
+    }
+    return -1;
+}
+
+// Parse one term into `term`, returns 0 and prints why if it is not understood
+int parseQueryTerm(const char* text, struct QueryTerm* term, struct PatientQuery* query) {
+    memset(term, 0, sizeof(*term));
+    snprintf(term->text, sizeof(term->text), "%s", text);
+    term->exact = 1;
+    if (*text == '!') {
+        term->negate = 1;
+        text++;
+    }
+
+    char key[MAX_NAME_LEN];
+    int length = 0;
+    while (text[length] && !strchr("=<>", text[length]) && length < MAX_NAME_LEN - 1) {
+        key[length] = (char)tolower((unsigned char)text[length]);
+        length++;
+    }
+    key[length] = '\0';
+    char op[3] = {0};
+    const char* value = text + length;
+    if (*value == '<' || *value == '>') {
+        op[0] = *value++;
+    }
+    if (*value == '=') {
+        op[op[0] ? 1 : 0] = *value++;
+    }
+    if (op[0] == '\0' || *value == '\0') {
+        printf("Expected key=value in '%s'.\n", term->text);
+        return 0;
+    }
+    int number = atoi(value);
+
+    if (strcmp(key, "limit") == 0 || strcmp(key, "offset") == 0) {
+        if (number < 0) number = 0;
+        if (key[0] == 'l') query->limit = number; else query->offset = number;
+        return -1;  // Not a filter
+    } else if (strcmp(key, "age") == 0) {
+        term->kind = QUERY_AGE;
+        term->low = INT_MIN;
+        term->high = INT_MAX;
+        const char* dash = strchr(value + 1, '-');
+        if (strcmp(op, "=") == 0 && dash) {
+            term->low = number;
+            term->high = atoi(dash + 1);
+        } else if (strcmp(op, "=") == 0) {
+            term->low = term->high = number;
+        } else if (strcmp(op, ">=") == 0) {
+            term->low = number;
+        } else if (strcmp(op, ">") == 0) {
+            term->low = number + 1;
+        } else if (strcmp(op, "<=") == 0) {
+            term->high = number;
+        } else {
+            term->high = number - 1;
+        }
+        return 1;
+    } else if (strcmp(op, "=") != 0) {
+        printf("Only age takes <, <=, > or >= ('%s').\n", term->text);
+        return 0;
+    }
+
+    if (strcmp(key, "emergency") == 0 || strcmp(key, "queued") == 0) {
+        term->kind = key[0] == 'e' ? QUERY_EMERGENCY : QUERY_QUEUED;
+        if (number == 0) {
+            term->negate = !term->negate;
+        }
+    } else if (strcmp(key, "disease") == 0) {
+        term->kind = QUERY_DISEASE;
+        if (nextWord(value, term->word) == 0) {
+            printf("No word to look for in '%s'.\n", term->text);
+            return 0;
+        }
+    } else if (strcmp(key, "needs") == 0 || strcmp(key, "specialty") == 0) {
+        term->kind = key[0] == 'n' ? QUERY_NEEDS : QUERY_SPECIALTY;
+        term->value = parseSpecialtyName(value);
+        if (term->value == -1) {
+            printf("Unknown specialty in '%s' (write spaces as _).\n", term->text);
+            return 0;
+        }
+    } else if (strcmp(key, "doctor") == 0) {
+        term->kind = QUERY_DOCTOR;
+        term->value = number;
+    } else {
+        printf("Unknown field '%s'.\n", key);
+        return 0;
+    }
+    return 1;
+}
+
+// Parse a whole query line, returns 0 if any term was not understood
+int parsePatientQuery(const char* line, struct PatientQuery* query) {
+    query->termCount = 0;
+    query->limit = QUERY_DEFAULT_LIMIT;
+    query->offset = 0;
+    char word[MAX_NAME_LEN];
+    while (*line) {
+        while (*line == ' ' || *line == '\t') line++;
+        int length = 0;
+        while (line[length] && line[length] != ' ' && line[length] != '\t') length++;
+        if (length == 0) break;
+        if (length >= MAX_NAME_LEN) length = MAX_NAME_LEN - 1;
+        memcpy(word, line, length);
+        word[length] = '\0';
+        line += strcspn(line, " \t");
+
+        if (query->termCount == MAX_QUERY_TERMS) {
+            printf("At most %d terms per query.\n", MAX_QUERY_TERMS);
+            return 0;
+        }
+        int parsed = parseQueryTerm(word, &query->terms[query->termCount], query);
+        if (parsed == 0) {
+            return 0;
+        }
+        if (parsed == 1) {
+            query->termCount++;
+        }
+    }
+    return 1;
+}
+
+// Fill in the rows the indexes give for a term
+void lookupQueryTerm(struct Hospital* site, struct QueryTerm* term) {
+    struct PatientIndex* index = &site->index;
+    memset(&term->rows, 0, sizeof(term->rows));
+    switch (term->kind) {
+        case QUERY_AGE:
+            scanColumnRange(&index->columns, index->columns.age, term->low, term->high, &term->rows);
+            break;
+        case QUERY_EMERGENCY:
+            term->rows = index->emergency;
+            break;
+        case QUERY_QUEUED:
+            term->rows = index->queued;
+            break;
+        case QUERY_DISEASE:
+            term->rows = index->diseaseToken[wordBucket(term->word)];
+            term->exact = 0;  // Other words can share the bucket
+            break;
+        case QUERY_NEEDS:
+            term->rows = index->needsSpecialty[term->value];
+            break;
+        case QUERY_SPECIALTY:
+            for (int i = 0; i < site->doctorCount; i++) {
+                if (specialtyBucket(site->doctors[i].specialty) == term->value) {
+                    struct RowBitmap doctorRows;
+                    patientsOfDoctor(index, site->doctors[i].id, &doctorRows);
+                    combineRows(&term->rows, &doctorRows, 1);
+                }
+            }
+            break;
+        case QUERY_DOCTOR:
+            patientsOfDoctor(index, term->value, &term->rows);
+            break;
+    }
+}
+
+// Check a disease term against the record itself, ignoring `negate`
+int patientMatchesTerm(const struct Patient* patient, const struct QueryTerm* term) {
+    return textHasWord(patient->disease, term->word);
+}
+
+// Rows the term is expected to leave, used to order the plan
+int termEstimate(const struct PatientIndex* index, const struct QueryTerm* term) {
+    return term->negate ? index->live.count - term->rows.count : term->rows.count;
+}
+
+void runPatientQuery(struct Hospital* site, struct PatientQuery* query, struct QueryResult* result) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    struct PatientIndex* index = &site->index;
+
+    // Order the terms the bitmaps can answer by how many rows they leave.
+    // A negated approximate term cannot be subtracted (its superset would drop
+    // real matches) and is only checked row by row.
+    int order[MAX_QUERY_TERMS];
+    int steps = 0;
+    for (int t = 0; t < query->termCount; t++) {
+        struct QueryTerm* term = &query->terms[t];
+        lookupQueryTerm(site, term);
+        if (term->negate && !term->exact) {
+            continue;
+        }
+        int estimate = termEstimate(index, term);
+        int at = steps++;
+        while (at > 0 && termEstimate(index, &query->terms[order[at - 1]]) > estimate) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = t;
+    }
+
+    // Start from the smallest positive term (every live row if there is none)
+    // and narrow the candidates one bitmap at a time
+    struct RowBitmap candidates = index->live;
+    result->planSteps = 0;
+    for (int i = 0; i < steps; i++) {
+        struct QueryTerm* term = &query->terms[order[i]];
+        combineRows(&candidates, &term->rows, term->negate ? 2 : 0);
+        result->planOrder[result->planSteps] = order[i];
+        result->planRows[result->planSteps++] = candidates.count;
+        if (candidates.count == 0) {
+            break;
+        }
+    }
+
+    // Check the approximate terms on what is left, then page through the matches
+    result->rowCount = 0;
+    result->total = 0;
+    for (int row = nextRow(&candidates, 0); row != -1; row = nextRow(&candidates, row + 1)) {
+        int matches = 1;
+        for (int t = 0; t < query->termCount && matches; t++) {
+            struct QueryTerm* term = &query->terms[t];
+            if (!term->exact && patientMatchesTerm(&site->patients[row], term) == term->negate) {
+                matches = 0;
+            }
+        }
+        if (!matches) {
+            continue;
+        }
+        if (result->total >= query->offset && result->rowCount < query->limit) {
+            result->rows[result->rowCount++] = row;
+        }
+        result->total++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    result->micros = (finished.tv_sec - started.tv_sec) * 1000000LL + (finished.tv_nsec - started.tv_nsec) / 1000;
+}
+
+void printQueryHelp() {
+    printf("Terms (all must match; prefix any term with ! to negate it):\n");
+    printf("  age=60-80  age>=60  age<18      emergency=1  queued=0\n");
+    printf("  disease=fever                   needs=Cardiology (requested specialty)\n");
+    printf("  specialty=General_Medicine (assigned doctor's specialty)\n");
+    printf("  doctor=5 (doctor=-1 for unassigned)   limit=20  offset=0\n");
+}
+
+void queryPatients(struct Hospital* site) {
+    printHeader("Query Patients");
+    printQueryHelp();
+    printDivider();
+
+    char line[256];
+    printf("Query: ");
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        return;
+    }
+    line[strcspn(line, "\n")] = 0;
+
+    struct PatientQuery query;
+    if (!parsePatientQuery(line, &query)) {
+        pauseExecution();
+        return;
+    }
+    struct QueryResult result;
+    runPatientQuery(site, &query, &result);
+
+    printf("\nPlan (%d patients):\n", site->index.live.count);
+    for (int i = 0; i < result.planSteps; i++) {
+        struct QueryTerm* term = &query.terms[result.planOrder[i]];
+        printf("  %d. %-28s %5d index rows -> %d candidates\n", i + 1, term->text, term->rows.count, result.planRows[i]);
+    }
+    for (int t = 0; t < query.termCount; t++) {
+        if (!query.terms[t].exact) {
+            printf("  checked per row: %s\n", query.terms[t].text);
+        }
+    }
+
+    printf("\n%-5s %-20s %-5s %-20s %-10s %-7s %-6s\n", "ID", "Name", "Age", "Disease", "Type", "Doctor", "Queued");
+    printDivider();
+    for (int i = 0; i < result.rowCount; i++) {
+        int row = result.rows[i];
+        const struct Patient* patient = &site->patients[row];
+        printf("%-5d %-20s %-5d %-20s %-10s %-7d %-6s\n", patient->id, patient->name, patient->age, patient->disease,
+               patient->isEmergency ? "Emergency" : "Regular", patient->assignedDoctorId,
+               hasRow(&site->index.queued, row) ? "Yes" : "No");
+    }
+    printf("\nShowing %d of %d matches (offset %d) in %lld microseconds.\n",
+           result.rowCount, result.total, query.offset, result.micros);
+    pauseExecution();
+}
+
+// Doctors are few and their table is compacted on removal, so they are
+// filtered by a scan rather than indexed
+void queryDoctors(struct Hospital* site) {
+    printHeader("Query Doctors");
+    printf("Specialty (blank for any, spaces as _): ");
+    char line[MAX_NAME_LEN];
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        return;
+    }
+    line[strcspn(line, "\n")] = 0;
+    int bucket = -1;
+    if (line[0] != '\0') {
+        bucket = parseSpecialtyName(line);
+        if (bucket == -1) {
+            printf("Unknown specialty.\n");
+            pauseExecution();
+            return;
+        }
+    }
+    int onlyAvailable;
+    printf("Only doctors on shift with a free slot? (1-Yes, 0-No): ");
+    scanf("%d", &onlyAvailable);
+    getchar();
+
+    printf("\n%-5s %-20s %-20s %-10s %-10s\n", "ID", "Name", "Specialty", "Free", "Patients");
+    printDivider();
+    int minuteOfDay = currentMinuteOfDay();
+    int shown = 0;
+    for (int i = 0; i < site->doctorCount; i++) {
+        struct Doctor* doctor = &site->doctors[i];
+        if ((bucket != -1 && specialtyBucket(doctor->specialty) != bucket) ||
+            (onlyAvailable && !isDoctorAvailable(doctor, minuteOfDay))) {
+            continue;
+        }
+        struct RowBitmap assigned;
+        patientsOfDoctor(&site->index, doctor->id, &assigned);
+        char slots[24];
+        snprintf(slots, sizeof(slots), "%d/%d", freeSlotCount(doctor), doctor->capacity);
+        printf("%-5d %-20s %-20s %-10s %-10d\n", doctor->id, doctor->name, doctor->specialty, slots,
+               assigned.count);
+        shown++;
+    }
+    printf("\n%d doctor(s) found.\n", shown);
+    pauseExecution();
+}
+
+#define ARCHIVE_LIST_PAGE 20
+
+// Patients or doctors in ID order from `fromId`, one screen at a time
+void listArchive(struct Hospital* site, int tree, int fromId) {
+    struct ArchiveCursor cursor;
+    archiveSeek(site->archive, tree, fromId, &cursor);
+    struct Patient patient;
+    struct Doctor doctor;
+    while (1) {
+        if (tree == ARCHIVE_PATIENTS) {
+            printf("%-6s %-20s %-5s %-20s %-8s %-8s\n", "ID", "Name", "Age", "Disease", "Visits", "Status");
+        } else {
+            printf("%-6s %-20s %-20s %-10s %-10s\n", "ID", "Name", "Specialty", "Slots", "Attended");
+        }
+        printDivider();
+        int shown = 0;
+        while (shown < ARCHIVE_LIST_PAGE && archiveNext(&cursor, tree == ARCHIVE_PATIENTS ? (void*)&patient : (void*)&doctor)) {
+            if (tree == ARCHIVE_PATIENTS) {
+                printf("%-6d %-20s %-5d %-20s %-8d %-8s\n", patient.id, patient.name, patient.age, patient.disease,
+                       patient.visitCount, findPatientIndex(site->patients, patient.id) != -1 ? "Active" : "Archived");
+            } else {
+                printf("%-6d %-20s %-20s %-10d %-10d\n", doctor.id, doctor.name, doctor.specialty,
+                       doctor.capacity, doctor.patientsAttended);
+            }
+            shown++;
+        }
+        if (shown < ARCHIVE_LIST_PAGE) {
+            printf("\nEnd of archive.\n");
+            return;
+        }
+        printf("\nShow the next %d? (1-Yes, 0-No): ", ARCHIVE_LIST_PAGE);
+        int more;
+        scanf("%d", &more);
+        getchar();
+        if (!more) {
+            return;
+        }
+    }
+}
+
+void manageArchive(struct Hospital* site) {
+    printHeader("Patient Archive");
+    if (site->archive == NULL) {
+        printf("No patient archive is open for this site.\n");
+        pauseExecution();
+        return;
+    }
+    struct PatientArchive* archive = site->archive;
+    printf("1. Look Up Archived Patient\n");
+    printf("2. List Patients in ID Order\n");
+    printf("3. List Doctors in ID Order\n");
+    printf("4. Readmit Archived Patient\n");
+    printf("5. Archive Status\n");
+    printDivider();
+    printf("Enter your choice: ");
+    int choice;
+    scanf("%d", &choice);
+    getchar();
+
+    switch (choice) {
+        case 1: {
+            int id;
+            printf("Enter Patient ID: ");
+            scanf("%d", &id);
+            getchar();
+            struct timespec started, finished;
+            clock_gettime(CLOCK_MONOTONIC, &started);
+            struct Patient patient;
+            int found = archiveGet(archive, ARCHIVE_PATIENTS, id, &patient);
+            clock_gettime(CLOCK_MONOTONIC, &finished);
+            if (!found) {
+                printf("Patient not found in the archive.\n");
+                break;
+            }
+            printPatientDetails(&patient);
+            printVisitHistory(&patient, site->doctors);
+            printf("Found in %lld microseconds.\n",
+                   (finished.tv_sec - started.tv_sec) * 1000000LL + (finished.tv_nsec - started.tv_nsec) / 1000);
+            break;
+        }
+        case 2:
+        case 3: {
+            int fromId;
+            printf("Start from ID: ");
+            scanf("%d", &fromId);
+            getchar();
+            listArchive(site, choice == 2 ? ARCHIVE_PATIENTS : ARCHIVE_DOCTORS, fromId);
+            break;
+        }
+        case 4: {
+            int id;
+            printf("Enter Patient ID to readmit: ");
+            scanf("%d", &id);
+            getchar();
+            struct Patient patient;
+            if (findPatientIndex(site->patients, id) != -1) {
+                printf("Patient is already admitted.\n");
+                break;
+            }
+            if (!archiveGet(archive, ARCHIVE_PATIENTS, id, &patient)) {
+                printf("Patient not found in the archive.\n");
+                break;
+            }
+            char reason[MAX_NAME_LEN];
+            printf("Reason for this admission (blank to keep '%s'): ", patient.disease);
+            fgets(reason, MAX_NAME_LEN, stdin);
+            reason[strcspn(reason, "\n")] = 0;
+            if (reason[0] != '\0') {
+                strcpy(patient.disease, reason);
+            }
+            printf("Emergency case? (1-Yes, 0-No): ");
+            scanf("%d", &patient.isEmergency);
+            getchar();
+            patient.assignedDoctorId = -1;
+            if (findPatientIndex(site->patients, patient.id) != -1) {
+                printf("Patient ID %d is already admitted.\n", patient.id);
+            } else if (hospitalAdmitPatient(site, &patient) == -1) {
+                printf("Error: Maximum capacity reached for patients.\n");
+            } else {
+                printf("%s readmitted with %d earlier visit(s).\n", patient.name, patient.visitCount);
+            }
+            break;
+        }
+        case 5: {
+            struct ArchiveHeader* header = &archive->header;
+            struct BufferPool* pool = &archive->pool;
+            printf("File: %s (%d pages of %d KB)\n", archive->path, header->pageCount, ARCHIVE_PAGE_SIZE / 1024);
+            printf("Patients: %d records, tree height %d, %d per leaf\n",
+                   header->recordCount[ARCHIVE_PATIENTS], header->height[ARCHIVE_PATIENTS], leafCapacity(ARCHIVE_PATIENTS));
+            printf("Doctors:  %d records, tree height %d, %d per leaf\n",
+                   header->recordCount[ARCHIVE_DOCTORS], header->height[ARCHIVE_DOCTORS], leafCapacity(ARCHIVE_DOCTORS));
+            long long requests = pool->hits + pool->misses;
+            printf("Buffer pool: %d frames, %lld hits, %lld misses (%.1f%% hit rate), %lld page writes\n",
+                   ARCHIVE_POOL_FRAMES, pool->hits, pool->misses,
+                   requests ? 100.0 * pool->hits / requests : 0.0, pool->writes);
+            break;
+        }
+        default:
+            printf("Invalid choice.\n");
+    }
+    pauseExecution();
+}
+
+// ---------------------------------------------------------------------------
+// Appointments
+//
+// Bookings ahead of time for doctors and for rooms and equipment. Each doctor
+// and each room has its own interval tree (a treap ordered by start time) of
+// the appointments that hold it; bookings on one tree never overlap. Every
+// node also carries the earliest start, latest end and widest free gap in its
+// subtree, so "what overlaps this window" and "first free window of this
+// length" are answered by a descent instead of a walk over the bookings.
+// Times are minutes since the epoch.
+// ---------------------------------------------------------------------------
+
+#define MAX_APPOINTMENTS 20000
+#define MAX_RESOURCES 32
+#define MAX_CALENDAR_DOCTORS (2 * MAX_DOCTORS)  // Doctors with bookings, including ones since removed
+#define MAX_SCHEDULE_ROWS 200
+#define SEARCH_HORIZON_MINUTES (90 * 24 * 60)  // How far ahead to look for a free slot
+#define CHECK_IN_EARLY_MINUTES 30  // Booked patients due this soon are checked in
+#define CALENDAR_KEEP_MINUTES (7 * 24 * 60)  // Past appointments kept when the calendar is loaded
+
+#define APPOINTMENT_BOOKED 0
+#define APPOINTMENT_ARRIVED 1  // Checked in and sent to the waiting queue
+
+// Result codes from bookAppointment (an appointment ID > 0 means success)
+#define BOOK_PATIENT_NOT_FOUND -1
+#define BOOK_DOCTOR_NOT_FOUND -2
+#define BOOK_OFF_SHIFT -3
+#define BOOK_DOCTOR_TAKEN -4
+#define BOOK_RESOURCE_NOT_FOUND -5
+#define BOOK_RESOURCE_TAKEN -6
+#define BOOK_CALENDAR_FULL -7
+
+// A room or piece of equipment that can be booked, e.g. "Room 4" of kind "Ultrasound"
+struct Resource {
+    int id;
+    char name[MAX_NAME_LEN];
+    char kind[MAX_NAME_LEN];
+};
+
+struct Appointment {
+    int id;  // 0 marks a free entry
+    int patientId;
+    int doctorId;
+    int resourceId;  // 0 when no room or equipment is booked
+    long long start;
+    long long end;
+    int status;
+};
+
+struct IntervalNode {
+    long long start;
+    long long end;
+    long long minStart;  // Over the subtree
+    long long maxEnd;
+    long long maxGap;  // Widest gap between consecutive bookings inside the subtree
+    int appointment;  // Index into AppointmentBook.appointments
+    int left;  // -1 for none; links the free list while the node is unused
+    int right;
+    unsigned int priority;
+};
+
+struct AppointmentBook {
+    struct Appointment appointments[MAX_APPOINTMENTS];
+    int appointmentCount;
+    int firstFreeAppointment;  // No free entry below this index
+    int nextAppointmentId;
+    struct IntervalNode nodes[2 * MAX_APPOINTMENTS];  // One node per doctor tree and one per resource tree
+    int freeNode;
+    int doctorIds[MAX_CALENDAR_DOCTORS];
+    int doctorRoots[MAX_CALENDAR_DOCTORS];
+    int doctorTrees;
+    struct Resource resources[MAX_RESOURCES];
+    int resourceRoots[MAX_RESOURCES];
+    int resourceCount;
+    int nextResourceId;
+    unsigned int seed;  // For treap priorities
+};
+
+void initAppointmentBook(struct AppointmentBook* book) {
+    memset(book, 0, sizeof(*book));
+    for (int i = 0; i < 2 * MAX_APPOINTMENTS; i++) {
+        book->nodes[i].left = i + 1 < 2 * MAX_APPOINTMENTS ? i + 1 : -1;
+    }
+    for (int i = 0; i < MAX_RESOURCES; i++) {
+        book->resourceRoots[i] = -1;
+    }
+    book->nextAppointmentId = 1;
+    book->nextResourceId = 1;
+    book->seed = 2463534242u;
+}
+
+void updateIntervalNode(struct AppointmentBook* book, int n) {
+    struct IntervalNode* node = &book->nodes[n];
+    node->minStart = node->start;
+    node->maxEnd = node->end;
+    node->maxGap = 0;
+    if (node->left != -1) {
+        struct IntervalNode* left = &book->nodes[node->left];
+        node->minStart = left->minStart;
+        node->maxEnd = left->maxEnd > node->maxEnd ? left->maxEnd : node->maxEnd;
+        node->maxGap = left->maxGap;
+        if (node->start - left->maxEnd > node->maxGap) {
+            node->maxGap = node->start - left->maxEnd;
+        }
+    }
+    if (node->right != -1) {
+        struct IntervalNode* right = &book->nodes[node->right];
+        node->maxEnd = right->maxEnd > node->maxEnd ? right->maxEnd : node->maxEnd;
+        if (right->maxGap > node->maxGap) {
+            node->maxGap = right->maxGap;
+        }
+        if (right->minStart - node->end > node->maxGap) {
+            node->maxGap = right->minStart - node->end;
+        }
+    }
+}
+
+int rotateIntervalRight(struct AppointmentBook* book, int n) {
+    int pivot = book->nodes[n].left;
+    book->nodes[n].left = book->nodes[pivot].right;
+    book->nodes[pivot].right = n;
+    updateIntervalNode(book, n);
+    updateIntervalNode(book, pivot);
+    return pivot;
+}
+
+int rotateIntervalLeft(struct AppointmentBook* book, int n) {
+    int pivot = book->nodes[n].right;
+    book->nodes[n].right = book->nodes[pivot].left;
+    book->nodes[pivot].left = n;
+    updateIntervalNode(book, n);
+    updateIntervalNode(book, pivot);
+    return pivot;
+}
+
+// Add node `n` to the tree at `root`, returns the new root
+int insertInterval(struct AppointmentBook* book, int root, int n) {
+    if (root == -1) {
+        updateIntervalNode(book, n);
+        return n;
+    }
+    struct IntervalNode* node = &book->nodes[root];
+    if (book->nodes[n].start < node->start) {
+        node->left = insertInterval(book, node->left, n);
+        if (book->nodes[node->left].priority > node->priority) {
+            return rotateIntervalRight(book, root);
+        }
+    } else {
+        node->right = insertInterval(book, node->right, n);
+        if (book->nodes[node->right].priority > node->priority) {
+            return rotateIntervalLeft(book, root);
+        }
+    }
+    updateIntervalNode(book, root);
+    return root;
+}
+
+// Remove the booking that starts at `start` and free its node, returns the new root
+int deleteInterval(struct AppointmentBook* book, int root, long long start) {
+    if (root == -1) {
+        return -1;
+    }
+    struct IntervalNode* node = &book->nodes[root];
+    if (start < node->start) {
+        node->left = deleteInterval(book, node->left, start);
+    } else if (start > node->start) {
+        node->right = deleteInterval(book, node->right, start);
+    } else if (node->left == -1 || node->right == -1) {
+        int child = node->left != -1 ? node->left : node->right;
+        node->left = book->freeNode;
+        book->freeNode = root;
+        return child;
+    } else if (book->nodes[node->left].priority > book->nodes[node->right].priority) {
+        root = rotateIntervalRight(book, root);
+        book->nodes[root].right = deleteInterval(book, book->nodes[root].right, start);
+    } else {
+        root = rotateIntervalLeft(book, root);
+        book->nodes[root].left = deleteInterval(book, book->nodes[root].left, start);
+    }
+    updateIntervalNode(book, root);
+    return root;
+}
+
+// Appointments on one tree that overlap [from, to), in start order
+void findOverlaps(struct AppointmentBook* book, int root, long long from, long long to, int out[], int* count, int max) {
+    if (root == -1 || *count >= max) {
+        return;
+    }
+    struct IntervalNode* node = &book->nodes[root];
+    if (node->maxEnd <= from || node->minStart >= to) {
+        return;  // Nothing in this subtree reaches the window
+    }
+    findOverlaps(book, node->left, from, to, out, count, max);
+    if (node->start < to && node->end > from && *count < max) {
+        out[(*count)++] = node->appointment;
+    }
+    findOverlaps(book, node->right, from, to, out, count, max);
+}
+
+// Earliest x >= from such that [x, x + length) overlaps no booking on the tree
+long long firstFreeWindow(struct AppointmentBook* book, int root, long long from, long long length) {
+    if (root == -1) {
+        return from;
+    }
+    struct IntervalNode* node = &book->nodes[root];
+    if (from >= node->maxEnd || from + length <= node->minStart) {
+        return from;
+    }
+    if (node->maxGap < length) {
+        return node->maxEnd;  // No gap inside the subtree is wide enough; first chance is after it
+    }
+    long long x = firstFreeWindow(book, node->left, from, length);
+    if (x + length <= node->start) {
+        return x;
+    }
+    // Anything before this booking's end would overlap it
+    return firstFreeWindow(book, node->right, x > node->end ? x : node->end, length);
+}
+
+int localMinuteOfDay(long long minute) {
+    time_t when = (time_t)(minute * 60);
+    struct tm local;
+    localtime_r(&when, &local);
+    return local.tm_hour * 60 + local.tm_min;
+}
+
+// Earliest x >= from such that [x, x + length) lies inside one of the doctor's shifts, -1 if it never can
+long long nextShiftWindow(const struct Doctor* doctor, long long from, long long length) {
+    if (doctor->shiftStart == doctor->shiftEnd) {
+        return from;
+    }
+    int shiftLength = (doctor->shiftEnd - doctor->shiftStart + 1440) % 1440;
+    if (length > shiftLength) {
+        return -1;
+    }
+    int intoShift = (localMinuteOfDay(from) - doctor->shiftStart + 1440) % 1440;  // Since the latest shift start
+    if (intoShift + length <= shiftLength) {
+        return from;
+    }
+    return from + (1440 - intoShift);  // Start of the next shift
+}
+
+int* doctorTreeRoot(struct AppointmentBook* book, int doctorId, int create) {
+    for (int i = 0; i < book->doctorTrees; i++) {
+        if (book->doctorIds[i] == doctorId) {
+            return &book->doctorRoots[i];
+        }
+    }
+    if (!create || book->doctorTrees >= MAX_CALENDAR_DOCTORS) {
+        return NULL;
+    }
+    book->doctorIds[book->doctorTrees] = doctorId;
+    book->doctorRoots[book->doctorTrees] = -1;
+    return &book->doctorRoots[book->doctorTrees++];
+}
+
+int findResourceIndex(struct AppointmentBook* book, int resourceId) {
+    for (int i = 0; i < book->resourceCount; i++) {
+        if (book->resources[i].id == resourceId) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int findAppointmentIndex(struct AppointmentBook* book, int appointmentId) {
+    for (int i = 0; i < MAX_APPOINTMENTS; i++) {
+        if (book->appointments[i].id == appointmentId && appointmentId > 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Earliest start >= from at which the doctor is on shift and free, and, when
+// `kind` is given, some resource of that kind is free too. Gives up once the
+// start would be `limit` or later. Returns -1 if there is no such start.
+long long earliestWithDoctor(struct AppointmentBook* book, const struct Doctor* doctor, long long from,
+                             long long length, const char* kind, long long limit, int* resourceId) {
+    int* root = doctorTreeRoot(book, doctor->id, 0);
+    long long x = from;
+    while (x != -1 && x < limit) {
+        long long y = firstFreeWindow(book, root != NULL ? *root : -1, x, length);
+        y = nextShiftWindow(doctor, y, length);
+        if (y == -1 || y >= limit) {
+            return -1;
+        }
+        if (y != x) {
+            x = y;  // Moved on; the new start has to be checked against the bookings again
+            continue;
+        }
+        if (kind == NULL || kind[0] == '\0') {
+            *resourceId = 0;
+            return x;
+        }
+        long long earliestResource = -1;
+        for (int i = 0; i < book->resourceCount; i++) {
+            if (strcasecmp(book->resources[i].kind, kind) != 0) {
+                continue;
+            }
+            long long r = firstFreeWindow(book, book->resourceRoots[i], x, length);
+            if (earliestResource == -1 || r < earliestResource) {
+                earliestResource = r;
+                *resourceId = book->resources[i].id;
+            }
+        }
+        if (earliestResource == -1) {
+            return -1;  // No resource of that kind
+        }
+        if (earliestResource == x) {
+            return x;
+        }
+        x = earliestResource;
+    }
+    return -1;
+}
+
+// Earliest free slot with any doctor of a specialty. Each doctor's search
+// stops at the best start found so far, so later doctors cost little.
+long long findEarliestSlot(struct Hospital* site, const char* specialty, long long from, long long length,
+                           const char* kind, int* doctorId, int* resourceId) {
+    long long best = -1;
+    for (int i = 0; i < site->doctorCount; i++) {
+        if (strcmp(site->doctors[i].specialty, specialty) != 0) {
+            continue;
+        }
+        int resource = 0;
+        long long limit = best != -1 ? best : from + SEARCH_HORIZON_MINUTES;
+        long long start = earliestWithDoctor(site->calendar, &site->doctors[i], from, length, kind, limit, &resource);
+        if (start != -1) {
+            best = start;
+            *doctorId = site->doctors[i].id;
+            *resourceId = resource;
+        }
+    }
+    return best;
+}
+
+int bookAppointment(struct Hospital* site, int patientId, int doctorId, int resourceId, long long start, long long length) {
+    struct AppointmentBook* book = site->calendar;
+    if (findPatientIndex(site->patients, patientId) == -1) {
+        return BOOK_PATIENT_NOT_FOUND;
+    }
+    int doctorIndex = findDoctorIndex(site, doctorId);
+    if (doctorIndex == -1) {
+        return BOOK_DOCTOR_NOT_FOUND;
+    }
+    if (nextShiftWindow(&site->doctors[doctorIndex], start, length) != start) {
+        return BOOK_OFF_SHIFT;
+    }
+    int* doctorRoot = doctorTreeRoot(book, doctorId, 1);
+    if (doctorRoot == NULL || book->appointmentCount >= MAX_APPOINTMENTS) {
+        return BOOK_CALENDAR_FULL;
+    }
+    if (firstFreeWindow(book, *doctorRoot, start, length) != start) {
+        return BOOK_DOCTOR_TAKEN;
+    }
+    int resourceIndex = -1;
+    if (resourceId != 0) {
+        resourceIndex = findResourceIndex(book, resourceId);
+        if (resourceIndex == -1) {
+            return BOOK_RESOURCE_NOT_FOUND;
+        }
+        if (firstFreeWindow(book, book->resourceRoots[resourceIndex], start, length) != start) {
+            return BOOK_RESOURCE_TAKEN;
+        }
+    }
+
+    int slot = book->firstFreeAppointment;
+    while (book->appointments[slot].id != 0) {
+        slot++;
+    }
+    book->firstFreeAppointment = slot + 1;
+    struct Appointment* appointment = &book->appointments[slot];
+    appointment->id = book->nextAppointmentId++;
+    appointment->patientId = patientId;
+    appointment->doctorId = doctorId;
+    appointment->resourceId = resourceId;
+    appointment->start = start;
+    appointment->end = start + length;
+    appointment->status = APPOINTMENT_BOOKED;
+    book->appointmentCount++;
+
+    // One node in the doctor's tree and, if a resource is booked, one in its tree
+    for (int tree = 0; tree < (resourceIndex != -1 ? 2 : 1); tree++) {
+        int n = book->freeNode;
+        book->freeNode = book->nodes[n].left;
+        book->seed ^= book->seed << 13;
+        book->seed ^= book->seed >> 17;
+        book->seed ^= book->seed << 5;
+        book->nodes[n].start = start;
+        book->nodes[n].end = start + length;
+        book->nodes[n].appointment = slot;
+        book->nodes[n].left = book->nodes[n].right = -1;
+        book->nodes[n].priority = book->seed;
+        int* root = tree == 0 ? doctorRoot : &book->resourceRoots[resourceIndex];
+        *root = insertInterval(book, *root, n);
+    }
+    return appointment->id;
+}
+
+void removeAppointment(struct AppointmentBook* book, int index) {
+    struct Appointment* appointment = &book->appointments[index];
+    int* doctorRoot = doctorTreeRoot(book, appointment->doctorId, 0);
+    if (doctorRoot != NULL) {
+        *doctorRoot = deleteInterval(book, *doctorRoot, appointment->start);
+    }
+    int resourceIndex = findResourceIndex(book, appointment->resourceId);
+    if (resourceIndex != -1) {
+        book->resourceRoots[resourceIndex] = deleteInterval(book, book->resourceRoots[resourceIndex], appointment->start);
+    }
+    appointment->id = 0;
+    book->appointmentCount--;
+    if (index < book->firstFreeAppointment) {
+        book->firstFreeAppointment = index;
+    }
+}
+
+// Send a booked patient who has arrived to the waiting queue
+int checkInAppointment(struct Hospital* site, int index) {
+    struct Appointment* appointment = &site->calendar->appointments[index];
+    if (appointment->status != APPOINTMENT_BOOKED || !hospitalEnqueue(site, appointment->patientId)) {
+        return 0;
+    }
+    appointment->status = APPOINTMENT_ARRIVED;
+    return 1;
+}
+
+// Check in every booked patient due before now + CHECK_IN_EARLY_MINUTES, earliest first
+int checkInDueAppointments(struct Hospital* site, long long now) {
+    struct AppointmentBook* book = site->calendar;
+    int due[MAX_SCHEDULE_ROWS];
+    int count = 0;
+    for (int i = 0; i < book->doctorTrees; i++) {
+        int found = 0;
+        findOverlaps(book, book->doctorRoots[i], now - 24 * 60, now + CHECK_IN_EARLY_MINUTES, due, &found, MAX_SCHEDULE_ROWS);
+        for (int j = 0; j < found; j++) {
+            if (book->appointments[due[j]].start <= now + CHECK_IN_EARLY_MINUTES && checkInAppointment(site, due[j])) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+long long minutesNow() {
+    return (long long)time(NULL) / 60;
+}
+
+// "YYYY-MM-DD HH:MM" in local time, -1 if it does not parse
+long long parseDateTime(const char* text) {
+    struct tm local;
+    memset(&local, 0, sizeof(local));
+    if (sscanf(text, "%d-%d-%d %d:%d", &local.tm_year, &local.tm_mon, &local.tm_mday, &local.tm_hour, &local.tm_min) != 5) {
+        return -1;
+    }
+    local.tm_year -= 1900;
+    local.tm_mon -= 1;
+    local.tm_isdst = -1;
+    time_t when = mktime(&local);
+    return when == (time_t)-1 ? -1 : (long long)when / 60;
+}
+
+void formatDateTime(long long minute, char out[20]) {
+    time_t when = (time_t)(minute * 60);
+    struct tm local;
+    localtime_r(&when, &local);
+    strftime(out, 20, "%Y-%m-%d %H:%M", &local);
+}
+
+// Read a date and time, or take `fallback` when the line is left empty
+long long readDateTime(const char* prompt, long long fallback) {
+    char line[64];
+    printf("%s", prompt);
+    if (fgets(line, sizeof(line), stdin) == NULL || line[0] == '\n') {
+        return fallback;
+    }
+    return parseDateTime(line);
+}
+
+// The calendar sits next to the data file: hospital_data.bin -> hospital_data.appt
+void calendarPath(struct Hospital* site, char path[MAX_NAME_LEN + 32]) {
+    snprintf(path, MAX_NAME_LEN + 32, "%s", site->dataFile);
+    char* extension = strrchr(path, '.');
+    if (extension != NULL && strcmp(extension, ".bin") == 0) {
+        *extension = '\0';
+    }
+    strncat(path, ".appt", MAX_NAME_LEN + 32 - strlen(path) - 1);
+}
+
+void saveSiteCalendar(struct Hospital* site) {
+    struct AppointmentBook* book = site->calendar;
+    if (book == NULL) {
+        return;
+    }
+    char path[MAX_NAME_LEN + 32];
+    calendarPath(site, path);
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        printf("Error opening appointment file for writing\n");
+        return;
+    }
+    fwrite(&book->resourceCount, sizeof(int), 1, fp);
+    fwrite(&book->nextResourceId, sizeof(int), 1, fp);
+    fwrite(&book->nextAppointmentId, sizeof(int), 1, fp);
+    fwrite(&book->appointmentCount, sizeof(int), 1, fp);
+    fwrite(book->resources, sizeof(struct Resource), book->resourceCount, fp);
+    for (int i = 0; i < MAX_APPOINTMENTS; i++) {
+        if (book->appointments[i].id != 0) {
+            fwrite(&book->appointments[i], sizeof(struct Appointment), 1, fp);
+        }
+    }
+    fclose(fp);
+}
+
+// Load the site's calendar and rebuild its trees; appointments long past are dropped
+void loadSiteCalendar(struct Hospital* site) {
+    struct AppointmentBook* book = malloc(sizeof(struct AppointmentBook));
+    if (book == NULL) {
+        printf("Continuing without appointments for site %s\n", site->siteName);
+        return;
+    }
+    initAppointmentBook(book);
+    site->calendar = book;
+
+    char path[MAX_NAME_LEN + 32];
+    calendarPath(site, path);
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return;
+    }
+    int resourceCount = 0;
+    int appointmentCount = 0;
+    if (fread(&resourceCount, sizeof(int), 1, fp) != 1 || fread(&book->nextResourceId, sizeof(int), 1, fp) != 1 ||
+        fread(&book->nextAppointmentId, sizeof(int), 1, fp) != 1 || fread(&appointmentCount, sizeof(int), 1, fp) != 1 ||
+        resourceCount < 0 || resourceCount > MAX_RESOURCES ||
+        fread(book->resources, sizeof(struct Resource), resourceCount, fp) != (size_t)resourceCount) {
+        printf("Error reading appointment file %s\n", path);
+        fclose(fp);
+        return;
+    }
+    book->resourceCount = resourceCount;
+    long long keepFrom = minutesNow() - CALENDAR_KEEP_MINUTES;
+    struct Appointment appointment;
+    for (int i = 0; i < appointmentCount && fread(&appointment, sizeof(appointment), 1, fp) == 1; i++) {
+        if (appointment.end < keepFrom) {
+            continue;
+        }
+        int nextId = book->nextAppointmentId;
+        int id = bookAppointment(site, appointment.patientId, appointment.doctorId, appointment.resourceId,
+                                 appointment.start, appointment.end - appointment.start);
+        if (id > 0) {
+            // Loading leaves no holes, so it went in the last entry; keep the saved ID and status
+            book->appointments[book->appointmentCount - 1].id = appointment.id;
+            book->appointments[book->appointmentCount - 1].status = appointment.status;
+        }
+        book->nextAppointmentId = nextId;
+    }
+    fclose(fp);
+}
+
+void printAppointment(struct Hospital* site, const struct Appointment* appointment) {
+    char start[20];
+    formatDateTime(appointment->start, start);
+    int patientIndex = findPatientIndex(site->patients, appointment->patientId);
+    int doctorIndex = findDoctorIndex(site, appointment->doctorId);
+    int resourceIndex = findResourceIndex(site->calendar, appointment->resourceId);
+    printf("%-6d %-17s %-5lld %-20s %-20s %-12s %-8s\n", appointment->id, start, appointment->end - appointment->start,
+           patientIndex != -1 ? site->patients[patientIndex].name : "(not admitted)",
+           doctorIndex != -1 ? site->doctors[doctorIndex].name : "(doctor left)",
+           resourceIndex != -1 ? site->calendar->resources[resourceIndex].name : "-",
+           appointment->status == APPOINTMENT_ARRIVED ? "Arrived" : "Booked");
+}
+
+void printAppointmentHeader() {
+    printf("%-6s %-17s %-5s %-20s %-20s %-12s %-8s\n", "ID", "Start", "Mins", "Patient", "Doctor", "Room", "Status");
+    printDivider();
+}
+
+const char* bookingError(int code) {
+    switch (code) {
+        case BOOK_PATIENT_NOT_FOUND: return "Patient not found.";
+        case BOOK_DOCTOR_NOT_FOUND: return "Doctor not found.";
+        case BOOK_OFF_SHIFT: return "The doctor is not on shift for the whole appointment.";
+        case BOOK_DOCTOR_TAKEN: return "The doctor already has an appointment in that time.";
+        case BOOK_RESOURCE_NOT_FOUND: return "Room or equipment not found.";
+        case BOOK_RESOURCE_TAKEN: return "The room or equipment is already booked in that time.";
+        case BOOK_CALENDAR_FULL: return "The appointment calendar is full.";
+    }
+    return "Booking failed.";
+}
+
+void bookAppointmentScreen(struct Hospital* site) {
+    struct AppointmentBook* book = site->calendar;
+    int patientId, doctorId, length;
+    printf("Enter Patient ID: ");
+    scanf("%d", &patientId);
+    getchar();
+    printf("Enter Doctor ID (0 for the earliest free doctor of a specialty): ");
+    scanf("%d", &doctorId);
+    getchar();
+    printf("Length in minutes: ");
+    scanf("%d", &length);
+    getchar();
+    if (length < 1) {
+        printf("Invalid length.\n");
+        return;
+    }
+
+    long long start;
+    int resourceId = 0;
+    if (doctorId == 0) {
+        char specialtyName[MAX_NAME_LEN];
+        char kind[MAX_NAME_LEN];
+        printf("Specialty: ");
+        fgets(specialtyName, sizeof(specialtyName), stdin);
+        specialtyName[strcspn(specialtyName, "\n")] = 0;
+        printf("Room or equipment kind needed (blank for none): ");
+        fgets(kind, sizeof(kind), stdin);
+        kind[strcspn(kind, "\n")] = 0;
+        long long from = readDateTime("Earliest start (YYYY-MM-DD HH:MM, blank for now): ", minutesNow());
+        if (from == -1) {
+            printf("Invalid date and time.\n");
+            return;
+        }
+        start = findEarliestSlot(site, specialtyName, from, length, kind, &doctorId, &resourceId);
+        if (start == -1) {
+            printf("No free slot in the next %d days.\n", SEARCH_HORIZON_MINUTES / (24 * 60));
+            return;
+        }
+        char when[20];
+        formatDateTime(start, when);
+        printf("Earliest slot: %s with %s", when, site->doctors[findDoctorIndex(site, doctorId)].name);
+        if (resourceId != 0) {
+            printf(" in %s", book->resources[findResourceIndex(book, resourceId)].name);
+        }
+        int confirm;
+        printf("\nBook it? (1-Yes, 0-No): ");
+        scanf("%d", &confirm);
+        getchar();
+        if (!confirm) {
+            return;
+        }
+    } else {
+        start = readDateTime("Start (YYYY-MM-DD HH:MM): ", -1);
+        if (start == -1) {
+            printf("Invalid date and time.\n");
+            return;
+        }
+        printf("Room or equipment ID (0 for none): ");
+        scanf("%d", &resourceId);
+        getchar();
+    }
+
+    int result = bookAppointment(site, patientId, doctorId, resourceId, start, length);
+    if (result > 0) {
+        printf("Appointment %d booked.\n", result);
+        return;
+    }
+    printf("%s\n", bookingError(result));
+    if (result == BOOK_DOCTOR_TAKEN || result == BOOK_RESOURCE_TAKEN) {
+        int clashes[MAX_SCHEDULE_ROWS];
+        int count = 0;
+        int* root = result == BOOK_DOCTOR_TAKEN ? doctorTreeRoot(book, doctorId, 0)
+                                                : &book->resourceRoots[findResourceIndex(book, resourceId)];
+        findOverlaps(book, *root, start, start + length, clashes, &count, MAX_SCHEDULE_ROWS);
+        printAppointmentHeader();
+        for (int i = 0; i < count; i++) {
+            printAppointment(site, &book->appointments[clashes[i]]);
+        }
+    }
+}
+
+void findSlotScreen(struct Hospital* site) {
+    char specialtyName[MAX_NAME_LEN];
+    char kind[MAX_NAME_LEN];
+    int length;
+    printf("Specialty: ");
+    fgets(specialtyName, sizeof(specialtyName), stdin);
+    specialtyName[strcspn(specialtyName, "\n")] = 0;
+    printf("Length in minutes: ");
+    scanf("%d", &length);
+    getchar();
+    printf("Room or equipment kind needed (blank for none): ");
+    fgets(kind, sizeof(kind), stdin);
+    kind[strcspn(kind, "\n")] = 0;
+    long long from = readDateTime("Earliest start (YYYY-MM-DD HH:MM, blank for now): ", minutesNow());
+    if (from == -1 || length < 1) {
+        printf("Invalid input.\n");
+        return;
+    }
+
+    struct timespec started, finished;
+    int doctorId = 0;
+    int resourceId = 0;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    long long start = findEarliestSlot(site, specialtyName, from, length, kind, &doctorId, &resourceId);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    long long micros = (finished.tv_sec - started.tv_sec) * 1000000LL + (finished.tv_nsec - started.tv_nsec) / 1000;
+    if (start == -1) {
+        printf("No free slot in the next %d days (searched in %lld microseconds).\n",
+               SEARCH_HORIZON_MINUTES / (24 * 60), micros);
+        return;
+    }
+    char when[20];
+    formatDateTime(start, when);
+    printf("Earliest slot: %s with %s", when, site->doctors[findDoctorIndex(site, doctorId)].name);
+    if (resourceId != 0) {
+        printf(" in %s", site->calendar->resources[findResourceIndex(site->calendar, resourceId)].name);
+    }
+    printf(" (found in %lld microseconds, %d appointments on the calendar).\n", micros, site->calendar->appointmentCount);
+}
+
+// Bookings of one doctor or room that overlap a window of days
+void scheduleScreen(struct Hospital* site) {
+    struct AppointmentBook* book = site->calendar;
+    int type, id, days;
+    printf("1. Doctor  2. Room or equipment: ");
+    scanf("%d", &type);
+    getchar();
+    printf("Enter ID: ");
+    scanf("%d", &id);
+    getchar();
+    long long from = readDateTime("From (YYYY-MM-DD HH:MM, blank for now): ", minutesNow());
+    printf("Number of days: ");
+    scanf("%d", &days);
+    getchar();
+    if (from == -1 || days < 1) {
+        printf("Invalid input.\n");
+        return;
+    }
+    int root = -1;
+    if (type == 1) {
+        int* doctorRoot = doctorTreeRoot(book, id, 0);
+        root = doctorRoot != NULL ? *doctorRoot : -1;
+    } else if (findResourceIndex(book, id) != -1) {
+        root = book->resourceRoots[findResourceIndex(book, id)];
+    } else {
+        printf("Room or equipment not found.\n");
+        return;
+    }
+    int rows[MAX_SCHEDULE_ROWS];
+    int count = 0;
+    findOverlaps(book, root, from, from + (long long)days * 24 * 60, rows, &count, MAX_SCHEDULE_ROWS);
+    if (count == 0) {
+        printf("No appointments in that window.\n");
+        return;
+    }
+    printAppointmentHeader();
+    for (int i = 0; i < count; i++) {
+        printAppointment(site, &book->appointments[rows[i]]);
+    }
+}
+
+void manageResources(struct Hospital* site) {
+    struct AppointmentBook* book = site->calendar;
+    printf("%-5s %-20s %-20s\n", "ID", "Name", "Kind");
+    printDivider();
+    for (int i = 0; i < book->resourceCount; i++) {
+        printf("%-5d %-20s %-20s\n", book->resources[i].id, book->resources[i].name, book->resources[i].kind);
+    }
+    printf("\n1. Add  2. Remove  0. Back: ");
+    int choice;
+    scanf("%d", &choice);
+    getchar();
+    if (choice == 1) {
+        if (book->resourceCount >= MAX_RESOURCES) {
+            printf("Cannot add more rooms or equipment.\n");
+            return;
+        }
+        struct Resource* resource = &book->resources[book->resourceCount];
+        printf("Name (e.g. Room 4): ");
+        fgets(resource->name, MAX_NAME_LEN, stdin);
+        resource->name[strcspn(resource->name, "\n")] = 0;
+        printf("Kind (e.g. Consulting Room, Ultrasound): ");
+        fgets(resource->kind, MAX_NAME_LEN, stdin);
+        resource->kind[strcspn(resource->kind, "\n")] = 0;
+        resource->id = book->nextResourceId++;
+        book->resourceRoots[book->resourceCount++] = -1;
+        printf("Added with ID %d.\n", resource->id);
+    } else if (choice == 2) {
+        int id;
+        printf("Enter ID to remove: ");
+        scanf("%d", &id);
+        getchar();
+        int index = findResourceIndex(book, id);
+        if (index == -1) {
+            printf("Room or equipment not found.\n");
+        } else if (book->resourceRoots[index] != -1) {
+            printf("It still has appointments; cancel them first.\n");
+        } else {
+            for (int i = index; i < book->resourceCount - 1; i++) {
+                book->resources[i] = book->resources[i + 1];
+                book->resourceRoots[i] = book->resourceRoots[i + 1];
+            }
+            book->resourceCount--;
+            printf("Removed.\n");
+        }
+    }
+}
+
+void manageAppointments(struct Hospital* site) {
+    printHeader("Appointments");
+    if (site->calendar == NULL) {
+        printf("No appointment calendar is open for this site.\n");
+        pauseExecution();
+        return;
+    }
+    struct AppointmentBook* book = site->calendar;
+    printf("1. Book Appointment\n");
+    printf("2. Cancel Appointment\n");
+    printf("3. Find Earliest Free Slot\n");
+    printf("4. Doctor or Room Schedule\n");
+    printf("5. Check In Arrivals\n");
+    printf("6. Rooms and Equipment\n");
+    printDivider();
+    printf("Enter your choice: ");
+    int choice;
+    scanf("%d", &choice);
+    getchar();
+
+    switch (choice) {
+        case 1:
+            bookAppointmentScreen(site);
+            break;
+        case 2: {
+            int id;
+            printf("Enter Appointment ID to cancel: ");
+            scanf("%d", &id);
+            getchar();
+            int index = findAppointmentIndex(book, id);
+            if (index == -1) {
+                printf("Appointment not found.\n");
+            } else {
+                removeAppointment(book, index);
+                printf("Appointment cancelled.\n");
+            }
+            break;
+        }
+        case 3:
+            findSlotScreen(site);
+            break;
+        case 4:
+            scheduleScreen(site);
+            break;
+        case 5: {
+            int id;
+            printf("Enter Appointment ID (0 to check in everyone due in the next %d minutes): ", CHECK_IN_EARLY_MINUTES);
+            scanf("%d", &id);
+            getchar();
+            if (id == 0) {
+                printf("%d patient(s) checked in to the waiting queue.\n", checkInDueAppointments(site, minutesNow()));
+            } else if (findAppointmentIndex(book, id) == -1) {
+                printf("Appointment not found.\n");
+            } else if (checkInAppointment(site, findAppointmentIndex(book, id))) {
+                printf("Patient checked in to the waiting queue.\n");
+            } else {
+                printf("Could not check in (already arrived, patient not admitted, or queue full).\n");
+            }
+            break;
+        }
+        case 6:
+            manageResources(site);
+            break;
+        default:
+            printf("Invalid choice. Please try again.\n");
+    }
+    pauseExecution();
+}
+
+// ---------------------------------------------------------------------------
+// Caseload analytics
+//
+// Scans visit histories as a parallel reduction: the patient tables are cut
+// into partitions, each worker thread fills its own partial aggregates, and
+// the partials are merged once all threads are done.
+// ---------------------------------------------------------------------------
+
+#define AGE_BANDS 6
+#define ANALYTICS_PERIODS 12  // Monthly buckets, the current month first
+#define ANALYTICS_MIN_ROWS_PER_THREAD 64
+#define MAX_ANALYTICS_THREADS 64
+#define MAX_REPORT_DOCTORS (MAX_SITES * MAX_DOCTORS)
+
+const char* ageBandLabels[AGE_BANDS] = {"0-11", "12-17", "18-39", "40-59", "60-74", "75+"};
+
+struct CaseloadStats {
+    long visits;
+    long emergencyVisits;
+    long patients;  // Distinct patients seen
+    long repeatPatients;  // Patients seen more than once
+    long byAgeBand[AGE_BANDS];
+    long byDiseaseGroup[SPECIALTY_COUNT];  // Disease grouped by suggested specialty
+    long byPeriod[ANALYTICS_PERIODS + 1];  // Last bucket: older or undated
+};
+
+struct AnalyticsPartial {
+    struct CaseloadStats byDoctor[MAX_REPORT_DOCTORS];
+    struct CaseloadStats bySpecialty[SPECIALTY_COUNT + 1];
+};
+
+// Read-only inputs shared by all analytics threads
+struct AnalyticsInput {
+    struct Hospital** sites;
+    int siteCount;
+    int currentMonth;  // year * 12 + month
+    int specialtyOfDoctor[MAX_REPORT_DOCTORS];
+};
+
+struct AnalyticsTask {
+    struct AnalyticsInput* input;
+    long firstRow;  // Rows are site * MAX_PATIENTS + patient index
+    long lastRow;
+    struct AnalyticsPartial* partial;
+};
+
+int ageBand(int age) {
+    if (age < 12) return 0;
+    if (age < 18) return 1;
+    if (age < 40) return 2;
+    if (age < 60) return 3;
+    if (age < 75) return 4;
+    return 5;
+}
+
+int monthNumber(time_t when) {
+    struct tm local;
+    localtime_r(&when, &local);
+    return (local.tm_year + 1900) * 12 + local.tm_mon;
+}
+
+// Index into the report's doctor table, -1 if the doctor is unknown at that site
+int reportDoctorIndex(struct Hospital* site, int siteIndex, int doctorId) {
+    for (int i = 0; i < site->doctorCount; i++) {
+        if (site->doctors[i].id == doctorId) {
+            return siteIndex * MAX_DOCTORS + i;
+        }
+    }
+    return -1;
+}
+
+void addCaseloadVisit(struct CaseloadStats* stats, const struct Patient* patient, int diseaseGroup, int period) {
+    stats->visits++;
+    stats->emergencyVisits += patient->isEmergency ? 1 : 0;
+    stats->byAgeBand[ageBand(patient->age)]++;
+    stats->byDiseaseGroup[diseaseGroup]++;
+    stats->byPeriod[period]++;
+}
+
+void mergeCaseloadStats(struct CaseloadStats* into, const struct CaseloadStats* from) {
+    into->visits += from->visits;
+    into->emergencyVisits += from->emergencyVisits;
+    into->patients += from->patients;
+    into->repeatPatients += from->repeatPatients;
+    for (int i = 0; i < AGE_BANDS; i++) into->byAgeBand[i] += from->byAgeBand[i];
+    for (int i = 0; i < SPECIALTY_COUNT; i++) into->byDiseaseGroup[i] += from->byDiseaseGroup[i];
+    for (int i = 0; i <= ANALYTICS_PERIODS; i++) into->byPeriod[i] += from->byPeriod[i];
+}
+
+void accumulatePatientVisits(struct AnalyticsInput* input, int siteIndex, const struct Patient* patient,
+                             struct AnalyticsPartial* partial) {
+    struct Hospital* site = input->sites[siteIndex];
+    int diseaseGroup = specialtyIndex(suggestSpecialty(patient->disease));
+
+    // Visits per doctor and per specialty for this patient, for distinct and repeat counts
+    int doctorSeen[MAX_VISIT_HISTORY];
+    int doctorVisits[MAX_VISIT_HISTORY];
+    int doctorsSeen = 0;
+    int specialtyVisits[SPECIALTY_COUNT + 1] = {0};
+
+    int recorded = patient->visitCount < MAX_VISIT_HISTORY ? patient->visitCount : MAX_VISIT_HISTORY;
+    for (int v = 0; v < recorded; v++) {
+        const struct VisitRecord* visit = &patient->visitHistory[v];
+        int doctorId = visit->doctorId ? visit->doctorId : patient->assignedDoctorId;  // Older records carry no doctor
+        int doctor = reportDoctorIndex(site, siteIndex, doctorId);
+        if (doctor == -1) {
+            continue;
+        }
+        int period = ANALYTICS_PERIODS;
+        if (visit->visitTime > 0) {
+            int monthsAgo = input->currentMonth - monthNumber((time_t)visit->visitTime);
+            if (monthsAgo >= 0 && monthsAgo < ANALYTICS_PERIODS) {
+                period = monthsAgo;
+            }
+        }
+        int specialty = input->specialtyOfDoctor[doctor];
+        addCaseloadVisit(&partial->byDoctor[doctor], patient, diseaseGroup, period);
+        addCaseloadVisit(&partial->bySpecialty[specialty], patient, diseaseGroup, period);
+        specialtyVisits[specialty]++;
+
+        int k = 0;
+        while (k < doctorsSeen && doctorSeen[k] != doctor) k++;
+        if (k == doctorsSeen) {
+            doctorSeen[doctorsSeen] = doctor;
+            doctorVisits[doctorsSeen++] = 0;
+        }
+        doctorVisits[k]++;
+    }
+
+    for (int k = 0; k < doctorsSeen; k++) {
+        partial->byDoctor[doctorSeen[k]].patients++;
+        partial->byDoctor[doctorSeen[k]].repeatPatients += doctorVisits[k] > 1;
+    }
+    for (int s = 0; s <= SPECIALTY_COUNT; s++) {
+        if (specialtyVisits[s] > 0) {
+            partial->bySpecialty[s].patients++;
+            partial->bySpecialty[s].repeatPatients += specialtyVisits[s] > 1;
+        }
+    }
+}
+
+void* analyticsWorker(void* arg) {
+    struct AnalyticsTask* task = arg;
+    for (long row = task->firstRow; row < task->lastRow; row++) {
+        int siteIndex = (int)(row / MAX_PATIENTS);
+        const struct Patient* patient = &task->input->sites[siteIndex]->patients[row % MAX_PATIENTS];
+        if (patient->occupied) {
+            accumulatePatientVisits(task->input, siteIndex, patient, task->partial);
+        }
+    }
+    return NULL;
+}
+
+int analyticsThreadCount(long rows) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    long threads = rows / ANALYTICS_MIN_ROWS_PER_THREAD;
+    if (threads > cores) threads = cores;
+    if (threads > MAX_ANALYTICS_THREADS) threads = MAX_ANALYTICS_THREADS;
+    return threads < 1 ? 1 : (int)threads;
+}
+
+// Aggregate visit history across the given sites; the caller must keep them unchanged meanwhile
+void computeCaseload(struct Hospital* sites[], int siteCount, struct AnalyticsPartial* result) {
+    struct AnalyticsInput input;
+    input.sites = sites;
+    input.siteCount = siteCount;
+    input.currentMonth = monthNumber(time(NULL));
+    for (int s = 0; s < siteCount; s++) {
+        for (int d = 0; d < MAX_DOCTORS; d++) {
+            int specialty = d < sites[s]->doctorCount ? specialtyIndex(sites[s]->doctors[d].specialty) : -1;
+            input.specialtyOfDoctor[s * MAX_DOCTORS + d] = specialty == -1 ? OTHER_SPECIALTY : specialty;
+        }
+    }
+
+    long rows = (long)siteCount * MAX_PATIENTS;
+    int threadCount = analyticsThreadCount(rows);
+    struct AnalyticsTask tasks[MAX_ANALYTICS_THREADS];
+    pthread_t threads[MAX_ANALYTICS_THREADS];
+    for (int t = 0; t < threadCount; t++) {
+        tasks[t].input = &input;
+        tasks[t].firstRow = rows * t / threadCount;
+        tasks[t].lastRow = rows * (t + 1) / threadCount;
+        tasks[t].partial = t == 0 ? result : calloc(1, sizeof(struct AnalyticsPartial));
+    }
+    memset(result, 0, sizeof(*result));
+
+    // Thread 0's share runs on the calling thread
+    for (int t = 1; t < threadCount; t++) {
+        pthread_create(&threads[t], NULL, analyticsWorker, &tasks[t]);
+    }
+    analyticsWorker(&tasks[0]);
+    for (int t = 1; t < threadCount; t++) {
+        pthread_join(threads[t], NULL);
+        for (int d = 0; d < MAX_REPORT_DOCTORS; d++) {
+            mergeCaseloadStats(&result->byDoctor[d], &tasks[t].partial->byDoctor[d]);
+        }
+        for (int s = 0; s <= SPECIALTY_COUNT; s++) {
+            mergeCaseloadStats(&result->bySpecialty[s], &tasks[t].partial->bySpecialty[s]);
+        }
+        free(tasks[t].partial);
+    }
+}
+
+double sharePercent(long part, long whole) {
+    return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+int topDiseaseGroup(const struct CaseloadStats* stats) {
+    int top = 0;
+    for (int i = 1; i < SPECIALTY_COUNT; i++) {
+        if (stats->byDiseaseGroup[i] > stats->byDiseaseGroup[top]) {
+            top = i;
+        }
+    }
+    return top;
+}
+
+void displayCaseloadReport(struct Hospital* sites[], int siteCount) {
+    struct AnalyticsPartial* report = malloc(sizeof(struct AnalyticsPartial));
+    if (report == NULL) {
+        printf("Error: Not enough memory for the report\n");
+        return;
+    }
+    computeCaseload(sites, siteCount, report);
+
+    printf("Caseload by Specialty\n");
+    printf("%-18s %-7s %-9s %-7s %-8s", "Specialty", "Visits", "Patients", "Emerg%", "Repeat%");
+    for (int b = 0; b < AGE_BANDS; b++) printf(" %-6s", ageBandLabels[b]);
+    printf("\n");
+    for (int s = 0; s <= SPECIALTY_COUNT; s++) {
+        struct CaseloadStats* stats = &report->bySpecialty[s];
+        if (stats->visits == 0) continue;
+        printf("%-18s %-7ld %-9ld %6.1f%% %6.1f%% ", s == OTHER_SPECIALTY ? "Other" : specialties[s],
+               stats->visits, stats->patients, sharePercent(stats->emergencyVisits, stats->visits),
+               sharePercent(stats->repeatPatients, stats->patients));
+        for (int b = 0; b < AGE_BANDS; b++) printf(" %-6ld", stats->byAgeBand[b]);
+        printf("\n");
+    }
+
+    printf("\nCaseload by Doctor\n");
+    printf("%-5s %-20s %-12s %-7s %-9s %-7s %-8s %-18s\n", "ID", "Name", "Site", "Visits", "Patients",
+           "Emerg%", "Repeat%", "Top Disease Group");
+    for (int s = 0; s < siteCount; s++) {
+        for (int d = 0; d < sites[s]->doctorCount; d++) {
+            struct CaseloadStats* stats = &report->byDoctor[s * MAX_DOCTORS + d];
+            if (stats->visits == 0) continue;
+            printf("%-5d %-20s %-12s %-7ld %-9ld %6.1f%% %6.1f%%  %-18s\n", sites[s]->doctors[d].id,
+                   sites[s]->doctors[d].name, sites[s]->siteName, stats->visits, stats->patients,
+                   sharePercent(stats->emergencyVisits, stats->visits),
+                   sharePercent(stats->repeatPatients, stats->patients), specialties[topDiseaseGroup(stats)]);
+        }
+    }
+
+    printf("\nVisits per Month by Specialty (most recent first)\n");
+    printf("%-18s", "Specialty");
+    time_t now = time(NULL);
+    struct tm month;
+    localtime_r(&now, &month);
+    month.tm_mday = 1;
+    for (int p = 0; p < 6; p++) {
+        char label[16];
+        strftime(label, sizeof(label), "%Y-%m", &month);
+        printf(" %-8s", label);
+        month.tm_mon--;
+        mktime(&month);
+    }
+    printf(" %-8s\n", "Undated");
+    for (int s = 0; s <= SPECIALTY_COUNT; s++) {
+        struct CaseloadStats* stats = &report->bySpecialty[s];
+        if (stats->visits == 0) continue;
+        printf("%-18s", s == OTHER_SPECIALTY ? "Other" : specialties[s]);
+        for (int p = 0; p < 6; p++) printf(" %-8ld", stats->byPeriod[p]);
+        printf(" %-8ld\n", stats->byPeriod[ANALYTICS_PERIODS]);
+    }
+    free(report);
+}
+
+
+// ---------------------------------------------------------------------------
+// Multi-site deployment
+//
+// Each site (shard) owns its patients, doctors, waiting queue and data file,
+// and is served by its own worker thread. Anything that spans sites goes
+// through the router, which sends commands to the site workers in parallel
+// and waits for their answers.
+// ---------------------------------------------------------------------------
+
+#define SITE_CMD_FIND_PATIENT 0
+#define SITE_CMD_STATS 1
+#define SITE_CMD_FREE_SLOTS 2
+#define SITE_CMD_LIST_OVERFLOW 3
+#define SITE_CMD_WITHDRAW_QUEUED 4
+#define SITE_CMD_ADMIT_AND_ASSIGN 5
+#define SITE_CMD_ADMIT_AND_QUEUE 6
+#define SITE_CMD_SAVE 7
+#define SITE_CMD_INTAKE 8
+#define SITE_CMD_ASSIGN_NEXT 9
+#define SITE_CMD_DISCHARGE 10
+
+struct SiteStats {
+    int patients;
+    int doctors;
+    int queued;
+    int queuedEmergencies;
+    int freeSlots;
+    int totalSlots;
+    int patientsAttended;
+};
+
+struct SiteCommand {
+    int type;
+    int patientId;
+    int minuteOfDay;
+    char specialty[MAX_NAME_LEN];
+    struct Patient record;
+    struct SiteStats stats;
+    int ids[MAX_PATIENTS];  // Patient IDs returned by SITE_CMD_LIST_OVERFLOW, or to SITE_CMD_DISCHARGE
+    int idCount;
+    int result;
+    int done;
+    long long finishedAt;  // monotonicMicros() when the worker finished the command
+    struct SiteCommand* next;
+};
+
+struct SiteWorker {
+    struct Hospital* site;
+    pthread_t thread;
+    pthread_mutex_t lock;  // Held while the site's data is read or changed (lockSite)
+    struct SharedSite* shared;  // NULL unless the site lives in shared memory; its lock is used instead
+    pthread_mutex_t mailboxLock;
+    pthread_cond_t mailboxReady;
+    struct SiteCommand* head;
+    struct SiteCommand* tail;
+    int stopping;
+    struct ShardRouter* router;
+};
+
+struct ShardRouter {
+    struct SiteWorker workers[MAX_SITES];
+    int siteCount;
+    pthread_mutex_t doneLock;
+    pthread_cond_t doneCond;
+    struct ReplicationJournal* journal;  // NULL unless started with --replicate
+    struct ChangeFeed* feed;  // NULL unless started with --events
+    struct OperationTrace* trace;  // NULL unless started with --record
+};
+
+struct Hospital* createHospital(const char* siteName, const char* dataFile) {
+    struct Hospital* site = calloc(1, sizeof(struct Hospital));
+    if (site == NULL) {
+        return NULL;
+    }
+    snprintf(site->siteName, sizeof(site->siteName), "%s", siteName);
+    snprintf(site->dataFile, sizeof(site->dataFile), "%s", dataFile);
+    initPriorityQueue(&site->waitingQueue);
+    return site;
+}
+
+// ---------------------------------------------------------------------------
+// Shared-memory sites
+//
+// With --shared every site lives in a POSIX shared-memory segment instead of
+// this process's heap, so several terminals on one machine work on the same
+// patients, doctors and queue. The site is guarded by a process-shared robust
+// mutex: taking it costs a few atomic instructions when nobody else holds it,
+// and if a process dies holding it the next one to lock it is told so and
+// repairs the site before carrying on. The first process to attach loads the
+// data file; later ones join the live state. Archive, calendar, replication
+// and the change feed hang off per-process pointers, so shared sites run
+// without them.
+// ---------------------------------------------------------------------------
+
+#define SHARED_MAGIC 0x48534d31  // "HSM1"
+#define SHARED_ATTACH_WAIT_MS 3000  // How long a joining process waits for the creator to load the data
+
+struct SharedSite {
+    unsigned int magic;
+    unsigned int size;  // sizeof(struct SharedSite) of the build that created it
+    int ready;  // Set once the creator has loaded the data
+    pthread_mutex_t lock;  // Process-shared and robust; guards `site`
+    long long recoveries;  // Times the site was repaired after a process died holding it
+    struct Hospital site;
+};
+
+// hospital_data.bin -> /hospital_data, hospital_data_North.bin -> /hospital_data_North
+void sharedSegmentName(const char* dataFile, char name[MAX_NAME_LEN + 32]) {
+    snprintf(name, MAX_NAME_LEN + 32, "/%s", dataFile);
+    char* extension = strrchr(name, '.');
+    if (extension != NULL && strcmp(extension, ".bin") == 0) {
+        *extension = '\0';
+    }
+}
+
+// A process died while changing the site, so the change may be half done.
+// Recount the tables, drop references to patients that are not on them, and
+// rebuild everything derived from them.
+void repairSharedSite(struct SharedSite* shared) {
+    struct Hospital* site = &shared->site;
+    site->patientCount = 0;
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        site->patientCount += site->patients[i].occupied ? 1 : 0;
+    }
+
+    struct PriorityQueue* queue = &site->waitingQueue;
+    if (!isPriorityQueueEmpty(queue)) {
+        int kept = queue->front;
+        for (int i = queue->front; i <= queue->rear; i++) {
+            if (findPatientIndex(site->patients, queue->items[i].patientId) != -1) {
+                queue->items[kept++] = queue->items[i];
+            }
+        }
+        queue->rear = kept - 1;
+        if (queue->rear < queue->front) {
+            queue->front = queue->rear = -1;
+        }
+    }
+
+    for (int d = 0; d < site->doctorCount; d++) {
+        struct Doctor* doctor = &site->doctors[d];
+        for (int s = 0; s < doctor->capacity; s++) {
+            if (!(doctor->freeSlots & (1u << s)) && findPatientIndex(site->patients, doctor->slotPatientId[s]) == -1) {
+                releaseDoctorSlot(doctor, s);
+            }
+        }
+    }
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        struct Patient* patient = &site->patients[i];
+        if (!patient->occupied || patient->assignedDoctorId == -1) {
+            continue;
+        }
+        int doctorIndex = findDoctorIndex(site, patient->assignedDoctorId);
+        if (doctorIndex == -1 || findPatientSlot(&site->doctors[doctorIndex], patient->id) == -1) {
+            patient->assignedDoctorId = -1;
+        }
+    }
+
+    rebuildDashboardCounters(site);
+    rebuildPatientIndex(site);
+    shared->recoveries++;
+    printf("\n[%s] Another terminal stopped while changing this site; the site has been checked and repaired.\n",
+           site->siteName);
+}
+
+void lockSite(struct SiteWorker* worker) {
+    if (worker->shared == NULL) {
+        pthread_mutex_lock(&worker->lock);
+    } else if (pthread_mutex_lock(&worker->shared->lock) == EOWNERDEAD) {
+        repairSharedSite(worker->shared);
+        pthread_mutex_consistent(&worker->shared->lock);
+    }
+}
+
+void unlockSite(struct SiteWorker* worker) {
+    publishSiteView(worker->site);
+    pthread_mutex_unlock(worker->shared == NULL ? &worker->lock : &worker->shared->lock);
+}
+
+// Map the site's segment, creating and loading it if this is the first process
+struct SharedSite* attachSharedSite(const char* siteName, const char* dataFile) {
+    char name[MAX_NAME_LEN + 32];
+    sharedSegmentName(dataFile, name);
+    int created = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1 && errno == EEXIST) {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd == -1) {
+        printf("Error: Cannot open shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (created && ftruncate(fd, sizeof(struct SharedSite)) == -1) {
+        printf("Error: Cannot size shared memory %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // A joining process can get here before the creator has sized the segment
+    struct stat info;
+    int waited = 0;
+    while (fstat(fd, &info) == 0 && info.st_size == 0 && waited < SHARED_ATTACH_WAIT_MS) {
+        usleep(10000);
+        waited += 10;
+    }
+    if (info.st_size != (off_t)sizeof(struct SharedSite)) {
+        printf("Error: Shared memory %s was made by a different build; remove /dev/shm%s once no terminal uses it\n",
+               name, name);
+        close(fd);
+        return NULL;
+    }
+    struct SharedSite* shared = mmap(NULL, sizeof(struct SharedSite), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        printf("Error: Cannot map shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    if (created) {
+        shared->magic = SHARED_MAGIC;
+        shared->size = sizeof(struct SharedSite);
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&shared->lock, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+
+        struct Hospital* site = &shared->site;
+        snprintf(site->siteName, sizeof(site->siteName), "%s", siteName);
+        snprintf(site->dataFile, sizeof(site->dataFile), "%s", dataFile);
+        initPriorityQueue(&site->waitingQueue);
+        loadData(dataFile, site->patients, &site->patientCount, site->doctors, &site->doctorCount);
+        rebuildDashboardCounters(site);
+        rebuildPatientIndex(site);
+        __atomic_store_n(&shared->ready, 1, __ATOMIC_RELEASE);
+        printf("Shared site %s created in %s\n", siteName, name);
+        return shared;
+    }
+
+    for (waited = 0; !__atomic_load_n(&shared->ready, __ATOMIC_ACQUIRE) && waited < SHARED_ATTACH_WAIT_MS; waited += 10) {
+        usleep(10000);
+    }
+    if (!__atomic_load_n(&shared->ready, __ATOMIC_ACQUIRE) || shared->magic != SHARED_MAGIC ||
+        shared->size != sizeof(struct SharedSite)) {
+        printf("Error: Shared memory %s was never set up (its creator stopped); remove /dev/shm%s and start again\n",
+               name, name);
+        munmap(shared, sizeof(struct SharedSite));
+        return NULL;
+    }
+    printf("Joined shared site %s (%d patients, %d doctors)\n", siteName, shared->site.patientCount,
+           shared->site.doctorCount);
+    return shared;
+}
+
+// Keyboard input for shared sites. The menus hold the site while they run,
+// so a terminal left at a prompt would hold up every other terminal; instead
+// the site is let go while this process waits for a line and taken back
+// before the menu carries on. Menus look records up by ID after reading.
+struct SiteWorker* terminalSite = NULL;  // Site the main menu holds, if any
+
+ssize_t readTerminal(void* cookie, char* buffer, size_t size) {
+    (void)cookie;
+    struct SiteWorker* held = terminalSite;
+    if (held != NULL) {
+        unlockSite(held);
+    }
+    ssize_t count = read(STDIN_FILENO, buffer, size);
+    if (held != NULL) {
+        lockSite(held);
+    }
+    return count;
+}
+
+void shareTerminalInput() {
+    cookie_io_functions_t functions = {readTerminal, NULL, NULL, NULL};
+    FILE* input = fopencookie(NULL, "r", functions);
+    if (input != NULL) {
+        stdin = input;
+    }
+}
+
+// Show a listing screen. With a published view the site is let go while the
+// screen prints, so intake carries on; the view is let go before the pause.
+// Shared sites have no view and print from the live tables, still held.
+void showSiteView(struct SiteWorker* worker, void (*screen)(const struct SiteView* view)) {
+    struct Hospital* site = worker->site;
+    if (site->views == NULL) {
+        struct SiteView* live = malloc(sizeof(struct SiteView));
+        viewLiveTables(site, live);
+        screen(live);
+        free(live);
+        pauseExecution();
+        return;
+    }
+    int held = terminalSite == worker;
+    if (held) {
+        terminalSite = NULL;
+        unlockSite(worker);
+    }
+    const struct SiteView* view;
+    int slot = beginSiteRead(site, &view);
+    screen(view);
+    endSiteRead(slot);
+    pauseExecution();
+    if (held) {
+        lockSite(worker);
+        terminalSite = worker;
+    }
+}
+
+// Month-end statements for the active site; the site is let go while the ledger is read
+void runSiteStatements(struct SiteWorker* worker) {
+    struct BillingLedger* ledger = worker->site->ledger;
+    char month[16];
+    char line[16];
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(month, sizeof(month), "%Y-%m", &local);
+    printf("Month (YYYY-MM) [%s]: ", month);
+    if (fgets(line, sizeof(line), stdin) != NULL && line[0] != '\n') {
+        line[strcspn(line, "\n")] = 0;
+        snprintf(month, sizeof(month), "%s", line);
+    }
+    long long monthStart, monthEnd;
+    if (!parseMonth(month, &monthStart, &monthEnd)) {
+        printf("Invalid month.\n");
+        return;
+    }
+    // hospital_data.ledger -> hospital_data.statements-2026-10.txt
+    char outPath[MAX_NAME_LEN + 64];
+    snprintf(outPath, sizeof(outPath), "%s", ledger->path);
+    char* extension = strrchr(outPath, '.');
+    if (extension != NULL) {
+        *extension = '\0';
+    }
+    snprintf(outPath + strlen(outPath), sizeof(outPath) - strlen(outPath), ".statements-%s.txt", month);
+
+    drainLedger(ledger);  // Everything posted so far is in the file before it is read
+    int held = terminalSite == worker;
+    if (held) {
+        terminalSite = NULL;
+        unlockSite(worker);
+    }
+    struct StatementRun run;
+    if (writeStatements(ledger->path, month, monthStart, monthEnd, outPath, &run)) {
+        printf("%lld statements for %s written to %s\n", run.statements, month, outPath);
+        printf("%lld postings read, %lld on the statements, in %.2f s\n", run.postings, run.lines, run.micros / 1e6);
+    }
+    if (held) {
+        lockSite(worker);
+        terminalSite = worker;
+    }
+}
+
+void manageBilling(struct SiteWorker* worker) {
+    struct Hospital* site = worker->site;
+    printHeader("Billing");
+    struct BillingLedger* ledger = site->ledger;
+    if (ledger == NULL) {
+        printf("No billing ledger is open for this site.\n");
+        pauseExecution();
+        return;
+    }
+    printf("1. Patient Balance\n");
+    printf("2. Record Payment\n");
+    printf("3. Revenue by Specialty\n");
+    printf("4. Month-End Statements\n");
+    printf("5. Ledger Status\n");
+    printDivider();
+    printf("Enter your choice: ");
+    int choice;
+    scanf("%d", &choice);
+    getchar();
+
+    char charged[32], paid[32], balance[32];
+    switch (choice) {
+        case 1: {
+            printHeader("Patient Balance");
+            int id;
+            printf("Enter Patient ID: ");
+            scanf("%d", &id);
+            getchar();
+            struct PatientAccount* account = findAccount(&ledger->accounts, id, 0);
+            if (account == NULL) {
+                printf("No charges posted for patient ID %d.\n", id);
+                break;
+            }
+            formatCents(account->chargedCents, charged);
+            formatCents(account->paidCents, paid);
+            formatCents(account->chargedCents - account->paidCents, balance);
+            printf("Charged: %s\nPaid:    %s\nBalance: %s\n", charged, paid, balance);
+            break;
+        }
+        case 2: {
+            printHeader("Record Payment");
+            int id;
+            double amount;
+            printf("Enter Patient ID: ");
+            scanf("%d", &id);
+            getchar();
+            printf("Enter Amount: ");
+            if (scanf("%lf", &amount) != 1) {
+                amount = 0;
+            }
+            getchar();
+            long long cents = llround(amount * 100);
+            if (findAccount(&ledger->accounts, id, 0) == NULL) {
+                printf("No charges posted for patient ID %d.\n", id);
+            } else if (cents <= 0) {
+                printf("Invalid amount.\n");
+            } else {
+                postPayment(ledger, (long long)time(NULL), id, cents);
+                struct PatientAccount* account = findAccount(&ledger->accounts, id, 0);
+                formatCents(account->chargedCents - account->paidCents, balance);
+                printf("Payment recorded. Balance: %s\n", balance);
+            }
+            break;
+        }
+        case 3: {
+            printHeader("Revenue by Specialty");
+            printf("%-20s %14s\n", "Specialty", "Revenue");
+            printDivider();
+            long long total = 0;
+            for (int s = 0; s <= SPECIALTY_COUNT; s++) {
+                if (ledger->revenueCents[s] != 0) {
+                    formatCents(ledger->revenueCents[s], balance);
+                    printf("%-20s %14s\n", s < SPECIALTY_COUNT ? specialties[s] : "Other", balance);
+                    total += ledger->revenueCents[s];
+                }
+            }
+            formatCents(total, balance);
+            printf("%-20s %14s\n", "Total", balance);
+            // Every posting debits and credits the same amount, so receivables and cash add up to revenue
+            long long owed = 0;
+            for (int i = 0; i < ledger->accounts.capacity; i++) {
+                if (ledger->accounts.slots[i].used) {
+                    owed += ledger->accounts.slots[i].chargedCents - ledger->accounts.slots[i].paidCents;
+                }
+            }
+            formatCents(owed, charged);
+            formatCents(ledger->cashCents, paid);
+            printf("\nOwed by patients %s + received %s = revenue %s (%s)\n", charged, paid, balance,
+                   owed + ledger->cashCents == total ? "balanced" : "OUT OF BALANCE");
+            break;
+        }
+        case 4:
+            printHeader("Month-End Statements");
+            runSiteStatements(worker);
+            break;
+        case 5: {
+            printHeader("Ledger Status");
+            pthread_mutex_lock(&ledger->lock);
+            long long head = ledger->head;
+            long long written = ledger->written;
+            long long batches = ledger->batches;
+            long long stalls = ledger->stalls;
+            pthread_mutex_unlock(&ledger->lock);
+            printf("File: %s\n", ledger->path);
+            printf("Postings: %lld in %lld entries (%lld read back at startup)\n", head, ledger->entry, ledger->replayed);
+            printf("Patient accounts: %d\n", ledger->accounts.count);
+            printf("Waiting for the writer: %lld postings\n", head - written);
+            printf("Written this session in %lld batches; %lld postings waited for room\n", batches, stalls);
+            break;
+        }
+        default:
+            printf("Invalid choice. Please try again.\n");
+    }
+    pauseExecution();
+}
+
+void collectSiteStats(struct Hospital* site, struct SiteStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->patients = site->patientCount;
+    stats->doctors = site->doctorCount;
+    if (!isPriorityQueueEmpty(&site->waitingQueue)) {
+        for (int i = site->waitingQueue.front; i <= site->waitingQueue.rear; i++) {
+            stats->queued++;
+            stats->queuedEmergencies += site->waitingQueue.items[i].priority;
+        }
+    }
+    for (int i = 0; i < site->doctorCount; i++) {
+        stats->freeSlots += freeSlotCount(&site->doctors[i]);
+        stats->totalSlots += site->doctors[i].capacity;
+        stats->patientsAttended += site->doctors[i].patientsAttended;
+    }
+}
+
+// Runs on the site's worker thread with the site lock held
+void executeSiteCommand(struct Hospital* site, struct SiteCommand* cmd) {
+    switch (cmd->type) {
+        case SITE_CMD_FIND_PATIENT: {
+            int index = findPatientIndex(site->patients, cmd->patientId);
+            cmd->result = index != -1;
+            if (index != -1) {
+                cmd->record = site->patients[index];
+            }
+            break;
+        }
+        case SITE_CMD_STATS:
+            collectSiteStats(site, &cmd->stats);
+            break;
+        case SITE_CMD_FREE_SLOTS:
+            // None for a referral whose patient ID is already taken here
+            cmd->result = cmd->patientId != 0 && findPatientIndex(site->patients, cmd->patientId) != -1 ? 0 :
+                countAvailableSlotsInSpecialty(site->doctors, site->doctorCount, cmd->specialty, cmd->minuteOfDay);
+            break;
+        case SITE_CMD_LIST_OVERFLOW: {
+            // Queued patients whose specialty has no free doctor at this site
+            struct PriorityQueue* q = &site->waitingQueue;
+            cmd->idCount = 0;
+            if (isPriorityQueueEmpty(q)) {
+                break;
+            }
+            for (int i = q->front; i <= q->rear; i++) {
+                int index = findPatientIndex(site->patients, q->items[i].patientId);
+                if (index != -1 &&
+                    countAvailableSlotsInSpecialty(site->doctors, site->doctorCount,
+                                                   requestedSpecialty(&site->patients[index]), cmd->minuteOfDay) == 0) {
+                    cmd->ids[cmd->idCount++] = q->items[i].patientId;
+                }
+            }
+            break;
+        }
+        case SITE_CMD_WITHDRAW_QUEUED: {
+            int index = findPatientIndex(site->patients, cmd->patientId);
+            cmd->result = index != -1 && hospitalWithdrawFromQueue(site, cmd->patientId);
+            if (cmd->result) {
+                cmd->record = site->patients[index];
+                hospitalDischargePatient(site, cmd->patientId);
+            }
+            break;
+        }
+        case SITE_CMD_ADMIT_AND_ASSIGN: {
+            cmd->result = -1;
+            int doctorIndex = findAvailableDoctor(site->doctors, site->doctorCount,
+                                                  requestedSpecialty(&cmd->record), cmd->minuteOfDay);
+            if (doctorIndex == -1 || hospitalAdmitPatient(site, &cmd->record) == -1) {
+                break;
+            }
+            if (hospitalAssign(site, cmd->record.id, site->doctors[doctorIndex].id) >= 0) {
+                cmd->result = site->doctors[doctorIndex].id;
+            } else {
+                hospitalDischargePatient(site, cmd->record.id);
+            }
+            break;
+        }
+        case SITE_CMD_ADMIT_AND_QUEUE:
+            cmd->result = hospitalAdmitPatient(site, &cmd->record) != -1;
+            if (cmd->result) {
+                hospitalEnqueue(site, cmd->record.id);
+            }
+            break;
+        case SITE_CMD_INTAKE: {
+            // Admit and queue; an emergency goes through the fast lane. Result is -1 if the site is
+            // full or already holds the ID
+            struct EmergencyDispatch dispatch;
+            cmd->result = -1;
+            if (hospitalAdmitPatient(site, &cmd->record) != -1) {
+                if (enqueueWithFastLane(site, cmd->record.id, &dispatch)) {
+                    cmd->result = dispatch.outcome;
+                } else {
+                    hospitalDischargePatient(site, cmd->record.id);
+                }
+            }
+            break;
+        }
+        case SITE_CMD_ASSIGN_NEXT: {
+            // First queued patient, in queue order, that an on-shift doctor of their specialty can take
+            struct PriorityQueue* q = &site->waitingQueue;
+            cmd->result = -1;
+            for (int i = q->front; !isPriorityQueueEmpty(q) && i <= q->rear; i++) {
+                int patientId = q->items[i].patientId;
+                int index = findPatientIndex(site->patients, patientId);
+                int doctorIndex = index == -1 ? -1 :
+                    findFreeDoctor(site, requestedSpecialty(&site->patients[index]), cmd->minuteOfDay);
+                if (doctorIndex != -1) {
+                    hospitalWithdrawFromQueue(site, patientId);
+                    if (hospitalAssign(site, patientId, site->doctors[doctorIndex].id) >= 0) {
+                        cmd->result = patientId;
+                    } else {
+                        hospitalRequeueFront(site, patientId);
+                    }
+                    break;
+                }
+            }
+            break;
+        }
+        case SITE_CMD_DISCHARGE:
+            cmd->result = 0;
+            for (int i = 0; i < cmd->idCount; i++) {
+                cmd->result += hospitalDischargePatient(site, cmd->ids[i]);
+            }
+            break;
+        case SITE_CMD_SAVE:
+            saveData(site->dataFile, site->patients, site->patientCount, site->doctors, site->doctorCount);
+            syncSiteArchive(site);
+            saveSiteCalendar(site);
+            traceAppend(site, JOURNAL_SAVE, 0, 0, 0, NULL, 0);
+            break;
+    }
+}
+
+void* siteWorkerMain(void* arg) {
+    struct SiteWorker* worker = arg;
+    while (1) {
+        pthread_mutex_lock(&worker->mailboxLock);
+        while (worker->head == NULL && !worker->stopping) {
+            pthread_cond_wait(&worker->mailboxReady, &worker->mailboxLock);
+        }
+        struct SiteCommand* cmd = worker->head;
+        if (cmd == NULL) {
+            pthread_mutex_unlock(&worker->mailboxLock);
+            break;
+        }
+        worker->head = cmd->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        pthread_mutex_unlock(&worker->mailboxLock);
+
+        lockSite(worker);
+        executeSiteCommand(worker->site, cmd);
+        unlockSite(worker);
+        cmd->finishedAt = monotonicMicros();
+
+        pthread_mutex_lock(&worker->router->doneLock);
+        cmd->done = 1;
+        pthread_cond_broadcast(&worker->router->doneCond);
+        pthread_mutex_unlock(&worker->router->doneLock);
+    }
+    return NULL;
+}
+
+// Queue a command for a site without waiting for it
+void routerSubmit(struct ShardRouter* router, int siteIndex, struct SiteCommand* cmd) {
+    struct SiteWorker* worker = &router->workers[siteIndex];
+    cmd->done = 0;
+    cmd->next = NULL;
+    pthread_mutex_lock(&worker->mailboxLock);
+    if (worker->tail) {
+        worker->tail->next = cmd;
+    } else {
+        worker->head = cmd;
+    }
+    worker->tail = cmd;
+    pthread_cond_signal(&worker->mailboxReady);
+    pthread_mutex_unlock(&worker->mailboxLock);
+}
+
+void routerWait(struct ShardRouter* router, struct SiteCommand* cmd) {
+    pthread_mutex_lock(&router->doneLock);
+    while (!cmd->done) {
+        pthread_cond_wait(&router->doneCond, &router->doneLock);
+    }
+    pthread_mutex_unlock(&router->doneLock);
+}
+
+void routerCall(struct ShardRouter* router, int siteIndex, struct SiteCommand* cmd) {
+    routerSubmit(router, siteIndex, cmd);
+    routerWait(router, cmd);
+}
+
+// Send the same command to every site at once; cmds has one entry per site
+void routerBroadcast(struct ShardRouter* router, struct SiteCommand cmds[]) {
+    for (int i = 0; i < router->siteCount; i++) {
+        routerSubmit(router, i, &cmds[i]);
+    }
+    for (int i = 0; i < router->siteCount; i++) {
+        routerWait(router, &cmds[i]);
+    }
+}
+
+void initRouter(struct ShardRouter* router) {
+    memset(router, 0, sizeof(*router));
+    pthread_mutex_init(&router->doneLock, NULL);
+    pthread_cond_init(&router->doneCond, NULL);
+}
+
+// Give a loaded site the next worker thread; `shared` is its segment, or NULL
+void startSiteWorker(struct ShardRouter* router, struct Hospital* site, struct SharedSite* shared) {
+    struct SiteWorker* worker = &router->workers[router->siteCount];
+    worker->site = site;
+    worker->shared = shared;
+    worker->router = router;
+    site->siteNumber = router->siteCount;
+    if (shared == NULL) {
+        enableSiteViews(site);
+    }
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_mutex_init(&worker->mailboxLock, NULL);
+    pthread_cond_init(&worker->mailboxReady, NULL);
+    pthread_create(&worker->thread, NULL, siteWorkerMain, worker);
+    router->siteCount++;
+}
+
+// With `shared` set the sites are attached from shared memory (attachSharedSite)
+int startRouter(struct ShardRouter* router, char* siteNames[], int siteCount, int shared) {
+    initRouter(router);
+    for (int i = 0; i < siteCount && i < MAX_SITES; i++) {
+        char dataFile[MAX_NAME_LEN + 32];
+        if (siteCount == 1 && strcmp(siteNames[0], "Main") == 0) {
+            strcpy(dataFile, "hospital_data.bin");
+        } else {
+            snprintf(dataFile, sizeof(dataFile), "hospital_data_%s.bin", siteNames[i]);
+        }
+        if (shared) {
+            struct SharedSite* segment = attachSharedSite(siteNames[i], dataFile);
+            if (segment == NULL) {
+                return 0;
+            }
+            startSiteWorker(router, &segment->site, segment);
+            continue;
+        }
+        struct Hospital* site = createHospital(siteNames[i], dataFile);
+        if (site == NULL) {
+            printf("Error: Not enough memory for site %s\n", siteNames[i]);
+            return 0;
+        }
+        if (siteCount > 1) {
+            printf("[%s] ", siteNames[i]);
+        }
+        loadData(dataFile, site->patients, &site->patientCount, site->doctors, &site->doctorCount);
+        rebuildDashboardCounters(site);
+        rebuildPatientIndex(site);
+        openSiteArchive(site);
+        loadSiteCalendar(site);
+        openSiteLedger(site);
+        startSiteWorker(router, site, NULL);
+    }
+    return 1;
+}
+
+// Stop replication and the change feed first (stopReplication, stopChangeFeed)
+void stopRouter(struct ShardRouter* router) {
+    for (int i = 0; i < router->siteCount; i++) {
+        struct SiteWorker* worker = &router->workers[i];
+        pthread_mutex_lock(&worker->mailboxLock);
+        worker->stopping = 1;
+        pthread_cond_signal(&worker->mailboxReady);
+        pthread_mutex_unlock(&worker->mailboxLock);
+        pthread_join(worker->thread, NULL);
+        if (worker->shared != NULL) {
+            munmap(worker->shared, sizeof(struct SharedSite));  // The segment stays for the other terminals
+            continue;
+        }
+        if (worker->site->archive != NULL) {
+            archiveClose(worker->site->archive);
+            free(worker->site->archive);
+        }
+        free(worker->site->calendar);
+        if (worker->site->ledger != NULL) {
+            closeLedger(worker->site->ledger);
+        }
+        freeSiteViews(worker->site);
+        free(worker->site);
+    }
+}
+
+// Look a patient ID up across all sites. IDs are only unique within a site (a
+// patient is known by site and ID), so every site holding the ID is returned:
+// their indexes in `sites` and records in `found`. Returns how many there are.
+int routerFindPatient(struct ShardRouter* router, int patientId, int sites[MAX_SITES], struct Patient found[MAX_SITES]) {
+    struct SiteCommand* cmds = calloc(router->siteCount, sizeof(struct SiteCommand));
+    for (int i = 0; i < router->siteCount; i++) {
+        cmds[i].type = SITE_CMD_FIND_PATIENT;
+        cmds[i].patientId = patientId;
+    }
+    routerBroadcast(router, cmds);
+    int count = 0;
+    for (int i = 0; i < router->siteCount; i++) {
+        if (cmds[i].result) {
+            sites[count] = i;
+            found[count++] = cmds[i].record;
+        }
+    }
+    free(cmds);
+    return count;
+}
+
+// Move a queued patient to the site with the most free slots in their specialty.
+// Returns the receiving site index, or -1 if the patient stays where they are.
+int routerReferPatient(struct ShardRouter* router, int fromSite, int patientId, int minuteOfDay) {
+    struct SiteCommand* cmds = calloc(router->siteCount, sizeof(struct SiteCommand));
+    cmds[fromSite].type = SITE_CMD_FIND_PATIENT;
+    cmds[fromSite].patientId = patientId;
+    routerCall(router, fromSite, &cmds[fromSite]);
+    if (!cmds[fromSite].result) {
+        free(cmds);
+        return -1;
+    }
+    const char* specialty = requestedSpecialty(&cmds[fromSite].record);
+
+    // Ask every other site for free capacity in parallel
+    for (int i = 0; i < router->siteCount; i++) {
+        cmds[i].type = SITE_CMD_FREE_SLOTS;
+        cmds[i].patientId = patientId;
+        cmds[i].minuteOfDay = minuteOfDay;
+        strcpy(cmds[i].specialty, specialty);
+        if (i != fromSite) {
+            routerSubmit(router, i, &cmds[i]);
+        }
+    }
+    int target = -1;
+    for (int i = 0; i < router->siteCount; i++) {
+        if (i == fromSite) {
+            continue;
+        }
+        routerWait(router, &cmds[i]);
+        if (cmds[i].result > 0 && (target == -1 || cmds[i].result > cmds[target].result)) {
+            target = i;
+        }
+    }
+    free(cmds);
+    if (target == -1) {
+        return -1;
+    }
+
+    struct SiteCommand withdraw = {0};
+    withdraw.type = SITE_CMD_WITHDRAW_QUEUED;
+    withdraw.patientId = patientId;
+    routerCall(router, fromSite, &withdraw);
+    if (!withdraw.result) {
+        return -1;
+    }
+
+    struct SiteCommand admit = {0};
+    admit.type = SITE_CMD_ADMIT_AND_ASSIGN;
+    admit.minuteOfDay = minuteOfDay;
+    admit.record = withdraw.record;
+    routerCall(router, target, &admit);
+    if (admit.result == -1) {
+        // Capacity vanished in the meantime, put the patient back in their queue
+        struct SiteCommand restore = {0};
+        restore.type = SITE_CMD_ADMIT_AND_QUEUE;
+        restore.record = withdraw.record;
+        routerCall(router, fromSite, &restore);
+        return -1;
+    }
+    return target;
+}
+
+// Refer every queued patient at a site who has no local specialist available
+int routerReferOverflow(struct ShardRouter* router, int fromSite, int minuteOfDay) {
+    struct SiteCommand* list = calloc(1, sizeof(struct SiteCommand));
+    list->type = SITE_CMD_LIST_OVERFLOW;
+    list->minuteOfDay = minuteOfDay;
+    routerCall(router, fromSite, list);
+
+    int referred = 0;
+    for (int i = 0; i < list->idCount; i++) {
+        int target = routerReferPatient(router, fromSite, list->ids[i], minuteOfDay);
+        if (target != -1) {
+            printf("Patient %d referred to %s\n", list->ids[i], router->workers[target].site->siteName);
+            referred++;
+        }
+    }
+    free(list);
+    return referred;
+}
+
+void displaySiteReport(struct ShardRouter* router) {
+    struct SiteCommand* cmds = calloc(router->siteCount, sizeof(struct SiteCommand));
+    for (int i = 0; i < router->siteCount; i++) {
+        cmds[i].type = SITE_CMD_STATS;
+    }
+    routerBroadcast(router, cmds);
+
+    struct SiteStats total = {0};
+    printf("%-15s %-9s %-8s %-8s %-10s %-12s %-9s\n",
+           "Site", "Patients", "Doctors", "Queued", "Emergency", "Free Slots", "Attended");
+    printDivider();
+    for (int i = 0; i < router->siteCount; i++) {
+        struct SiteStats* s = &cmds[i].stats;
+        char slots[24];
+        snprintf(slots, sizeof(slots), "%d/%d", s->freeSlots, s->totalSlots);
+        printf("%-15s %-9d %-8d %-8d %-10d %-12s %-9d\n", router->workers[i].site->siteName,
+               s->patients, s->doctors, s->queued, s->queuedEmergencies, slots, s->patientsAttended);
+        total.patients += s->patients;
+        total.doctors += s->doctors;
+        total.queued += s->queued;
+        total.queuedEmergencies += s->queuedEmergencies;
+        total.freeSlots += s->freeSlots;
+        total.totalSlots += s->totalSlots;
+        total.patientsAttended += s->patientsAttended;
+    }
+    char slots[24];
+    snprintf(slots, sizeof(slots), "%d/%d", total.freeSlots, total.totalSlots);
+    printDivider();
+    printf("%-15s %-9d %-8d %-8d %-10d %-12s %-9d\n", "All Sites",
+           total.patients, total.doctors, total.queued, total.queuedEmergencies, slots, total.patientsAttended);
+    free(cmds);
+}
+
+// Save every site to its own data file, in parallel
+void routerSaveAll(struct ShardRouter* router) {
+    struct SiteCommand* cmds = calloc(router->siteCount, sizeof(struct SiteCommand));
+    for (int i = 0; i < router->siteCount; i++) {
+        cmds[i].type = SITE_CMD_SAVE;
+    }
+    routerBroadcast(router, cmds);
+    free(cmds);
+}
+
+// ---------------------------------------------------------------------------
+// Replication
+//
+// Shipping side of the replication journal, and the follower process that
+// receives it (`hospital_management follow PATH`). The follower keeps a full
+// copy of every site by replaying the records through the same site
+// operations, serves read-only screens, and can be promoted to primary.
+// ---------------------------------------------------------------------------
+
+#define JOURNAL_READ_BYTES (1024 * 1024)  // Must hold one whole snapshot record
+#define REPLICA_RECONNECT_MS 1000
+
+struct JournalReader {
+    int fd;
+    unsigned char* buffer;
+    int start;  // Unread bytes are buffer[start..end)
+    int end;
+};
+
+struct ReplicaFollower {
+    struct ShardRouter* router;
+    struct JournalReader reader;
+    char path[108];
+    pthread_t thread;
+    pthread_mutex_t lock;  // Guards the fields below and reader.fd
+    int connected;
+    int stopping;
+    long long appliedSequence;
+    long long primarySequence;  // Latest sequence the primary has reported
+    long long recordsApplied;
+    long long lastLagMicros;
+    long long maxLagMicros;
+    long long totalLagMicros;
+    long long lastHeardAt;
+    int resyncs;
+};
+
+// Write all of a buffer to a socket, 0 if the other end has gone
+int sendAll(int fd, const void* data, long long length) {
+    const unsigned char* bytes = data;
+    while (length > 0) {
+        ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return 0;
+        }
+        bytes += sent;
+        length -= sent;
+    }
+    return 1;
+}
+
+void takeSiteSnapshot(struct Hospital* site, struct SiteSnapshot* snapshot) {
+    snprintf(snapshot->siteName, sizeof(snapshot->siteName), "%s", site->siteName);
+    snprintf(snapshot->dataFile, sizeof(snapshot->dataFile), "%s", site->dataFile);
+    snapshot->patientCount = site->patientCount;
+    snapshot->doctorCount = site->doctorCount;
+    memcpy(snapshot->patients, site->patients, sizeof(site->patients));
+    memcpy(snapshot->doctors, site->doctors, sizeof(site->doctors));
+    snapshot->waitingQueue = site->waitingQueue;
+}
+
+// Replace a site's tables with a snapshot and rebuild everything derived from them
+void loadSiteSnapshot(struct Hospital* site, const struct SiteSnapshot* snapshot) {
+    snprintf(site->siteName, sizeof(site->siteName), "%s", snapshot->siteName);
+    snprintf(site->dataFile, sizeof(site->dataFile), "%s", snapshot->dataFile);
+    site->patientCount = snapshot->patientCount;
+    site->doctorCount = snapshot->doctorCount;
+    memcpy(site->patients, snapshot->patients, sizeof(site->patients));
+    memcpy(site->doctors, snapshot->doctors, sizeof(site->doctors));
+    site->waitingQueue = snapshot->waitingQueue;
+    site->waitingQueue.capacity = MAX_PATIENTS;  // The site's own room, whatever the sender's
+    rebuildDashboardCounters(site);
+    rebuildPatientIndex(site);
+    noteViewReload(site);
+}
+
+void journalDropFollower(struct ReplicationJournal* journal) {
+    pthread_mutex_lock(&journal->lock);
+    if (journal->followerFd != -1) {
+        close(journal->followerFd);
+    }
+    journal->followerFd = -1;
+    journal->overflowed = 0;
+    journal->head = journal->shipped = 0;
+    pthread_mutex_unlock(&journal->lock);
+}
+
+// Start shipping to a newly connected follower: snapshot every site at one
+// sequence number, then stream the records appended after it. Waits for the
+// site locks, so a snapshot is taken between operations, never during one.
+int journalConnectFollower(struct ReplicationJournal* journal, int fd) {
+    struct SiteSnapshot* snapshots = malloc(journal->siteCount * sizeof(struct SiteSnapshot));
+    if (snapshots == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < journal->siteCount; i++) {
+        pthread_mutex_lock(journal->siteLocks[i]);
+    }
+    for (int i = 0; i < journal->siteCount; i++) {
+        takeSiteSnapshot(journal->sites[i], &snapshots[i]);
+    }
+    pthread_mutex_lock(&journal->lock);
+    long long sequence = journal->sequence;
+    journal->head = journal->shipped = 0;
+    journal->overflowed = 0;
+    journal->ackedSequence = sequence;
+    journal->ackBytes = 0;
+    journal->followerFd = fd;
+    pthread_mutex_unlock(&journal->lock);
+    for (int i = journal->siteCount - 1; i >= 0; i--) {
+        pthread_mutex_unlock(journal->siteLocks[i]);
+    }
+
+    // Records appended while the snapshot is on its way wait in the ring
+    struct JournalRecord header;
+    memset(&header, 0, sizeof(header));
+    header.sequence = sequence;
+    header.type = JOURNAL_SNAPSHOT;
+    header.length = sizeof(struct SiteSnapshot);
+    int sent = 1;
+    for (int i = 0; i < journal->siteCount && sent; i++) {
+        header.site = i;
+        header.appendedAt = monotonicMicros();
+        sent = sendAll(fd, &header, sizeof(header)) && sendAll(fd, &snapshots[i], sizeof(struct SiteSnapshot));
+    }
+    header.type = JOURNAL_SNAPSHOT_END;
+    header.site = 0;
+    header.length = 0;
+    sent = sent && sendAll(fd, &header, sizeof(header));
+    free(snapshots);
+    if (!sent) {
+        journalDropFollower(journal);
+    }
+    return 1;
+}
+
+// Take in whatever acks the follower has sent, without waiting for more
+void journalReadAcks(struct ReplicationJournal* journal, int fd) {
+    while (1) {
+        ssize_t got = recv(fd, journal->ackBuffer + journal->ackBytes,
+                           sizeof(struct JournalAck) - journal->ackBytes, MSG_DONTWAIT);
+        if (got <= 0) {
+            return;  // Nothing yet, or the follower has gone and the next send notices
+        }
+        journal->ackBytes += got;
+        if (journal->ackBytes == sizeof(struct JournalAck)) {
+            struct JournalAck ack;
+            memcpy(&ack, journal->ackBuffer, sizeof(ack));
+            journal->ackBytes = 0;
+            pthread_mutex_lock(&journal->lock);
+            journal->ackedSequence = ack.sequence;
+            journal->lagMicros = ack.lagMicros;
+            if (ack.lagMicros > journal->maxLagMicros) {
+                journal->maxLagMicros = ack.lagMicros;
+            }
+            pthread_mutex_unlock(&journal->lock);
+        }
+    }
+}
+
+void* journalShipperMain(void* arg) {
+    struct ReplicationJournal* journal = arg;
+    while (1) {
+        pthread_mutex_lock(&journal->lock);
+        int stopping = journal->stopping;
+        int fd = journal->followerFd;
+        pthread_mutex_unlock(&journal->lock);
+        if (stopping) {
+            break;
+        }
+
+        if (fd == -1) {
+            struct pollfd listener = { journal->listenFd, POLLIN, 0 };
+            if (poll(&listener, 1, JOURNAL_HEARTBEAT_MS) > 0) {
+                int follower = accept(journal->listenFd, NULL, NULL);
+                if (follower != -1 && !journalConnectFollower(journal, follower)) {
+                    close(follower);
+                }
+            }
+            continue;
+        }
+
+        // Wait for records; if none come, send a heartbeat so the follower
+        // knows the primary is alive and how far the journal has got
+        pthread_mutex_lock(&journal->lock);
+        if (journal->head == journal->shipped && !journal->overflowed && !journal->stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += JOURNAL_HEARTBEAT_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&journal->pending, &journal->lock, &deadline);
+        }
+        if (journal->overflowed) {
+            journal->resyncs++;
+            pthread_mutex_unlock(&journal->lock);
+            journalDropFollower(journal);
+            continue;
+        }
+        int heartbeatOnly = journal->head == journal->shipped;
+        if (heartbeatOnly) {
+            struct JournalRecord heartbeat;
+            memset(&heartbeat, 0, sizeof(heartbeat));
+            heartbeat.sequence = journal->sequence;
+            heartbeat.appendedAt = monotonicMicros();
+            heartbeat.type = JOURNAL_HEARTBEAT;
+            ringWrite(journal, &heartbeat, sizeof(heartbeat));
+        }
+        // Everything up to head goes out in one batch. Appends carry on
+        // meanwhile; they never overwrite bytes that are not yet shipped.
+        long long from = journal->shipped;
+        long long length = journal->head - from;
+        pthread_mutex_unlock(&journal->lock);
+
+        int offset = (int)(from % JOURNAL_RING_BYTES);
+        if (offset + length > JOURNAL_RING_BYTES) {
+            length = JOURNAL_RING_BYTES - offset;  // The rest goes in the next batch
+        }
+        if (!sendAll(fd, journal->ring + offset, length)) {
+            journalDropFollower(journal);
+            continue;
+        }
+        pthread_mutex_lock(&journal->lock);
+        journal->shipped += length;
+        journal->bytesShipped += length;
+        if (heartbeatOnly) {
+            journal->heartbeats++;
+        } else {
+            journal->batches++;
+        }
+        pthread_mutex_unlock(&journal->lock);
+        journalReadAcks(journal, fd);
+    }
+    return NULL;
+}
+
+// Listen for a follower at path and start recording changes to every site
+int startReplication(struct ShardRouter* router, const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Error: Replication socket path is too long\n");
+        return 0;
+    }
+    strcpy(address.sun_path, path);
+
+    struct ReplicationJournal* journal = calloc(1, sizeof(struct ReplicationJournal));
+    if (journal == NULL || (journal->ring = malloc(JOURNAL_RING_BYTES)) == NULL) {
+        printf("Error: Not enough memory for the replication journal\n");
+        free(journal);
+        return 0;
+    }
+    // A socket left behind by a primary that died would make bind fail
+    struct stat existing;
+    if (stat(path, &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+        unlink(path);
+    }
+    journal->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (journal->listenFd == -1 ||
+        bind(journal->listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(journal->listenFd, 1) != 0) {
+        printf("Error: Cannot listen for a follower at %s (%s)\n", path, strerror(errno));
+        if (journal->listenFd != -1) {
+            close(journal->listenFd);
+        }
+        free(journal->ring);
+        free(journal);
+        return 0;
+    }
+    snprintf(journal->path, sizeof(journal->path), "%s", path);
+    journal->followerFd = -1;
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->pending, NULL);
+    for (int i = 0; i < router->siteCount; i++) {
+        struct SiteWorker* worker = &router->workers[i];
+        journal->sites[i] = worker->site;
+        journal->siteLocks[i] = &worker->lock;
+        pthread_mutex_lock(&worker->lock);
+        worker->site->journal = journal;
+        pthread_mutex_unlock(&worker->lock);
+    }
+    journal->siteCount = router->siteCount;
+    pthread_create(&journal->shipper, NULL, journalShipperMain, journal);
+    router->journal = journal;
+    printf("Replicating to a follower at %s\n", path);
+    return 1;
+}
+
+void stopReplication(struct ShardRouter* router) {
+    struct ReplicationJournal* journal = router->journal;
+    if (journal == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&journal->lock);
+    journal->stopping = 1;
+    pthread_cond_signal(&journal->pending);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->shipper, NULL);
+    for (int i = 0; i < journal->siteCount; i++) {
+        pthread_mutex_lock(journal->siteLocks[i]);
+        journal->sites[i]->journal = NULL;
+        pthread_mutex_unlock(journal->siteLocks[i]);
+    }
+    journalDropFollower(journal);
+    close(journal->listenFd);
+    unlink(journal->path);
+    free(journal->ring);
+    free(journal);
+    router->journal = NULL;
+}
+
+void displayReplicationStatus(struct ShardRouter* router) {
+    struct ReplicationJournal* journal = router->journal;
+    if (journal == NULL) {
+        printf("Replication is off. Start with --replicate PATH to ship changes to a follower.\n");
+        return;
+    }
+    pthread_mutex_lock(&journal->lock);
+    struct ReplicationJournal copy = *journal;
+    pthread_mutex_unlock(&journal->lock);
+
+    printf("Socket: %s\n", copy.path);
+    printf("Follower: %s\n", copy.followerFd != -1 ? "connected" : "waiting for a follower to connect");
+    printf("Journal sequence: %lld\n", copy.sequence);
+    if (copy.followerFd != -1) {
+        printf("Follower applied: %lld (%lld record(s) behind)\n",
+               copy.ackedSequence, copy.sequence - copy.ackedSequence);
+        printf("Apply lag: %lld microseconds (worst %lld)\n", copy.lagMicros, copy.maxLagMicros);
+        printf("Ring in use: %lld of %d bytes\n", copy.head - copy.shipped, JOURNAL_RING_BYTES);
+    }
+    printf("Shipped: %lld record(s) in %lld batch(es) and %lld heartbeat(s), %lld bytes\n",
+           copy.recordsQueued, copy.batches, copy.heartbeats, copy.bytesShipped);
+    printf("Re-syncs after the follower fell behind: %d\n", copy.resyncs);
+}
+
+int connectToPrimary(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Make at least `need` unread bytes available, 0 if the stream ended first
+int fillJournalReader(struct JournalReader* reader, int need) {
+    if (reader->end - reader->start >= need) {
+        return 1;
+    }
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+    while (reader->end < need) {
+        ssize_t got = recv(reader->fd, reader->buffer + reader->end, JOURNAL_READ_BYTES - reader->end, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 0;
+        }
+        reader->end += got;
+    }
+    return 1;
+}
+
+// Next record from the primary; the payload stays valid until the next call
+int readJournalRecord(struct JournalReader* reader, struct JournalRecord* record, unsigned char** payload) {
+    if (!fillJournalReader(reader, sizeof(*record))) {
+        return 0;
+    }
+    memcpy(record, reader->buffer + reader->start, sizeof(*record));
+    if (record->length < 0 || record->length > JOURNAL_READ_BYTES - (int)sizeof(*record) ||
+        !fillJournalReader(reader, sizeof(*record) + record->length)) {
+        return 0;
+    }
+    *payload = reader->buffer + reader->start + sizeof(*record);
+    reader->start += sizeof(*record) + record->length;
+    return 1;
+}
+
+// Replay one change through the site operations, so the replica's counters
+// and indexes follow along exactly as they do on the primary
+void applyJournalRecord(struct Hospital* site, const struct JournalRecord* record, const unsigned char* payload) {
+    switch (record->type) {
+        case JOURNAL_ADMIT: {
+            struct Patient patient;
+            memcpy(&patient, payload, sizeof(patient));
+            hospitalAdmitPatient(site, &patient);
+            break;
+        }
+        case JOURNAL_ENQUEUE:
+            hospitalEnqueue(site, record->patientId);
+            break;
+        case JOURNAL_REQUEUE:
+            hospitalRequeueFront(site, record->patientId);
+            break;
+        case JOURNAL_DEQUEUE:
+            hospitalDequeue(site);
+            break;
+        case JOURNAL_WITHDRAW:
+            hospitalWithdrawFromQueue(site, record->patientId);
+            break;
+        case JOURNAL_ASSIGN:
+            if (hospitalAssign(site, record->patientId, record->doctorId) >= 0) {
+                // Keep the primary's visit time rather than the replay time
+                struct Patient* patient = &site->patients[findPatientIndex(site->patients, record->patientId)];
+                if (patient->visitCount <= MAX_VISIT_HISTORY) {
+                    patient->visitHistory[patient->visitCount - 1].visitTime = record->when;
+                }
+            }
+            break;
+        case JOURNAL_RELEASE_SLOT: {
+            int doctorIndex = findDoctorIndex(site, record->doctorId);
+            if (doctorIndex != -1) {
+                hospitalReleaseSlot(site, doctorIndex, record->slot);
+            }
+            break;
+        }
+        case JOURNAL_DISCHARGE:
+            hospitalDischargePatient(site, record->patientId);
+            break;
+        case JOURNAL_ADD_DOCTOR: {
+            struct Doctor doctor;
+            memcpy(&doctor, payload, sizeof(doctor));
+            hospitalAddDoctor(site, &doctor);
+            break;
+        }
+        case JOURNAL_REMOVE_DOCTOR:
+            hospitalRemoveDoctor(site, record->doctorId);
+            break;
+        case JOURNAL_VISIT_NOTES: {
+            char notes[MAX_NAME_LEN];
+            memcpy(notes, payload, MAX_NAME_LEN);
+            notes[MAX_NAME_LEN - 1] = '\0';
+            hospitalRecordVisitNotes(site, record->patientId, record->doctorId, notes, record->slot);  // The slot field carries "completed"
+            break;
+        }
+    }
+}
+
+void* replicaReceiverMain(void* arg) {
+    struct ReplicaFollower* follower = arg;
+    struct ShardRouter* router = follower->router;
+    while (1) {
+        pthread_mutex_lock(&follower->lock);
+        int stopping = follower->stopping;
+        int fd = follower->reader.fd;
+        pthread_mutex_unlock(&follower->lock);
+        if (stopping) {
+            break;
+        }
+
+        if (fd == -1) {
+            // The primary dropped us or went away; keep trying until promoted
+            usleep(REPLICA_RECONNECT_MS * 1000);
+            fd = connectToPrimary(follower->path);
+            pthread_mutex_lock(&follower->lock);
+            if (fd != -1 && follower->stopping) {
+                close(fd);
+            } else if (fd != -1) {
+                follower->reader.fd = fd;
+                follower->reader.start = follower->reader.end = 0;
+                follower->connected = 1;
+                follower->resyncs++;
+            }
+            pthread_mutex_unlock(&follower->lock);
+            continue;
+        }
+
+        struct JournalRecord record;
+        unsigned char* payload;
+        if (!readJournalRecord(&follower->reader, &record, &payload)) {
+            pthread_mutex_lock(&follower->lock);
+            close(follower->reader.fd);
+            follower->reader.fd = -1;
+            follower->connected = 0;
+            pthread_mutex_unlock(&follower->lock);
+            continue;
+        }
+
+        long long now = monotonicMicros();
+        if (record.type == JOURNAL_SNAPSHOT && record.site < router->siteCount) {
+            struct SiteSnapshot* snapshot = malloc(sizeof(struct SiteSnapshot));
+            if (snapshot != NULL) {
+                memcpy(snapshot, payload, sizeof(*snapshot));
+                lockSite(&router->workers[record.site]);
+                loadSiteSnapshot(router->workers[record.site].site, snapshot);
+                unlockSite(&router->workers[record.site]);
+                free(snapshot);
+            }
+        } else if (record.type > JOURNAL_HEARTBEAT && record.site < router->siteCount) {
+            lockSite(&router->workers[record.site]);
+            applyJournalRecord(router->workers[record.site].site, &record, payload);
+            unlockSite(&router->workers[record.site]);
+        }
+
+        pthread_mutex_lock(&follower->lock);
+        follower->lastHeardAt = now;
+        if (record.sequence > follower->primarySequence) {
+            follower->primarySequence = record.sequence;
+        }
+        if (record.type > JOURNAL_HEARTBEAT) {
+            follower->appliedSequence = record.sequence;
+            follower->recordsApplied++;
+            follower->lastLagMicros = monotonicMicros() - record.appendedAt;
+            follower->totalLagMicros += follower->lastLagMicros;
+            if (follower->lastLagMicros > follower->maxLagMicros) {
+                follower->maxLagMicros = follower->lastLagMicros;
+            }
+        } else if (record.type == JOURNAL_SNAPSHOT_END) {
+            follower->appliedSequence = record.sequence;
+        }
+        struct JournalAck ack = { follower->appliedSequence, follower->lastLagMicros };
+        pthread_mutex_unlock(&follower->lock);
+
+        // Acknowledge once everything read so far is applied, not per record
+        if (follower->reader.start == follower->reader.end) {
+            sendAll(fd, &ack, sizeof(ack));
+        }
+    }
+    return NULL;
+}
+
+// Read the snapshot the primary sends on connect and start a site for each
+// part of it. Returns the number of sites, 0 if the stream broke off.
+int receiveInitialSnapshot(struct ReplicaFollower* follower, struct ShardRouter* router) {
+    struct JournalRecord record;
+    unsigned char* payload;
+    while (readJournalRecord(&follower->reader, &record, &payload)) {
+        if (record.type == JOURNAL_SNAPSHOT && router->siteCount < MAX_SITES) {
+            struct SiteSnapshot* snapshot = malloc(sizeof(struct SiteSnapshot));
+            struct Hospital* site = snapshot != NULL ? createHospital("", "") : NULL;
+            if (site == NULL) {
+                free(snapshot);
+                printf("Error: Not enough memory for the replica\n");
+                return 0;
+            }
+            memcpy(snapshot, payload, sizeof(*snapshot));
+            loadSiteSnapshot(site, snapshot);
+            free(snapshot);
+            startSiteWorker(router, site, NULL);
+        } else if (record.type == JOURNAL_SNAPSHOT_END) {
+            follower->appliedSequence = follower->primarySequence = record.sequence;
+            return router->siteCount;
+        }
+    }
+    return 0;
+}
+
+void displayFollowerStatus(struct ReplicaFollower* follower) {
+    pthread_mutex_lock(&follower->lock);
+    struct ReplicaFollower copy = *follower;
+    pthread_mutex_unlock(&follower->lock);
+
+    printf("Primary: %s (%s)\n", copy.path, copy.connected ? "connected" : "disconnected, retrying");
+    if (copy.lastHeardAt > 0) {
+        printf("Last heard from the primary: %lld ms ago\n", (monotonicMicros() - copy.lastHeardAt) / 1000);
+    }
+    printf("Applied sequence: %lld of %lld (%lld record(s) behind)\n", copy.appliedSequence,
+           copy.primarySequence, copy.primarySequence - copy.appliedSequence);
+    printf("Records applied: %lld\n", copy.recordsApplied);
+    if (copy.recordsApplied > 0) {
+        printf("Apply lag: last %lld, average %lld, worst %lld microseconds\n", copy.lastLagMicros,
+               copy.totalLagMicros / copy.recordsApplied, copy.maxLagMicros);
+    }
+    printf("Re-syncs: %d\n", copy.resyncs);
+    if (!copy.connected) {
+        printf("\nIf the primary is down for good, promote this replica to take over.\n");
+    }
+}
+
+// Stop following; the replica keeps the data it has applied
+void stopFollowing(struct ReplicaFollower* follower) {
+    pthread_mutex_lock(&follower->lock);
+    follower->stopping = 1;
+    if (follower->reader.fd != -1) {
+        shutdown(follower->reader.fd, SHUT_RDWR);  // Wakes the receiver from its read
+    }
+    pthread_mutex_unlock(&follower->lock);
+    pthread_join(follower->thread, NULL);
+    if (follower->reader.fd != -1) {
+        close(follower->reader.fd);
+    }
+    free(follower->reader.buffer);
+}
+
+// ---------------------------------------------------------------------------
+// Recording traces
+// ---------------------------------------------------------------------------
+
+// FNV-1a, continued from `hash`
+unsigned long long hashBytes(unsigned long long hash, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+unsigned long long hashText(unsigned long long hash, const char* text) {
+    return hashBytes(hash, text, strlen(text) + 1);
+}
+
+unsigned long long hashInt(unsigned long long hash, long long value) {
+    return hashBytes(hash, &value, sizeof(value));
+}
+
+// Checksum of a site's patients, doctors and queue, field by field so that
+// padding and unused entries do not count
+unsigned long long siteChecksum(struct Hospital* site, unsigned long long hash) {
+    hash = hashInt(hash, site->patientCount);
+    for (int i = 0; i < MAX_PATIENTS; i++) {
+        const struct Patient* patient = &site->patients[i];
+        if (!patient->occupied) {
+            continue;
+        }
+        hash = hashInt(hash, i);
+        hash = hashInt(hash, patient->id);
+        hash = hashText(hash, patient->name);
+        hash = hashInt(hash, patient->age);
+        hash = hashText(hash, patient->disease);
+        hash = hashInt(hash, patient->isEmergency);
+        hash = hashInt(hash, patient->assignedDoctorId);
+        hash = hashText(hash, patient->requestedSpecialty);
+        hash = hashInt(hash, patient->visitCount);
+        int visits = patient->visitCount < MAX_VISIT_HISTORY ? patient->visitCount : MAX_VISIT_HISTORY;
+        for (int v = 0; v < visits; v++) {
+            hash = hashText(hash, patient->visitHistory[v].doctorName);
+            hash = hashText(hash, patient->visitHistory[v].notes);
+            hash = hashInt(hash, patient->visitHistory[v].doctorId);
+            hash = hashInt(hash, patient->visitHistory[v].visitTime);
+        }
+    }
+    hash = hashInt(hash, site->doctorCount);
+    for (int i = 0; i < site->doctorCount; i++) {
+        const struct Doctor* doctor = &site->doctors[i];
+        hash = hashInt(hash, doctor->id);
+        hash = hashText(hash, doctor->name);
+        hash = hashText(hash, doctor->specialty);
+        hash = hashInt(hash, doctor->capacity);
+        hash = hashInt(hash, doctor->patientsAttended);
+        hash = hashInt(hash, doctor->freeSlots);
+        hash = hashInt(hash, doctor->shiftStart);
+        hash = hashInt(hash, doctor->shiftEnd);
+        for (int s = 0; s < doctor->capacity; s++) {
+            hash = hashInt(hash, doctor->slotPatientId[s]);
+        }
+    }
+    struct PriorityQueue* queue = &site->waitingQueue;
+    hash = hashInt(hash, queueLength(queue));
+    for (int i = queue->front; i != -1 && i <= queue->rear; i++) {
+        hash = hashInt(hash, queue->items[i].patientId);
+        hash = hashInt(hash, queue->items[i].priority);
+    }
+    return hash;
+}
+
+// Write the header and a snapshot of every site, then record from here on.
+// All sites are held while they are snapshotted, so the trace starts from
+// one consistent state.
+int startTrace(struct ShardRouter* router, const char* path) {
+    struct OperationTrace* trace = calloc(1, sizeof(struct OperationTrace));
+    struct SiteSnapshot* snapshot = malloc(sizeof(struct SiteSnapshot));
+    if (trace == NULL || snapshot == NULL || (trace->file = fopen(path, "wb")) == NULL) {
+        printf("Error: Cannot record a trace to %s\n", path);
+        free(trace);
+        free(snapshot);
+        return 0;
+    }
+    setvbuf(trace->file, NULL, _IOFBF, TRACE_BUFFER_BYTES);
+    snprintf(trace->path, sizeof(trace->path), "%s", path);
+    pthread_mutex_init(&trace->lock, NULL);
+
+    struct TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.siteCount = router->siteCount;
+    header.recordBytes = sizeof(struct JournalRecord);
+    header.patientBytes = sizeof(struct Patient);
+    header.doctorBytes = sizeof(struct Doctor);
+    fwrite(&header, sizeof(header), 1, trace->file);
+
+    for (int i = 0; i < router->siteCount; i++) {
+        lockSite(&router->workers[i]);
+    }
+    for (int i = 0; i < router->siteCount; i++) {
+        struct Hospital* site = router->workers[i].site;
+        takeSiteSnapshot(site, snapshot);
+        site->trace = trace;
+        traceAppend(site, JOURNAL_SNAPSHOT, 0, 0, 0, snapshot, sizeof(struct SiteSnapshot));
+    }
+    router->trace = trace;
+    for (int i = 0; i < router->siteCount; i++) {
+        unlockSite(&router->workers[i]);
+    }
+    free(snapshot);
+    printf("Recording operations to %s\n", path);
+    return 1;
+}
+
+// Stop recording, closing the trace with the checksum of the final state
+void stopTrace(struct ShardRouter* router) {
+    struct OperationTrace* trace = router->trace;
+    if (trace == NULL) {
+        return;
+    }
+    for (int i = 0; i < router->siteCount; i++) {
+        lockSite(&router->workers[i]);
+    }
+    unsigned long long checksum = 14695981039346656037ULL;
+    for (int i = 0; i < router->siteCount; i++) {
+        checksum = siteChecksum(router->workers[i].site, checksum);
+    }
+    traceAppend(router->workers[0].site, JOURNAL_TRACE_END, 0, 0, 0, &checksum, sizeof(checksum));
+    for (int i = 0; i < router->siteCount; i++) {
+        router->workers[i].site->trace = NULL;
+        unlockSite(&router->workers[i]);
+    }
+    router->trace = NULL;
+    if (fclose(trace->file) != 0) {
+        printf("Error writing trace %s\n", trace->path);
+    } else {
+        printf("Trace %s: %lld records, %lld KB, final checksum %016llx\n", trace->path, trace->sequence,
+               trace->bytes / 1024, checksum);
+    }
+    free(trace);
+}
+
+// ---------------------------------------------------------------------------
+// Change feed log and subscribers
+// ---------------------------------------------------------------------------
+
+const char* eventTypeName(int type) {
+    switch (type) {
+        case JOURNAL_ADMIT: return "patient_admitted";
+        case JOURNAL_ENQUEUE: return "enqueued";
+        case JOURNAL_DEQUEUE: return "dequeued";
+        case JOURNAL_WITHDRAW: return "withdrawn";
+        case JOURNAL_ASSIGN: return "assigned";
+        case JOURNAL_RELEASE_SLOT: return "slot_released";
+        case JOURNAL_DISCHARGE: return "patient_discharged";
+        case JOURNAL_ADD_DOCTOR: return "doctor_added";
+        case JOURNAL_REMOVE_DOCTOR: return "doctor_removed";
+        case JOURNAL_VISIT_NOTES: return "visit_notes";
+        case JOURNAL_REQUEUE: return "requeued";
+        case JOURNAL_SAVE: return "saved";
+    }
+    return "unknown";
+}
+
+void jsonEscape(const char* text, char* out, int size) {
+    int n = 0;
+    for (const unsigned char* c = (const unsigned char*)text; *c != '\0' && n < size - 7; c++) {
+        if (*c == '"' || *c == '\\') {
+            out[n++] = '\\';
+            out[n++] = *c;
+        } else if (*c < 0x20) {
+            n += snprintf(out + n, size - n, "\\u%04x", *c);
+        } else {
+            out[n++] = *c;
+        }
+    }
+    out[n] = '\0';
+}
+
+// One log line for an event, returns its length
+int formatChangeEvent(struct ChangeFeed* feed, const struct ChangeEvent* event, char* out) {
+    char name[MAX_NAME_LEN * 2];
+    char text[MAX_NAME_LEN * 2];
+    jsonEscape(event->name, name, sizeof(name));
+    jsonEscape(event->text, text, sizeof(text));
+    int n = snprintf(out, FEED_LINE_BYTES, "{\"seq\":%lld,\"time\":%lld,\"site\":\"%s\",\"type\":\"%s\"",
+                     event->sequence, event->when, feed->siteNames[event->site], eventTypeName(event->type));
+    switch (event->type) {
+        case JOURNAL_ADMIT:
+            n += snprintf(out + n, FEED_LINE_BYTES - n,
+                          ",\"patient\":%d,\"name\":\"%s\",\"age\":%d,\"disease\":\"%s\",\"emergency\":%d",
+                          event->patientId, name, event->number, text, event->flag);
+            break;
+        case JOURNAL_ADD_DOCTOR:
+            n += snprintf(out + n, FEED_LINE_BYTES - n, ",\"doctor\":%d,\"name\":\"%s\",\"specialty\":\"%s\",\"capacity\":%d",
+                          event->doctorId, name, text, event->number);
+            break;
+        case JOURNAL_REMOVE_DOCTOR:
+            n += snprintf(out + n, FEED_LINE_BYTES - n, ",\"doctor\":%d", event->doctorId);
+            break;
+        case JOURNAL_ASSIGN:
+        case JOURNAL_RELEASE_SLOT:
+            n += snprintf(out + n, FEED_LINE_BYTES - n, ",\"patient\":%d,\"doctor\":%d,\"slot\":%d",
+                          event->patientId, event->doctorId, event->slot);
+            break;
+        case JOURNAL_VISIT_NOTES:
+            n += snprintf(out + n, FEED_LINE_BYTES - n, ",\"patient\":%d,\"doctor\":%d,\"notes\":\"%s\",\"completed\":%d",
+                          event->patientId, event->doctorId, text, event->slot);
+            break;
+        default:
+            n += snprintf(out + n, FEED_LINE_BYTES - n, ",\"patient\":%d", event->patientId);
+    }
+    n += snprintf(out + n, FEED_LINE_BYTES - n, "}\n");
+    return n;
+}
+
+int compareLongLongs(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+void feedSegmentPath(long long first, char path[64]) {
+    snprintf(path, 64, "hospital_events.%012lld.log", first);
+}
+
+// First sequence of every log segment in the working directory, ascending
+int listFeedSegments(long long firsts[], int max) {
+    DIR* dir = opendir(".");
+    if (dir == NULL) {
+        return 0;
+    }
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL && count < max) {
+        long long first;
+        int end = 0;
+        if (sscanf(entry->d_name, "hospital_events.%lld.log%n", &first, &end) == 1 &&
+            end > 0 && entry->d_name[end] == '\0') {
+            firsts[count++] = first;
+        }
+    }
+    closedir(dir);
+    qsort(firsts, count, sizeof(long long), compareLongLongs);
+    return count;
+}
+
+// Segment holding a sequence: the last one that starts at or before it, -1 if none
+long long findFeedSegment(long long sequence) {
+    long long firsts[FEED_MAX_SEGMENTS];
+    int count = listFeedSegments(firsts, FEED_MAX_SEGMENTS);
+    if (count == 0) {
+        return -1;
+    }
+    long long found = firsts[0];  // Older events have been rotated away; start from the oldest kept
+    for (int i = 0; i < count && firsts[i] <= sequence; i++) {
+        found = firsts[i];
+    }
+    return found;
+}
+
+// Sequence of the last event already in the log, so numbering carries on across restarts
+long long lastLoggedSequence() {
+    long long firsts[FEED_MAX_SEGMENTS];
+    int count = listFeedSegments(firsts, FEED_MAX_SEGMENTS);
+    long long last = 0;
+    for (int i = count - 1; i >= 0 && last == 0; i--) {
+        char path[64];
+        char line[FEED_LINE_BYTES];
+        feedSegmentPath(firsts[i], path);
+        FILE* fp = fopen(path, "r");
+        if (fp == NULL) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            long long sequence;
+            if (sscanf(line, "{\"seq\":%lld", &sequence) == 1 && sequence > last) {
+                last = sequence;
+            }
+        }
+        fclose(fp);
+    }
+    return last;
+}
+
+// Start a new segment at sequence `first` and drop the oldest beyond the ones kept
+int openFeedSegment(struct ChangeFeed* feed, long long first) {
+    if (feed->log != NULL) {
+        fclose(feed->log);
+    }
+    char path[64];
+    feedSegmentPath(first, path);
+    feed->log = fopen(path, "a");
+    if (feed->log == NULL) {
+        printf("Error opening change feed log %s\n", path);
+        return 0;
+    }
+    fseek(feed->log, 0, SEEK_END);
+    feed->segmentFirst = first;
+    feed->segmentBytes = ftell(feed->log);
+
+    long long firsts[FEED_MAX_SEGMENTS];
+    int count = listFeedSegments(firsts, FEED_MAX_SEGMENTS);
+    for (int i = 0; i < count - FEED_SEGMENTS_KEPT; i++) {
+        feedSegmentPath(firsts[i], path);
+        remove(path);
+    }
+    return 1;
+}
+
+void writeFeedBatch(struct ChangeFeed* feed, const char* batch, int used) {
+    if (feed->log != NULL && used > 0) {
+        fwrite(batch, 1, used, feed->log);
+        feed->segmentBytes += used;
+    }
+}
+
+// Writes queued events to the log, as many as have built up per write
+void* feedWriterMain(void* arg) {
+    struct ChangeFeed* feed = arg;
+    char* batch = malloc(FEED_BATCH_BYTES);
+    while (batch != NULL) {
+        pthread_mutex_lock(&feed->lock);
+        if (feed->head == feed->written && !feed->stopping) {
+            while (feed->head == feed->written && !feed->stopping) {
+                feed->writerIdle = 1;
+                pthread_cond_wait(&feed->pending, &feed->lock);
+            }
+            // Let the rest of a burst arrive, rather than waking for every event
+            pthread_mutex_unlock(&feed->lock);
+            usleep(FEED_LINGER_US);
+            pthread_mutex_lock(&feed->lock);
+        }
+        if (feed->head == feed->written) {
+            pthread_mutex_unlock(&feed->lock);
+            break;
+        }
+        long long from = feed->written;
+        long long to = feed->head;
+        pthread_mutex_unlock(&feed->lock);
+
+        int used = 0;
+        for (long long i = from; i < to; i++) {
+            const struct ChangeEvent* event = &feed->ring[i % FEED_RING_EVENTS];
+            if (used > FEED_BATCH_BYTES - FEED_LINE_BYTES || feed->segmentBytes + used >= FEED_SEGMENT_BYTES) {
+                writeFeedBatch(feed, batch, used);
+                used = 0;
+            }
+            if (feed->segmentBytes >= FEED_SEGMENT_BYTES) {
+                openFeedSegment(feed, event->sequence);  // Closing the old segment flushes it
+            }
+            used += formatChangeEvent(feed, event, batch + used);
+        }
+        writeFeedBatch(feed, batch, used);
+        if (feed->log != NULL) {
+            fflush(feed->log);
+        }
+
+        pthread_mutex_lock(&feed->lock);
+        feed->loggedSequence = feed->ring[(to - 1) % FEED_RING_EVENTS].sequence;
+        feed->written = to;
+        feed->batches++;
+        pthread_cond_broadcast(&feed->drained);
+        pthread_cond_broadcast(&feed->logged);
+        pthread_mutex_unlock(&feed->lock);
+    }
+    free(batch);
+    return NULL;
+}
+
+// Read the subscriber's "FROM <sequence>" request line: the sequence, 0 for
+// the oldest event kept, or -1 if it is malformed or does not arrive in time
+long long readSubscribeRequest(int fd) {
+    char request[64];
+    int used = 0;
+    long long deadline = monotonicMicros() + FEED_REQUEST_TIMEOUT_MS * 1000LL;
+    while (used < (int)sizeof(request) - 1) {
+        struct pollfd client = { fd, POLLIN, 0 };
+        long long remaining = deadline - monotonicMicros();
+        if (remaining <= 0 || poll(&client, 1, (int)(remaining / 1000) + 1) <= 0) {
+            return -1;
+        }
+        ssize_t got = recv(fd, request + used, 1, 0);
+        if (got <= 0) {
+            return -1;
+        }
+        if (request[used] == '\n') {
+            break;
+        }
+        used++;
+    }
+    request[used] = '\0';
+    long long from;
+    if (sscanf(request, "FROM %lld", &from) != 1) {
+        return -1;
+    }
+    return from < 0 ? 0 : from;
+}
+
+// Streams the log to one subscriber from the sequence it asked for. Reads go
+// at the subscriber's pace: a slow reader fills its socket and this thread
+// waits there, while the desk keeps appending to the log. The request is read
+// here rather than by the acceptor, so a client that connects and says
+// nothing only holds up its own slot.
+void* feedSubscriberMain(void* arg) {
+    struct FeedSubscriber* subscriber = arg;
+    struct ChangeFeed* feed = subscriber->feed;
+    char refusal[128] = "";
+    long long from = readSubscribeRequest(subscriber->fd);
+    long long oldest = findFeedSegment(0);
+    if (from == -1) {
+        snprintf(refusal, sizeof(refusal), "{\"error\":\"expected FROM <sequence>\"}\n");
+    } else if (from > 0 && oldest != -1 && from < oldest) {
+        snprintf(refusal, sizeof(refusal), "{\"error\":\"sequence %lld is no longer kept\",\"oldest\":%lld}\n",
+                 from, oldest);
+    } else {
+        pthread_mutex_lock(&feed->lock);
+        subscriber->nextSequence = from > 0 ? from : (oldest > 0 ? oldest : 1);
+        pthread_mutex_unlock(&feed->lock);
+    }
+    if (refusal[0] != '\0') {
+        sendAll(subscriber->fd, refusal, strlen(refusal));
+    }
+
+    char* batch = refusal[0] == '\0' ? malloc(FEED_BATCH_BYTES) : NULL;
+    char line[FEED_LINE_BYTES];
+    FILE* fp = NULL;
+    long long segment = -1;
+    int open = batch != NULL;
+    while (open) {
+        pthread_mutex_lock(&feed->lock);
+        while (feed->loggedSequence < subscriber->nextSequence && !feed->stopping) {
+            pthread_cond_wait(&feed->logged, &feed->lock);
+        }
+        long long logged = feed->loggedSequence;
+        int stopping = feed->stopping;
+        pthread_mutex_unlock(&feed->lock);
+        if (stopping) {
+            break;
+        }
+
+        // Move to the segment holding the next event when the current one is used up
+        long long wanted = findFeedSegment(subscriber->nextSequence);
+        if (fp == NULL || wanted != segment) {
+            if (fp != NULL) {
+                fclose(fp);
+            }
+            char path[64];
+            feedSegmentPath(wanted, path);
+            fp = fopen(path, "r");
+            segment = wanted;
+            if (fp == NULL) {
+                break;
+            }
+        }
+        int used = 0;
+        clearerr(fp);
+        while (subscriber->nextSequence <= logged && fgets(line, sizeof(line), fp) != NULL) {
+            long long sequence;
+            if (sscanf(line, "{\"seq\":%lld", &sequence) != 1 || sequence < subscriber->nextSequence) {
+                continue;
+            }
+            int length = strlen(line);
+            if (used + length > FEED_BATCH_BYTES) {
+                if (!sendAll(subscriber->fd, batch, used)) {
+                    open = 0;
+                    break;
+                }
+                used = 0;
+            }
+            memcpy(batch + used, line, length);
+            used += length;
+            subscriber->nextSequence = sequence + 1;
+        }
+        if (open && used > 0 && !sendAll(subscriber->fd, batch, used)) {
+            open = 0;
+        }
+        if (open && subscriber->nextSequence <= logged && findFeedSegment(subscriber->nextSequence) == segment) {
+            // Logged but not yet readable here; the segment was rotated under us
+            // or the line is still in the writer's buffer. Try again shortly.
+            usleep(1000);
+        }
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    free(batch);
+    pthread_mutex_lock(&feed->lock);
+    close(subscriber->fd);
+    subscriber->fd = -1;
+    pthread_mutex_unlock(&feed->lock);
+    return NULL;
+}
+
+void* feedAcceptorMain(void* arg) {
+    struct ChangeFeed* feed = arg;
+    while (1) {
+        pthread_mutex_lock(&feed->lock);
+        int stopping = feed->stopping;
+        pthread_mutex_unlock(&feed->lock);
+        if (stopping) {
+            break;
+        }
+        struct pollfd listener = { feed->listenFd, POLLIN, 0 };
+        if (poll(&listener, 1, 200) <= 0) {
+            continue;
+        }
+        int fd = accept(feed->listenFd, NULL, NULL);
+        if (fd == -1) {
+            continue;
+        }
+        struct FeedSubscriber* subscriber = NULL;
+        pthread_mutex_lock(&feed->lock);
+        for (int i = 0; i < FEED_MAX_SUBSCRIBERS && subscriber == NULL; i++) {
+            if (feed->subscribers[i].fd == -1) {
+                subscriber = &feed->subscribers[i];
+                if (subscriber->started) {
+                    pthread_join(subscriber->thread, NULL);  // Finished with its last client
+                }
+                subscriber->started = 1;
+                subscriber->fd = fd;
+                subscriber->nextSequence = 0;
+                subscriber->feed = feed;
+            }
+        }
+        pthread_mutex_unlock(&feed->lock);
+        if (subscriber == NULL) {
+            const char* refusal = "{\"error\":\"too many subscribers\"}\n";
+            sendAll(fd, refusal, strlen(refusal));
+            close(fd);
+            continue;
+        }
+        pthread_create(&subscriber->thread, NULL, feedSubscriberMain, subscriber);
+    }
+    return NULL;
+}
+
+// Start logging change events and serving subscribers at path
+int startChangeFeed(struct ShardRouter* router, const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Error: Change feed socket path is too long\n");
+        return 0;
+    }
+    strcpy(address.sun_path, path);
+    struct ChangeFeed* feed = calloc(1, sizeof(struct ChangeFeed));
+    if (feed == NULL) {
+        printf("Error: Not enough memory for the change feed\n");
+        return 0;
+    }
+    feed->sequence = feed->loggedSequence = lastLoggedSequence();
+    long long newest = findFeedSegment(LLONG_MAX);
+    if (!openFeedSegment(feed, newest == -1 ? feed->sequence + 1 : newest)) {
+        free(feed);
+        return 0;
+    }
+    struct stat existing;
+    if (stat(path, &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+        unlink(path);
+    }
+    feed->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (feed->listenFd == -1 ||
+        bind(feed->listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(feed->listenFd, FEED_MAX_SUBSCRIBERS) != 0) {
+        printf("Error: Cannot listen for change feed subscribers at %s (%s)\n", path, strerror(errno));
+        if (feed->listenFd != -1) {
+            close(feed->listenFd);
+        }
+        fclose(feed->log);
+        free(feed);
+        return 0;
+    }
+    snprintf(feed->path, sizeof(feed->path), "%s", path);
+    for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++) {
+        feed->subscribers[i].fd = -1;
+    }
+    pthread_mutex_init(&feed->lock, NULL);
+    pthread_cond_init(&feed->pending, NULL);
+    pthread_cond_init(&feed->drained, NULL);
+    pthread_cond_init(&feed->logged, NULL);
+    for (int i = 0; i < router->siteCount; i++) {
+        struct SiteWorker* worker = &router->workers[i];
+        snprintf(feed->siteNames[i], MAX_NAME_LEN, "%s", worker->site->siteName);
+        pthread_mutex_lock(&worker->lock);
+        worker->site->feed = feed;
+        pthread_mutex_unlock(&worker->lock);
+    }
+    pthread_create(&feed->writer, NULL, feedWriterMain, feed);
+    pthread_create(&feed->acceptor, NULL, feedAcceptorMain, feed);
+    router->feed = feed;
+    printf("Publishing change events at %s (next sequence %lld)\n", path, feed->sequence + 1);
+    return 1;
+}
+
+// Detach the feed from the sites, write out what is queued and close subscribers
+void stopChangeFeed(struct ShardRouter* router) {
+    struct ChangeFeed* feed = router->feed;
+    if (feed == NULL) {
+        return;
+    }
+    for (int i = 0; i < router->siteCount; i++) {
+        pthread_mutex_lock(&router->workers[i].lock);
+        router->workers[i].site->feed = NULL;
+        pthread_mutex_unlock(&router->workers[i].lock);
+    }
+    pthread_mutex_lock(&feed->lock);
+    feed->stopping = 1;
+    pthread_cond_broadcast(&feed->pending);
+    pthread_cond_broadcast(&feed->logged);
+    for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++) {
+        if (feed->subscribers[i].fd != -1) {
+            shutdown(feed->subscribers[i].fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&feed->lock);
+    pthread_join(feed->writer, NULL);
+    pthread_join(feed->acceptor, NULL);
+    for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++) {
+        if (feed->subscribers[i].started) {
+            pthread_join(feed->subscribers[i].thread, NULL);
+        }
+    }
+    fclose(feed->log);
+    close(feed->listenFd);
+    unlink(feed->path);
+    free(feed);
+    router->feed = NULL;
+}
+
+void displayChangeFeedStatus(struct ShardRouter* router) {
+    struct ChangeFeed* feed = router->feed;
+    if (feed == NULL) {
+        printf("The change feed is off. Start with --events PATH to publish change events.\n");
+        return;
+    }
+    pthread_mutex_lock(&feed->lock);
+    printf("Socket: %s\n", feed->path);
+    printf("Last sequence: %lld (%lld in the log, %lld waiting)\n",
+           feed->sequence, feed->loggedSequence, feed->head - feed->written);
+    printf("Log batches written: %lld, appends that waited for the writer: %lld\n", feed->batches, feed->stalls);
+    printf("Current segment: hospital_events.%012lld.log (%lld bytes)\n", feed->segmentFirst, feed->segmentBytes);
+    printf("\n%-12s %-15s %-10s\n", "Subscriber", "Next Sequence", "Behind");
+    int subscribers = 0;
+    for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++) {
+        if (feed->subscribers[i].fd != -1) {
+            long long next = feed->subscribers[i].nextSequence;
+            if (next == 0) {
+                printf("%-12d waiting for its FROM request\n", i + 1);
+            } else {
+                printf("%-12d %-15lld %-10lld\n", i + 1, next, feed->loggedSequence - next + 1);
+            }
+            subscribers++;
+        }
+    }
+    if (subscribers == 0) {
+        printf("No subscribers connected.\n");
+    }
+    pthread_mutex_unlock(&feed->lock);
+}
+
+// `hospital_management events PATH [--from N]`: print events as they happen,
+// from the oldest kept unless --from is given. A consumer that records the
+// last sequence it handled resumes with --from; if that event has been
+// rotated out of the log the feed answers with an error instead.
+int runEventConsumer(int argc, char* argv[]) {
+    if (argc < 1) {
+        printf("Usage: hospital_management events PATH [--from SEQUENCE]\n");
+        return 1;
+    }
+    long long from = 0;
+    if (argc > 2 && strcmp(argv[1], "--from") == 0) {
+        from = atoll(argv[2]);
+    }
+    int fd = connectToPrimary(argv[0]);
+    if (fd == -1) {
+        printf("Error: Cannot reach a change feed at %s (%s)\n", argv[0], strerror(errno));
+        return 1;
+    }
+    char request[64];
+    int length = snprintf(request, sizeof(request), "FROM %lld\n", from);
+    if (!sendAll(fd, request, length)) {
+        close(fd);
+        return 1;
+    }
+    char buffer[FEED_BATCH_BYTES];
+    ssize_t got;
+    int refused = -1;  // Known once the first reply arrives
+    while ((got = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        if (refused == -1) {
+            refused = got >= 9 && memcmp(buffer, "{\"error\":", 9) == 0;
+        }
+        fwrite(buffer, 1, got, stdout);
+        fflush(stdout);
+    }
+    close(fd);
+    return refused == 1;
+}
+
+void manageSites(struct ShardRouter* router, int* activeSite) {
+    printHeader("Multi-Site Operations");
+    printf("Active site: %s\n\n", router->workers[*activeSite].site->siteName);
+    printf("1. Switch Active Site\n");
+    printf("2. Find Patient at Any Site\n");
+    printf("3. Refer Overflow Patients to Other Sites\n");
+    printf("4. All-Sites Report\n");
+    printf("5. All-Sites Caseload Analytics\n");
+    printf("6. Replication Status\n");
+    printf("7. Change Feed Status\n");
+    printDivider();
+    printf("Enter your choice: ");
+    int siteChoice;
+    scanf("%d", &siteChoice);
+    getchar();
+
+    switch (siteChoice) {
+        case 1: {
+            for (int i = 0; i < router->siteCount; i++) {
+                printf("%d. %s (%s)\n", i + 1, router->workers[i].site->siteName, router->workers[i].site->dataFile);
+            }
+            int choice;
+            printf("Enter site number (1-%d): ", router->siteCount);
+            scanf("%d", &choice);
+            getchar();
+            if (choice > 0 && choice <= router->siteCount) {
+                *activeSite = choice - 1;
+                printf("Active site is now %s.\n", router->workers[*activeSite].site->siteName);
+            } else {
+                printf("Invalid site.\n");
+            }
+            break;
+        }
+        case 2: {
+            int id;
+            printf("Enter Patient ID: ");
+            scanf("%d", &id);
+            getchar();
+            int sites[MAX_SITES];
+            struct Patient found[MAX_SITES];
+            int count = routerFindPatient(router, id, sites, found);
+            if (count == 0) {
+                printf("Patient not found at any site.\n");
+            }
+            for (int i = 0; i < count; i++) {
+                printf("%sFound at site: %s\n", i > 0 ? "\n" : "", router->workers[sites[i]].site->siteName);
+                printPatientDetails(&found[i]);
+            }
+            break;
+        }
+        case 3: {
+            int referred = routerReferOverflow(router, *activeSite, currentMinuteOfDay());
+            printf("%d patient(s) referred from %s.\n", referred, router->workers[*activeSite].site->siteName);
+            break;
+        }
+        case 4:
+            displaySiteReport(router);
+            break;
+        case 5: {
+            // Hold every site still while the report scans them
+            struct Hospital* sites[MAX_SITES];
+            for (int i = 0; i < router->siteCount; i++) {
+                pthread_mutex_lock(&router->workers[i].lock);
+                sites[i] = router->workers[i].site;
+            }
+            displayCaseloadReport(sites, router->siteCount);
+            for (int i = router->siteCount - 1; i >= 0; i--) {
+                pthread_mutex_unlock(&router->workers[i].lock);
+            }
+            break;
+        }
+        case 6:
+            displayReplicationStatus(router);
+            break;
+        case 7:
+            displayChangeFeedStatus(router);
+            break;
+        default:
+            printf("Invalid choice. Please try again.\n");
+    }
+    pauseExecution();
+}
+
+// Run as a read-only replica of the primary at path. Returns 1 if the
+// replica was promoted, with the router serving its sites as a primary.
+// Copy of a follower's site taken under its lock, without the per-process
+// pointers; NULL if there is no memory for it
+struct Hospital* copySiteTables(struct SiteWorker* worker) {
+    struct Hospital* copy = malloc(sizeof(struct Hospital));
+    if (copy == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&worker->lock);
+    memcpy(copy, worker->site, sizeof(*copy));
+    pthread_mutex_unlock(&worker->lock);
+    copy->archive = NULL;
+    copy->journal = NULL;
+    copy->feed = NULL;
+    copy->calendar = NULL;
+    copy->trace = NULL;
+    copy->views = NULL;
+    copy->ledger = NULL;
+    return copy;
+}
+
+int runFollower(struct ShardRouter* router, const char* path) {
+    struct ReplicaFollower* follower = calloc(1, sizeof(struct ReplicaFollower));
+    if (follower == NULL || (follower->reader.buffer = malloc(JOURNAL_READ_BYTES)) == NULL) {
+        printf("Error: Not enough memory for the replica\n");
+        free(follower);
+        return 0;
+    }
+    snprintf(follower->path, sizeof(follower->path), "%s", path);
+    follower->router = router;
+    follower->reader.fd = connectToPrimary(path);
+    if (follower->reader.fd == -1) {
+        printf("Error: Cannot reach a primary at %s (%s)\n", path, strerror(errno));
+        free(follower->reader.buffer);
+        free(follower);
+        return 0;
+    }
+    initRouter(router);
+    if (!receiveInitialSnapshot(follower, router)) {
+        printf("Error: The primary closed the connection before sending its data\n");
+        close(follower->reader.fd);
+        free(follower->reader.buffer);
+        stopRouter(router);
+        free(follower);
+        return 0;
+    }
+    follower->connected = 1;
+    follower->lastHeardAt = monotonicMicros();
+    pthread_mutex_init(&follower->lock, NULL);
+    pthread_create(&follower->thread, NULL, replicaReceiverMain, follower);
+
+    int activeSite = 0;
+    while (1) {
+        struct SiteWorker* worker = &router->workers[activeSite];
+        struct Hospital* site = worker->site;
+
+        printHeader("Hospital Management System (Replica)");
+        printf("Following %s, site %s. Changes are made on the primary.\n\n", path, site->siteName);
+        printf("1. Display Patient Records\n");
+        printf("2. Display Doctor Status\n");
+        printf("3. Display Waiting Queue\n");
+        printf("4. Live Dashboard\n");
+        printf("5. Query Patients\n");
+        printf("6. Replication Status\n");
+        printf("7. Switch Site\n");
+        printf("8. Promote to Primary\n");
+        printf("9. Exit\n");
+        printDivider();
+        printf("Enter your choice: ");
+        int choice;
+        scanf("%d", &choice);
+        getchar();
+
+        // The listings read the published view; the dashboard and queries read a
+        // copy taken under the lock, so their prompts never hold up replayed changes
+        struct Hospital* copy = NULL;
+        if (choice >= 4 && choice <= 5 && (copy = copySiteTables(worker)) == NULL) {
+            printf("Error: Not enough memory to copy the site\n");
+            pauseExecution();
+            continue;
+        }
+        switch (choice) {
+            case 1:
+                showSiteView(worker, displayPatients);
+                break;
+            case 2:
+                showSiteView(worker, displayDoctors);
+                break;
+            case 3:
+                showSiteView(worker, displayQueue);
+                break;
+            case 4:
+                displayDashboard(copy);
+                break;
+            case 5:
+                queryPatients(copy);
+                break;
+            case 6:
+                printHeader("Replication Status");
+                displayFollowerStatus(follower);
+                pauseExecution();
+                break;
+            case 7:
+                activeSite = (activeSite + 1) % router->siteCount;
+                break;
+            case 8: {
+                printHeader("Promote to Primary");
+                stopFollowing(follower);
+                long long applied = follower->appliedSequence;
+                free(follower);
+                for (int i = 0; i < router->siteCount; i++) {
+                    pthread_mutex_lock(&router->workers[i].lock);
+                    openSiteArchive(router->workers[i].site);
+                    loadSiteCalendar(router->workers[i].site);
+                    openSiteLedger(router->workers[i].site);
+                    pthread_mutex_unlock(&router->workers[i].lock);
+                }
+                printf("Promoted at journal sequence %lld. This process now serves the sites and saves their data files.\n",
+                       applied);
+                pauseExecution();
+                return 1;
+            }
+            case 9:
+                stopFollowing(follower);
+                free(follower);
+                stopRouter(router);
+                return 0;
+            default:
+                printf("Invalid choice. Please try again.\n");
+                pauseExecution();
+        }
+        free(copy);
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// Discrete-event simulation for capacity planning
+//
+// Runs the real waiting queue, specialty matching, consultation and slot
+// release functions against a private copy of the doctors, driven by a
+// time-ordered heap of events. Nothing is written back to hospital_data.bin.
+// The queue (from newPriorityQueue), the arrivals and the doctors grow as the
+// simulation goes, so it can model a hospital larger than a site's 100-patient
+// and 30-doctor tables.
+// ---------------------------------------------------------------------------
+
+#define SIM_MINUTES_PER_DAY 1440
+
+// Event types, ordered so that capacity is freed before new arrivals at the same time
+#define SIM_EVENT_COMPLETION 0
+#define SIM_EVENT_SHIFT_START 1
+#define SIM_EVENT_ARRIVAL 2
+
+#define SIM_CONSULT_EXPONENTIAL 0
+#define SIM_CONSULT_FIXED 1
+#define SIM_CONSULT_UNIFORM 2
+
+#define SIM_WAIT_BUCKETS 7
+
+struct SimEvent {
+    double time;  // Minutes since the start of the simulation
+    int type;
+    int doctorIndex;  // Completion and shift events
+    int slot;  // Completion events
+};
+
+// Binary min-heap of events keyed by time
+struct SimEventHeap {
+    struct SimEvent* items;
+    int count;
+    int capacity;
+};
+
+struct SimConfig {
+    int days;
+    double arrivalsPerHour;
+    double emergencyRatio;
+    double meanConsultMinutes;
+    int consultDistribution;
+    unsigned long long seed;
+    const char* tracePath;
+    const char* dataFile;
+    double mixWeight[SPECIALTY_COUNT];  // Relative share of arrivals per specialty
+    int hasMix;
+};
+
+// One arrival; the queue and doctors' slots hold its position in Simulation.patients
+struct SimPatient {
+    double arrivalTime;
+    double consultMinutes;
+    int specialty;
+    int isEmergency;
+};
+
+struct Simulation {
+    struct SimConfig config;
+    struct Doctor* doctors;
+    int doctorCount;
+    int doctorCapacity;
+    struct SimPatient* patients;  // Every arrival, in order
+    int patientCount;
+    int patientCapacity;
+    struct PriorityQueue* queue;  // Grown with growPriorityQueue when full
+    long queuedBySpecialty[SPECIALTY_COUNT];
+    struct SimEventHeap events;
+    unsigned long long rngState;
+    FILE* trace;
+    double horizon;
+
+    // Results
+    long arrivals;
+    long completed;
+    long emergencies;
+    long peakWaiting;
+    double* busySlotMinutes;  // Per doctor
+    long* consultations;
+    double* waits;
+    char* waitIsEmergency;
+    int* waitSpecialty;
+    long waitCount;
+    long waitCapacity;
+};
+
+void simHeapPush(struct SimEventHeap* heap, struct SimEvent event) {
+    if (heap->count == heap->capacity) {
+        heap->capacity = heap->capacity ? heap->capacity * 2 : 256;
+        heap->items = realloc(heap->items, heap->capacity * sizeof(struct SimEvent));
+    }
+    int i = heap->count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        struct SimEvent* p = &heap->items[parent];
+        if (p->time < event.time || (p->time == event.time && p->type <= event.type)) {
+            break;
+        }
+        heap->items[i] = *p;
+        i = parent;
+    }
+    heap->items[i] = event;
+}
+
+struct SimEvent simHeapPop(struct SimEventHeap* heap) {
+    struct SimEvent top = heap->items[0];
+    struct SimEvent last = heap->items[--heap->count];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        struct SimEvent* c = &heap->items[child];
+        if (child + 1 < heap->count) {
+            struct SimEvent* r = &heap->items[child + 1];
+            if (r->time < c->time || (r->time == c->time && r->type < c->type)) {
+                child++;
+                c = r;
+            }
+        }
+        if (last.time < c->time || (last.time == c->time && last.type <= c->type)) {
+            break;
+        }
+        heap->items[i] = *c;
+        i = child;
+    }
+    heap->items[i] = last;
+    return top;
+}
+
+// xorshift64* generator, uniform in (0, 1)
+double randomUnit(unsigned long long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    unsigned long long bits = *state * 2685821657736338717ULL;
+    return ((bits >> 11) + 0.5) / 9007199254740992.0;
+}
+
+double simRandom(struct Simulation* sim) {
+    return randomUnit(&sim->rngState);
+}
+
+double simExponential(struct Simulation* sim, double mean) {
+    return -mean * log(simRandom(sim));
+}
+
+double simConsultDuration(struct Simulation* sim) {
+    double mean = sim->config.meanConsultMinutes;
+    switch (sim->config.consultDistribution) {
+        case SIM_CONSULT_FIXED:
+            return mean;
+        case SIM_CONSULT_UNIFORM:
+            return mean * 2.0 * simRandom(sim);
+        default:
+            return simExponential(sim, mean);
+    }
+}
+
+int simPickSpecialty(struct Simulation* sim) {
+    double total = 0;
+    for (int i = 0; i < SPECIALTY_COUNT; i++) {
+        total += sim->config.mixWeight[i];
+    }
+    double target = simRandom(sim) * total;
+    for (int i = 0; i < SPECIALTY_COUNT; i++) {
+        target -= sim->config.mixWeight[i];
+        if (target <= 0 && sim->config.mixWeight[i] > 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Arrival details are kept outside the heap; only one arrival is pending at a time
+struct SimArrival {
+    double time;
+    int specialty;
+    int isEmergency;
+    double consultMinutes;
+};
+
+int simNextArrival(struct Simulation* sim, double now, struct SimArrival* arrival) {
+    if (sim->trace) {
+        char line[256];
+        while (fgets(line, sizeof(line), sim->trace)) {
+            char specialty[MAX_NAME_LEN];
+            double consult = 0;
+            if (line[0] == '#' ||
+                sscanf(line, "%lf,%49[^,],%d,%lf", &arrival->time, specialty, &arrival->isEmergency, &consult) < 3) {
+                continue;
+            }
+            arrival->specialty = specialtyIndex(specialty);
+            if (arrival->specialty == -1) {
+                arrival->specialty = 0;  // Unknown specialties go to General Medicine
+            }
+            arrival->consultMinutes = consult > 0 ? consult : simConsultDuration(sim);
+            return 1;
+        }
+        return 0;
+    }
+
+    arrival->time = now + simExponential(sim, 60.0 / sim->config.arrivalsPerHour);
+    arrival->specialty = simPickSpecialty(sim);
+    arrival->isEmergency = simRandom(sim) < sim->config.emergencyRatio;
+    arrival->consultMinutes = simConsultDuration(sim);
+    return 1;
+}
+
+void simRecordWait(struct Simulation* sim, double wait, int isEmergency, int specialty) {
+    if (sim->waitCount == sim->waitCapacity) {
+        sim->waitCapacity = sim->waitCapacity ? sim->waitCapacity * 2 : 4096;
+        sim->waits = realloc(sim->waits, sim->waitCapacity * sizeof(double));
+        sim->waitIsEmergency = realloc(sim->waitIsEmergency, sim->waitCapacity);
+        sim->waitSpecialty = realloc(sim->waitSpecialty, sim->waitCapacity * sizeof(int));
+    }
+    sim->waits[sim->waitCount] = wait;
+    sim->waitIsEmergency[sim->waitCount] = (char)isEmergency;
+    sim->waitSpecialty[sim->waitCount] = specialty;
+    sim->waitCount++;
+}
+
+// A doctor the specialty's patients can see now, -1 if there is none
+int simFreeDoctor(struct Simulation* sim, int specialty, int minuteOfDay) {
+    return findAvailableDoctor(sim->doctors, sim->doctorCount, specialties[specialty], minuteOfDay);
+}
+
+// Assign waiting patients while any of them has a free doctor, walking the
+// queue in order (emergencies first, then by arrival) as Assign Next does and
+// taking each patient whose specialty has a doctor free
+void simDispatch(struct Simulation* sim, double now) {
+    struct PriorityQueue* q = sim->queue;
+    if (isPriorityQueueEmpty(q)) {
+        return;
+    }
+    int minuteOfDay = (int)fmod(now, SIM_MINUTES_PER_DAY);
+    int doctorFor[SPECIALTY_COUNT];
+    int staffed = 0;  // Specialties with a doctor free
+    for (int s = 0; s < SPECIALTY_COUNT; s++) {
+        doctorFor[s] = sim->queuedBySpecialty[s] > 0 ? simFreeDoctor(sim, s, minuteOfDay) : -1;
+        staffed += doctorFor[s] != -1;
+    }
+    int passed = 0;  // Queued patients looked at and left waiting
+    while (staffed > 0 && !isPriorityQueueEmpty(q) && q->front + passed <= q->rear) {
+        int number = q->items[q->front + passed].patientId;
+        const struct SimPatient* patient = &sim->patients[number];
+        int doctorIndex = doctorFor[patient->specialty];
+        if (doctorIndex == -1) {
+            passed++;
+            continue;
+        }
+        if (passed == 0) {
+            dequeuePriority(q);
+        } else {
+            removeFromPriorityQueue(q, number);
+        }
+        sim->queuedBySpecialty[patient->specialty]--;
+        struct Doctor* doctor = &sim->doctors[doctorIndex];
+        int slot = startConsultation(doctor, number);
+        simRecordWait(sim, now - patient->arrivalTime, patient->isEmergency, patient->specialty);
+
+        double duration = patient->consultMinutes;
+        double busyUntil = now + duration < sim->horizon ? now + duration : sim->horizon;
+        sim->busySlotMinutes[doctorIndex] += busyUntil - now;
+        sim->consultations[doctorIndex]++;
+        struct SimEvent done = {now + duration, SIM_EVENT_COMPLETION, doctorIndex, slot};
+        simHeapPush(&sim->events, done);
+
+        // The slot may have been the last one free for this or any specialty that falls back on the doctor
+        for (int s = 0; s < SPECIALTY_COUNT; s++) {
+            if (doctorFor[s] != -1 && (doctorFor[s] == doctorIndex || sim->queuedBySpecialty[s] == 0)) {
+                doctorFor[s] = sim->queuedBySpecialty[s] > 0 ? simFreeDoctor(sim, s, minuteOfDay) : -1;
+                staffed -= doctorFor[s] == -1;
+            }
+        }
+    }
+}
+
+void simHandleArrival(struct Simulation* sim, const struct SimArrival* arrival) {
+    sim->arrivals++;
+    if (sim->patientCount == sim->patientCapacity) {
+        sim->patientCapacity = sim->patientCapacity ? sim->patientCapacity * 2 : 4096;
+        sim->patients = realloc(sim->patients, sim->patientCapacity * sizeof(struct SimPatient));
+    }
+    int number = sim->patientCount++;
+    struct SimPatient* patient = &sim->patients[number];
+    patient->arrivalTime = arrival->time;
+    patient->consultMinutes = arrival->consultMinutes;
+    patient->specialty = arrival->specialty;
+    patient->isEmergency = arrival->isEmergency;
+    if (arrival->isEmergency) {
+        sim->emergencies++;
+    }
+    if (queueLength(sim->queue) == sim->queue->capacity) {
+        sim->queue = growPriorityQueue(sim->queue);
+    }
+    enqueuePriority(sim->queue, number, arrival->isEmergency ? 1 : 0);
+    sim->queuedBySpecialty[arrival->specialty]++;
+    if (queueLength(sim->queue) > sim->peakWaiting) {
+        sim->peakWaiting = queueLength(sim->queue);
+    }
+}
+
+void simHandleCompletion(struct Simulation* sim, const struct SimEvent* event) {
+    releaseDoctorSlot(&sim->doctors[event->doctorIndex], event->slot);
+    sim->completed++;
+}
+
+int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Percentile of an already sorted array
+double percentileOf(const double* sorted, long count, double percentile) {
+    if (count == 0) {
+        return 0;
+    }
+    long rank = (long)ceil(percentile / 100.0 * count) - 1;
+    if (rank < 0) rank = 0;
+    if (rank >= count) rank = count - 1;
+    return sorted[rank];
+}
+
+int doctorShiftMinutes(const struct Doctor* doctor) {
+    if (doctor->shiftStart == doctor->shiftEnd) {
+        return SIM_MINUTES_PER_DAY;
+    }
+    return (doctor->shiftEnd - doctor->shiftStart + SIM_MINUTES_PER_DAY) % SIM_MINUTES_PER_DAY;
+}
+
+void printWaitSummary(const char* label, struct Simulation* sim, int emergencyFilter) {
+    double* values = malloc((sim->waitCount + 1) * sizeof(double));
+    long count = 0;
+    double total = 0;
+    for (long i = 0; i < sim->waitCount; i++) {
+        if (emergencyFilter == -1 || sim->waitIsEmergency[i] == emergencyFilter) {
+            values[count++] = sim->waits[i];
+            total += sim->waits[i];
+        }
+    }
+    qsort(values, count, sizeof(double), compareDoubles);
+    printf("%-10s %-8ld %-8.1f %-8.1f %-8.1f %-8.1f %-8.1f\n", label, count,
+           count ? total / count : 0.0,
+           percentileOf(values, count, 50), percentileOf(values, count, 90),
+           percentileOf(values, count, 99), count ? values[count - 1] : 0.0);
+    free(values);
+}
+
+void printSimulationReport(struct Simulation* sim, double elapsedSeconds) {
+    printf("\nSimulation Report (%d days)\n", sim->config.days);
+    printDivider();
+    printf("Arrivals:              %ld (%ld emergency)\n", sim->arrivals, sim->emergencies);
+    printf("Assigned to a doctor:  %ld\n", sim->waitCount);
+    printf("Consultations done:    %ld\n", sim->completed);
+    printf("Still waiting at end:  %d\n", queueLength(sim->queue));
+    printf("Longest queue:         %ld\n", sim->peakWaiting);
+    printf("Throughput:            %.1f patients/day\n", sim->completed / (double)sim->config.days);
+
+    printf("\nWait Time (minutes)\n");
+    printf("%-10s %-8s %-8s %-8s %-8s %-8s %-8s\n", "Class", "Count", "Mean", "p50", "p90", "p99", "Max");
+    printWaitSummary("All", sim, -1);
+    printWaitSummary("Emergency", sim, 1);
+    printWaitSummary("Regular", sim, 0);
+
+    const double bucketLimits[SIM_WAIT_BUCKETS - 1] = {5, 15, 30, 60, 120, 240};
+    const char* bucketLabels[SIM_WAIT_BUCKETS] = {"< 5", "5-15", "15-30", "30-60", "60-120", "120-240", ">= 240"};
+    long buckets[SIM_WAIT_BUCKETS] = {0};
+    for (long i = 0; i < sim->waitCount; i++) {
+        int b = 0;
+        while (b < SIM_WAIT_BUCKETS - 1 && sim->waits[i] >= bucketLimits[b]) {
+            b++;
+        }
+        buckets[b]++;
+    }
+    printf("\nWait Time Distribution\n");
+    for (int b = 0; b < SIM_WAIT_BUCKETS; b++) {
+        double share = sim->waitCount ? 100.0 * buckets[b] / sim->waitCount : 0;
+        printf("%-10s %-8ld %5.1f%%\n", bucketLabels[b], buckets[b], share);
+    }
+
+    printf("\nUtilisation per Doctor\n");
+    printf("%-5s %-20s %-20s %-6s %-8s %-8s\n", "ID", "Name", "Specialty", "Slots", "Seen", "Util");
+    for (int i = 0; i < sim->doctorCount; i++) {
+        double available = (double)sim->doctors[i].capacity * doctorShiftMinutes(&sim->doctors[i]) * sim->config.days;
+        printf("%-5d %-20s %-20s %-6d %-8ld %5.1f%%\n", sim->doctors[i].id, sim->doctors[i].name,
+               sim->doctors[i].specialty, sim->doctors[i].capacity, sim->consultations[i],
+               available > 0 ? 100.0 * sim->busySlotMinutes[i] / available : 0.0);
+    }
+
+    printf("\nUtilisation per Specialty\n");
+    printf("%-20s %-8s %-8s %-8s %-10s\n", "Specialty", "Doctors", "Seen", "Util", "Mean Wait");
+    for (int s = 0; s < SPECIALTY_COUNT; s++) {
+        int doctorTotal = 0;
+        long seen = 0;
+        double busy = 0, available = 0;
+        for (int i = 0; i < sim->doctorCount; i++) {
+            if (strcmp(sim->doctors[i].specialty, specialties[s]) == 0) {
+                doctorTotal++;
+                seen += sim->consultations[i];
+                busy += sim->busySlotMinutes[i];
+                available += (double)sim->doctors[i].capacity * doctorShiftMinutes(&sim->doctors[i]) * sim->config.days;
+            }
+        }
+        long waited = 0;
+        double waitTotal = 0;
+        for (long i = 0; i < sim->waitCount; i++) {
+            if (sim->waitSpecialty[i] == s) {
+                waited++;
+                waitTotal += sim->waits[i];
+            }
+        }
+        if (doctorTotal == 0 && waited == 0) {
+            continue;
+        }
+        printf("%-20s %-8d %-8ld %5.1f%%   %-10.1f\n", specialties[s], doctorTotal, seen,
+               available > 0 ? 100.0 * busy / available : 0.0, waited ? waitTotal / waited : 0.0);
+    }
+
+    printf("\nSimulated %d days in %.2f seconds.\n", sim->config.days, elapsedSeconds);
+}
+
+// Replace the staff of one specialty with `count` doctors (existing ones are kept first)
+int simSetStaff(struct Simulation* sim, const char* specialty, int count, int capacity, int shiftStart, int shiftEnd) {
+    int kept = 0;
+    for (int i = 0; i < sim->doctorCount; ) {
+        if (strcmp(sim->doctors[i].specialty, specialty) == 0) {
+            if (kept < count) {
+                if (capacity > 0) initDoctorSlots(&sim->doctors[i], capacity);
+                if (shiftStart >= 0) {
+                    sim->doctors[i].shiftStart = shiftStart;
+                    sim->doctors[i].shiftEnd = shiftEnd;
+                }
+                kept++;
+                i++;
+            } else {
+                sim->doctors[i] = sim->doctors[--sim->doctorCount];
+            }
+        } else {
+            i++;
+        }
+    }
+    while (kept < count) {
+        if (sim->doctorCount == sim->doctorCapacity) {
+            sim->doctorCapacity *= 2;
+            sim->doctors = realloc(sim->doctors, sim->doctorCapacity * sizeof(struct Doctor));
+        }
+        struct Doctor* doctor = &sim->doctors[sim->doctorCount++];
+        memset(doctor, 0, sizeof(*doctor));
+        doctor->id = 9000 + sim->doctorCount;
+        snprintf(doctor->name, MAX_NAME_LEN, "Sim Doctor %d", doctor->id);
+        strcpy(doctor->specialty, specialty);
+        initDoctorSlots(doctor, capacity > 0 ? capacity : 1);
+        if (shiftStart >= 0) {
+            doctor->shiftStart = shiftStart;
+            doctor->shiftEnd = shiftEnd;
+        }
+        kept++;
+    }
+    return 1;
+}
+
+void printSimulationUsage() {
+    printf("Usage: hospital_management simulate [options]\n");
+    printf("  --days N                   Days to simulate (default 30)\n");
+    printf("  --arrivals-per-hour R      Mean Poisson arrival rate (default 12)\n");
+    printf("  --emergency-ratio P        Share of emergency arrivals (default 0.1)\n");
+    printf("  --mean-consult M           Mean consultation minutes (default 20)\n");
+    printf("  --consult-dist D           exponential, fixed or uniform (default exponential)\n");
+    printf("  --mix Specialty=W          Relative arrival weight, repeatable\n");
+    printf("                             (default: proportional to slots per specialty)\n");
+    printf("  --staff Specialty=N[:S[:H1-H2]]\n");
+    printf("                             Use N doctors with S slots, on shift H1:00-H2:00\n");
+    printf("  --trace FILE               Replay arrivals from CSV lines:\n");
+    printf("                             minute,specialty,emergency[,consultMinutes]\n");
+    printf("  --seed N                   Random seed (default 1)\n");
+    printf("  --data FILE                Doctors to start from (default hospital_data.bin)\n");
+}
+
+void freeSimulation(struct Simulation* sim) {
+    if (sim->trace) fclose(sim->trace);
+    free(sim->queue);
+    free(sim->patients);
+    free(sim->doctors);
+    free(sim->busySlotMinutes);
+    free(sim->consultations);
+    free(sim->events.items);
+    free(sim->waits);
+    free(sim->waitIsEmergency);
+    free(sim->waitSpecialty);
+    free(sim);
+}
+
+int runSimulation(int argc, char* argv[]) {
+    struct Simulation* sim = calloc(1, sizeof(struct Simulation));
+    if (sim == NULL || (sim->queue = newPriorityQueue(MAX_PATIENTS)) == NULL) {
+        free(sim);
+        printf("Error: Not enough memory for the simulation\n");
+        return 1;
+    }
+    sim->config.days = 30;
+    sim->config.arrivalsPerHour = 12;
+    sim->config.emergencyRatio = 0.1;
+    sim->config.meanConsultMinutes = 20;
+    sim->config.consultDistribution = SIM_CONSULT_EXPONENTIAL;
+    sim->config.seed = 1;
+    sim->config.dataFile = "hospital_data.bin";
+    for (int i = 0; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--data") == 0) {
+            sim->config.dataFile = argv[i + 1];
+        }
+    }
+
+    // Start from the saved doctors; patients are generated by the simulation
+    struct Patient* saved = malloc(MAX_PATIENTS * sizeof(struct Patient));
+    int savedPatientCount = 0;
+    sim->doctorCapacity = MAX_DOCTORS;
+    sim->doctors = calloc(sim->doctorCapacity, sizeof(struct Doctor));
+    loadData(sim->config.dataFile, saved, &savedPatientCount, sim->doctors, &sim->doctorCount);
+    free(saved);
+    for (int i = 0; i < sim->doctorCount; i++) {
+        initDoctorSlots(&sim->doctors[i], sim->doctors[i].capacity);
+        sim->doctors[i].patientsAttended = 0;
+    }
+
+    int status = 0;
+    for (int i = 0; i < argc && status == 0; i++) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        char name[MAX_NAME_LEN];
+        if (value == NULL) {
+            status = 1;
+        } else if (strcmp(option, "--days") == 0) {
+            sim->config.days = atoi(value);
+        } else if (strcmp(option, "--arrivals-per-hour") == 0) {
+            sim->config.arrivalsPerHour = atof(value);
+        } else if (strcmp(option, "--emergency-ratio") == 0) {
+            sim->config.emergencyRatio = atof(value);
+        } else if (strcmp(option, "--mean-consult") == 0) {
+            sim->config.meanConsultMinutes = atof(value);
+        } else if (strcmp(option, "--consult-dist") == 0) {
+            if (strcmp(value, "fixed") == 0) sim->config.consultDistribution = SIM_CONSULT_FIXED;
+            else if (strcmp(value, "uniform") == 0) sim->config.consultDistribution = SIM_CONSULT_UNIFORM;
+            else sim->config.consultDistribution = SIM_CONSULT_EXPONENTIAL;
+        } else if (strcmp(option, "--seed") == 0) {
+            sim->config.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(option, "--data") == 0) {
+            // Already applied before the doctors were loaded
+        } else if (strcmp(option, "--trace") == 0) {
+            sim->config.tracePath = value;
+        } else if (strcmp(option, "--mix") == 0) {
+            double weight;
+            int s;
+            if (sscanf(value, "%49[^=]=%lf", name, &weight) != 2 || (s = specialtyIndex(name)) == -1) {
+                printf("Error: Unknown specialty in --mix %s\n", value);
+                status = 1;
+            } else {
+                sim->config.mixWeight[s] = weight;
+                sim->config.hasMix = 1;
+            }
+        } else if (strcmp(option, "--staff") == 0) {
+            int count = 0, capacity = 0, startHour = -1, endHour = -1;
+            if (sscanf(value, "%49[^=]=%d:%d:%d-%d", name, &count, &capacity, &startHour, &endHour) < 2) {
+                printf("Error: Invalid --staff %s\n", value);
+                status = 1;
+            } else if (!simSetStaff(sim, name, count, capacity,
+                                    startHour >= 0 ? startHour * 60 : -1, endHour >= 0 ? endHour * 60 : 0)) {
+                status = 1;
+            }
+        } else {
+            status = 1;
+        }
+        i++;
+    }
+    if (status != 0 || sim->config.days <= 0 || sim->config.arrivalsPerHour <= 0 || sim->config.meanConsultMinutes <= 0) {
+        printSimulationUsage();
+        freeSimulation(sim);
+        return 1;
+    }
+
+    if (!sim->config.hasMix) {
+        for (int i = 0; i < sim->doctorCount; i++) {
+            int s = specialtyIndex(sim->doctors[i].specialty);
+            if (s != -1) {
+                sim->config.mixWeight[s] += sim->doctors[i].capacity;
+            }
+        }
+        sim->config.mixWeight[0] += 1e-9;  // Never leave the mix empty
+    }
+    if (sim->config.tracePath) {
+        sim->trace = fopen(sim->config.tracePath, "r");
+        if (sim->trace == NULL) {
+            printf("Error opening trace file %s\n", sim->config.tracePath);
+            freeSimulation(sim);
+            return 1;
+        }
+    }
+
+    clock_t started = clock();
+    sim->busySlotMinutes = calloc(sim->doctorCount + 1, sizeof(double));
+    sim->consultations = calloc(sim->doctorCount + 1, sizeof(long));
+    sim->rngState = sim->config.seed ? sim->config.seed : 1;
+    sim->horizon = (double)sim->config.days * SIM_MINUTES_PER_DAY;
+
+    for (int i = 0; i < sim->doctorCount; i++) {
+        if (sim->doctors[i].shiftStart != sim->doctors[i].shiftEnd) {
+            struct SimEvent shift = {sim->doctors[i].shiftStart, SIM_EVENT_SHIFT_START, i, 0};
+            simHeapPush(&sim->events, shift);
+        }
+    }
+
+    struct SimArrival pending;
+    int hasPending = simNextArrival(sim, 0, &pending);
+    if (hasPending) {
+        struct SimEvent arrival = {pending.time, SIM_EVENT_ARRIVAL, -1, 0};
+        simHeapPush(&sim->events, arrival);
+    }
+
+    while (sim->events.count > 0) {
+        struct SimEvent event = simHeapPop(&sim->events);
+        if (event.time >= sim->horizon) {
+            break;
+        }
+        switch (event.type) {
+            case SIM_EVENT_ARRIVAL:
+                simHandleArrival(sim, &pending);
+                if (simNextArrival(sim, event.time, &pending)) {
+                    struct SimEvent next = {pending.time, SIM_EVENT_ARRIVAL, -1, 0};
+                    simHeapPush(&sim->events, next);
+                }
+                break;
+            case SIM_EVENT_COMPLETION:
+                simHandleCompletion(sim, &event);
+                break;
+            case SIM_EVENT_SHIFT_START: {
+                struct SimEvent next = event;
+                next.time += SIM_MINUTES_PER_DAY;
+                simHeapPush(&sim->events, next);
+                break;
+            }
+        }
+        simDispatch(sim, event.time);
+    }
+
+    printSimulationReport(sim, (double)(clock() - started) / CLOCKS_PER_SEC);
+
+    freeSimulation(sim);
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Trace replay
+//
+// `replay PATH` rebuilds the sites from the trace's snapshot and applies its
+// operations through the same site operations a replica uses, timing each
+// one. Saves are timed by writing the data to a scratch file beside the real
+// one. The final checksum is compared with the one recorded, so a build that
+// changes behaviour shows up as a mismatch, and one that changes speed shows
+// up in the latency table.
+// ---------------------------------------------------------------------------
+
+#define TRACE_TYPES 16  // Record types, JOURNAL_SNAPSHOT .. JOURNAL_TRACE_END
+
+struct ReplayLatencies {
+    double* micros;
+    long count;
+    long capacity;
+};
+
+void addLatency(struct ReplayLatencies* latencies, double micros) {
+    if (latencies->count == latencies->capacity) {
+        latencies->capacity = latencies->capacity ? latencies->capacity * 2 : 1024;
+        latencies->micros = realloc(latencies->micros, latencies->capacity * sizeof(double));
+    }
+    latencies->micros[latencies->count++] = micros;
+}
+
+double elapsedMicros(const struct timespec* from, const struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * 1e6 + (to->tv_nsec - from->tv_nsec) / 1e3;
+}
+
+void printReplayUsage() {
+    printf("Usage: hospital_management replay TRACE [options]\n\n");
+    printf("  --realtime    Keep the recorded gaps between operations (default: full speed)\n");
+    printf("  --repeat N    Replay the trace N times from its snapshot (default 1)\n");
+}
+
+int runReplay(int argc, char* argv[]) {
+    if (argc < 1 || strcmp(argv[0], "--help") == 0) {
+        printReplayUsage();
+        return argc < 1;
+    }
+    int realtime = 0;
+    int repeat = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = 1;
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else {
+            printReplayUsage();
+            return 1;
+        }
+    }
+
+    // Read the whole trace first so file reads are not timed
+    FILE* fp = fopen(argv[0], "rb");
+    if (fp == NULL) {
+        printf("Error: Cannot open trace %s\n", argv[0]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char* data = malloc(size > 0 ? size : 1);
+    if (data == NULL || fread(data, 1, size, fp) != (size_t)size) {
+        printf("Error: Cannot read trace %s\n", argv[0]);
+        fclose(fp);
+        free(data);
+        return 1;
+    }
+    fclose(fp);
+    struct TraceHeader header;
+    if (size < (long)sizeof(header) || (memcpy(&header, data, sizeof(header)), memcmp(header.magic, TRACE_MAGIC, 8) != 0)) {
+        printf("Error: %s is not an operation trace\n", argv[0]);
+        free(data);
+        return 1;
+    }
+    if (header.recordBytes != (int)sizeof(struct JournalRecord) || header.patientBytes != (int)sizeof(struct Patient) ||
+        header.doctorBytes != (int)sizeof(struct Doctor) || header.siteCount < 1 || header.siteCount > MAX_SITES) {
+        printf("Error: %s was recorded by a build with different record layouts\n", argv[0]);
+        free(data);
+        return 1;
+    }
+
+    struct ReplayLatencies latencies[TRACE_TYPES];
+    memset(latencies, 0, sizeof(latencies));
+    unsigned long long checksum = 0;
+    unsigned long long recordedChecksum = 0;
+    int haveRecordedChecksum = 0;
+    long operations = 0;
+    double applyMicros = 0;
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    for (int round = 0; round < repeat; round++) {
+        struct Hospital* sites[MAX_SITES] = {0};
+        long long firstAppendedAt = -1;
+        struct timespec roundStart;
+        clock_gettime(CLOCK_MONOTONIC, &roundStart);
+        long offset = sizeof(header);
+        while (offset + (long)sizeof(struct JournalRecord) <= size) {
+            struct JournalRecord record;
+            memcpy(&record, data + offset, sizeof(record));
+            const unsigned char* payload = data + offset + sizeof(record);
+            offset += sizeof(record) + record.length;
+            if (offset > size || record.site < 0 || record.site >= header.siteCount ||
+                record.type < 0 || record.type >= TRACE_TYPES ||
+                (record.type == JOURNAL_SNAPSHOT && record.length != (int)sizeof(struct SiteSnapshot))) {
+                printf("Trace %s is cut short or damaged; stopped there\n", argv[0]);
+                break;
+            }
+
+            if (record.type == JOURNAL_SNAPSHOT) {
+                struct SiteSnapshot* snapshot = malloc(sizeof(struct SiteSnapshot));
+                memcpy(snapshot, payload, sizeof(struct SiteSnapshot));
+                free(sites[record.site]);
+                sites[record.site] = createHospital(snapshot->siteName, snapshot->dataFile);
+                loadSiteSnapshot(sites[record.site], snapshot);
+                sites[record.site]->siteNumber = record.site;
+                free(snapshot);
+                continue;
+            }
+            if (record.type == JOURNAL_TRACE_END) {
+                memcpy(&recordedChecksum, payload, sizeof(recordedChecksum));
+                haveRecordedChecksum = 1;
+                continue;
+            }
+            struct Hospital* site = sites[record.site];
+            if (site == NULL) {
+                continue;
+            }
+
+            if (realtime) {
+                // Wait until as long after the first operation as it was when recorded
+                if (firstAppendedAt == -1) {
+                    firstAppendedAt = record.appendedAt;
+                }
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                double wait = (record.appendedAt - firstAppendedAt) - elapsedMicros(&roundStart, &now);
+                if (wait > 0) {
+                    usleep((useconds_t)wait);
+                }
+            }
+
+            struct timespec before, after;
+            if (record.type == JOURNAL_SAVE) {
+                char scratch[MAX_NAME_LEN + 48];
+                snprintf(scratch, sizeof(scratch), "%s.replay", site->dataFile);
+                clock_gettime(CLOCK_MONOTONIC, &before);
+                saveData(scratch, site->patients, site->patientCount, site->doctors, site->doctorCount);
+                clock_gettime(CLOCK_MONOTONIC, &after);
+                remove(scratch);
+            } else {
+                clock_gettime(CLOCK_MONOTONIC, &before);
+                applyJournalRecord(site, &record, payload);
+                clock_gettime(CLOCK_MONOTONIC, &after);
+            }
+            double micros = elapsedMicros(&before, &after);
+            addLatency(&latencies[record.type], micros);
+            applyMicros += micros;
+            operations++;
+        }
+
+        checksum = 14695981039346656037ULL;
+        for (int i = 0; i < header.siteCount; i++) {
+            if (sites[i] != NULL) {
+                checksum = siteChecksum(sites[i], checksum);
+            }
+            free(sites[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    free(data);
+
+    double seconds = elapsedMicros(&started, &finished) / 1e6;
+    printf("\nReplayed %ld operations (%d site%s, %d round%s) in %.3f s; %.3f s inside the operations, %.0f operations/s\n",
+           operations, header.siteCount, header.siteCount == 1 ? "" : "s", repeat, repeat == 1 ? "" : "s", seconds,
+           applyMicros / 1e6, applyMicros > 0 ? operations / (applyMicros / 1e6) : 0.0);
+    printf("\n%-20s %-9s %-9s %-9s %-9s %-9s\n", "Operation", "Count", "Mean us", "p50 us", "p99 us", "Max us");
+    printDivider();
+    for (int type = 0; type < TRACE_TYPES; type++) {
+        struct ReplayLatencies* list = &latencies[type];
+        if (list->count == 0) {
+            continue;
+        }
+        double total = 0;
+        for (long i = 0; i < list->count; i++) {
+            total += list->micros[i];
+        }
+        qsort(list->micros, list->count, sizeof(double), compareDoubles);
+        printf("%-20s %-9ld %-9.2f %-9.2f %-9.2f %-9.2f\n", eventTypeName(type), list->count, total / list->count,
+               percentileOf(list->micros, list->count, 50), percentileOf(list->micros, list->count, 99),
+               list->micros[list->count - 1]);
+        free(list->micros);
+    }
+    printf("\nFinal state checksum: %016llx", checksum);
+    if (haveRecordedChecksum) {
+        printf(" (recorded %016llx: %s)\n", recordedChecksum, checksum == recordedChecksum ? "match" : "MISMATCH");
+    } else {
+        printf(" (the trace has no recorded checksum; recording did not finish)\n");
+    }
+    return haveRecordedChecksum && checksum != recordedChecksum ? 2 : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Load generator
+//
+// `loadtest` sends patients through the same site workers the menus use: each
+// request admits and queues a patient (emergencies through the fast lane),
+// then asks the site to assign the first queued patient a doctor can take,
+// and discharges whoever was placed. Open-loop arrivals (Poisson, or bursts)
+// are sent on schedule whether or not earlier requests have finished;
+// closed-loop clients each wait for their previous request. Sites start from
+// the saved doctors with no patients, and nothing is saved.
+//
+// Latency is normally measured from when a request was sent. With --co-safe
+// it is measured from when the request was due, so a stall that holds up the
+// generator counts against every request that should have gone out during it
+// instead of being left out (coordinated omission).
+// ---------------------------------------------------------------------------
+
+#define LOAD_OPEN_POISSON 0
+#define LOAD_OPEN_BURSTY 1
+#define LOAD_CLOSED 2
+
+#define LOAD_MAX_IN_FLIGHT 1024  // Open loop: requests sent but not yet discharged
+#define LOAD_MAX_CLIENTS 256
+#define LOAD_MAX_STEPS 24  // Saturation search
+#define LOAD_FIRST_PATIENT_ID 1000000
+
+#define LOAD_OP_INTAKE 0
+#define LOAD_OP_ASSIGN 1
+#define LOAD_OP_DISCHARGE 2
+#define LOAD_OPS 3
+
+struct LoadConfig {
+    int mode;
+    double rate;  // Requests per second; closed loop paces each client with it when set
+    int burst;  // Arrivals per burst in bursty mode
+    int clients;
+    long long thinkMicros;  // Closed loop: pause between a client's requests
+    double seconds;
+    double intervalSeconds;
+    double emergencyRatio;
+    double mixWeight[SPECIALTY_COUNT];
+    int hasMix;
+    int siteCount;
+    int readers;  // Threads walking the sites' read views throughout the run
+    int coSafe;
+    int saturate;
+    double p99LimitMicros;  // Saturation search: highest p99 still counted as keeping up
+    unsigned long long seed;
+    const char* dataFile;
+    struct Doctor doctors[MAX_DOCTORS];
+    int doctorCount;
+};
+
+// One request's commands; the discharge goes out once the assignment is back
+struct LoadRequest {
+    struct SiteCommand intake;
+    struct SiteCommand assign;
+    struct SiteCommand discharge;
+    int site;
+    long long dueAt;  // Scheduled send time
+    long long sentAt;
+    long long dischargeSentAt;
+};
+
+struct LoadSamples {
+    long long* at;  // Completion time, microseconds since the run started
+    double* micros;
+    long count;
+    long capacity;
+};
+
+struct LoadResults {
+    struct LoadSamples requests;
+    struct ReplayLatencies ops[LOAD_OPS];
+    long sent;
+    long turnedAway;  // Site full at intake
+    long assigned;
+    long fastLane;
+    long preempted;
+    long long maxLagMicros;  // Furthest the generator fell behind its schedule
+    long reads;  // Passes over a read view by the reader threads
+    long inconsistentReads;
+    double seconds;
+};
+
+struct LoadRun {
+    struct LoadConfig* config;
+    struct ShardRouter router;
+    struct LoadResults* results;
+    long long startedAt;
+    long long endAt;
+    int nextPatientId;
+    int nextClient;
+    // Open loop
+    struct LoadRequest* pool;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    long submitted;
+    long released;
+    int senderDone;
+    // Closed loop
+    pthread_mutex_t resultsLock;
+    // Readers
+    int nextReader;
+    int stopReaders;
+};
+
+void addLoadSample(struct LoadSamples* samples, long long at, double micros) {
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 4096;
+        samples->at = realloc(samples->at, samples->capacity * sizeof(long long));
+        samples->micros = realloc(samples->micros, samples->capacity * sizeof(double));
+    }
+    samples->at[samples->count] = at;
+    samples->micros[samples->count++] = micros;
+}
+
+void freeLoadResults(struct LoadResults* results) {
+    free(results->requests.at);
+    free(results->requests.micros);
+    for (int i = 0; i < LOAD_OPS; i++) {
+        free(results->ops[i].micros);
+    }
+    memset(results, 0, sizeof(*results));
+}
+
+int loadPickSpecialty(const struct LoadConfig* config, unsigned long long* rng) {
+    double total = 0;
+    for (int i = 0; i < SPECIALTY_COUNT; i++) {
+        total += config->mixWeight[i];
+    }
+    double target = randomUnit(rng) * total;
+    for (int i = 0; i < SPECIALTY_COUNT; i++) {
+        target -= config->mixWeight[i];
+        if (target <= 0 && config->mixWeight[i] > 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Fill in a request's intake and assignment commands for a new patient
+void prepareLoadRequest(struct LoadRun* run, struct LoadRequest* request, int patientId, unsigned long long* rng) {
+    struct LoadConfig* config = run->config;
+    int minuteOfDay = currentMinuteOfDay();
+    request->site = (int)(randomUnit(rng) * config->siteCount);
+    request->intake.type = SITE_CMD_INTAKE;
+    memset(&request->intake.record, 0, sizeof(struct Patient));
+    struct Patient* record = &request->intake.record;
+    record->id = patientId;
+    snprintf(record->name, MAX_NAME_LEN, "Load Patient %d", patientId);
+    record->isEmergency = randomUnit(rng) < config->emergencyRatio;
+    record->assignedDoctorId = -1;
+    strcpy(record->requestedSpecialty, specialties[loadPickSpecialty(config, rng)]);
+    request->assign.type = SITE_CMD_ASSIGN_NEXT;
+    request->assign.minuteOfDay = minuteOfDay;
+    request->discharge.type = SITE_CMD_DISCHARGE;
+    request->discharge.idCount = 0;
+}
+
+void sendLoadRequest(struct LoadRun* run, struct LoadRequest* request) {
+    request->sentAt = monotonicMicros();
+    routerSubmit(&run->router, request->site, &request->intake);
+    routerSubmit(&run->router, request->site, &request->assign);
+}
+
+// Count what the intake and assignment did, then send the discharge for whoever was placed
+void finishLoadRequest(struct LoadRun* run, struct LoadRequest* request, struct LoadResults* results) {
+    long long startedAt = run->config->coSafe ? request->dueAt : request->sentAt;
+    addLoadSample(&results->requests, request->assign.finishedAt - run->startedAt,
+                  (double)(request->assign.finishedAt - startedAt));
+    addLatency(&results->ops[LOAD_OP_INTAKE], (double)(request->intake.finishedAt - request->sentAt));
+    addLatency(&results->ops[LOAD_OP_ASSIGN], (double)(request->assign.finishedAt - request->sentAt));
+
+    struct SiteCommand* discharge = &request->discharge;
+    discharge->idCount = 0;
+    if (request->intake.result == -1) {
+        results->turnedAway++;
+    } else if (request->intake.result != DISPATCH_QUEUED) {
+        results->fastLane++;
+        results->preempted += request->intake.result == DISPATCH_PREEMPTED;
+        discharge->ids[discharge->idCount++] = request->intake.record.id;
+    }
+    if (request->assign.result != -1) {
+        results->assigned++;
+        discharge->ids[discharge->idCount++] = request->assign.result;
+    }
+    discharge->done = 1;
+    if (discharge->idCount > 0) {
+        request->dischargeSentAt = monotonicMicros();
+        routerSubmit(&run->router, request->site, discharge);
+    }
+}
+
+void waitForDischarge(struct LoadRun* run, struct LoadRequest* request, struct LoadResults* results) {
+    if (request->discharge.idCount == 0) {
+        return;
+    }
+    routerWait(&run->router, &request->discharge);
+    addLatency(&results->ops[LOAD_OP_DISCHARGE], (double)(request->discharge.finishedAt - request->dischargeSentAt));
+}
+
+void sleepUntilMicros(long long micros) {
+    struct timespec until = {micros / 1000000, (micros % 1000000) * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+    }
+}
+
+// Open loop: send every request when it is due, never waiting for replies
+void* loadSenderMain(void* arg) {
+    struct LoadRun* run = arg;
+    struct LoadConfig* config = run->config;
+    unsigned long long rng = config->seed ? config->seed : 1;
+    long long due = run->startedAt;
+    int burstLeft = 0;
+    for (long i = 0;; i++) {
+        if (config->mode == LOAD_OPEN_BURSTY) {
+            // Bursts arrive as a Poisson process; a burst's patients are all due at once
+            if (burstLeft == 0) {
+                due += (long long)(-log(randomUnit(&rng)) * config->burst / config->rate * 1e6);
+                burstLeft = config->burst;
+            }
+            burstLeft--;
+        } else {
+            due += (long long)(-log(randomUnit(&rng)) / config->rate * 1e6);
+        }
+        if (due >= run->endAt) {
+            break;
+        }
+
+        pthread_mutex_lock(&run->lock);
+        while (i - run->released >= LOAD_MAX_IN_FLIGHT) {
+            pthread_cond_wait(&run->changed, &run->lock);  // Too far behind; the wait shows up as lag
+        }
+        pthread_mutex_unlock(&run->lock);
+
+        struct LoadRequest* request = &run->pool[i % LOAD_MAX_IN_FLIGHT];
+        prepareLoadRequest(run, request, run->nextPatientId++, &rng);
+        request->dueAt = due;
+        long long now = monotonicMicros();
+        if (now < due) {
+            sleepUntilMicros(due);
+        } else if (now - due > run->results->maxLagMicros) {
+            run->results->maxLagMicros = now - due;
+        }
+        sendLoadRequest(run, request);
+
+        pthread_mutex_lock(&run->lock);
+        run->submitted = i + 1;
+        pthread_cond_signal(&run->changed);
+        pthread_mutex_unlock(&run->lock);
+    }
+    pthread_mutex_lock(&run->lock);
+    run->senderDone = 1;
+    pthread_cond_signal(&run->changed);
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+}
+
+// Collect open-loop requests in the order they were sent
+void collectOpenLoop(struct LoadRun* run) {
+    struct LoadRequest* previous = NULL;
+    for (long i = 0;; i++) {
+        pthread_mutex_lock(&run->lock);
+        while (run->submitted <= i && !run->senderDone) {
+            pthread_cond_wait(&run->changed, &run->lock);
+        }
+        int finished = run->submitted <= i;
+        pthread_mutex_unlock(&run->lock);
+        if (finished) {
+            break;
+        }
+
+        struct LoadRequest* request = &run->pool[i % LOAD_MAX_IN_FLIGHT];
+        routerWait(&run->router, &request->assign);  // The intake ran before it
+        finishLoadRequest(run, request, run->results);
+        if (previous != NULL) {
+            waitForDischarge(run, previous, run->results);
+            pthread_mutex_lock(&run->lock);
+            run->released = i;
+            pthread_cond_signal(&run->changed);
+            pthread_mutex_unlock(&run->lock);
+        }
+        previous = request;
+        run->results->sent++;
+    }
+    if (previous != NULL) {
+        waitForDischarge(run, previous, run->results);
+    }
+}
+
+// Closed loop: one request at a time, paced by --rate when it is given
+void* loadClientMain(void* arg) {
+    struct LoadRun* run = arg;
+    struct LoadConfig* config = run->config;
+    struct LoadRequest* request = calloc(1, sizeof(struct LoadRequest));
+    struct LoadResults* results = calloc(1, sizeof(struct LoadResults));
+    struct LoadResults* shared = run->results;
+    int client = __atomic_fetch_add(&run->nextClient, 1, __ATOMIC_RELAXED);
+    unsigned long long rng = (config->seed ? config->seed : 1) + client * 0x9E3779B97F4A7C15ULL;
+    double pacing = config->rate > 0 ? config->clients / config->rate * 1e6 : 0;
+    long long due = run->startedAt + (long long)(randomUnit(&rng) * pacing);  // Spread the clients out
+    while (1) {
+        long long now = monotonicMicros();
+        if (pacing > 0) {
+            if (due >= run->endAt) {
+                break;
+            }
+            if (now < due) {
+                sleepUntilMicros(due);
+            } else if (now - due > results->maxLagMicros) {
+                results->maxLagMicros = now - due;
+            }
+        } else {
+            if (now >= run->endAt) {
+                break;
+            }
+            due = now;
+        }
+        prepareLoadRequest(run, request, __atomic_fetch_add(&run->nextPatientId, 1, __ATOMIC_RELAXED), &rng);
+        request->dueAt = due;
+        sendLoadRequest(run, request);
+        routerWait(&run->router, &request->assign);  // The intake ran before it
+        finishLoadRequest(run, request, results);
+        waitForDischarge(run, request, results);
+        results->sent++;
+        if (pacing > 0) {
+            due += (long long)pacing;
+        } else if (config->thinkMicros > 0) {
+            usleep((useconds_t)config->thinkMicros);
+        }
+    }
+
+    pthread_mutex_lock(&run->resultsLock);
+    for (long i = 0; i < results->requests.count; i++) {
+        addLoadSample(&shared->requests, results->requests.at[i], results->requests.micros[i]);
+    }
+    for (int op = 0; op < LOAD_OPS; op++) {
+        for (long i = 0; i < results->ops[op].count; i++) {
+            addLatency(&shared->ops[op], results->ops[op].micros[i]);
+        }
+    }
+    shared->sent += results->sent;
+    shared->turnedAway += results->turnedAway;
+    shared->assigned += results->assigned;
+    shared->fastLane += results->fastLane;
+    shared->preempted += results->preempted;
+    if (results->maxLagMicros > shared->maxLagMicros) {
+        shared->maxLagMicros = results->maxLagMicros;
+    }
+    pthread_mutex_unlock(&run->resultsLock);
+    freeLoadResults(results);
+    free(results);
+    free(request);
+    return NULL;
+}
+
+// Walks one site's read view over and over, as a busy listing screen would,
+// checking that every view it sees hangs together
+void* loadReaderMain(void* arg) {
+    struct LoadRun* run = arg;
+    int siteIndex = __atomic_fetch_add(&run->nextReader, 1, __ATOMIC_RELAXED) % run->config->siteCount;
+    struct Hospital* site = run->router.workers[siteIndex].site;
+    long reads = 0, inconsistent = 0;
+    while (!__atomic_load_n(&run->stopReaders, __ATOMIC_ACQUIRE)) {
+        const struct SiteView* view;
+        int slot = beginSiteRead(site, &view);
+        int rows = 0, consistent = 1;
+        for (int i = 0; i < MAX_PATIENTS; i++) {
+            rows += view->patients[i] != NULL;
+        }
+        const struct PriorityQueue* q = &view->waitingQueue;
+        for (int i = q->front; q->front != -1 && i <= q->rear; i++) {
+            consistent &= findViewPatient(view, q->items[i].patientId) != -1;
+        }
+        consistent &= rows == view->patientCount;
+        endSiteRead(slot);
+        inconsistent += !consistent;
+        reads++;
+    }
+    __atomic_fetch_add(&run->results->reads, reads, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&run->results->inconsistentReads, inconsistent, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// One run at a fixed load against fresh sites
+void runLoadOnce(struct LoadConfig* config, struct LoadResults* results) {
+    struct LoadRun* run = calloc(1, sizeof(struct LoadRun));
+    initRouter(&run->router);
+    for (int i = 0; i < config->siteCount; i++) {
+        char name[MAX_NAME_LEN];
+        snprintf(name, sizeof(name), "Load%d", i + 1);
+        struct Hospital* site = createHospital(name, config->dataFile);
+        memcpy(site->doctors, config->doctors, sizeof(site->doctors));
+        site->doctorCount = config->doctorCount;
+        rebuildDashboardCounters(site);
+        rebuildPatientIndex(site);
+        startSiteWorker(&run->router, site, NULL);
+    }
+    run->config = config;
+    run->results = results;
+    run->nextPatientId = LOAD_FIRST_PATIENT_ID;
+    pthread_mutex_init(&run->lock, NULL);
+    pthread_cond_init(&run->changed, NULL);
+    pthread_mutex_init(&run->resultsLock, NULL);
+    pthread_t* readers = calloc(config->readers + 1, sizeof(pthread_t));
+    for (int i = 0; i < config->readers; i++) {
+        pthread_create(&readers[i], NULL, loadReaderMain, run);
+    }
+    run->startedAt = monotonicMicros();
+    run->endAt = run->startedAt + (long long)(config->seconds * 1e6);
+
+    if (config->mode == LOAD_CLOSED) {
+        pthread_t clients[LOAD_MAX_CLIENTS];
+        for (int i = 0; i < config->clients; i++) {
+            pthread_create(&clients[i], NULL, loadClientMain, run);
+        }
+        for (int i = 0; i < config->clients; i++) {
+            pthread_join(clients[i], NULL);
+        }
+    } else {
+        pthread_t sender;
+        run->pool = calloc(LOAD_MAX_IN_FLIGHT, sizeof(struct LoadRequest));
+        pthread_create(&sender, NULL, loadSenderMain, run);
+        collectOpenLoop(run);
+        pthread_join(sender, NULL);
+        free(run->pool);
+    }
+    results->seconds = (monotonicMicros() - run->startedAt) / 1e6;
+    if (results->seconds < config->seconds) {
+        results->seconds = config->seconds;
+    }
+    __atomic_store_n(&run->stopReaders, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < config->readers; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    free(readers);
+    stopRouter(&run->router);
+    free(run);
+}
+
+// Sorted copy of the request latencies that finished in [from, to) microseconds
+long sortedLoadWindow(const struct LoadSamples* samples, long long from, long long to, double* out) {
+    long count = 0;
+    for (long i = 0; i < samples->count; i++) {
+        if (samples->at[i] >= from && samples->at[i] < to) {
+            out[count++] = samples->micros[i];
         }
-    } else {
-        strcpy(specialty, suggestedSpecialty);
     }
-    
-    printf("Selected Specialty: %s\n", specialty);
-    
-    printf("Emergency case? (1-Yes, 0-No): ");
-    scanf("%d", &newPatient.isEmergency);
-    
-    newPatient.visitCount = 0;
-    newPatient.assignedDoctorId = -1;
-    strcpy(newPatient.visitHistory[0].doctorName, specialty);
-    
-    int index = hash(newPatient.id);
-    while (patients[index].occupied) {
-        index = (index + 1) % MAX_PATIENTS;
+    qsort(out, count, sizeof(double), compareDoubles);
+    return count;
+}
+
+const char* loadModeName(int mode) {
+    switch (mode) {
+        case LOAD_OPEN_BURSTY: return "open loop, bursty arrivals";
+        case LOAD_CLOSED: return "closed loop";
+        default: return "open loop, Poisson arrivals";
     }
-    
-    patients[index] = newPatient;
-    patients[index].occupied = 1;
-    (*patientCount)++;
-    
-    printDivider();
-    printf("Patient added successfully!\n");
-    pauseExecution();
 }
 
-void displayPatients(struct Patient patients[], int patientCount) {
-    printHeader("Patient Records");
-    
-    if (patientCount == 0) {
-        printf("No patients in the system.\n");
-        pauseExecution();
-        return;
+void printLoadReport(struct LoadConfig* config, struct LoadResults* results) {
+    struct LoadSamples* samples = &results->requests;
+    double* sorted = malloc((samples->count + 1) * sizeof(double));
+
+    printf("\nLoad Test: %s", loadModeName(config->mode));
+    if (config->mode == LOAD_CLOSED) {
+        printf(", %d client%s", config->clients, config->clients == 1 ? "" : "s");
     }
-    
-    printf("%-5s %-20s %-5s %-20s %-8s %-10s\n", 
-           "ID", "Name", "Age", "Disease", "Visits", "Type");
+    if (config->rate > 0) {
+        printf(", %.0f requests/s", config->rate);
+    }
+    printf(", %d site%s, %.0f s\n", config->siteCount, config->siteCount == 1 ? "" : "s", config->seconds);
+    printf("Latency is from when each request was %s to when its assignment came back.\n",
+           config->coSafe ? "due (coordinated-omission safe)" : "sent");
     printDivider();
-    
-    for (int i = 0; i < MAX_PATIENTS; i++) {
-        if (patients[i].occupied) {
-            printf("%-5d %-20s %-5d %-20s %-8d %-10s\n",
-                   patients[i].id, 
-                   patients[i].name, 
-                   patients[i].age, 
-                   patients[i].disease, 
-                   patients[i].visitCount,
-                   patients[i].isEmergency ? "Emergency" : "Regular");
+    printf("%-9s %-10s %-10s %-10s %-10s %-10s\n", "Time s", "Done/s", "p50 us", "p99 us", "p999 us", "Max us");
+    long long step = (long long)(config->intervalSeconds * 1e6);
+    long long end = (long long)(config->seconds * 1e6);
+    for (long long from = 0; from < end; from += step) {
+        // The last line also takes requests that finished while the run drained
+        long count = sortedLoadWindow(samples, from, from + step >= end ? LLONG_MAX : from + step, sorted);
+        printf("%-9.1f %-10.0f %-10.0f %-10.0f %-10.0f %-10.0f\n", (from + step) / 1e6, count / config->intervalSeconds,
+               percentileOf(sorted, count, 50), percentileOf(sorted, count, 99), percentileOf(sorted, count, 99.9),
+               count ? sorted[count - 1] : 0.0);
+    }
+
+    long count = sortedLoadWindow(samples, 0, LLONG_MAX, sorted);
+    printDivider();
+    printf("Requests:            %ld sent, %ld turned away (site full)\n", results->sent, results->turnedAway);
+    printf("Assigned a doctor:   %ld from the queue, %ld through the fast lane (%ld preempting)\n",
+           results->assigned, results->fastLane, results->preempted);
+    printf("Throughput:          %.0f requests/s\n", count / results->seconds);
+    printf("Latency:             p50 %.0f us, p99 %.0f us, p999 %.0f us, max %.0f us\n",
+           percentileOf(sorted, count, 50), percentileOf(sorted, count, 99), percentileOf(sorted, count, 99.9),
+           count ? sorted[count - 1] : 0.0);
+    if (config->readers > 0) {
+        printf("View readers:        %d, %.0f passes/s over the published views, %ld inconsistent\n",
+               config->readers, results->reads / results->seconds, results->inconsistentReads);
+    }
+    if (config->mode != LOAD_CLOSED || config->rate > 0) {
+        printf("Generator lag:       up to %.1f ms behind schedule%s\n", results->maxLagMicros / 1000.0,
+               config->coSafe || results->maxLagMicros < 1000 ? "" : " (not in the latencies; try --co-safe)");
+    }
+    free(sorted);
+
+    const char* opNames[LOAD_OPS] = {"intake", "assign", "discharge"};
+    printf("\n%-12s %-10s %-10s %-10s %-10s %-10s\n", "Operation", "Count", "Mean us", "p50 us", "p99 us", "p999 us");
+    for (int op = 0; op < LOAD_OPS; op++) {
+        struct ReplayLatencies* list = &results->ops[op];
+        double total = 0;
+        for (long i = 0; i < list->count; i++) {
+            total += list->micros[i];
         }
+        qsort(list->micros, list->count, sizeof(double), compareDoubles);
+        printf("%-12s %-10ld %-10.1f %-10.0f %-10.0f %-10.0f\n", opNames[op], list->count,
+               list->count ? total / list->count : 0.0, percentileOf(list->micros, list->count, 50),
+               percentileOf(list->micros, list->count, 99), percentileOf(list->micros, list->count, 99.9));
     }
-    
-    pauseExecution();
+    printf("(From when the command was sent to its site; includes time waiting in the site's mailbox.)\n");
 }
 
-void displayDoctors(struct Doctor doctors[], int doctorCount) {
-    printHeader("Doctor Status");
-    
-    if (doctorCount == 0) {
-        printf("No doctors in the system.\n");
-        pauseExecution();
-        return;
+// Raise the rate until the sites stop keeping up, then narrow it down. A step
+// keeps up if it finishes 95% of what was offered, turns away under 1%, and
+// its p99 stays under the limit.
+int runSaturationSearch(struct LoadConfig* config) {
+    double good = 0, bad = 0;
+    printf("\nSaturation search: %s, %d site%s, %.0f s per step, p99 limit %.0f us\n", loadModeName(config->mode),
+           config->siteCount, config->siteCount == 1 ? "" : "s", config->seconds, config->p99LimitMicros);
+    printf("Latency is from when each request was due (coordinated-omission safe); Away counts patients\n");
+    printf("turned away because the site was full.\n");
+    printDivider();
+    printf("%-12s %-12s %-10s %-10s %-10s %-8s %-8s\n", "Offered/s", "Done/s", "p50 us", "p99 us", "p999 us", "Away",
+           "Result");
+    for (int stepNumber = 0; stepNumber < LOAD_MAX_STEPS && config->rate >= 1; stepNumber++) {
+        struct LoadResults results;
+        memset(&results, 0, sizeof(results));
+        runLoadOnce(config, &results);
+        double* sorted = malloc((results.requests.count + 1) * sizeof(double));
+        long count = sortedLoadWindow(&results.requests, 0, LLONG_MAX, sorted);
+        double done = count / results.seconds;
+        double p99 = percentileOf(sorted, count, 99);
+        int keptUp = done >= 0.95 * config->rate && results.turnedAway * 100 <= results.sent &&
+                     p99 <= config->p99LimitMicros;
+        printf("%-12.0f %-12.0f %-10.0f %-10.0f %-10.0f %-8ld %-8s\n", config->rate, done,
+               percentileOf(sorted, count, 50), p99, percentileOf(sorted, count, 99.9), results.turnedAway,
+               keptUp ? "ok" : "behind");
+        fflush(stdout);
+        free(sorted);
+        freeLoadResults(&results);
+
+        if (keptUp) {
+            good = config->rate;
+        } else {
+            bad = config->rate;
+        }
+        if (good > 0 && bad > 0) {
+            if ((bad - good) / good < 0.05) {
+                break;
+            }
+            config->rate = (good + bad) / 2;
+        } else {
+            config->rate = keptUp ? config->rate * 2 : config->rate / 2;
+        }
     }
-    
-    printf("%-5s %-20s %-20s %-10s\n", 
-           "ID", "Name", "Specialty", "Status");
     printDivider();
-    
-    for (int i = 0; i < doctorCount; i++) {
-        printf("%-5d %-20s %-20s %-10s\n",
-               doctors[i].id,
-               doctors[i].name,
-               doctors[i].specialty,
-               doctors[i].isBusy ? "Busy" : "Available");
+    if (good > 0) {
+        printf("Saturation point: about %.0f requests/s (the highest rate that kept up)\n", good);
+    } else {
+        printf("The sites did not keep up at any rate tried\n");
     }
-    
-    pauseExecution();
+    return 0;
 }
 
-void displayQueue(struct PriorityQueue* q, struct Patient patients[]) {
-    printHeader("Current Waiting Queue");
-    
-    if (isPriorityQueueEmpty(q)) {
-        printf("No patients in the queue.\n");
-        pauseExecution();
-        return;
+void printLoadUsage() {
+    printf("Usage: hospital_management loadtest [options]\n");
+    printf("  --mode M                 poisson, bursty or closed (default poisson)\n");
+    printf("  --rate R                 Requests per second (default 1000; closed loop: unpaced)\n");
+    printf("  --burst N                Patients per burst in bursty mode (default 20)\n");
+    printf("  --clients N              Closed-loop clients (default 4)\n");
+    printf("  --think-us T             Closed loop: pause between a client's requests\n");
+    printf("  --duration S             Seconds to run, or per saturation step (default 10, 3)\n");
+    printf("  --interval S             Seconds per line of the report (default 1)\n");
+    printf("  --emergency-ratio P      Share of emergency patients (default 0.1)\n");
+    printf("  --mix Specialty=W        Relative share of patients per specialty, repeatable\n");
+    printf("                           (default: proportional to slots on shift now)\n");
+    printf("  --sites N                Sites, each with its own worker (default 1)\n");
+    printf("  --readers N              Threads reading the sites' published views meanwhile\n");
+    printf("  --data FILE              Doctors to start from (default hospital_data.bin)\n");
+    printf("  --co-safe                Measure from when each request was due\n");
+    printf("  --saturate               Search for the highest rate the sites keep up with\n");
+    printf("  --p99-limit-us US        Saturation search: p99 that counts as keeping up (default 10000)\n");
+    printf("  --seed N                 Random seed (default 1)\n");
+}
+
+int runLoadTest(int argc, char* argv[]) {
+    struct LoadConfig* config = calloc(1, sizeof(struct LoadConfig));
+    if (config == NULL) {
+        printf("Error: Not enough memory for the load test\n");
+        return 1;
     }
-    
-    printf("%-5s %-20s %-10s\n", 
-           "ID", "Name", "Priority");
-    printDivider();
-    
-    for (int i = q->front; i <= q->rear; i++) {
-        int patientId = q->items[i].patientId;
-        for (int j = 0; j < MAX_PATIENTS; j++) {
-            if (patients[j].occupied && patients[j].id == patientId) {
-                printf("%-5d %-20s %-10s\n",
-                       patients[j].id,
-                       patients[j].name,
-                       q->items[i].priority ? "Emergency" : "Regular");
-                break;
+    config->mode = LOAD_OPEN_POISSON;
+    config->burst = 20;
+    config->clients = 4;
+    config->seconds = -1;
+    config->intervalSeconds = 1;
+    config->emergencyRatio = 0.1;
+    config->siteCount = 1;
+    config->p99LimitMicros = 10000;
+    config->seed = 1;
+    config->dataFile = "hospital_data.bin";
+    config->rate = -1;
+
+    int status = 0;
+    for (int i = 0; i < argc && status == 0; i++) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        char name[MAX_NAME_LEN];
+        if (strcmp(option, "--co-safe") == 0) {
+            config->coSafe = 1;
+            continue;
+        } else if (strcmp(option, "--saturate") == 0) {
+            config->saturate = 1;
+            continue;
+        } else if (value == NULL) {
+            status = 1;
+        } else if (strcmp(option, "--mode") == 0) {
+            if (strcmp(value, "poisson") == 0) config->mode = LOAD_OPEN_POISSON;
+            else if (strcmp(value, "bursty") == 0) config->mode = LOAD_OPEN_BURSTY;
+            else if (strcmp(value, "closed") == 0) config->mode = LOAD_CLOSED;
+            else status = 1;
+        } else if (strcmp(option, "--rate") == 0) {
+            config->rate = atof(value);
+        } else if (strcmp(option, "--burst") == 0) {
+            config->burst = atoi(value);
+        } else if (strcmp(option, "--clients") == 0) {
+            config->clients = atoi(value);
+        } else if (strcmp(option, "--think-us") == 0) {
+            config->thinkMicros = atoll(value);
+        } else if (strcmp(option, "--duration") == 0) {
+            config->seconds = atof(value);
+        } else if (strcmp(option, "--interval") == 0) {
+            config->intervalSeconds = atof(value);
+        } else if (strcmp(option, "--emergency-ratio") == 0) {
+            config->emergencyRatio = atof(value);
+        } else if (strcmp(option, "--sites") == 0) {
+            config->siteCount = atoi(value);
+        } else if (strcmp(option, "--readers") == 0) {
+            config->readers = atoi(value);
+        } else if (strcmp(option, "--data") == 0) {
+            config->dataFile = value;
+        } else if (strcmp(option, "--p99-limit-us") == 0) {
+            config->p99LimitMicros = atof(value);
+        } else if (strcmp(option, "--seed") == 0) {
+            config->seed = strtoull(value, NULL, 10);
+        } else if (strcmp(option, "--mix") == 0) {
+            double weight;
+            int s;
+            if (sscanf(value, "%49[^=]=%lf", name, &weight) != 2 || (s = specialtyIndex(name)) == -1) {
+                printf("Error: Unknown specialty in --mix %s\n", value);
+                status = 1;
+            } else {
+                config->mixWeight[s] = weight;
+                config->hasMix = 1;
             }
+        } else {
+            status = 1;
         }
+        i++;
+    }
+    if (config->seconds < 0) {
+        config->seconds = config->saturate ? 3 : 10;
+    }
+    if (config->rate < 0) {
+        config->rate = config->mode == LOAD_CLOSED ? 0 : 1000;
+    }
+    if (status == 0 && config->mode == LOAD_CLOSED && config->saturate) {
+        printf("Error: --saturate needs an open-loop mode (poisson or bursty)\n");
+        status = 2;
+    }
+    if (status == 0 && config->mode == LOAD_CLOSED && config->coSafe && config->rate <= 0) {
+        printf("Error: --co-safe in closed loop needs --rate, so each client has a schedule to be late against\n");
+        status = 2;
+    }
+    if (status == 1 || config->seconds <= 0 || config->intervalSeconds <= 0 || config->burst < 1 ||
+        (config->mode != LOAD_CLOSED && config->rate <= 0) || config->clients < 1 ||
+        config->clients > LOAD_MAX_CLIENTS || config->siteCount < 1 || config->siteCount > MAX_SITES ||
+        config->readers < 0 || config->readers > MAX_VIEW_READERS) {
+        printLoadUsage();
+        status = 1;
+    }
+    if (status != 0) {
+        free(config);
+        return 1;
     }
-    
-    pauseExecution();
-}
 
-void displayPatientInfo(struct Patient patients[], int patientId) {
-    for (int i = 0; i < MAX_PATIENTS; i++) {
-        if (patients[i].occupied && patients[i].id == patientId) {
-            printf("Patient ID: %d\n", patients[i].id);
-            printf("Name: %s\n", patients[i].name);
-            printf("Age: %d\n", patients[i].age);
-            printf("Disease: %s\n", patients[i].disease);
-            printf("Visits: %d\n", patients[i].visitCount);
-            printf("Emergency: %s\n", patients[i].isEmergency ? "Yes" : "No");
-            printf("Assigned Doctor ID: %d\n", patients[i].assignedDoctorId);
-            return;
+    // Start from the saved doctors with every slot free; patients come from the load
+    struct Patient* saved = malloc(MAX_PATIENTS * sizeof(struct Patient));
+    int savedCount = 0;
+    loadData(config->dataFile, saved, &savedCount, config->doctors, &config->doctorCount);
+    free(saved);
+    if (config->doctorCount == 0) {
+        printf("Error: %s has no doctors to assign patients to\n", config->dataFile);
+        free(config);
+        return 1;
+    }
+    int minuteOfDay = currentMinuteOfDay();
+    for (int i = 0; i < config->doctorCount; i++) {
+        initDoctorSlots(&config->doctors[i], config->doctors[i].capacity);
+        config->doctors[i].patientsAttended = 0;
+        int s = specialtyIndex(config->doctors[i].specialty);
+        if (!config->hasMix && s != -1 && isDoctorOnShift(&config->doctors[i], minuteOfDay)) {
+            config->mixWeight[s] += config->doctors[i].capacity;
         }
     }
-    printf("Patient not found.\n");
-}
+    if (!config->hasMix) {
+        config->mixWeight[0] += 1e-9;  // Never leave the mix empty
+    }
 
-// New function to add a visit record
-void addVisitRecord(struct Patient *patient, const char *doctorName, const char *notes) {
-    if (patient->visitCount < MAX_VISIT_HISTORY) {
-        strncpy(patient->visitHistory[patient->visitCount].doctorName, doctorName, MAX_NAME_LEN);
-        strncpy(patient->visitHistory[patient->visitCount].notes, notes, MAX_NAME_LEN);
-        patient->visitCount++;
+    if (config->saturate) {
+        config->coSafe = 1;
+        runSaturationSearch(config);
     } else {
-        printf("Visit history is full for patient ID %d.\n", patient->id);
+        struct LoadResults results;
+        memset(&results, 0, sizeof(results));
+        runLoadOnce(config, &results);
+        printLoadReport(config, &results);
+        freeLoadResults(&results);
     }
+    free(config);
+    return 0;
 }
 
-void displayVisitHistory(struct Patient patients[], struct Doctor doctors[], int patientId) {
-    for (int i = 0; i < MAX_PATIENTS; i++) {
-        if (patients[i].occupied && patients[i].id == patientId) {
-            printf("Visit History for Patient ID: %d, Name: %s\n", 
-                   patients[i].id, patients[i].name);
-            
-            if (patients[i].visitCount == 0) {
-                printf("No visit records found.\n");
-                return;
-            }
-            
-            for (int j = 0; j < patients[i].visitCount; j++) {
-                // Find the doctor's full name based on the assigned doctor ID
-                char doctorFullName[MAX_NAME_LEN] = "Unknown Doctor";
-                for (int k = 0; k < MAX_DOCTORS; k++) {
-                    if (patients[i].assignedDoctorId == doctors[k].id) {
-                        strcpy(doctorFullName, doctors[k].name);
-                        break;
-                    }
-                }
-                
-                printf("%d. Doctor: %s\n", j + 1, 
-                       patients[i].visitHistory[j].doctorName[0] != '\0' ? 
-                       patients[i].visitHistory[j].doctorName : doctorFullName);
-                printf("   Reason: %s\n", patients[i].disease);
-                printf("   Notes: %s\n", patients[i].visitHistory[j].notes);
-                printf("\n");
-            }
-            return;
+// ---------------------------------------------------------------------------
+// Billing from the command line
+//
+// `billing statements` runs the month-end statements against a ledger file,
+// e.g. from a scheduled job. `billing bench` checks the ledger at volume: it
+// posts a synthetic month of visits and payments through the same path the
+// desk uses, into a scratch ledger, then times the statements for them.
+// ---------------------------------------------------------------------------
+
+void printBillingUsage() {
+    printf("Usage: hospital_management billing statements --month YYYY-MM [options]\n");
+    printf("       hospital_management billing bench [options]\n");
+    printf("       hospital_management billing check\n");
+    printf("  --month YYYY-MM          Month to produce statements for (bench default: last month)\n");
+    printf("  --ledger FILE            Ledger to read (default hospital_data.ledger;\n");
+    printf("                           bench: billing_bench.ledger, created afresh)\n");
+    printf("  --out FILE               Where the statements go (default <ledger>.statements-YYYY-MM.txt)\n");
+    printf("  --patients N             Bench: patients to bill (default 1000000)\n");
+    printf("  --visits N               Bench: visits per patient over the month and the one before (default 4)\n");
+    printf("  --keep                   Bench: keep the ledger and statements afterwards\n");
+    printf("  --seed N                 Bench: random seed (default 1)\n");
+}
+
+// Post `patients * visits` visits spread evenly over the month before `monthStart`
+// and the month itself, with a payment after every fourth; returns the running totals' balance
+long long postBenchVolume(struct BillingLedger* ledger, int patients, int visits, long long monthStart,
+                          long long monthEnd, unsigned long long seed) {
+    long long total = (long long)patients * visits;
+    long long from = monthStart - (monthEnd - monthStart);
+    for (long long i = 0; i < total; i++) {
+        long long postedAt = from + (long long)((double)i / total * (monthEnd - from));
+        int patientId = 1 + (int)(randomUnit(&seed) * patients);
+        int specialty = (int)(randomUnit(&seed) * SPECIALTY_COUNT);
+        int doctorId = 1 + (int)(randomUnit(&seed) * MAX_DOCTORS);
+        postVisitCharges(ledger, postedAt, patientId, doctorId, specialty, randomUnit(&seed) < 0.1, postedAt);
+        if (i % 4 == 3) {
+            postPayment(ledger, postedAt, 1 + (int)(randomUnit(&seed) * patients), SPECIALIST_CONSULTATION_CENTS);
         }
     }
-    printf("Patient not found.\n");
+    long long owed = 0;
+    for (int i = 0; i < ledger->accounts.capacity; i++) {
+        if (ledger->accounts.slots[i].used) {
+            owed += ledger->accounts.slots[i].chargedCents - ledger->accounts.slots[i].paidCents;
+        }
+    }
+    return owed;
 }
 
-void markDoctorAvailable(struct Doctor doctors[], int doctorCount, struct Patient patients[]) {
-    printf("Currently Busy Doctors:\n");
-    printf("%-5s %-20s %-20s\n", "ID", "Name", "Specialty");
-    printf("----------------------------------------\n");
-    for (int i = 0; i < doctorCount; i++) {
-        if (doctors[i].isBusy) {
-            printf("%-5d %-20s %-20s\n", doctors[i].id, doctors[i].name, doctors[i].specialty);
+// Scratch-site helpers for the self checks
+int reportCheck(const char* name, int ok) {
+    printf("%-60s %s\n", name, ok ? "ok" : "WRONG");
+    return ok;
+}
+
+void checkAddDoctor(struct Hospital* site, int id, const char* specialty, int capacity) {
+    struct Doctor doctor;
+    memset(&doctor, 0, sizeof(doctor));
+    doctor.id = id;
+    snprintf(doctor.name, MAX_NAME_LEN, "Check Doctor %d", id);
+    snprintf(doctor.specialty, MAX_NAME_LEN, "%s", specialty);
+    initDoctorSlots(&doctor, capacity);
+    hospitalAddDoctor(site, &doctor);
+}
+
+void checkAdmit(struct Hospital* site, int id, const char* disease, const char* specialty, int isEmergency) {
+    struct Patient record;
+    memset(&record, 0, sizeof(record));
+    record.id = id;
+    snprintf(record.name, MAX_NAME_LEN, "Check Patient %d", id);
+    snprintf(record.disease, MAX_NAME_LEN, "%s", disease);
+    snprintf(record.requestedSpecialty, MAX_NAME_LEN, "%s", specialty);
+    record.isEmergency = isEmergency;
+    record.assignedDoctorId = -1;
+    hospitalAdmitPatient(site, &record);
+}
+
+// Finish the patient's consultation the way Release Doctor Slot does
+void checkCompleteVisit(struct Hospital* site, int patientId, const char* notes) {
+    int row = findPatientIndex(site->patients, patientId);
+    int doctorIndex = row != -1 ? findDoctorIndex(site, site->patients[row].assignedDoctorId) : -1;
+    if (doctorIndex != -1) {
+        hospitalReleaseSlot(site, doctorIndex, findPatientSlot(&site->doctors[doctorIndex], patientId));
+        hospitalRecordVisitNotes(site, patientId, site->doctors[doctorIndex].id, notes, 1);
+    }
+}
+
+// Check that a visit interrupted by an emergency is billed once, when it
+// completes: one General Medicine doctor with one slot sees a regular patient,
+// an emergency takes the slot, then both visits complete. Then check that a
+// patient keeps being billed once their visit history is full. Returns 0 if
+// the charges are right.
+int runBillingCheck() {
+    const char* ledgerPath = "billing_check.ledger";
+    remove(ledgerPath);
+    struct Hospital* site = createHospital("Billing check", "billing_check.bin");
+    site->ledger = openLedger(ledgerPath);
+    if (site->ledger == NULL) {
+        free(site);
+        return 1;
+    }
+
+    int doctorId = 1;
+    checkAddDoctor(site, doctorId, "General Medicine", 1);
+    int regularId = 1001, emergencyId = 1002;
+    checkAdmit(site, regularId, "Fever", "General Medicine", 0);
+    checkAdmit(site, emergencyId, "Fever", "General Medicine", 1);
+
+    struct EmergencyDispatch dispatch;
+    hospitalEnqueue(site, regularId);
+    hospitalDequeue(site);
+    hospitalAssign(site, regularId, doctorId);
+    enqueueWithFastLane(site, emergencyId, &dispatch);
+    int preempted = dispatch.outcome == DISPATCH_PREEMPTED && dispatch.suspendedPatientId == regularId;
+
+    // The emergency's visit completes, then the suspended patient is seen again and completes
+    checkCompleteVisit(site, emergencyId, "Stabilised");
+    hospitalDequeue(site);
+    hospitalAssign(site, regularId, doctorId);
+    checkCompleteVisit(site, regularId, "Seen");
+
+    struct PatientAccount* regular = findAccount(&site->ledger->accounts, regularId, 0);
+    struct PatientAccount* emergency = findAccount(&site->ledger->accounts, emergencyId, 0);
+    long long regularCents = regular != NULL ? regular->chargedCents : 0;
+    long long emergencyCents = emergency != NULL ? emergency->chargedCents : 0;
+    int ok = reportCheck("Emergency suspends the regular visit", preempted);
+    ok &= reportCheck("Suspended visit billed once, when it completes", regularCents == GENERAL_CONSULTATION_CENTS);
+    ok &= reportCheck("Emergency billed with the surcharge",
+                      emergencyCents == GENERAL_CONSULTATION_CENTS + EMERGENCY_SURCHARGE_CENTS);
+
+    int frequentId = 1003;
+    int visits = MAX_VISIT_HISTORY + 5;
+    checkAdmit(site, frequentId, "Fever", "General Medicine", 0);
+    for (int v = 0; v < visits; v++) {
+        hospitalAssign(site, frequentId, doctorId);
+        checkCompleteVisit(site, frequentId, "Seen");
+    }
+    struct PatientAccount* frequent = findAccount(&site->ledger->accounts, frequentId, 0);
+    ok &= reportCheck("Visits past a full history still billed",
+                      frequent != NULL && frequent->chargedCents == (long long)visits * GENERAL_CONSULTATION_CENTS);
+
+    closeLedger(site->ledger);
+    free(site);
+    remove(ledgerPath);
+    return ok ? 0 : 1;
+}
+
+int runBilling(int argc, char* argv[]) {
+    if (argc > 0 && strcmp(argv[0], "check") == 0) {
+        return runBillingCheck();
+    }
+    int bench = argc > 0 && strcmp(argv[0], "bench") == 0;
+    if (argc == 0 || (!bench && strcmp(argv[0], "statements") != 0)) {
+        printBillingUsage();
+        return 1;
+    }
+    const char* month = NULL;
+    const char* ledgerPath = bench ? "billing_bench.ledger" : "hospital_data.ledger";
+    const char* outPath = NULL;
+    int patients = 1000000;
+    int visits = 4;
+    int keep = 0;
+    unsigned long long seed = 1;
+    int status = 0;
+    for (int i = 1; i < argc && status == 0; i++) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(option, "--keep") == 0) {
+            keep = 1;
+            continue;
+        } else if (value == NULL) {
+            status = 1;
+        } else if (strcmp(option, "--month") == 0) {
+            month = value;
+        } else if (strcmp(option, "--ledger") == 0) {
+            ledgerPath = value;
+        } else if (strcmp(option, "--out") == 0) {
+            outPath = value;
+        } else if (strcmp(option, "--patients") == 0) {
+            patients = atoi(value);
+        } else if (strcmp(option, "--visits") == 0) {
+            visits = atoi(value);
+        } else if (strcmp(option, "--seed") == 0) {
+            seed = strtoull(value, NULL, 10);
+        } else {
+            status = 1;
+        }
+        i++;
+    }
+    char lastMonth[16];
+    if (month == NULL && bench) {
+        time_t now = time(NULL);
+        struct tm local;
+        localtime_r(&now, &local);
+        local.tm_mday = 1;
+        local.tm_mon--;  // mktime carries January back into December
+        local.tm_isdst = -1;
+        time_t then = mktime(&local);
+        localtime_r(&then, &local);
+        strftime(lastMonth, sizeof(lastMonth), "%Y-%m", &local);
+        month = lastMonth;
+    }
+    long long monthStart, monthEnd;
+    if (status != 0 || month == NULL || !parseMonth(month, &monthStart, &monthEnd) || patients < 1 || visits < 1) {
+        printBillingUsage();
+        return 1;
+    }
+    char defaultOut[PATH_MAX];
+    if (outPath == NULL) {
+        snprintf(defaultOut, sizeof(defaultOut), "%s", ledgerPath);
+        char* extension = strrchr(defaultOut, '.');
+        if (extension != NULL) {
+            *extension = '\0';
         }
+        snprintf(defaultOut + strlen(defaultOut), sizeof(defaultOut) - strlen(defaultOut), ".statements-%s.txt", month);
+        outPath = defaultOut;
     }
 
-    int docId;
-    printf("Enter Doctor ID to mark as available: ");
-    scanf("%d", &docId);
-    getchar();
+    long long owed = 0;
+    if (bench) {
+        remove(ledgerPath);
+        struct BillingLedger* ledger = openLedger(ledgerPath);
+        if (ledger == NULL) {
+            return 1;
+        }
+        long long started = monotonicMicros();
+        owed = postBenchVolume(ledger, patients, visits, monthStart, monthEnd, seed);
+        drainLedger(ledger);
+        long long micros = monotonicMicros() - started;
+        long long total = (long long)patients * visits;
+        printf("Posted %lld visits (%lld postings) in %.2f s: %.0f visits/s, written in %lld batches, %lld postings waited for room\n",
+               total, ledger->head, micros / 1e6, total / (micros / 1e6), ledger->batches, ledger->stalls);
+        closeLedger(ledger);
+    }
 
-    int found = 0;
-    for (int i = 0; i < doctorCount; i++) {
-        if (doctors[i].id == docId && doctors[i].isBusy) {
-            doctors[i].isBusy = 0;  // Mark doctor available
-            printf("Doctor marked as available.\n");
-            found = 1;
-
-            // Show the patient they attended and add notes
-            for (int j = 0; j < MAX_PATIENTS; j++) {
-                if (patients[j].occupied && patients[j].assignedDoctorId == docId) {
-                    printf("\nAttended Patient: %s (ID: %d)\n", patients[j].name, patients[j].id);
-                    printf("Reason for Visit: %s\n", patients[j].disease);
-
-                    printf("Enter Notes for the Visit: ");
-                    fgets(patients[j].visitHistory[patients[j].visitCount - 1].notes, MAX_NAME_LEN, stdin);
-                    patients[j].visitHistory[patients[j].visitCount - 1].notes[strcspn(patients[j].visitHistory[patients[j].visitCount - 1].notes, "\n")] = 0;
-                    break;
-                }
-            }
-            break;
+    struct StatementRun run;
+    if (!writeStatements(ledgerPath, month, monthStart, monthEnd, outPath, &run)) {
+        return 1;
+    }
+    printf("%lld statements for %s from %lld postings (%lld on the statements) in %.2f s: %.0f statements/s\n",
+           run.statements, month, run.postings, run.lines, run.micros / 1e6,
+           run.micros > 0 ? run.statements / (run.micros / 1e6) : 0.0);
+    printf("Written to %s\n", outPath);
+    if (bench) {
+        // Every bench posting falls before the month's end, so the statements close on the running totals
+        char closing[32], running[32];
+        formatCents(run.closingCents, closing);
+        formatCents(owed, running);
+        printf("Closing balances %s, running totals %s: %s\n", closing, running,
+               run.closingCents == owed ? "they agree" : "MISMATCH");
+        if (!keep) {
+            remove(ledgerPath);
+            remove(outPath);
         }
+        return run.closingCents == owed ? 0 : 1;
     }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Self checks
+//
+// `hospital_management check` drives the site operations on scratch sites,
+// in memory with nothing saved, and compares what they did with what they
+// should have done. Each check prints one line per case and the command exits
+// non-zero if any case is wrong.
+// ---------------------------------------------------------------------------
 
-    if (!found) {
-        printf("Doctor not found or not busy.\n");
+// A repeat patient is routed by the specialty they asked for at intake, not
+// the one their disease suggests, after visits have been recorded
+int runRoutingCheck() {
+    struct Hospital* site = createHospital("Routing check", "routing_check.bin");
+    checkAddDoctor(site, 1, "General Medicine", 2);
+    checkAddDoctor(site, 2, "Cardiology", 1);
+    int regularId = 2001, emergencyId = 2002;
+    checkAdmit(site, regularId, "Fever", "Cardiology", 0);  // "Fever" alone suggests General Medicine
+    checkAdmit(site, emergencyId, "Fever", "Cardiology", 1);
+    int ok = 1;
+
+    for (int id = regularId; id <= emergencyId; id++) {
+        hospitalAssign(site, id, 2);
+        checkCompleteVisit(site, id, "First visit");
     }
+    int row = findPatientIndex(site->patients, regularId);
+    ok &= reportCheck("Requested specialty kept after the first visit",
+                      strcmp(requestedSpecialty(&site->patients[row]), "Cardiology") == 0);
+
+    hospitalEnqueue(site, regularId);
+    ok &= reportCheck("Repeat patient queued under Cardiology on the dashboard",
+                      site->counters.queuedBySpecialty[specialtyIndex("Cardiology")] == 1);
+    ok &= reportCheck("Repeat patient indexed under Cardiology",
+                      hasRow(&site->index.needsSpecialty[specialtyIndex("Cardiology")], row));
+    hospitalWithdrawFromQueue(site, regularId);
+
+    struct EmergencyDispatch dispatch;
+    enqueueWithFastLane(site, emergencyId, &dispatch);
+    ok &= reportCheck("Repeat emergency dispatched to the cardiologist",
+                      dispatch.outcome == DISPATCH_FREE_SLOT && dispatch.doctorId == 2);
+
+    free(site);
+    return ok;
 }
 
+// Patient IDs are per site: a site turns away an ID it already holds, and a
+// referral never lands on a site where the ID is taken
+int runSitesCheck() {
+    struct ShardRouter* router = calloc(1, sizeof(struct ShardRouter));
+    initRouter(router);
+    struct Hospital* north = createHospital("North check", "north_check.bin");
+    struct Hospital* south = createHospital("South check", "south_check.bin");
+    checkAddDoctor(north, 1, "General Medicine", 1);
+    checkAddDoctor(south, 2, "Cardiology", 2);
+    int sharedId = 3001;
+    checkAdmit(north, sharedId, "Chest Pain", "Cardiology", 0);
+    hospitalEnqueue(north, sharedId);
+    checkAdmit(south, sharedId, "Fever", "General Medicine", 0);
+    int ok = 1;
 
-int main() {
-    struct Patient patients[MAX_PATIENTS] = {0};
-    struct Doctor doctors[MAX_DOCTORS] = {0};
-    int patientCount = 0;
-    int doctorCount = 0;
-    
-    struct PriorityQueue waitingQueue;
-    initPriorityQueue(&waitingQueue);
-    
-    loadData(patients, &patientCount, doctors, &doctorCount);
+    struct Patient duplicate = south->patients[findPatientIndex(south->patients, sharedId)];
+    ok &= reportCheck("Admitting an ID the site already holds is refused",
+                      hospitalAdmitPatient(south, &duplicate) == -1 && south->patientCount == 1);
+    startSiteWorker(router, north, NULL);
+    startSiteWorker(router, south, NULL);
+
+    struct SiteCommand intake = {0};
+    intake.type = SITE_CMD_INTAKE;
+    intake.record = duplicate;
+    routerCall(router, 1, &intake);
+    ok &= reportCheck("Intake of a taken ID fails", intake.result == -1);
+
+    int sites[MAX_SITES];
+    struct Patient found[MAX_SITES];
+    ok &= reportCheck("Lookup returns both sites holding the ID",
+                      routerFindPatient(router, sharedId, sites, found) == 2);
+
+    ok &= reportCheck("Referral to the only site holding the ID fails",
+                      routerReferPatient(router, 0, sharedId, 12 * 60) == -1);
+    int row = findPatientIndex(north->patients, sharedId);
+    ok &= reportCheck("Referred patient stays queued at the source",
+                      row != -1 && hasRow(&north->index.queued, row) && queueLength(&north->waitingQueue) == 1);
+    ok &= reportCheck("Receiving site still holds only its own patient",
+                      south->patientCount == 1 && freeSlotCount(&south->doctors[0]) == 2);
+
+    stopRouter(router);
+    free(router);
+    return ok;
+}
+
+// The dashboard counters are kept up to date by each site operation instead of
+// being recomputed on every refresh. Drive each operation on a scratch site and
+// compare the counters with a full recompute after every step.
+int runDashboardCheck() {
+    struct Hospital* site = createHospital("Dashboard check", "dashboard_check.bin");
+    int ok = 1;
+    checkAddDoctor(site, 1, "General Medicine", 1);
+    checkAddDoctor(site, 2, "Cardiology", 1);
+    checkAddDoctor(site, 3, "Neurology", 1);
+    ok &= reportCheck("Counters after adding doctors", verifyDashboardCounters(site, 1));
+    checkAdmit(site, 4001, "Chest Pain", "Cardiology", 0);
+    checkAdmit(site, 4002, "Fever", "General Medicine", 0);
+    checkAdmit(site, 4003, "Heart Attack", "Cardiology", 1);
+    checkAdmit(site, 4004, "Headache", "Neurology", 0);
+    ok &= reportCheck("Counters after admissions", verifyDashboardCounters(site, 1));
+
+    hospitalEnqueue(site, 4001);
+    hospitalEnqueue(site, 4002);
+    hospitalEnqueue(site, 4004);
+    hospitalEnqueue(site, 4002);  // Queued twice
+    ok &= reportCheck("Counters after enqueues", verifyDashboardCounters(site, 1));
+    int first = hospitalDequeue(site);
+    ok &= reportCheck("Counters after a dequeue", first == 4001 && verifyDashboardCounters(site, 1));
+    hospitalWithdrawFromQueue(site, 4002);
+    ok &= reportCheck("Counters after a withdrawal", verifyDashboardCounters(site, 1));
+    hospitalRequeueFront(site, 4001);
+    ok &= reportCheck("Counters after a requeue at the front", verifyDashboardCounters(site, 1));
+
+    hospitalWithdrawFromQueue(site, 4001);
+    hospitalAssign(site, 4001, 2);
+    hospitalAssign(site, 4002, 1);
+    ok &= reportCheck("Counters after assignments", verifyDashboardCounters(site, 1));
+    struct EmergencyDispatch dispatch;
+    enqueueWithFastLane(site, 4003, &dispatch);
+    ok &= reportCheck("Counters after an emergency takes a busy slot",
+                      dispatch.outcome == DISPATCH_PREEMPTED && verifyDashboardCounters(site, 1));
+    checkCompleteVisit(site, 4003, "Stabilised");
+    ok &= reportCheck("Counters after a slot is released", verifyDashboardCounters(site, 1));
+
+    hospitalDischargePatient(site, 4002);  // Holds a slot and is still queued once
+    hospitalDischargePatient(site, 4004);  // Queued
+    ok &= reportCheck("Counters after discharges", verifyDashboardCounters(site, 1));
+    hospitalRemoveDoctor(site, 3);
+    ok &= reportCheck("Counters after removing a doctor", verifyDashboardCounters(site, 1));
+    ok &= reportCheck("Patient indexes agree with the table", verifyPatientIndex(site, 1));
+
+    free(site);
+    return ok;
+}
+
+// Remove a doctor the way Remove Doctor does: move their patients, then take the doctor away
+void checkRemoveDoctor(struct Hospital* site, int doctorId, struct RebalanceResult* result) {
+    rebalanceDoctors(site, &doctorId, 1, currentMinuteOfDay(), result);
+    hospitalRemoveDoctor(site, doctorId);
+    dispatchRequeuedEmergencies(site, result);
+}
+
+// An emergency a rebalance cannot place keeps its priority: it takes a slot
+// through the fast lane if a regular case can be suspended, and otherwise
+// waits at the head of the emergency queue
+int runRebalanceCheck() {
+    struct Hospital* site = createHospital("Rebalance check", "rebalance_check.bin");
+    checkAddDoctor(site, 1, "Cardiology", 1);
+    checkAddDoctor(site, 2, "Cardiology", 1);
+    checkAdmit(site, 5001, "Heart Attack", "Cardiology", 1);
+    checkAdmit(site, 5002, "Heart Attack", "Cardiology", 1);
+    checkAdmit(site, 5003, "Heart Attack", "Cardiology", 1);
+    checkAdmit(site, 5004, "Chest Pain", "Cardiology", 0);
+    hospitalAssign(site, 5001, 1);
+    hospitalAssign(site, 5002, 2);
+    hospitalEnqueue(site, 5003);
+    hospitalEnqueue(site, 5004);
+    int ok = 1;
+
+    struct RebalanceResult result;
+    checkRemoveDoctor(site, 1, &result);
+    struct PriorityQueue* q = &site->waitingQueue;
+    ok &= reportCheck("Unplaced emergency requeued ahead of waiting emergencies",
+                      result.requeued == 1 && queueLength(q) == 3 && q->items[q->front].patientId == 5001);
+
+    // Now the remaining cardiologist is with a regular case
+    checkCompleteVisit(site, 5002, "Seen");
+    hospitalWithdrawFromQueue(site, 5004);
+    hospitalAssign(site, 5004, 2);
+    checkAddDoctor(site, 3, "Cardiology", 1);
+    hospitalWithdrawFromQueue(site, 5001);
+    hospitalAssign(site, 5001, 3);
+    checkRemoveDoctor(site, 3, &result);
+    int row = findPatientIndex(site->patients, 5001);
+    ok &= reportCheck("Unplaced emergency takes a regular case's slot",
+                      result.requeued == 0 && result.suspended == 1 && site->patients[row].assignedDoctorId == 2 &&
+                      findPatientSlot(&site->doctors[findDoctorIndex(site, 2)], 5001) != -1);
+    ok &= reportCheck("Suspended regular case waits behind the emergencies only",
+                      queueLength(q) == 2 && q->items[q->rear].patientId == 5004);
+
+    free(site);
+    return ok;
+}
+
+void printCheckUsage() {
+    printf("Usage: hospital_management check [routing|billing|sites|dashboard|rebalance]\n");
+    printf("  Runs the named check, or all of them\n");
+}
+
+int runChecks(int argc, char* argv[]) {
+    const char* only = argc > 0 ? argv[0] : NULL;
+    if (only != NULL && strcmp(only, "routing") != 0 && strcmp(only, "billing") != 0 &&
+        strcmp(only, "sites") != 0 && strcmp(only, "dashboard") != 0 && strcmp(only, "rebalance") != 0) {
+        printCheckUsage();
+        return 1;
+    }
+    int ok = 1;
+    if (only == NULL || strcmp(only, "routing") == 0) {
+        ok &= runRoutingCheck();
+    }
+    if (only == NULL || strcmp(only, "billing") == 0) {
+        ok &= runBillingCheck() == 0;
+    }
+    if (only == NULL || strcmp(only, "sites") == 0) {
+        ok &= runSitesCheck();
+    }
+    if (only == NULL || strcmp(only, "dashboard") == 0) {
+        ok &= runDashboardCheck();
+    }
+    if (only == NULL || strcmp(only, "rebalance") == 0) {
+        ok &= runRebalanceCheck();
+    }
+    printf("%s\n", ok ? "All checks passed." : "Some checks FAILED.");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "simulate") == 0) {
+        return runSimulation(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "events") == 0) {
+        return runEventConsumer(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "replay") == 0) {
+        return runReplay(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "loadtest") == 0) {
+        return runLoadTest(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "billing") == 0) {
+        return runBilling(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "check") == 0) {
+        return runChecks(argc - 2, argv + 2);
+    }
+
+    // Sites come from --sites North,South,...; a single site uses hospital_data.bin.
+    // --replicate PATH ships every change to a follower started with `follow PATH`.
+    // --events PATH publishes change events to subscribers (`events PATH`).
+    // --shared keeps the sites in shared memory for other terminals on this machine.
+    // --record PATH writes every operation to a trace for `replay PATH`.
+    char siteList[MAX_SITES * MAX_NAME_LEN] = "Main";
+    const char* replicatePath = NULL;
+    const char* eventsPath = NULL;
+    const char* recordPath = NULL;
+    int shared = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--shared") == 0) {
+            shared = 1;
+        } else if (i + 1 >= argc) {
+            break;
+        } else if (strcmp(argv[i], "--sites") == 0) {
+            strncpy(siteList, argv[++i], sizeof(siteList) - 1);
+        } else if (strcmp(argv[i], "--replicate") == 0) {
+            replicatePath = argv[++i];
+        } else if (strcmp(argv[i], "--events") == 0) {
+            eventsPath = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0) {
+            recordPath = argv[++i];
+        }
+    }
+    if (shared && (replicatePath != NULL || eventsPath != NULL || recordPath != NULL)) {
+        printf("Error: --replicate, --events and --record cannot be used with --shared\n");
+        return 1;
+    }
+    char* siteNames[MAX_SITES];
+    int siteCount = 0;
+    for (char* name = strtok(siteList, ","); name != NULL && siteCount < MAX_SITES; name = strtok(NULL, ",")) {
+        siteNames[siteCount++] = name;
+    }
+
+    struct ShardRouter router;
+    if (argc > 2 && strcmp(argv[1], "follow") == 0) {
+        if (!runFollower(&router, argv[2])) {
+            return 0;
+        }
+        replicatePath = argv[2];  // The promoted replica takes over the primary's socket
+    } else if (!startRouter(&router, siteNames, siteCount, shared)) {
+        return 1;
+    }
+    if (shared) {
+        shareTerminalInput();
+    }
+    if (replicatePath != NULL) {
+        startReplication(&router, replicatePath);
+    }
+    if (eventsPath != NULL) {
+        startChangeFeed(&router, eventsPath);
+    }
+    if (recordPath != NULL && !startTrace(&router, recordPath)) {
+        return 1;
+    }
+    int activeSite = 0;
     
     int choice;
     while (1) {
+        struct SiteWorker* worker = &router.workers[activeSite];
+        struct Hospital* site = worker->site;
+        struct Patient* patients = site->patients;
+        struct Doctor* doctors = site->doctors;
+
         printHeader("Hospital Management System");
+        if (router.siteCount > 1) {
+            printf("Site: %s\n\n", site->siteName);
+        }
         printf("1. Manage Patient Records\n");
         printf("2. Manage Doctor Assignments\n");
         printf("3. Manage Waiting Queue\n");
-        printf("4. Save and Exit\n");
+        printf("4. Live Dashboard\n");
+        printf("5. Appointments\n");
+        printf("6. Billing\n");
+        printf("7. Multi-Site Operations\n");
+        printf("8. Save and Exit\n");
         printDivider();
         printf("Enter your choice: ");
         scanf("%d", &choice);
         getchar();
 
+        // Site workers may be serving other sites' requests; keep them off this site meanwhile
+        if (choice >= 1 && choice <= 6) {
+            lockSite(worker);
+            terminalSite = worker;
+        }
+
         switch (choice) {
             case 1: {
                 printHeader("Patient Record Management");
@@ -639,6 +10717,9 @@ int main() {
                 printf("2. Remove Patient\n");
                 printf("3. Display Patient Records\n");
                 printf("4. View Patient Visit History\n");
+                printf("5. Query Patients\n");
+                printf("6. Find Duplicate Patients\n");
+                printf("7. Patient Archive\n");
                 printDivider();
                 printf("Enter your choice: ");
                 int recordChoice;
@@ -647,7 +10728,7 @@ int main() {
                 
                 switch (recordChoice) {
                     case 1:
-                        addPatient(patients, &patientCount);
+                        addPatient(site);
                         break;
                     case 2: {
                         printHeader("Remove Patient");
@@ -656,24 +10737,16 @@ int main() {
                         scanf("%d", &id);
                         getchar();
                         
-                        int index = hash(id);
-                        int found = 0;
-                        while (patients[index].occupied) {
-                            if (patients[index].id == id) {
-                                patients[index].occupied = 0;
-                                patientCount--;
-                                found = 1;
-                                printf("Patient removed successfully!\n");
-                                break;
-                            }
-                            index = (index + 1) % MAX_PATIENTS;
+                        if (hospitalDischargePatient(site, id)) {
+                            printf("Patient removed successfully!\n");
+                        } else {
+                            printf("Patient not found.\n");
                         }
-                        if (!found) printf("Patient not found.\n");
                         pauseExecution();
                         break;
                     }
                     case 3:
-                        displayPatients(patients, patientCount);
+                        showSiteView(worker, displayPatients);
                         break;
                     case 4: {
                         printHeader("View Patient Visit History");
@@ -681,10 +10754,19 @@ int main() {
                         printf("Enter Patient ID to view visit history: ");
                         scanf("%d", &id);
                         getchar();
-                        displayVisitHistory(patients, doctors, id);
+                        displayVisitHistory(site, id);
                         pauseExecution();
                         break;
                     }
+                    case 5:
+                        queryPatients(site);
+                        break;
+                    case 6:
+                        findDuplicatePatients(site);
+                        break;
+                    case 7:
+                        manageArchive(site);
+                        break;
                 }
                 break;
             }
@@ -693,8 +10775,11 @@ int main() {
                 printf("1. Add Doctor\n");
                 printf("2. Remove Doctor\n");
                 printf("3. Display Doctor Status\n");
-                printf("4. Mark Doctor as Available\n");
+                printf("4. Release Doctor Slot\n");
                 printf("5. Doctor Performance\n");
+                printf("6. Caseload Analytics\n");
+                printf("7. Query Doctors\n");
+                printf("8. Rebalance Off-Shift Doctors\n");
                 printDivider();
                 printf("Enter your choice: ");
                 int doctorChoice;
@@ -703,24 +10788,32 @@ int main() {
                 
                 switch (doctorChoice) {
                     case 1:
-                        addDoctor(doctors, &doctorCount);
+                        addDoctor(site);
                         break;
                     case 2:
-                        removeDoctor(doctors, &doctorCount);
+                        removeDoctor(site);
                         break;
                     case 3:
-                        displayDoctors(doctors, doctorCount);
+                        showSiteView(worker, displayDoctors);
                         break;
                     case 4:
-                        markDoctorAvailable(doctors, doctorCount, patients);
+                        markDoctorAvailable(site);
                         pauseExecution();
                         break;
-                    case 5: {
-                        printHeader("Doctor Performance");
-                        displayDoctorPerformance(doctors, doctorCount);
+                    case 5:
+                        showSiteView(worker, displayDoctorPerformance);
+                        break;
+                    case 6:
+                        printHeader("Caseload Analytics");
+                        displayCaseloadReport(&site, 1);
                         pauseExecution();
                         break;
-                    }
+                    case 7:
+                        queryDoctors(site);
+                        break;
+                    case 8:
+                        rebalanceOffShiftDoctors(site);
+                        break;
                     default:
                         printf("Invalid choice. Please try again.\n");
                         pauseExecution();
@@ -746,69 +10839,66 @@ int main() {
                         scanf("%d", &patientId);
                         getchar();
                         
-                        int priority = 0;
-                        int found = 0;
-                        for (int i = 0; i < MAX_PATIENTS; i++) {
-                            if (patients[i].occupied && patients[i].id == patientId) {
-                                priority = patients[i].isEmergency;
-                                found = 1;
-                                break;
-                            }
-                        }
-                        
-                        if (found) {
-                            enqueuePriority(&waitingQueue, patientId, priority);
+                        struct EmergencyDispatch dispatch;
+                        if (findPatientIndex(patients, patientId) == -1) {
+                            printf("Patient not found.\n");
+                        } else if (enqueueWithFastLane(site, patientId, &dispatch)) {
                             printf("Patient added to queue successfully!\n");
+                            printDispatch(site, &dispatch);
                         } else {
-                            printf("Patient not found.\n");
+                            printf("Queue is full\n");
                         }
                         pauseExecution();
                         break;
                     }
                     case 2: {
                         printHeader("Remove Patient from Queue");
-                        int patientId = dequeuePriority(&waitingQueue);
-                        if (patientId != -1) {
+                        int patientId = hospitalDequeue(site);
+                        if (patientId == -1) {
+                            printf("Queue is empty\n");
+                        } else {
                             // Find the patient to get their assigned doctor
-                            int patientIndex = -1;
-                            for (int i = 0; i < MAX_PATIENTS; i++) {
-                                if (patients[i].occupied && patients[i].id == patientId) {
-                                    patientIndex = i;
-                                    break;
-                                }
-                            }
+                            int patientIndex = findPatientIndex(patients, patientId);
 
                             if (patientIndex != -1) {
                                 int previousDoctorId = patients[patientIndex].assignedDoctorId;
                                 char previousDoctorSpecialty[MAX_NAME_LEN] = "Unknown";
 
-                                // If no previous doctor was assigned, use the specialty from visit history
+                                // If no previous doctor was assigned, use the specialty asked for at intake
                             if (previousDoctorId == -1 && patientIndex != -1) {
-                                strcpy(previousDoctorSpecialty, patients[patientIndex].visitHistory[0].doctorName);
+                                strcpy(previousDoctorSpecialty, requestedSpecialty(&patients[patientIndex]));
                             }
                             
                                 // Display the previous doctor information
                                 printf("Previous Doctor Assigned: ID %d, Specialty: %s\n", previousDoctorId, previousDoctorSpecialty);
 
                                 // Show available doctors with the same specialty
-                                printf("Available Doctors with Specialty '%s':\n", previousDoctorSpecialty);
-                                printf("%-5s %-20s %-20s\n", "ID", "Name", "Specialty");
+                                int minuteOfDay = currentMinuteOfDay();
+                                printf("Available Doctors with Specialty '%s' (%d free slots):\n", previousDoctorSpecialty,
+                                       countAvailableSlotsInSpecialty(doctors, site->doctorCount, previousDoctorSpecialty, minuteOfDay));
+                                printf("%-5s %-20s %-20s %-10s\n", "ID", "Name", "Specialty", "Free");
                                 printDivider();
                                 
                                 // Track if any available doctors exist
                                 int availableDoctorsExist = 0;
-                                for (int i = 0; i < doctorCount; i++) {
-                                    if (!doctors[i].isBusy && strcmp(doctors[i].specialty, previousDoctorSpecialty) == 0) {
-                                        printf("%-5d %-20s %-20s\n", doctors[i].id, doctors[i].name, doctors[i].specialty);
+                                for (int i = 0; i < site->doctorCount; i++) {
+                                    if (isDoctorAvailable(&doctors[i], minuteOfDay) && strcmp(doctors[i].specialty, previousDoctorSpecialty) == 0) {
+                                        char slots[24];
+                                        snprintf(slots, sizeof(slots), "%d/%d", freeSlotCount(&doctors[i]), doctors[i].capacity);
+                                        printf("%-5d %-20s %-20s %-10s\n", doctors[i].id, doctors[i].name, doctors[i].specialty, slots);
                                         availableDoctorsExist = 1;
                                     }
                                 }
 
                                 if (!availableDoctorsExist) {
                                     printf("No available doctors with matching specialty.\n");
-                                    // Re-enqueue the patient if no doctors are available
-                                    enqueuePriority(&waitingQueue, patientId, patients[patientIndex].isEmergency);
-                                    printf("Patient returned to waiting queue.\n");
+                                    // Re-enqueue the patient if no doctors are available; an emergency goes through the fast lane
+                                    struct EmergencyDispatch dispatch;
+                                    enqueueWithFastLane(site, patientId, &dispatch);
+                                    if (dispatch.outcome == DISPATCH_QUEUED) {
+                                        printf("Patient returned to waiting queue.\n");
+                                    }
+                                    printDispatch(site, &dispatch);
                                     pauseExecution();
                                     break;
                                 }
@@ -822,25 +10912,28 @@ int main() {
                                     printf("Enter Doctor ID to assign the patient (Attempt %d/3): ", attempts + 1);
                                     scanf("%d", &selectedDoctorId);
                                     getchar(); // Consume newline
-                                    
+
+                                    // A shared site is let go while waiting for input, so look the patient and doctor up again
+                                    if (findPatientIndex(patients, patientId) == -1) {
+                                        break;
+                                    }
+                                    minuteOfDay = currentMinuteOfDay();
+                                    int doctorIndex = findDoctorIndex(site, selectedDoctorId);
+
                                     // Check if the selected doctor matches specialty and is available
-                                    for (int i = 0; i < doctorCount; i++) {
-                                        if (doctors[i].id == selectedDoctorId) {
-                                            if (strcmp(doctors[i].specialty, previousDoctorSpecialty) == 0 && !doctors[i].isBusy) {
-                                                // Attempt to assign patient to doctor
-                                                assignToDoctor(patients, doctors, patientId, selectedDoctorId, doctorCount);
-                                                doctorAssigned = 1;
-                                                break;
-                                            } else {
-                                                if (strcmp(doctors[i].specialty, previousDoctorSpecialty) != 0) {
-                                                    printf("Error: Doctor's specialty does not match patient's previous specialty.\n");
-                                                } else if (doctors[i].isBusy) {
-                                                    printf("Error: Selected doctor is currently busy.\n");
-                                                }
-                                            }
-                                        }
+                                    if (doctorIndex == -1) {
+                                        printf("Error: Doctor not found.\n");
+                                    } else if (strcmp(doctors[doctorIndex].specialty, previousDoctorSpecialty) != 0) {
+                                        printf("Error: Doctor's specialty does not match patient's previous specialty.\n");
+                                    } else if (!isDoctorOnShift(&doctors[doctorIndex], minuteOfDay)) {
+                                        printf("Error: Selected doctor is off shift.\n");
+                                    } else if (!isDoctorAvailable(&doctors[doctorIndex], minuteOfDay)) {
+                                        printf("Error: Selected doctor has no free slots.\n");
+                                    } else {
+                                        // Attempt to assign patient to doctor
+                                        doctorAssigned = assignToDoctor(site, patientId, selectedDoctorId) >= 0;
                                     }
-                                    
+
                                     if (!doctorAssigned) {
                                         attempts++;
                                         if (attempts < 3) {
@@ -849,11 +10942,13 @@ int main() {
                                     }
                                 }
                                 
-                                // If doctor could not be assigned after 3 attempts
-                                if (!doctorAssigned) {
+                                if (findPatientIndex(patients, patientId) == -1) {
+                                    printf("Patient ID %d was discharged meanwhile.\n", patientId);
+                                } else if (!doctorAssigned) {
+                                    // Doctor could not be assigned after 3 attempts
                                     printf("Failed to assign patient to a doctor after 3 attempts.\n");
                                     // Re-enqueue the patient
-                                    enqueuePriority(&waitingQueue, patientId, patients[patientIndex].isEmergency);
+                                    hospitalEnqueue(site, patientId);
                                     printf("Patient returned to waiting queue.\n");
                                 }
                             } else {
@@ -864,19 +10959,40 @@ int main() {
                         break;
                     }
                     case 3:
-                        displayQueue(&waitingQueue, patients);
+                        showSiteView(worker, displayQueue);
                         break;
                 }
                 break;
             }
-            case 4: {
+            case 4:
+                displayDashboard(site);
+                break;
+            case 5:
+                manageAppointments(site);
+                break;
+            case 6:
+                manageBilling(worker);
+                break;
+            case 7:
+                manageSites(&router, &activeSite);
+                break;
+            case 8: {
                 printHeader("Saving and Exiting");
-                saveData(patients, patientCount, doctors, doctorCount);
+                routerSaveAll(&router);
+                stopTrace(&router);
+                stopReplication(&router);
+                stopChangeFeed(&router);
+                stopRouter(&router);
                 return 0;
             }
             default:
                 printf("Invalid choice. Please try again.\n");
                 pauseExecution();
         }
+
+        if (choice >= 1 && choice <= 6) {
+            terminalSite = NULL;
+            unlockSite(worker);
+        }
     }
 }